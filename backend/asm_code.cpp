@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/common.h"
+#include "asm_code.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const size_t DEFAULT_CODE_CAPACITY   = 256;
+const int    DEFAULT_LABELS_CAPACITY = 64;
+const int    ANNOTATION_COLUMN       = 30;
+
+// -------------------------------------------------------------------------------------------------
+
+static int print_insn (const asm_code_t *code, const asm_insn_t *insn, FILE *stream, bool annotate);
+
+// -------------------------------------------------------------------------------------------------
+
+void asm_code::ctor (asm_code_t *code, int extern_labels_cnt)
+{
+    assert (code != nullptr && "invalid pointer");
+    assert (extern_labels_cnt >= 0 && "Invalid labels count");
+
+    code->insns    = (asm_insn_t *) calloc (DEFAULT_CODE_CAPACITY, sizeof (asm_insn_t));
+    code->size     = 0;
+    code->capacity = DEFAULT_CODE_CAPACITY;
+
+    // Extern labels have no names here
+    code->labels_capacity = extern_labels_cnt + DEFAULT_LABELS_CAPACITY;
+    code->label_names     = (char **) calloc ((size_t) code->labels_capacity, sizeof (char *));
+    code->labels_cnt      = extern_labels_cnt;
+
+    code->oom = (code->insns == nullptr || code->label_names == nullptr);
+}
+
+void asm_code::dtor (asm_code_t *code)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    for (int i = 0; i < code->labels_cnt; ++i) {
+        free (code->label_names[i]);
+    }
+
+    free (code->label_names);
+    free (code->insns);
+
+    *code = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void asm_code::append (asm_code_t *code, const asm_insn_t *insn)
+{
+    assert (code != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    if (code->oom) { return; }
+
+    if (code->size == code->capacity)
+    {
+        asm_insn_t *new_insns = (asm_insn_t *) realloc (code->insns,
+                                                2 * code->capacity * sizeof (asm_insn_t));
+        if (new_insns == nullptr)
+        {
+            code->oom = true;
+            return;
+        }
+
+        code->insns     = new_insns;
+        code->capacity *= 2;
+    }
+
+    code->insns[code->size++] = *insn;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void asm_code::splice (asm_code_t *code, const asm_code_t *piece, int extern_labels_cnt)
+{
+    assert (code  != nullptr && "invalid pointer");
+    assert (piece != nullptr && "invalid pointer");
+    assert (extern_labels_cnt <= piece->labels_cnt && "Invalid labels count");
+
+    if (piece->oom) { code->oom = true; }
+    if (code->oom)  { return; }
+
+    int first_label = code->labels_cnt;
+
+    for (int i = extern_labels_cnt; i < piece->labels_cnt; ++i) {
+        new_label (code, piece->label_names[i]);
+    }
+
+    for (size_t i = 0; i < piece->size; ++i)
+    {
+        asm_insn_t insn = piece->insns[i];
+
+        bool has_label = insn.kind == asm_kind_t::LABEL ||
+                        (insn.kind == asm_kind_t::INSN && insn.arg.type == isa::operand_type_t::LABEL);
+
+        if (has_label && insn.arg.value >= extern_labels_cnt) {
+            insn.arg.value += first_label - extern_labels_cnt;
+        }
+
+        append (code, &insn);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int asm_code::new_label (asm_code_t *code, const char *name)
+{
+    assert (code != nullptr && "invalid pointer");
+    assert (name != nullptr && "invalid pointer");
+
+    if (code->oom) { return ERROR; }
+
+    if (code->labels_cnt == code->labels_capacity)
+    {
+        char **new_names = (char **) realloc (code->label_names,
+                                        2 * (size_t) code->labels_capacity * sizeof (char *));
+        if (new_names == nullptr)
+        {
+            code->oom = true;
+            return ERROR;
+        }
+
+        code->label_names      = new_names;
+        code->labels_capacity *= 2;
+    }
+
+    code->label_names[code->labels_cnt] = strdup (name);
+    if (code->label_names[code->labels_cnt] == nullptr)
+    {
+        code->oom = true;
+        return ERROR;
+    }
+
+    return code->labels_cnt++;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void asm_code::print (const asm_code_t *code, FILE *stream, bool annotate)
+{
+    assert (code   != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    for (size_t i = 0; i < code->size; ++i)
+    {
+        const asm_insn_t *insn = &code->insns[i];
+        if (insn->deleted || (!annotate && insn->kind == asm_kind_t::NOTE)) { continue; }
+
+        int len = print_insn (code, insn, stream, annotate);
+
+        if (annotate)
+        {
+            int pad = (len < ANNOTATION_COLUMN) ? ANNOTATION_COLUMN - len : 0;
+            fprintf (stream, "%*s; %-20s (%s:%d)", pad, "", insn->func, insn->file, insn->line);
+        }
+
+        fputc ('\n', stream);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int print_insn (const asm_code_t *code, const asm_insn_t *insn, FILE *stream, bool annotate)
+{
+    assert (code   != nullptr && "invalid pointer");
+    assert (insn   != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    int len = 0;
+
+    switch (insn->kind)
+    {
+        case asm_kind_t::INSN:
+            len += fprintf (stream, "%s", isa::opcode_name (insn->opcode));
+
+            if (isa::is_reg_form (insn->opcode))
+            {
+                len += fprintf (stream, " ");
+                len += isa::print_reg_form (stream, insn->opcode, insn->reg, &insn->arg);
+            }
+            else if (insn->arg.type != isa::operand_type_t::NONE)
+            {
+                len += fprintf (stream, " ");
+                len += isa::print_operand (stream, &insn->arg, code->label_names);
+            }
+            break;
+
+        case asm_kind_t::LABEL:
+            len += fprintf (stream, "%s:", code->label_names[insn->arg.value]);
+            break;
+
+        case asm_kind_t::NOTE:
+            break;
+
+        default:
+            assert (0 && "Unexpected asm line kind");
+    }
+
+    if (annotate && insn->comment != nullptr) {
+        len += fprintf (stream, len > 0 ? " ; %s" : "; %s", insn->comment);
+    }
+
+    return len;
+}
@@ -0,0 +1,70 @@
+#ifndef ASM_CODE_H
+#define ASM_CODE_H
+
+#include <stdio.h>
+#include "../lib/isa.h"
+
+enum class asm_kind_t : unsigned char
+{
+    INSN,
+    LABEL,
+    NOTE,       ///< Comment-only line, blank line if there is no comment
+};
+
+/// One emitted instruction with the place in compiler that emitted it
+struct asm_insn_t
+{
+    asm_kind_t     kind;
+    isa::opcode_t  opcode;
+    isa::operand_t arg;         ///< Label id for LABEL kind
+    isa::reg_t     reg;         ///< Register operand of register forms
+
+    const char *comment;        ///< String literal, nullable
+    const char *func;
+    const char *file;
+    int line;
+
+    bool deleted;
+};
+
+struct asm_code_t
+{
+    asm_insn_t *insns;
+    size_t size;
+    size_t capacity;
+
+    char **label_names;
+    int labels_cnt;
+    int labels_capacity;
+
+    bool oom;
+};
+
+namespace asm_code
+{
+    /// @param extern_labels_cnt  Ids below it are left to labels of code this one is spliced to
+    void ctor (asm_code_t *code, int extern_labels_cnt = 0);
+    void dtor (asm_code_t *code);
+
+    void append (asm_code_t *code, const asm_insn_t *insn);
+
+    /**
+     * @brief      Append piece to the end of code. Labels below extern_labels_cnt are the same in
+     *             both, others are created anew in the same order, so spliced code is identical
+     *             to the one emitted in place.
+     */
+    void splice (asm_code_t *code, const asm_code_t *piece, int extern_labels_cnt);
+
+    /// @return New label id or ERROR if out of memory
+    int new_label (asm_code_t *code, const char *name);
+
+    /**
+     * @brief      Serialize code as text asm
+     *
+     * @param      annotate  Keep comments and mark each line with emitting function and source
+     *                       line, otherwise print only instructions and labels
+     */
+    void print (const asm_code_t *code, FILE *stream, bool annotate);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/common.h"
+#include "../lib/log.h"
+#include "assembler.h"
+
+// -------------------------------------------------------------------------------------------------
+
+#define ERR_CASE(cond, msg, ...)                    \
+{                                                   \
+    if (cond)                                       \
+    {                                               \
+        LOG (log::ERR, msg, ##__VA_ARGS__);         \
+        free (label_addrs);                         \
+        free (fixups);                              \
+        bytecode::dtor (bc);                        \
+        return ERROR;                               \
+    }                                               \
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int assembler::assemble (const asm_code_t *code, bytecode_t *bc, bool symbols)
+{
+    assert (code != nullptr && "invalid pointer");
+    assert (bc   != nullptr && "invalid pointer");
+
+    *bc = {};
+
+    uint32_t insns_cnt = 0;
+    uint32_t labels_cnt = 0;
+
+    for (size_t i = 0; i < code->size; ++i)
+    {
+        if (code->insns[i].deleted) { continue; }
+
+        if      (code->insns[i].kind == asm_kind_t::INSN)  { insns_cnt++;  }
+        else if (code->insns[i].kind == asm_kind_t::LABEL) { labels_cnt++; }
+    }
+
+    int32_t  *label_addrs = (int32_t *)  calloc ((size_t) code->labels_cnt + 1, sizeof (int32_t));
+    uint32_t *fixups      = (uint32_t *) calloc (insns_cnt + 1, sizeof (uint32_t));
+    uint32_t  fixups_cnt  = 0;
+
+    bc->code    = (bc_insn_t *)   calloc (insns_cnt + 1,  sizeof (bc_insn_t));
+    bc->symbols = (bc_symbol_t *) calloc (labels_cnt + 1, sizeof (bc_symbol_t));
+
+    ERR_CASE (label_addrs == nullptr || fixups == nullptr || bc->code == nullptr ||
+                                        bc->symbols == nullptr, "Failed to allocate bytecode");
+
+    for (int i = 0; i < code->labels_cnt; ++i) {
+        label_addrs[i] = -1;
+    }
+
+    for (size_t i = 0; i < code->size; ++i)
+    {
+        const asm_insn_t *insn = &code->insns[i];
+        if (insn->deleted) { continue; }
+
+        if (insn->kind == asm_kind_t::LABEL)
+        {
+            label_addrs[insn->arg.value] = (int32_t) bc->size;
+
+            if (symbols)
+            {
+                bc_symbol_t *symbol = &bc->symbols[bc->symbols_cnt++];
+                symbol->addr = bc->size;
+                strncpy (symbol->name, code->label_names[insn->arg.value], BC_SYMBOL_NAME_LEN - 1);
+            }
+        }
+        else if (insn->kind == asm_kind_t::INSN)
+        {
+            if (insn->arg.type == isa::operand_type_t::LABEL) {
+                fixups[fixups_cnt++] = bc->size;
+            }
+
+            bc->code[bc->size++] = {(uint8_t) insn->opcode, (uint8_t) insn->arg.type,
+                                    (uint8_t) insn->arg.reg, (uint8_t) insn->reg, insn->arg.value};
+        }
+    }
+
+    for (uint32_t i = 0; i < fixups_cnt; ++i)
+    {
+        bc_insn_t *insn = &bc->code[fixups[i]];
+        int label = insn->value;
+
+        ERR_CASE (label_addrs[label] == -1, "Undefined label %s", code->label_names[label]);
+        insn->value = label_addrs[label];
+    }
+
+    free (label_addrs);
+    free (fixups);
+
+    return 0;
+}
+
+#undef ERR_CASE
@@ -0,0 +1,20 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include "../lib/bytecode.h"
+#include "asm_code.h"
+
+namespace assembler
+{
+    /**
+     * @brief      Encode code to bytecode. Jumps and calls are encoded with label id and
+     *             patched with label address when all labels are placed.
+     *
+     * @param      symbols  Put label names to symbol section
+     *
+     * @return     0 or ERROR on OOM or undefined label
+     */
+    int assemble (const asm_code_t *code, bytecode_t *bc, bool symbols);
+}
+
+#endif
@@ -1,40 +1,127 @@
 #include <assert.h>
 #include <cstdlib>
+#include <stdarg.h>
 #include "../lib/common.h"
 #include "../lib/log.h"
+#include "../lib/pool.h"
 #include "compiler.h"
+#include "assembler.h"
+#include "fragment.h"
+#include "liveness.h"
+#include "peephole.h"
+#include "native.h"
+#include "transpiler.h"
 
-#define EMIT(fmt, ...)                                                              \
-{                                                                                   \
-    sprintf (buf, fmt, ##__VA_ARGS__);                                              \
-    fprintf (stream, "%-30s; %-20s (%s:%d)\n", buf,  __func__, __FILE__, __LINE__);     \
-}
+#define EMIT(opcode, ...)                                                                       \
+    emit (compiler, __func__, __FILE__, __LINE__, isa::opcode_t::opcode, ##__VA_ARGS__)
 
-// -------------------------------------------------------------------------------------------------
+#define EMIT_LABEL(label)                                                                       \
+    emit_special (compiler, __func__, __FILE__, __LINE__, asm_kind_t::LABEL, label, nullptr)
 
-const int DEFAULT_VARS_CAPACITY = 16;
-const int BUF_SIZE     = 64;
-const int VAR_BUF_SIZE = 16;
+#define EMIT_NOTE(comment)                                                                      \
+    emit_special (compiler, __func__, __FILE__, __LINE__, asm_kind_t::NOTE, 0, comment)
+
+#define EMIT_REG(opcode, reg, ...)                                                              \
+    emit_reg (compiler, __func__, __FILE__, __LINE__, isa::opcode_t::opcode, reg, ##__VA_ARGS__)
 
 // -------------------------------------------------------------------------------------------------
 
-static bool subtree_compile        (compiler_t *compiler, tree::node_t *node, FILE *stream, bool result_used = true);
-static bool compile_op             (compiler_t *compiler, tree::node_t *node, FILE *stream);
-static bool compile_if             (compiler_t *compiler, tree::node_t *node, FILE *stream);
-static bool compile_while          (compiler_t *compiler, tree::node_t *node, FILE *stream);
-static bool compile_func_def       (compiler_t *compiler, tree::node_t *node, FILE *stream);
-static int  compile_func_def_args  (compiler_t *compiler, tree::node_t *node, FILE *stream);
-static bool compile_func_call      (compiler_t *compiler, tree::node_t *node, FILE *stream);
-static int  compile_func_call_args (compiler_t *compiler, tree::node_t *node, FILE *stream);
+const int LABEL_NAME_BUF_SIZE   = 32;
+
+const int MEMO_TABLE_SIZE = 256;    // Memoized keys are [0, MEMO_TABLE_SIZE)
+const int MEMO_KEY_VAR    = -1;     // Hidden local with saved key, never clashes with real names
 
-static int  ctor_vars (vars_t *vars);
-static void dtor_vars (vars_t *vars);
+static const isa::operand_t RAX = isa::reg (isa::reg_t::RAX);
+static const isa::operand_t RCX = isa::reg (isa::reg_t::RCX);
+static const isa::operand_t RDX = isa::reg (isa::reg_t::RDX);
 
-static void register_var     (compiler_t *compiler, int number);
-static bool get_var_code     (compiler_t *compiler, int number, char *code);
-static void clear_local_vars (compiler_t *compiler);
+// Temps of register lowering, rdx is frame base. rax goes last: the last temp is spilled
+// before any nested code, so it never lives across labels and stays scratch for peephole
+static const isa::reg_t TEMP_REGS[]   = {isa::reg_t::RBX, isa::reg_t::RCX, isa::reg_t::RAX};
+static const int        TEMP_REGS_CNT = (int) (sizeof (TEMP_REGS) / sizeof (TEMP_REGS[0]));
+
+// -------------------------------------------------------------------------------------------------
+
+static bool subtree_compile        (compiler_t *compiler, tree::node_t *node, bool result_used = true);
+static bool compile_op             (compiler_t *compiler, tree::node_t *node);
+static bool compile_logic_op       (compiler_t *compiler, tree::node_t *node);
+static bool compile_cond_jump      (compiler_t *compiler, tree::node_t *node,
+                                                                bool jump_if, int label);
+static bool compile_cmp_jump       (compiler_t *compiler, tree::node_t *node,
+                                                                bool jump_if, int label);
+static bool compile_if             (compiler_t *compiler, tree::node_t *node);
+static bool compile_while          (compiler_t *compiler, tree::node_t *node);
+static bool compile_func_def       (compiler_t *compiler, tree::node_t *node);
+static bool compile_ahead          (compiler_t *compiler, tree::node_t *node, int threads);
+static bool compile_ahead_func     (void *compiler_ptr, int func);
+static unsigned int collect_defs   (compiler_t *compiler, tree::node_t *node);
+static void free_func_codes        (compiler_t *compiler);
+static bool compile_func_cached    (compiler_t *compiler, tree::node_t *node);
+static bool emit_func_def          (compiler_t *compiler, tree::node_t *node);
+static bool compile_memo_lookup    (compiler_t *compiler, tree::node_t *node);
+static bool compile_func_call      (compiler_t *compiler, tree::node_t *node);
+static bool compile_tail_call      (compiler_t *compiler, tree::node_t *node);
+static int  compile_func_call_args (compiler_t *compiler, tree::node_t *node);
+
+static bool compile_value          (compiler_t *compiler, tree::node_t *node, bool result_used);
+static bool compile_reg            (compiler_t *compiler, tree::node_t *node, int reg);
+static bool compile_arith_reg      (compiler_t *compiler, tree::node_t *node, int reg,
+                                        isa::opcode_t reg_opcode, isa::opcode_t stack_opcode);
+static bool compile_call_reg       (compiler_t *compiler, tree::node_t *node, int reg);
+static bool get_leaf_operand       (compiler_t *compiler, tree::node_t *node, isa::operand_t *operand);
+
+static bool resolve_vars     (compiler_t *compiler, tree::node_t *node);
+static bool resolve_node     (compiler_t *compiler, tree::node_t *node);
+static bool resolve_func_def (compiler_t *compiler, tree::node_t *node);
+static void resolve_params   (compiler_t *compiler, tree::node_t *node);
+static bool get_var_operand  (compiler_t *compiler, const tree::node_t *node, isa::operand_t *operand);
+
+static void hash_func_def    (const compiler_t *compiler, const tree::node_t *node, cache_key_t *key);
+static void hash_subtree     (const compiler_t *compiler, const tree::node_t *node, cache_key_t *key);
 
 static int  get_label_index  (compiler_t *compiler);
+__attribute__((format (printf, 2, 3)))
+static int  new_label        (compiler_t *compiler, const char *name_fmt, ...);
+
+static bool emit_bytecode     (compiler_t *compiler, FILE *stream, bool symbols);
+static bool setup_memo        (compiler_t *compiler, const compile_opts_t *opts);
+static bool setup_func_labels (compiler_t *compiler);
+
+static void emit         (compiler_t *compiler, const char *func, const char *file, int line,
+                          isa::opcode_t opcode, isa::operand_t arg = {}, const char *comment = nullptr);
+static void emit_special (compiler_t *compiler, const char *func, const char *file, int line,
+                          asm_kind_t kind, int label, const char *comment);
+static void emit_reg     (compiler_t *compiler, const char *func, const char *file, int line,
+                          isa::opcode_t opcode, isa::reg_t reg, isa::operand_t arg,
+                          const char *comment = nullptr);
+
+static inline bool is_leaf (const tree::node_t *node)
+{
+    return node->type == tree::node_type_t::VAL || node->type == tree::node_type_t::VAR;
+}
+
+/// Op that register lowering computes in register, others exist only in stack form
+static inline bool is_reg_op (const tree::node_t *node)
+{
+    if (node->type != tree::node_type_t::OP) { return false; }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD:
+        case tree::op_t::SUB:
+        case tree::op_t::MUL:
+        case tree::op_t::DIV:
+        case tree::op_t::ASSIG:
+        case tree::op_t::OUTPUT:
+            return true;
+
+        default:
+            return false;
+    }
+    #pragma GCC diagnostic pop
+}
 
 // -------------------------------------------------------------------------------------------------
 
@@ -52,107 +139,212 @@ void compiler::ctor (compiler_t *compiler)
 {
     assert (compiler != nullptr && "invalid pointer");
 
-    ctor_vars (&compiler->global_vars);
-    ctor_vars (&compiler->local_vars);
+    symtab::ctor  (&compiler->symbols);
+    int_map::ctor (&compiler->var_refs);
+    compiler->frames            = nullptr;
+    compiler->global_frame_size = 0;
 
     compiler->cur_label_index         = 0;
+    compiler->cur_func                = -1;
     compiler->frame_size              = 0;
     compiler->global_frame_size_store = 0;
+
+    compiler->funcs          = {};
+    compiler->memo_bases     = nullptr;
+    compiler->memo_area_size = 0;
+    compiler->func_labels    = nullptr;
+    compiler->regs           = false;
+    compiler->reg_base       = 0;
+    compiler->cache          = nullptr;
+    compiler->func_codes     = nullptr;
+
+    asm_code::ctor (&compiler->code);
 }
 
 void compiler::dtor (compiler_t *compiler)
 {
     assert (compiler != nullptr && "invalid pointer");
 
-    dtor_vars (&compiler->global_vars);
-    dtor_vars (&compiler->local_vars);
+    symtab::dtor  (&compiler->symbols);
+    int_map::dtor (&compiler->var_refs);
+    free (compiler->frames);
+
+    free_func_codes  (compiler);
+    func_table::dtor (&compiler->funcs);
+    free (compiler->memo_bases);
+    free (compiler->func_labels);
+
+    asm_code::dtor (&compiler->code);
 }
 
 // -------------------------------------------------------------------------------------------------
 
-bool compiler::compile (tree::node_t *node, FILE *stream)
+bool compiler::compile (tree::node_t *node, FILE *stream, const compile_opts_t *opts)
 {
     assert (node   != nullptr && "invalid pointer");
     assert (stream != nullptr && "invalid pointer");
 
-    compiler_t compiler = {};
-    ctor (&compiler);
+    const compile_opts_t default_opts = {};
+    if (opts == nullptr) { opts = &default_opts; }
+
+    // Native code and C have their own generators, bytecode passes do not apply to them
+    if (opts->emit == emit_format_t::ELF) {
+        return native::compile (node, stream);
+    }
 
-    char buf[BUF_SIZE] = "";
+    if (opts->emit == emit_format_t::C) {
+        return transpiler::compile (node, stream, opts->func_names, opts->func_names_cnt);
+    }
 
-    EMIT ("push 0");
-    EMIT ("pop rdx ; Init rdx");
-    EMIT ("  ");
-    EMIT ("  ");
-    EMIT ("; Here we go again");
+    compiler_t compiler_obj = {};
+    compiler_t *compiler = &compiler_obj;
+    ctor (compiler);
+    compiler->regs = opts->regs;
 
-    TRY (subtree_compile (&compiler, node, stream));
+    // Fragments keep no comments and emitter locations
+    if (opts->cache != nullptr && opts->cache->enabled && !opts->annotate) {
+        compiler->cache = opts->cache;
+    }
 
-    EMIT ("halt");
+    if (func_table::ctor (&compiler->funcs, node) == ERROR || !setup_memo (compiler, opts) ||
+        !setup_func_labels (compiler))
+    {
+        LOG (log::ERR, "Failed to analyze functions");
+        dtor (compiler);
+        return false;
+    }
 
-    dtor (&compiler);
-    return true;
+    if (!resolve_vars (compiler, node))
+    {
+        LOG (log::ERR, "Failed to resolve variables");
+        dtor (compiler);
+        return false;
+    }
+
+    compiler->frame_size = compiler->global_frame_size;
+
+    // Without threads or memory for them functions are just compiled in place
+    compile_ahead (compiler, node, opts->threads);
+
+    // Memo tables live in [0, memo_area_size), globals and frames go after them
+    if (compiler->regs) {
+        EMIT_REG (MOV, isa::reg_t::RDX, isa::imm (compiler->memo_area_size), "Init rdx");
+    } else {
+        EMIT (PUSH, isa::imm (compiler->memo_area_size));
+        EMIT (POP,  RDX, "Init rdx");
+    }
+    EMIT_NOTE (nullptr);
+    EMIT_NOTE (nullptr);
+    EMIT_NOTE ("Here we go again");
+
+    bool success = subtree_compile (compiler, node);
+
+    EMIT (HALT);
+
+    if (compiler->code.oom)
+    {
+        LOG (log::ERR, "Failed to allocate memory for asm code");
+        success = false;
+    }
+
+    if (success)
+    {
+        if (!opts->no_peephole) {
+            peephole::optimize (&compiler->code, opts->peephole_stats ? opts->report : nullptr);
+        }
+
+        if (opts->emit == emit_format_t::BIN) {
+            success = emit_bytecode (compiler, stream, !opts->strip_symbols);
+        } else {
+            asm_code::print (&compiler->code, stream, opts->annotate);
+        }
+    }
+
+    dtor (compiler);
+    return success;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-static bool subtree_compile (compiler_t *compiler, tree::node_t *node, FILE *stream, bool result_used)
+static bool subtree_compile (compiler_t *compiler, tree::node_t *node, bool result_used)
 {
-    assert (stream != nullptr && "invalid pointer");
 
     if (node == nullptr) {
         return true;
     }
 
-    char buf[BUF_SIZE] = "";
-    char var_code_buf[VAR_BUF_SIZE] = "";
+    isa::operand_t var = {};
+
+    if (compiler->regs && (is_leaf (node) || node->type == tree::node_type_t::OP ||
+                                             node->type == tree::node_type_t::FUNC_CALL))
+    {
+        return compile_value (compiler, node, result_used);
+    }
 
     switch (node->type)
     {
         case tree::node_type_t::FICTIOUS:
-            TRY (subtree_compile (compiler, node->left,  stream, false));
-            TRY (subtree_compile (compiler, node->right, stream, false));
+            TRY (subtree_compile (compiler, node->left, false));
+            TRY (subtree_compile (compiler, node->right, false));
             break;
 
         case tree::node_type_t::VAL:
-            EMIT ("push %d ; val node", node->data);
+            EMIT (PUSH, isa::imm (node->data), "val node");
+            if (!result_used) {
+                EMIT (POP, RAX, "Remove unused val");
+            }
             break;
 
         case tree::node_type_t::VAR:
-            TRY (get_var_code (compiler, node->data, var_code_buf));
-            EMIT ("push %s", var_code_buf);
+            TRY (get_var_operand (compiler, node, &var));
+            EMIT (PUSH, var);
+            if (!result_used) {
+                EMIT (POP, RAX, "Remove unused val");
+            }
             break;
 
         case tree::node_type_t::VAR_DEF:
-            register_var (compiler, node->data);
             break;
         
         case tree::node_type_t::OP:
-            TRY (compile_op (compiler, node, stream));
+            TRY (compile_op (compiler, node));
+            if (!result_used) {
+                EMIT (POP, RAX, "Remove unused val");
+            }
             break;
 
         case tree::node_type_t::IF:
-            TRY (compile_if (compiler, node, stream));
+            TRY (compile_if (compiler, node));
             break;
 
         case tree::node_type_t::WHILE:
-            TRY (compile_while (compiler, node, stream));
+            TRY (compile_while (compiler, node));
             break;
 
         case tree::node_type_t::FUNC_DEF:
-            TRY (compile_func_def (compiler, node, stream));
+            TRY (compile_func_def (compiler, node));
             break;
 
         case tree::node_type_t::FUNC_CALL:
-            TRY (compile_func_call (compiler, node, stream));
+            TRY (compile_func_call (compiler, node));
             if (!result_used) {
-                EMIT ("pop rax ;Remove unused val")
+                EMIT (POP, RAX, "Remove unused val");
             }
             break;
         
         case tree::node_type_t::RETURN:
-            TRY (subtree_compile (compiler, node->right,  stream, true));
-            EMIT ("ret");
+            // Memo lookup calls the body and keeps the key in frame, callee jumped to would
+            // overwrite it, so memoized functions return calls with call and ret
+            if (compiler->in_func && node->right != nullptr &&
+                node->right->type == tree::node_type_t::FUNC_CALL &&
+                compiler->memo_bases[compiler->cur_func] == -1)
+            {
+                TRY (compile_tail_call (compiler, node->right));
+                break;
+            }
+
+            TRY (subtree_compile (compiler, node->right, true));
+            EMIT (RET);
             break;
 
         case tree::node_type_t::ELSE:
@@ -172,112 +364,99 @@ static bool subtree_compile (compiler_t *compiler, tree::node_t *node, FILE *str
 // -------------------------------------------------------------------------------------------------
 
 #define EMIT_BINARY_OP(opcode)                              \
-    TRY (subtree_compile (compiler, node->left,  stream));  \
-    TRY (subtree_compile (compiler, node->right, stream));  \
+    TRY (subtree_compile (compiler, node->left));           \
+    TRY (subtree_compile (compiler, node->right));          \
     EMIT (opcode);
 
 #define EMIT_PUSH_TRUE_FALSE(jump_opcode)                   \
-    TRY (label_index = get_label_index (compiler));         \
-    EMIT (jump_opcode " push_one_%d", label_index);         \
-    EMIT ("    push 0");                                    \
-    EMIT ("    jmp end_%d", label_index);                   \
-    EMIT ("push_one_%d:", label_index);                     \
-    EMIT ("    push 1");                                    \
-    EMIT ("end_%d:", label_index);
+    label_index = get_label_index (compiler);               \
+    one_label   = new_label (compiler, "push_one_%d", label_index); \
+    end_label   = new_label (compiler, "end_%d",      label_index); \
+    EMIT (jump_opcode, isa::label (one_label));             \
+    EMIT (PUSH, isa::imm (0));                              \
+    EMIT (JMP,  isa::label (end_label));                    \
+    EMIT_LABEL (one_label);                                 \
+    EMIT (PUSH, isa::imm (1));                              \
+    EMIT_LABEL (end_label);
 
 #define EMIT_COMPARATOR(opcode)                             \
-    TRY (subtree_compile (compiler, node->left,  stream));  \
-    TRY (subtree_compile (compiler, node->right, stream));  \
+    TRY (subtree_compile (compiler, node->left));           \
+    TRY (subtree_compile (compiler, node->right));          \
     EMIT_PUSH_TRUE_FALSE (opcode)
     
 
-static bool compile_op (compiler_t *compiler, tree::node_t *node, FILE *stream)
+static bool compile_op (compiler_t *compiler, tree::node_t *node)
 {
     assert (compiler != nullptr && "invalid pointer");
     assert (node     != nullptr && "invalid pointer");
-    assert (stream   != nullptr && "invalid pointer");
 
     assert (node->type == tree::node_type_t::OP);
 
-    char buf[BUF_SIZE]          = "";
-    char var_code_buf[VAR_BUF_SIZE] = "";
-    int label_index    = -1;
-    EMIT (" ");
+    isa::operand_t var = {};
+    int label_index = -1;
+    int one_label   = -1;
+    int end_label   = -1;
+    EMIT_NOTE (nullptr);
 
     switch ((tree::op_t) node->data)
     {
-        case tree::op_t::ADD: EMIT_BINARY_OP ("add"); break;
-        case tree::op_t::SUB: EMIT_BINARY_OP ("sub"); break;
-        case tree::op_t::MUL: EMIT_BINARY_OP ("mul"); break;
-        case tree::op_t::DIV: EMIT_BINARY_OP ("div"); break;
+        case tree::op_t::ADD: EMIT_BINARY_OP (ADD); break;
+        case tree::op_t::SUB: EMIT_BINARY_OP (SUB); break;
+        case tree::op_t::MUL: EMIT_BINARY_OP (MUL); break;
+        case tree::op_t::DIV: EMIT_BINARY_OP (DIV); break;
 
         case tree::op_t::SQRT:
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("sqrt");
+            TRY (subtree_compile (compiler, node->right));
+            EMIT (SQRT);
             break;
 
         case tree::op_t::SIN:
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("sin");
+            TRY (subtree_compile (compiler, node->right));
+            EMIT (SIN);
             break;
 
         case tree::op_t::COS:
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("sin");
+            TRY (subtree_compile (compiler, node->right));
+            EMIT (SIN);
             break;
 
         case tree::op_t::OUTPUT:
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("pop  rax");
-            EMIT ("push rax");
-            EMIT ("push rax");
-            EMIT ("out");
+            TRY (subtree_compile (compiler, node->right));
+            EMIT (POP,  RAX);
+            EMIT (PUSH, RAX);
+            EMIT (PUSH, RAX);
+            EMIT (OUT);
             break;
 
         case tree::op_t::ASSIG:
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("pop  rax");
-            EMIT ("push rax");
-            EMIT ("push rax");
-            TRY (get_var_code (compiler, node->left->data, var_code_buf));
-            EMIT ("pop %s ; Assig", var_code_buf);
+            TRY (subtree_compile (compiler, node->right));
+            EMIT (POP,  RAX);
+            EMIT (PUSH, RAX);
+            EMIT (PUSH, RAX);
+            TRY (get_var_operand (compiler, node->left, &var));
+            EMIT (POP, var, "Assig");
             break;
 
         case tree::op_t::INPUT:
-            EMIT ("inp");
+            EMIT (INP);
             break;
             
-        case tree::op_t::EQ:  EMIT_COMPARATOR ("je" ); break;
-        case tree::op_t::GT:  EMIT_COMPARATOR ("ja" ); break;
-        case tree::op_t::LT:  EMIT_COMPARATOR ("jb" ); break;
-        case tree::op_t::GE:  EMIT_COMPARATOR ("jae"); break;
-        case tree::op_t::LE:  EMIT_COMPARATOR ("jbe"); break;
-        case tree::op_t::NEQ: EMIT_COMPARATOR ("jne"); break;
+        case tree::op_t::EQ:  EMIT_COMPARATOR (JE ); break;
+        case tree::op_t::GT:  EMIT_COMPARATOR (JA ); break;
+        case tree::op_t::LT:  EMIT_COMPARATOR (JB ); break;
+        case tree::op_t::GE:  EMIT_COMPARATOR (JAE); break;
+        case tree::op_t::LE:  EMIT_COMPARATOR (JBE); break;
+        case tree::op_t::NEQ: EMIT_COMPARATOR (JNE); break;
         
         case tree::op_t::NOT:
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("push 0")
-            EMIT_PUSH_TRUE_FALSE ("je");
+            TRY (subtree_compile (compiler, node->right));
+            EMIT (PUSH, isa::imm (0));
+            EMIT_PUSH_TRUE_FALSE (JE);
             break;
         
         case tree::op_t::AND:
-            TRY (subtree_compile (compiler, node->left, stream));
-            EMIT ("push 0")
-            EMIT_PUSH_TRUE_FALSE ("jne");
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("push 0")
-            EMIT_PUSH_TRUE_FALSE ("jne");
-            EMIT_PUSH_TRUE_FALSE ("je");
-            break;
-
         case tree::op_t::OR:
-            TRY (subtree_compile (compiler, node->left, stream));
-            EMIT ("push 0")
-            EMIT_PUSH_TRUE_FALSE ("jne");
-            TRY (subtree_compile (compiler, node->right, stream));
-            EMIT ("push 0")
-            EMIT_PUSH_TRUE_FALSE ("jne");
-            EMIT ("add");
+            TRY (compile_logic_op (compiler, node));
             break;
 
         default:
@@ -290,33 +469,184 @@ static bool compile_op (compiler_t *compiler, tree::node_t *node, FILE *stream)
 #undef EMIT_BINARY_OP
 
 // -------------------------------------------------------------------------------------------------
-static bool compile_if (compiler_t *compiler, tree::node_t *node, FILE *stream)
+
+/**
+ * @brief      AND/OR in value context. Right operand is not evaluated if left one decides
+ *             the result, value is materialized once at the end.
+ */
+static bool compile_logic_op (compiler_t *compiler, tree::node_t *node)
 {
     assert (compiler != nullptr && "invalid pointer");
     assert (node     != nullptr && "invalid pointer");
-    assert (stream   != nullptr && "invalid pointer");
-    assert (node->type == tree::node_type_t::IF && "Invalid call");
 
-    char buf[BUF_SIZE] = "";
     int label_index = get_label_index (compiler);
+    int short_label = new_label (compiler, "logic_short_%d", label_index);
+    int end_label   = new_label (compiler, "logic_end_%d",   label_index);
+
+    // AND is false as soon as some operand is false, OR is true as soon as some is true
+    bool is_and = ((tree::op_t) node->data == tree::op_t::AND);
+
+    TRY (compile_cond_jump (compiler, node, !is_and, short_label));
+
+    EMIT (PUSH, isa::imm (is_and ? 1 : 0));
+    EMIT (JMP,  isa::label (end_label));
+    EMIT_LABEL (short_label);
+    EMIT (PUSH, isa::imm (is_and ? 0 : 1));
+    EMIT_LABEL (end_label);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Compile condition in branch context: jump to label if its value is jump_if,
+ *             fall through otherwise. Nothing is left on stack.
+ */
+static bool compile_cond_jump (compiler_t *compiler, tree::node_t *node,
+                                                                bool jump_if, int label)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+
+    if (node->type == tree::node_type_t::VAL)
+    {
+        if ((node->data != 0) == jump_if) {
+            EMIT (JMP, isa::label (label));
+        }
+
+        return true;
+    }
+
+    if (node->type != tree::node_type_t::OP)
+    {
+        TRY (subtree_compile (compiler, node));
+        EMIT (PUSH, isa::imm (0));
+        emit (compiler, __func__, __FILE__, __LINE__, jump_if ? isa::opcode_t::JNE : isa::opcode_t::JE,
+                                                                                isa::label (label));
+        return true;
+    }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::NOT:
+            return compile_cond_jump (compiler, node->right, !jump_if, label);
+
+        case tree::op_t::EQ:
+        case tree::op_t::GT:
+        case tree::op_t::LT:
+        case tree::op_t::GE:
+        case tree::op_t::LE:
+        case tree::op_t::NEQ:
+            return compile_cmp_jump (compiler, node, jump_if, label);
+
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+        {
+            bool is_and = ((tree::op_t) node->data == tree::op_t::AND);
+
+            // a && b jumps on false if any operand is false, a || b jumps on true if any is true
+            if (jump_if != is_and)
+            {
+                TRY (compile_cond_jump (compiler, node->left, jump_if, label));
+                TRY (compile_cond_jump (compiler, node->right, jump_if, label));
+                return true;
+            }
+
+            // Otherwise left operand may only decide that there is no jump
+            int skip_label = new_label (compiler, "logic_skip_%d", get_label_index (compiler));
+            TRY (compile_cond_jump (compiler, node->left, !jump_if, skip_label));
+            TRY (compile_cond_jump (compiler, node->right,  jump_if, label));
+            EMIT_LABEL (skip_label);
+            return true;
+        }
+
+        default:
+            TRY (subtree_compile (compiler, node));
+            EMIT (PUSH, isa::imm (0));
+            emit (compiler, __func__, __FILE__, __LINE__, jump_if ? isa::opcode_t::JNE : isa::opcode_t::JE,
+                                                                                isa::label (label));
+            return true;
+    }
+    #pragma GCC diagnostic pop
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define CMP_CASE(op, jump_true, jump_false)                 \
+    case tree::op_t::op:                                    \
+        opcode = jump_if ? isa::opcode_t::jump_true : isa::opcode_t::jump_false; \
+        break;
+
+/**
+ * @brief      Comparison in branch context: one conditional jump (inverted if needed) instead
+ *             of materializing 0/1 and comparing it with zero again.
+ */
+static bool compile_cmp_jump (compiler_t *compiler, tree::node_t *node,
+                                                                bool jump_if, int label)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+
+    isa::opcode_t opcode = isa::opcode_t::NOP;
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch ((tree::op_t) node->data)
+    {
+        CMP_CASE (EQ,  JE,  JNE);
+        CMP_CASE (GT,  JA,  JBE);
+        CMP_CASE (LT,  JB,  JAE);
+        CMP_CASE (GE,  JAE, JB );
+        CMP_CASE (LE,  JBE, JA );
+        CMP_CASE (NEQ, JNE, JE );
+
+        default:
+            assert (0 && "Not a comparison");
+            return false;
+    }
+    #pragma GCC diagnostic pop
+
+    TRY (subtree_compile (compiler, node->left));
+    TRY (subtree_compile (compiler, node->right));
+    emit (compiler, __func__, __FILE__, __LINE__, opcode, isa::label (label));
+
+    return true;
+}
+
+#undef CMP_CASE
+
+// -------------------------------------------------------------------------------------------------
+
+static bool compile_if (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::IF && "Invalid call");
 
-    TRY (subtree_compile (compiler, node->left, stream));
-    EMIT ("push 0");
+    int label_index = get_label_index (compiler);
 
     if (node->right->left != nullptr)
     {
-        EMIT ("je else_%d", label_index);
-        TRY (subtree_compile (compiler, node->right->left,  stream));
-        EMIT ("jmp if_end_%d", label_index);
-        EMIT ("else_%d:", label_index);
-        TRY (subtree_compile (compiler, node->right->right, stream));
-        EMIT ("if_end_%d:", label_index);
+        int else_label = new_label (compiler, "else_%d",   label_index);
+        int end_label  = new_label (compiler, "if_end_%d", label_index);
+
+        TRY (compile_cond_jump (compiler, node->left, false, else_label));
+        TRY (subtree_compile (compiler, node->right->left));
+        EMIT (JMP, isa::label (end_label));
+        EMIT_LABEL (else_label);
+        TRY (subtree_compile (compiler, node->right->right));
+        EMIT_LABEL (end_label);
     }
     else
     {
-        EMIT ("je if_end_%d", label_index);
-        TRY (subtree_compile (compiler, node->right->right, stream));
-        EMIT ("if_end_%d:",   label_index);
+        int end_label = new_label (compiler, "if_end_%d", label_index);
+
+        TRY (compile_cond_jump (compiler, node->left, false, end_label));
+        TRY (subtree_compile (compiler, node->right->right));
+        EMIT_LABEL (end_label);
     }
 
     return true;
@@ -324,135 +654,351 @@ static bool compile_if (compiler_t *compiler, tree::node_t *node, FILE *stream)
 
 // -------------------------------------------------------------------------------------------------
 
-static bool compile_while (compiler_t *compiler, tree::node_t *node, FILE *stream)
+static bool compile_while (compiler_t *compiler, tree::node_t *node)
 {
     assert (compiler != nullptr && "invalid pointer");
     assert (node     != nullptr && "invalid pointer");
-    assert (stream   != nullptr && "invalid pointer");
     assert (node->type == tree::node_type_t::WHILE && "Invalid call");
 
-    char buf[BUF_SIZE] = "";
     int label_index = get_label_index (compiler);
+    int beg_label   = new_label (compiler, "while_beg_%d", label_index);
+    int end_label   = new_label (compiler, "while_end_%d", label_index);
 
-    EMIT ("while_beg_%d:", label_index);
+    EMIT_LABEL (beg_label);
     
-    TRY (subtree_compile (compiler, node->left, stream));
+    TRY (compile_cond_jump (compiler, node->left, false, end_label));
     
-    EMIT ("push 0");
-    EMIT ("je while_end_%d",  label_index);
+    TRY (subtree_compile (compiler, node->right));
     
-    TRY (subtree_compile (compiler, node->right, stream));
-    
-    EMIT ("jmp while_beg_%d", label_index);
-    EMIT ("while_end_%d:",    label_index);
+    EMIT (JMP, isa::label (beg_label));
+    EMIT_LABEL (end_label);
     
     return true;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-static bool compile_func_def (compiler_t *compiler, tree::node_t *node, FILE *stream)
+static bool compile_func_def (compiler_t *compiler, tree::node_t *node)
 {
     assert (compiler != nullptr && "invalid pointer");
     assert (node     != nullptr && "invalid pointer");
-    assert (stream   != nullptr && "invalid pointer");
     assert (node->type == tree::node_type_t::FUNC_DEF && "Invalid call");
-    char buf[BUF_SIZE] = "";
+
+    if (compiler->func_codes != nullptr && compiler->func_codes[node->data].def == node)
+    {
+        func_code_t *func_code = &compiler->func_codes[node->data];
+
+        asm_code::splice (&compiler->code, &func_code->code, (int) compiler->funcs.size);
+        asm_code::dtor   (&func_code->code);
+
+        return func_code->success;
+    }
 
     compiler->global_frame_size_store = compiler->frame_size;
-    compiler->frame_size = 0;
+    compiler->frame_size = compiler->frames[node->data].size;
     compiler->in_func = true;
 
-    EMIT ("jmp func_%d_def_end", node->data);
-    EMIT ("func_%d:", node->data);
+    // Labels are numbered within function, so its code does not depend on code emitted before
+    int label_index_store = compiler->cur_label_index;
+    int cur_func_store    = compiler->cur_func;
+    compiler->cur_label_index = 0;
+    compiler->cur_func        = node->data;
 
-    compile_func_def_args (compiler, node->left, stream);
-    TRY (subtree_compile (compiler, node->right, stream));
+    bool success = (compiler->cache != nullptr) ? compile_func_cached (compiler, node) :
+                                                  emit_func_def       (compiler, node);
 
-    EMIT ("func_%d_def_end:", node->data);
-    EMIT ("; ---FUNC END---")
-    EMIT ("  ");
+    compiler->cur_func        = cur_func_store;
+    compiler->cur_label_index = label_index_store;
 
     compiler->in_func = false;
-    clear_local_vars (compiler);
     compiler->frame_size = compiler->global_frame_size_store;
 
-    return true;
+    return success;
 }
 
-// -------------------------------------------------------------------------------------------------
+/**
+ * @brief      Compile top level function definitions on the pool, each into its own code.
+ *             Code of function does not depend on code emitted before it, so splicing it at
+ *             the place of definition gives the same code as compilation in place.
+ *
+ * @return     false if functions are to be compiled in place
+ */
+static bool compile_ahead (compiler_t *compiler, tree::node_t *node, int threads)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
 
-static int compile_func_def_args (compiler_t *compiler, tree::node_t *node, FILE *stream)
+    if (threads == 1 || compiler->funcs.size < PARALLEL_MIN_FUNCS) { return false; }
+
+    compiler->func_codes = (func_code_t *) calloc (compiler->funcs.size, sizeof (func_code_t));
+    if (compiler->func_codes == nullptr) { return false; }
+
+    bool success = collect_defs (compiler, node) >= PARALLEL_MIN_FUNCS &&
+                   pool::run ((int) compiler->funcs.size, threads, compile_ahead_func, compiler) != ERROR;
+
+    if (!success) {
+        free_func_codes (compiler);
+    }
+
+    return success;
+}
+
+static bool compile_ahead_func (void *compiler_ptr, int func)
+{
+    assert (compiler_ptr != nullptr && "invalid pointer");
+
+    const compiler_t *compiler  = (const compiler_t *) compiler_ptr;
+    func_code_t      *func_code = &compiler->func_codes[func];
+
+    if (func_code->def == nullptr) { return true; }
+
+    // Worker has its own code and emitter state, the rest is shared and only read
+    compiler_t worker = *compiler;
+    worker.func_codes = nullptr;
+    asm_code::ctor (&worker.code, (int) compiler->funcs.size);
+
+    func_code->success = compile_func_def (&worker, func_code->def);
+    func_code->code    = worker.code;
+
+    return func_code->success;
+}
+
+/// @return Count of definitions outside of other functions
+static unsigned int collect_defs (compiler_t *compiler, tree::node_t *node)
 {
     assert (compiler != nullptr && "invalid pointer");
-    assert (stream   != nullptr && "invalid pointer");
 
-    if (node == nullptr) {
-        return 0;
+    if (node == nullptr) { return 0; }
+
+    if (node->type == tree::node_type_t::FUNC_DEF)
+    {
+        compiler->func_codes[node->data].def = node;
+        return 1;
     }
 
-    int num_of_args = 0;
+    return collect_defs (compiler, node->left) + collect_defs (compiler, node->right);
+}
 
-    if (node->type == tree::node_type_t::FICTIOUS) {
-        if (node->left != nullptr) {
-            num_of_args += compile_func_def_args (compiler, node->left, stream);
-        }
+static void free_func_codes (compiler_t *compiler)
+{
+    assert (compiler != nullptr && "invalid pointer");
 
-        if (node->right != nullptr) {
-            num_of_args += compile_func_def_args (compiler, node->right, stream);
-        }
+    if (compiler->func_codes == nullptr) { return; }
+
+    for (unsigned int i = 0; i < compiler->funcs.size; ++i) {
+        asm_code::dtor (&compiler->func_codes[i].code);
+    }
+
+    free (compiler->func_codes);
+    compiler->func_codes = nullptr;
+}
+
+/**
+ * @brief      Splice code of function from cache if nothing it depends on has changed,
+ *             otherwise emit it and save for the next run. Code is cached before peephole,
+ *             so the output is the same as without cache.
+ */
+static bool compile_func_cached (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+
+    int extern_labels_cnt = (int) compiler->funcs.size;
+
+    cache_key_t key = cache::fragment_key (compiler->cache);
+    hash_func_def (compiler, node, &key);
+
+    size_t size = 0;
+    char  *data = cache::fetch_fragment (compiler->cache, &key, &size);
+
+    if (data != nullptr)
+    {
+        bool loaded = fragment::load (&compiler->code, data, size, extern_labels_cnt);
+        free (data);
+
+        if (loaded) { return true; }
+
+        LOG (log::WRN, "Malformed cached code of function %d, compiling it again", node->data);
     }
-    else if (node->type == tree::node_type_t::VAR)
+
+    size_t start       = compiler->code.size;
+    int    first_label = compiler->code.labels_cnt;
+
+    TRY (emit_func_def (compiler, node));
+
+    data = fragment::save (&compiler->code, start, first_label, extern_labels_cnt, &size);
+    if (data != nullptr)
     {
-        register_var (compiler, node->data);
-        num_of_args = 1;
+        cache::store_fragment (compiler->cache, &key, data, size);
+        free (data);
     }
-    else 
+
+    return true;
+}
+
+static bool emit_func_def (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+
+    int def_end_label = new_label (compiler, "def_end");
+
+    EMIT (JMP, isa::label (def_end_label));
+    EMIT_LABEL (compiler->func_labels[node->data]);
+
+    if (compiler->memo_bases[node->data] != -1)
     {
-        assert (0 && "Broken func def params subtree");
+        TRY (compile_memo_lookup (compiler, node));
     }
 
-    return num_of_args;
+    TRY (subtree_compile (compiler, node->right));
+
+    EMIT_LABEL (def_end_label);
+    EMIT_NOTE ("---FUNC END---");
+    EMIT_NOTE (nullptr);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Emit cache check in front of function body. Body is called (not jumped to) on
+ *             miss, so its result passes through here and gets stored. Keys out of table range
+ *             go straight to body.
+ */
+static bool compile_memo_lookup (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+    assert (compiler->memo_bases[node->data] != -1 && "Function is not memoized");
+    assert (func_table::count_args (node) == 1 && "Memoized function must have one param");
+
+    int func   = node->data;
+    int flags  = compiler->memo_bases[func];
+    int values = flags + MEMO_TABLE_SIZE;
+
+    int key_slot = compiler->frames[func].memo_key_slot;
+
+    int body_label = new_label (compiler, "body");
+    int miss_label = new_label (compiler, "memo_miss");
+
+    isa::operand_t key = isa::mem_reg (isa::reg_t::RDX, 0);
+
+    EMIT (PUSH, key);
+    EMIT (PUSH, isa::imm (0));
+    EMIT (JB,   isa::label (body_label), "Key out of memo table");
+    EMIT (PUSH, key);
+    EMIT (PUSH, isa::imm (MEMO_TABLE_SIZE));
+    EMIT (JAE,  isa::label (body_label));
+
+    EMIT (PUSH, key);
+    EMIT (POP,  RCX);
+    EMIT (PUSH, isa::mem_reg (isa::reg_t::RCX, flags));
+    EMIT (PUSH, isa::imm (0));
+    EMIT (JE,   isa::label (miss_label));
+    EMIT (PUSH, isa::mem_reg (isa::reg_t::RCX, values), "Memo hit");
+    EMIT (RET);
+
+    EMIT_LABEL (miss_label);
+    EMIT (PUSH, key);
+    EMIT (POP,  isa::mem_reg (isa::reg_t::RDX, key_slot), "Save memo key");
+    EMIT (CALL, isa::label (body_label));
+    EMIT (PUSH, isa::mem_reg (isa::reg_t::RDX, key_slot));
+    EMIT (POP,  RCX);
+    EMIT (POP,  RAX);
+    EMIT (PUSH, RAX);
+    EMIT (POP,  isa::mem_reg (isa::reg_t::RCX, values), "Memo store");
+    EMIT (PUSH, isa::imm (1));
+    EMIT (POP,  isa::mem_reg (isa::reg_t::RCX, flags));
+    EMIT (PUSH, RAX);
+    EMIT (RET);
+
+    EMIT_LABEL (body_label);
+
+    return true;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-static bool compile_func_call (compiler_t *compiler, tree::node_t *node, FILE *stream)
+static bool compile_func_call (compiler_t *compiler, tree::node_t *node)
 {
     assert (compiler != nullptr && "invalid pointer");
     assert (node     != nullptr && "invalid pointer");
-    assert (stream   != nullptr && "invalid pointer");
     assert (node->type == tree::node_type_t::FUNC_CALL && "Invalid call");
-    char buf[BUF_SIZE] = "";
 
-    int arg_counter = compile_func_call_args (compiler, node->right, stream);
+    int arg_counter = compile_func_call_args (compiler, node->right);
 
-    EMIT ("push rdx")
-    EMIT ("push %d", compiler->frame_size);
-    EMIT ("add")
-    EMIT ("pop rdx; Increment frame")
+    if (compiler->regs)
+    {
+        if (compiler->frame_size != 0) {
+            EMIT_REG (ADD_R, isa::reg_t::RDX, isa::imm (compiler->frame_size), "Increment frame");
+        }
+    }
+    else
+    {
+        EMIT (PUSH, RDX);
+        EMIT (PUSH, isa::imm (compiler->frame_size));
+        EMIT (ADD);
+        EMIT (POP,  RDX, "Increment frame");
+    }
 
     for (int i = arg_counter - 1; i >= 0; --i)
     {
-        EMIT ("pop [rdx+%d] ; Fill args", i);
+        EMIT (POP, isa::mem_reg (isa::reg_t::RDX, i), "Fill args");
     }
 
-    EMIT ("call func_%d", node->data);
+    EMIT (CALL, isa::label (compiler->func_labels[node->data]));
 
-    EMIT ("push rdx")
-    EMIT ("push %d", compiler->frame_size);
-    EMIT ("sub")
-    EMIT ("pop rdx ;Decrement frame")
+    if (compiler->regs)
+    {
+        if (compiler->frame_size != 0) {
+            EMIT_REG (SUB_R, isa::reg_t::RDX, isa::imm (compiler->frame_size), "Decrement frame");
+        }
+    }
+    else
+    {
+        EMIT (PUSH, RDX);
+        EMIT (PUSH, isa::imm (compiler->frame_size));
+        EMIT (SUB);
+        EMIT (POP,  RDX, "Decrement frame");
+    }
 
     return true;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-static int compile_func_call_args (compiler_t *compiler, tree::node_t *node, FILE *stream)
+/**
+ * @brief      Compile `call; ret` pair as a jump. Callee reuses current frame, so args are
+ *             written over our own frame and rdx stays untouched. Callee's ret returns
+ *             straight to our caller.
+ */
+static bool compile_tail_call (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::FUNC_CALL && "Invalid call");
+    assert (compiler->in_func && "Tail call outside of function");
+
+    // All args are evaluated before the first one is stored, so old param values are still valid
+    int arg_counter = compile_func_call_args (compiler, node->right);
+
+    for (int i = arg_counter - 1; i >= 0; --i)
+    {
+        EMIT (POP, isa::mem_reg (isa::reg_t::RDX, i), "Fill args");
+    }
+
+    EMIT (JMP, isa::label (compiler->func_labels[node->data]), "Tail call");
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int compile_func_call_args (compiler_t *compiler, tree::node_t *node)
 {
     assert (compiler != nullptr && "invalid pointer");
-    assert (stream   != nullptr && "invalid pointer");
 
     int args_counter = 0;
 
@@ -462,123 +1008,469 @@ static int compile_func_call_args (compiler_t *compiler, tree::node_t *node, FIL
 
     if (node->type != tree::node_type_t::FICTIOUS) {
         args_counter++;
-        subtree_compile (compiler, node, stream);
+        subtree_compile (compiler, node);
         return args_counter;
     } 
 
     if (node->left != nullptr)
     {
         if (node->left->type == tree::node_type_t::FICTIOUS) {
-            args_counter += compile_func_call_args (compiler, node->left, stream);
+            args_counter += compile_func_call_args (compiler, node->left);
         } else {
             args_counter++;
-            subtree_compile (compiler, node->left, stream);
+            subtree_compile (compiler, node->left);
         }
     }
 
     if (node->right != nullptr)
     {
         if (node->right->type == tree::node_type_t::FICTIOUS) {
-            args_counter += compile_func_call_args (compiler, node->right, stream);
+            args_counter += compile_func_call_args (compiler, node->right);
         } else {
             args_counter++;
-            subtree_compile (compiler, node->right, stream);
+            subtree_compile (compiler, node->right);
         }
     }
 
     return args_counter;
 }
 
+// -------------------------------------------------------------------------------------------------
+// Register lowering. Expression is computed in temp register given by index in TEMP_REGS,
+// temps with lower indexes are live and preserved. Parts that only exist in stack form
+// (comparisons, logic, math functions, calls) run on stack above live temps with
+// compiler->reg_base pointing to the first free one.
+// -------------------------------------------------------------------------------------------------
+
+/// Expression in stack context: pushes its value if it's used
+static bool compile_value (compiler_t *compiler, tree::node_t *node, bool result_used)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+
+    int reg = compiler->reg_base;
+    assert (reg < TEMP_REGS_CNT && "No free temp register");
+
+    if (is_leaf (node))
+    {
+        isa::operand_t operand = {};
+        TRY (get_leaf_operand (compiler, node, &operand));
+
+        if (result_used) {
+            EMIT (PUSH, operand);
+        }
+
+        return true;
+    }
+
+    // Unused result of output and assignment needs no copy in register
+    if (!result_used && node->type == tree::node_type_t::OP)
+    {
+        if ((tree::op_t) node->data == tree::op_t::OUTPUT)
+        {
+            TRY (compile_value (compiler, node->right, true));
+            EMIT (OUT);
+            return true;
+        }
+
+        if ((tree::op_t) node->data == tree::op_t::ASSIG && !is_leaf (node->right) &&
+                                                            !is_reg_op (node->right))
+        {
+            isa::operand_t var = {};
+
+            TRY (compile_value (compiler, node->right, true));
+            TRY (get_var_operand (compiler, node->left, &var));
+            EMIT (POP, var, "Assig");
+            return true;
+        }
+    }
+
+    // These leave their result on stack anyway, call has nothing to save when no temps are live
+    bool on_stack = (node->type == tree::node_type_t::FUNC_CALL) ? reg == 0 : !is_reg_op (node);
+
+    if (on_stack)
+    {
+        if (node->type == tree::node_type_t::FUNC_CALL) {
+            TRY (compile_func_call (compiler, node));
+        } else {
+            TRY (compile_op (compiler, node));
+        }
+
+        if (!result_used) {
+            EMIT (POP, RAX, "Remove unused val");
+        }
+
+        return true;
+    }
+
+    TRY (compile_reg (compiler, node, reg));
+
+    if (result_used) {
+        EMIT (PUSH, isa::reg (TEMP_REGS[reg]));
+    }
+
+    return true;
+}
+
 // -------------------------------------------------------------------------------------------------
 
-static int ctor_vars (vars_t *vars)
+static bool compile_reg (compiler_t *compiler, tree::node_t *node, int reg)
 {
-    assert (vars != nullptr && "invalid pointer");
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+    assert (0 <= reg && reg < TEMP_REGS_CNT && "Invalid temp register");
+
+    isa::reg_t     dst     = TEMP_REGS[reg];
+    isa::operand_t operand = {};
+
+    if (is_leaf (node))
+    {
+        TRY (get_leaf_operand (compiler, node, &operand));
+        EMIT_REG (MOV, dst, operand);
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::FUNC_CALL) {
+        return compile_call_reg (compiler, node, reg);
+    }
+
+    assert (node->type == tree::node_type_t::OP && "Not an expression");
 
-    vars->name_indexes = (int *) calloc (DEFAULT_VARS_CAPACITY, sizeof (int));
-    if (vars->name_indexes == nullptr) { return ERROR; }
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD: return compile_arith_reg (compiler, node, reg, isa::opcode_t::ADD_R, isa::opcode_t::ADD);
+        case tree::op_t::SUB: return compile_arith_reg (compiler, node, reg, isa::opcode_t::SUB_R, isa::opcode_t::SUB);
+        case tree::op_t::MUL: return compile_arith_reg (compiler, node, reg, isa::opcode_t::MUL_R, isa::opcode_t::MUL);
+        case tree::op_t::DIV: return compile_arith_reg (compiler, node, reg, isa::opcode_t::DIV_R, isa::opcode_t::DIV);
 
-    vars->size     = 0;
-    vars->capacity = DEFAULT_VARS_CAPACITY;
+        case tree::op_t::OUTPUT:
+            TRY (compile_reg (compiler, node->right, reg));
+            EMIT (PUSH, isa::reg (dst));
+            EMIT (OUT);
+            return true;
 
-    return 0;
+        case tree::op_t::ASSIG:
+            TRY (compile_reg (compiler, node->right, reg));
+            TRY (get_var_operand (compiler, node->left, &operand));
+            EMIT_REG (STORE, dst, operand, "Assig");
+            return true;
+
+        default:
+        {
+            int saved_base    = compiler->reg_base;
+            compiler->reg_base = reg;
+
+            bool success = compile_op (compiler, node);
+
+            compiler->reg_base = saved_base;
+            TRY (success);
+
+            EMIT (POP, isa::reg (dst));
+            return true;
+        }
+    }
+    #pragma GCC diagnostic pop
 }
 
-static void dtor_vars (vars_t *vars)
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Leaf rhs is used as operand directly, other one goes to the next temp.
+ *             Without free temps lhs is spilled and the stack form of operation is used.
+ */
+static bool compile_arith_reg (compiler_t *compiler, tree::node_t *node, int reg,
+                                        isa::opcode_t reg_opcode, isa::opcode_t stack_opcode)
 {
-    assert (vars != nullptr && "invalis pointer");
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
 
-    free (vars->name_indexes);
+    isa::reg_t     dst = TEMP_REGS[reg];
+    isa::operand_t rhs = {};
 
-    #ifndef NDEBUG
-        vars->size     = 0;
-        vars->capacity = 0;
-    #endif
+    TRY (compile_reg (compiler, node->left, reg));
+
+    if (is_leaf (node->right))
+    {
+        TRY (get_leaf_operand (compiler, node->right, &rhs));
+        emit_reg (compiler, __func__, __FILE__, __LINE__, reg_opcode, dst, rhs);
+    }
+    else if (reg + 1 < TEMP_REGS_CNT)
+    {
+        TRY (compile_reg (compiler, node->right, reg + 1));
+        emit_reg (compiler, __func__, __FILE__, __LINE__, reg_opcode, dst, isa::reg (TEMP_REGS[reg + 1]));
+    }
+    else
+    {
+        EMIT (PUSH, isa::reg (dst), "Spill");
+        TRY (compile_reg (compiler, node->right, reg));
+        EMIT (PUSH, isa::reg (dst));
+        emit (compiler, __func__, __FILE__, __LINE__, stack_opcode);
+        EMIT (POP,  isa::reg (dst));
+    }
+
+    return true;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-static void register_var (compiler_t *compiler, int number)
+/// Callee uses the same temps, so live ones are saved on stack around the call
+static bool compile_call_reg (compiler_t *compiler, tree::node_t *node, int reg)
 {
     assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+
+    for (int i = 0; i < reg; ++i) {
+        EMIT (PUSH, isa::reg (TEMP_REGS[i]), "Save temp");
+    }
 
-    vars_t *vars = nullptr;
+    int saved_base     = compiler->reg_base;
+    compiler->reg_base = 0;
 
-    if (compiler->in_func) {
-        vars = &compiler->local_vars;
-    } else {
-        vars = &compiler->global_vars;
+    bool success = compile_func_call (compiler, node);
+
+    compiler->reg_base = saved_base;
+    TRY (success);
+
+    EMIT (POP, isa::reg (TEMP_REGS[reg]));
+
+    for (int i = reg - 1; i >= 0; --i) {
+        EMIT (POP, isa::reg (TEMP_REGS[i]), "Restore temp");
     }
 
-    if (vars->size == vars->capacity)
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool get_leaf_operand (compiler_t *compiler, tree::node_t *node, isa::operand_t *operand)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+    assert (operand  != nullptr && "invalid pointer");
+    assert (is_leaf (node) && "Not a leaf");
+
+    if (node->type == tree::node_type_t::VAL)
     {
-        vars->name_indexes = (int *) realloc (vars->name_indexes, 2 * vars->capacity * sizeof (int));
-        vars->capacity    *= 2;
+        *operand = isa::imm (node->data);
+        return true;
     }
 
-    vars->name_indexes[vars->size] = number;
-    vars->size++;
+    return get_var_operand (compiler, node, operand);
+}
+
+// -------------------------------------------------------------------------------------------------
 
-    compiler->frame_size++;
+/**
+ * @brief      Bind every VAR node to its slot before codegen, in the order code is emitted:
+ *             variable is visible from its definition till the end of its scope and locals
+ *             shadow globals.
+ */
+static bool resolve_vars (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+
+    compiler->frames = (frame_info_t *) calloc (compiler->funcs.size + 1, sizeof (frame_info_t));
+    if (compiler->frames == nullptr) { return false; }
+
+    symtab::push_scope (&compiler->symbols, scope_kind_t::GLOBAL);
+    bool success = resolve_node (compiler, node);
+    compiler->global_frame_size = symtab::pop_scope (&compiler->symbols);
+
+    if (compiler->symbols.oom || compiler->var_refs.oom)
+    {
+        LOG (log::ERR, "Failed to allocate symbol table");
+        return false;
+    }
+
+    return success;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-static bool get_var_code (compiler_t *compiler, int number, char* code)
+static bool resolve_node (compiler_t *compiler, tree::node_t *node)
 {
-    assert (compiler != nullptr && "Invalid pointer");
-    assert (code     != nullptr && "Invalid pointer");
+    assert (compiler != nullptr && "invalid pointer");
 
-    for (unsigned int i = 0; i < compiler->local_vars.size; ++i)
+    if (node == nullptr) { return true; }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (node->type)
     {
-        if (compiler->local_vars.name_indexes[i] == number)
+        case tree::node_type_t::VAR_DEF:
         {
-            sprintf (code, "[rdx+%u]", i);
+            // Definition is referenced too, liveness starts from it
+            int symbol = symtab::define (&compiler->symbols, node->data);
+
+            if (symbol != -1) {
+                int_map::set (&compiler->var_refs, (int64_t) (uintptr_t) node, symbol);
+            }
             return true;
         }
-    }
 
-    for (unsigned int i = 0; i < compiler->global_vars.size; ++i)
-    {
-        if (compiler->global_vars.name_indexes[i] == number)
+        case tree::node_type_t::VAR:
         {
-            sprintf (code, "[%u]", i);
+            int symbol = symtab::lookup (&compiler->symbols, node->data);
+
+            if (symbol == -1)
+            {
+                LOG (log::ERR, "FAILED to get var code %d", node->data);
+                return false;
+            }
+
+            int_map::set (&compiler->var_refs, (int64_t) (uintptr_t) node, symbol);
             return true;
         }
+
+        case tree::node_type_t::FUNC_DEF:
+            return resolve_func_def (compiler, node);
+
+        default:
+            TRY (resolve_node (compiler, node->left));
+            return resolve_node (compiler, node->right);
+    }
+    #pragma GCC diagnostic pop
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool resolve_func_def (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::FUNC_DEF && "Invalid call");
+
+    frame_info_t *frame  = &compiler->frames[node->data];
+    frame->memo_key_slot = -1;
+
+    int first_symbol = compiler->symbols.symbols_cnt;
+    symtab::push_scope (&compiler->symbols, scope_kind_t::FUNCTION);
+
+    // Param i takes slot i, caller fills them so
+    resolve_params (compiler, node->left);
+
+    if (compiler->memo_bases[node->data] != -1)
+    {
+        // Body is free to overwrite its param, so key is saved to hidden local
+        int key = symtab::define (&compiler->symbols, MEMO_KEY_VAR);
+
+        if (key != -1) {
+            frame->memo_key_slot = symtab::get (&compiler->symbols, key)->slot;
+        }
+    }
+
+    int first_local = compiler->symbols.symbols_cnt;
+
+    bool success = resolve_node (compiler, node->right);
+    frame->size  = symtab::pop_scope (&compiler->symbols);
+
+    if (!success || compiler->symbols.oom || compiler->var_refs.oom) { return false; }
+
+    // Locals with disjoint lifetimes share slots, params and memo key stay where they are
+    frame->size = liveness::share_slots (&compiler->symbols, &compiler->var_refs, node->right,
+                                                        first_local, first_local - first_symbol);
+    return frame->size != -1;
+}
+
+static void resolve_params (compiler_t *compiler, tree::node_t *node)
+{
+    assert (compiler != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return; }
+
+    if (node->type == tree::node_type_t::VAR)
+    {
+        symtab::define (&compiler->symbols, node->data);
+        return;
     }
 
-    LOG (log::ERR, "FAILED to get var code %d", number);
+    assert (node->type == tree::node_type_t::FICTIOUS && "Broken func def params subtree");
 
-    return false;
+    resolve_params (compiler, node->left);
+    resolve_params (compiler, node->right);
 }
 
 // -------------------------------------------------------------------------------------------------
 
-static void clear_local_vars (compiler_t *compiler)
+static bool get_var_operand (compiler_t *compiler, const tree::node_t *node, isa::operand_t *operand)
+{
+    assert (compiler != nullptr && "Invalid pointer");
+    assert (node     != nullptr && "Invalid pointer");
+    assert (operand  != nullptr && "Invalid pointer");
+
+    int index = int_map::get (&compiler->var_refs, (int64_t) (uintptr_t) node, -1);
+
+    if (index == -1)
+    {
+        LOG (log::ERR, "Variable %d is not resolved", node->data);
+        return false;
+    }
+
+    const symbol_t *symbol = symtab::get (&compiler->symbols, index);
+
+    if (symbol->local) {
+        *operand = isa::mem_reg (isa::reg_t::RDX, symbol->slot);
+    } else {
+        *operand = isa::mem (symbol->slot + compiler->memo_area_size);
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Key of function code: its subtree with resolved slots and everything its code
+ *             refers to outside of it. Other functions are referred to only by index.
+ */
+static void hash_func_def (const compiler_t *compiler, const tree::node_t *node, cache_key_t *key)
 {
     assert (compiler != nullptr && "invalid pointer");
+    assert (node     != nullptr && "invalid pointer");
+    assert (key      != nullptr && "invalid pointer");
+
+    int func = node->data;
+    const int layout[] = {func, compiler->frames[func].size, compiler->frames[func].memo_key_slot,
+                          compiler->memo_bases[func], compiler->memo_area_size, compiler->regs};
 
-    compiler->local_vars.size = 0;
+    cache::hash  (key, layout, sizeof (layout));
+    hash_subtree (compiler, node, key);
+}
+
+static void hash_subtree (const compiler_t *compiler, const tree::node_t *node, cache_key_t *key)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (key      != nullptr && "invalid pointer");
+
+    // Null children are hashed too, otherwise different shapes may give the same key
+    int record[4] = {-1, 0, 0, 0};
+
+    if (node != nullptr)
+    {
+        record[0] = (int) node->type;
+        record[1] = node->data;
+
+        if (node->type == tree::node_type_t::VAR || node->type == tree::node_type_t::VAR_DEF)
+        {
+            int index = int_map::get (&compiler->var_refs, (int64_t) (uintptr_t) node, -1);
+
+            if (index != -1)
+            {
+                const symbol_t *symbol = symtab::get (&compiler->symbols, index);
+                record[2] = symbol->local;
+                record[3] = symbol->slot;
+            }
+        }
+    }
+
+    cache::hash (key, record, sizeof (record));
+
+    if (node == nullptr) { return; }
+
+    hash_subtree (compiler, node->left,  key);
+    hash_subtree (compiler, node->right, key);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -588,4 +1480,136 @@ static int get_label_index (compiler_t *compiler)
     assert (compiler != nullptr && "invalid pointer");
 
     return compiler->cur_label_index++;
-}
\ No newline at end of file
+}
+
+static int new_label (compiler_t *compiler, const char *name_fmt, ...)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (name_fmt != nullptr && "invalid pointer");
+
+    char name[LABEL_NAME_BUF_SIZE] = "";
+    int  len = 0;
+
+    if (compiler->cur_func != -1) {
+        len = snprintf (name, LABEL_NAME_BUF_SIZE, "func_%d_", compiler->cur_func);
+    }
+
+    va_list args;
+    va_start (args, name_fmt);
+    vsnprintf (name + len, (size_t) (LABEL_NAME_BUF_SIZE - len), name_fmt, args);
+    va_end (args);
+
+    // On OOM code is marked broken and label id is never printed
+    int label = asm_code::new_label (&compiler->code, name);
+    return (label == ERROR) ? 0 : label;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool emit_bytecode (compiler_t *compiler, FILE *stream, bool symbols)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (stream   != nullptr && "invalid pointer");
+
+    bytecode_t bc = {};
+    TRY (assembler::assemble (&compiler->code, &bc, symbols) != ERROR);
+
+    bool success = (bytecode::write (&bc, stream) != ERROR);
+    if (!success) {
+        LOG (log::ERR, "Failed to write bytecode");
+    }
+
+    bytecode::dtor (&bc);
+    return success;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool setup_func_labels (compiler_t *compiler)
+{
+    assert (compiler != nullptr && "invalid pointer");
+
+    compiler->func_labels = (int *) calloc (compiler->funcs.size + 1, sizeof (int));
+    if (compiler->func_labels == nullptr) { return false; }
+
+    for (unsigned int i = 0; i < compiler->funcs.size; ++i)
+    {
+        compiler->func_labels[i] = new_label (compiler, "func_%u", i);
+    }
+
+    return !compiler->code.oom;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool setup_memo (compiler_t *compiler, const compile_opts_t *opts)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (opts     != nullptr && "invalid pointer");
+
+    compiler->memo_bases = (int *) calloc (compiler->funcs.size + 1, sizeof (int));
+    if (compiler->memo_bases == nullptr) { return false; }
+
+    compiler->memo_area_size = 0;
+
+    for (unsigned int i = 0; i < compiler->funcs.size; ++i)
+    {
+        compiler->memo_bases[i] = -1;
+
+        tree::node_t *def = func_table::get_def (&compiler->funcs, (int) i);
+
+        if (!opts->memoize || def == nullptr               ||
+            !func_table::is_pure      (&compiler->funcs, (int) i) ||
+            !func_table::is_recursive (&compiler->funcs, (int) i) ||
+             func_table::count_args   (def) != 1)
+        {
+            continue;
+        }
+
+        compiler->memo_bases[i]   = compiler->memo_area_size;
+        compiler->memo_area_size += 2 * MEMO_TABLE_SIZE; // Flags & values
+
+        if (opts->report != nullptr)
+        {
+            const char *name = "?";
+            if (opts->func_names != nullptr && i < opts->func_names_cnt) {
+                name = opts->func_names[i];
+            }
+
+            fprintf (opts->report, "memoized: %s (func_%u), keys [0, %d)\n", name, i, MEMO_TABLE_SIZE);
+        }
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void emit (compiler_t *compiler, const char *func, const char *file, int line,
+                  isa::opcode_t opcode, isa::operand_t arg, const char *comment)
+{
+    assert (compiler != nullptr && "invalid pointer");
+
+    asm_insn_t insn = {asm_kind_t::INSN, opcode, arg, isa::reg_t::RAX, comment, func, file, line, false};
+    asm_code::append (&compiler->code, &insn);
+}
+
+static void emit_reg (compiler_t *compiler, const char *func, const char *file, int line,
+                      isa::opcode_t opcode, isa::reg_t reg, isa::operand_t arg, const char *comment)
+{
+    assert (compiler != nullptr && "invalid pointer");
+    assert (isa::is_reg_form (opcode) && "Not a register form");
+
+    asm_insn_t insn = {asm_kind_t::INSN, opcode, arg, reg, comment, func, file, line, false};
+    asm_code::append (&compiler->code, &insn);
+}
+
+static void emit_special (compiler_t *compiler, const char *func, const char *file, int line,
+                          asm_kind_t kind, int label, const char *comment)
+{
+    assert (compiler != nullptr && "invalid pointer");
+
+    asm_insn_t insn = {kind, isa::opcode_t::NOP, isa::label (label), isa::reg_t::RAX, comment,
+                       func, file, line, false};
+    asm_code::append (&compiler->code, &insn);
+}
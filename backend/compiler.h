@@ -1,26 +1,82 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 
+#include "../lib/cache.h"
 #include "../lib/tree.h"
+#include "../lib/func_table.h"
+#include "asm_code.h"
+#include "symtab.h"
 
-struct vars_t {
-    int *name_indexes;
+/// Frame layout of function, computed by resolver
+struct frame_info_t
+{
+    int size;
+    int memo_key_slot;      // Hidden local with saved memo key, -1 if not memoized
+};
 
-    unsigned int size;
-    unsigned int capacity;
+/// Code of function compiled ahead of the rest, spliced at the place of its definition
+struct func_code_t
+{
+    tree::node_t *def;      // nullptr if function is compiled in place
+    asm_code_t code;
+    bool success;
 };
 
-//TODO понадобится стек размеров фрейма
 struct compiler_t
 {
-    vars_t global_vars;
-    vars_t local_vars;
+    symtab_t  symbols;
+    int_map_t var_refs;     // VAR node address to index of its symbol, filled by resolver
+    frame_info_t *frames;   // Indexed by function
+    int global_frame_size;
 
     bool in_func;
     int global_frame_size_store;
     int frame_size;
 
-    int cur_label_index;
+    int cur_label_index;    // Relative to function while compiling one
+    int cur_func;           // Function being compiled, -1 at top level
+
+    func_table_t funcs;
+    int *memo_bases;
+    int  memo_area_size;
+
+    int *func_labels;       // Label id of each function entry
+
+    bool regs;              // Register lowering of expressions, see compile_reg
+    int  reg_base;          // First free temp register in register lowering
+
+    cache_t *cache;         // Code fragments of functions, nullable
+
+    func_code_t *func_codes;    // Indexed by function, nullptr if all are compiled in place
+
+    asm_code_t code;
+};
+
+enum class emit_format_t
+{
+    ASM = 0,                // Text asm
+    BIN,                    // Bytecode, see lib/bytecode.h
+    ELF,                    // Native x86-64 executable, see native.h
+    C,                      // C source, see transpiler.h
+};
+
+struct compile_opts_t
+{
+    emit_format_t emit;
+    bool strip_symbols;     // Do not put label names to bytecode
+
+    bool memoize;           // Cache results of pure recursive single-arg functions
+    bool no_peephole;       // Print asm exactly as emitted
+    bool peephole_stats;    // Print per rule peephole hits to report stream
+    bool annotate;          // Keep comments and emitter source location in asm
+    bool regs;              // Keep expression temporaries in registers, needs vm (not cpu)
+
+    int threads;            // Functions are compiled in parallel, 0 for number of cpus
+
+    FILE    *report;        // Where to list applied optimizations, nullable
+    cache_t *cache;         // Reuse code of unchanged functions, nullable. Ignored with annotate
+    char   **func_names;    // Nullable
+    unsigned int func_names_cnt;
 };
 
 namespace compiler
@@ -28,7 +84,7 @@ namespace compiler
     void ctor (compiler_t *compiler);
     void dtor (compiler_t *compiler);
 
-    bool compile (tree::node_t *node, FILE *stream);
+    bool compile (tree::node_t *node, FILE *stream, const compile_opts_t *opts = nullptr);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fragment.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const uint32_t FRAGMENT_MAGIC = 0x47524645;     // "EFRG"
+
+struct fragment_header_t
+{
+    uint32_t magic;
+    uint32_t labels_cnt;
+    uint32_t insns_cnt;
+};
+
+enum class label_ref_t : uint8_t
+{
+    NONE,
+    EXTERN,     ///< Value is label id in whole program
+    OWN,        ///< Value is index in fragment label table
+};
+
+struct packed_insn_t
+{
+    uint8_t kind;
+    uint8_t opcode;
+    uint8_t arg_type;
+    uint8_t arg_reg;
+    uint8_t reg;
+    uint8_t label_ref;
+    uint16_t reserved;
+
+    int32_t value;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static bool pack_insn     (const asm_insn_t *insn, int first_label, int labels_end,
+                                        int extern_labels_cnt, packed_insn_t *packed);
+static bool is_valid_insn (const packed_insn_t *packed, uint32_t labels_cnt, int extern_labels_cnt);
+
+static inline bool has_label (const asm_insn_t *insn)
+{
+    return insn->kind == asm_kind_t::LABEL ||
+          (insn->kind == asm_kind_t::INSN && insn->arg.type == isa::operand_type_t::LABEL);
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+char *fragment::save (const asm_code_t *code, size_t start, int first_label, int extern_labels_cnt,
+                                                                                size_t *size)
+{
+    assert (code != nullptr && "invalid pointer");
+    assert (size != nullptr && "invalid pointer");
+    assert (start <= code->size && first_label <= code->labels_cnt && "Invalid fragment bounds");
+
+    char  *data      = nullptr;
+    size_t data_size = 0;
+
+    FILE *stream = open_memstream (&data, &data_size);
+    if (stream == nullptr) { return nullptr; }
+
+    fragment_header_t header = {FRAGMENT_MAGIC, (uint32_t) (code->labels_cnt - first_label),
+                                                (uint32_t) (code->size - start)};
+    fwrite (&header, sizeof (header), 1, stream);
+
+    for (int i = first_label; i < code->labels_cnt; ++i) {
+        fwrite (code->label_names[i], 1, strlen (code->label_names[i]) + 1, stream);
+    }
+
+    bool success = true;
+
+    for (size_t i = start; i < code->size && success; ++i)
+    {
+        packed_insn_t packed = {};
+        success = pack_insn (&code->insns[i], first_label, code->labels_cnt, extern_labels_cnt, &packed);
+
+        fwrite (&packed, sizeof (packed), 1, stream);
+    }
+
+    // Memstream buffer is valid only after close, write errors show up here too
+    success = (fclose (stream) == 0) && success;
+
+    if (!success)
+    {
+        free (data);
+        return nullptr;
+    }
+
+    *size = data_size;
+    return data;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool fragment::load (asm_code_t *code, const char *data, size_t size, int extern_labels_cnt)
+{
+    assert (code != nullptr && "invalid pointer");
+    assert (data != nullptr && "invalid pointer");
+
+    fragment_header_t header = {};
+    if (size < sizeof (header)) { return false; }
+
+    memcpy (&header, data, sizeof (header));
+    if (header.magic != FRAGMENT_MAGIC) { return false; }
+
+    // Everything is checked before code is touched
+    const char *names = data + sizeof (header);
+    const char *end   = data + size;
+    const char *cur   = names;
+
+    for (uint32_t i = 0; i < header.labels_cnt; ++i)
+    {
+        const char *name_end = (const char *) memchr (cur, '\0', (size_t) (end - cur));
+        if (name_end == nullptr) { return false; }
+
+        cur = name_end + 1;
+    }
+
+    const char *insns = cur;
+    if ((size_t) (end - insns) != header.insns_cnt * sizeof (packed_insn_t)) { return false; }
+
+    for (uint32_t i = 0; i < header.insns_cnt; ++i)
+    {
+        packed_insn_t packed = {};
+        memcpy (&packed, insns + i * sizeof (packed_insn_t), sizeof (packed));
+
+        if (!is_valid_insn (&packed, header.labels_cnt, extern_labels_cnt)) { return false; }
+    }
+
+    int first_label = code->labels_cnt;
+
+    for (uint32_t i = 0; i < header.labels_cnt; ++i)
+    {
+        asm_code::new_label (code, names);
+        names += strlen (names) + 1;
+    }
+
+    for (uint32_t i = 0; i < header.insns_cnt; ++i)
+    {
+        packed_insn_t packed = {};
+        memcpy (&packed, insns + i * sizeof (packed_insn_t), sizeof (packed));
+
+        int value = packed.value;
+        if ((label_ref_t) packed.label_ref == label_ref_t::OWN) {
+            value += first_label;
+        }
+
+        asm_insn_t insn = {(asm_kind_t) packed.kind, (isa::opcode_t) packed.opcode,
+                           {(isa::operand_type_t) packed.arg_type, (isa::reg_t) packed.arg_reg, value},
+                           (isa::reg_t) packed.reg, nullptr, __func__, __FILE__, __LINE__, false};
+
+        asm_code::append (code, &insn);
+    }
+
+    return !code->oom;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static bool pack_insn (const asm_insn_t *insn, int first_label, int labels_end,
+                                        int extern_labels_cnt, packed_insn_t *packed)
+{
+    assert (insn   != nullptr && "invalid pointer");
+    assert (packed != nullptr && "invalid pointer");
+    assert (!insn->deleted && "Fragment is saved before peephole");
+
+    *packed = {(uint8_t) insn->kind, (uint8_t) insn->opcode, (uint8_t) insn->arg.type,
+               (uint8_t) insn->arg.reg, (uint8_t) insn->reg, (uint8_t) label_ref_t::NONE, 0,
+               insn->arg.value};
+
+    if (!has_label (insn)) { return true; }
+
+    int label = insn->arg.value;
+
+    if (label < extern_labels_cnt)
+    {
+        packed->label_ref = (uint8_t) label_ref_t::EXTERN;
+        return true;
+    }
+
+    if (first_label <= label && label < labels_end)
+    {
+        packed->label_ref = (uint8_t) label_ref_t::OWN;
+        packed->value     = label - first_label;
+        return true;
+    }
+
+    return false;
+}
+
+static bool is_valid_insn (const packed_insn_t *packed, uint32_t labels_cnt, int extern_labels_cnt)
+{
+    assert (packed != nullptr && "invalid pointer");
+
+    if (packed->kind     > (uint8_t) asm_kind_t::NOTE                ||
+        packed->opcode   >= isa::OPCODES_CNT                          ||
+        packed->arg_type > (uint8_t) isa::operand_type_t::LABEL       ||
+        packed->arg_reg  >= isa::REGS_CNT || packed->reg >= isa::REGS_CNT)
+    {
+        return false;
+    }
+
+    switch ((label_ref_t) packed->label_ref)
+    {
+        case label_ref_t::NONE:   return true;
+        case label_ref_t::EXTERN: return 0 <= packed->value && packed->value < extern_labels_cnt;
+        case label_ref_t::OWN:    return 0 <= packed->value && (uint32_t) packed->value < labels_cnt;
+        default:                  return false;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <stddef.h>
+#include "asm_code.h"
+
+/**
+ * @brief Serialized piece of asm code, e.g. one function, that can be appended to other code.
+ *        Labels below extern_labels_cnt (function entries) are shared by whole program and
+ *        saved by id. Labels created for the piece itself are saved with names and created
+ *        anew in the same order on load, so spliced code is identical to freshly emitted one.
+ *        Comments and emitter locations are not saved.
+ */
+namespace fragment
+{
+    /**
+     * @brief      Serialize code from insn start and label first_label till the end
+     *
+     * @return     Buffer from malloc or nullptr on OOM or reference to foreign label
+     */
+    char *save (const asm_code_t *code, size_t start, int first_label, int extern_labels_cnt,
+                                                                                size_t *size);
+
+    /// @return false if fragment is malformed, code is left untouched then
+    bool  load (asm_code_t *code, const char *data, size_t size, int extern_labels_cnt);
+}
+
+#endif
@@ -0,0 +1,246 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "liveness.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const int DEFAULT_LOOPS_CAPACITY = 8;
+
+/// Positions are indices of nodes in pre-order walk, which is the order code is emitted in
+struct live_range_t
+{
+    int symbol;
+    int beg;
+    int end;
+};
+
+struct loop_range_t
+{
+    int beg;
+    int end;
+};
+
+struct liveness_t
+{
+    const int_map_t *var_refs;
+
+    live_range_t *ranges;       ///< Indexed by symbol - first_symbol
+    int first_symbol;
+    int ranges_cnt;
+
+    loop_range_t *loops;        ///< Inner loops go before enclosing ones
+    int loops_cnt;
+    int loops_capacity;
+
+    int pos;
+    bool oom;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static void collect_ranges    (liveness_t *live, const tree::node_t *node);
+static void add_loop          (liveness_t *live, int beg, int end);
+static void extend_over_loops (liveness_t *live);
+static int  pack_ranges       (symtab_t *symbols, live_range_t *ranges, int ranges_cnt, int base_slot);
+
+static int  cmp_by_beg (const void *lhs, const void *rhs);
+static int  cmp_by_end (const void *lhs, const void *rhs);
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int liveness::share_slots (symtab_t *symbols, const int_map_t *var_refs, const tree::node_t *body,
+                                                                int first_symbol, int base_slot)
+{
+    assert (symbols  != nullptr && "invalid pointer");
+    assert (var_refs != nullptr && "invalid pointer");
+    assert (first_symbol <= symbols->symbols_cnt && "Invalid first symbol");
+
+    liveness_t live   = {};
+    live.var_refs     = var_refs;
+    live.first_symbol = first_symbol;
+    live.ranges_cnt   = symbols->symbols_cnt - first_symbol;
+
+    if (live.ranges_cnt == 0) { return base_slot; }
+
+    live.ranges = (live_range_t *) calloc ((size_t) live.ranges_cnt, sizeof (live_range_t));
+    if (live.ranges == nullptr) { return -1; }
+
+    for (int i = 0; i < live.ranges_cnt; ++i) {
+        live.ranges[i] = {first_symbol + i, -1, -1};
+    }
+
+    collect_ranges    (&live, body);
+    extend_over_loops (&live);
+
+    int frame_size = live.oom ? -1 : pack_ranges (symbols, live.ranges, live.ranges_cnt, base_slot);
+
+    free (live.ranges);
+    free (live.loops);
+
+    return frame_size;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static void collect_ranges (liveness_t *live, const tree::node_t *node)
+{
+    assert (live != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return; }
+
+    int pos = live->pos++;
+
+    if (node->type == tree::node_type_t::VAR || node->type == tree::node_type_t::VAR_DEF)
+    {
+        int index = int_map::get (live->var_refs, (int64_t) (uintptr_t) node, -1) - live->first_symbol;
+
+        // Globals and params are not ours
+        if (0 <= index && index < live->ranges_cnt)
+        {
+            live_range_t *range = &live->ranges[index];
+
+            if (range->beg == -1) { range->beg = pos; }
+            range->end = pos;
+        }
+    }
+
+    collect_ranges (live, node->left);
+    collect_ranges (live, node->right);
+
+    // Value written on one iteration may be read on the next one
+    if (node->type == tree::node_type_t::WHILE) {
+        add_loop (live, pos, live->pos - 1);
+    }
+}
+
+static void add_loop (liveness_t *live, int beg, int end)
+{
+    assert (live != nullptr && "invalid pointer");
+
+    if (live->oom) { return; }
+
+    if (live->loops_cnt == live->loops_capacity)
+    {
+        int new_capacity = live->loops_capacity == 0 ? DEFAULT_LOOPS_CAPACITY : 2 * live->loops_capacity;
+
+        loop_range_t *new_loops = (loop_range_t *) realloc (live->loops,
+                                                (size_t) new_capacity * sizeof (loop_range_t));
+        if (new_loops == nullptr)
+        {
+            live->oom = true;
+            return;
+        }
+
+        live->loops          = new_loops;
+        live->loops_capacity = new_capacity;
+    }
+
+    live->loops[live->loops_cnt++] = {beg, end};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void extend_over_loops (liveness_t *live)
+{
+    assert (live != nullptr && "invalid pointer");
+
+    // Loops nest properly and inner ones come first, so one pass reaches fixpoint
+    for (int i = 0; i < live->loops_cnt; ++i)
+    {
+        const loop_range_t *loop = &live->loops[i];
+
+        for (int j = 0; j < live->ranges_cnt; ++j)
+        {
+            live_range_t *range = &live->ranges[j];
+
+            if (range->beg == -1 || range->beg > loop->end || range->end < loop->beg) { continue; }
+
+            if (range->beg > loop->beg) { range->beg = loop->beg; }
+            if (range->end < loop->end) { range->end = loop->end; }
+        }
+    }
+}
+
+/**
+ * @brief      Linear scan over ranges sorted by start, slot of every expired range is reused.
+ *             Interval graph is colored optimally so, frame gets max number of simultaneously
+ *             live variables.
+ */
+static int pack_ranges (symtab_t *symbols, live_range_t *ranges, int ranges_cnt, int base_slot)
+{
+    assert (symbols != nullptr && "invalid pointer");
+    assert (ranges  != nullptr && "invalid pointer");
+
+    live_range_t *by_end     = (live_range_t *) calloc ((size_t) ranges_cnt, sizeof (live_range_t));
+    int          *free_slots = (int *)          calloc ((size_t) ranges_cnt, sizeof (int));
+
+    if (by_end == nullptr || free_slots == nullptr)
+    {
+        free (by_end);
+        free (free_slots);
+        return -1;
+    }
+
+    for (int i = 0; i < ranges_cnt; ++i)
+    {
+        // Variable that is never mentioned is dead everywhere
+        if (ranges[i].beg == -1) {
+            ranges[i].beg = ranges[i].end = 0;
+        }
+
+        by_end[i] = ranges[i];
+    }
+
+    qsort (ranges, (size_t) ranges_cnt, sizeof (live_range_t), cmp_by_beg);
+    qsort (by_end, (size_t) ranges_cnt, sizeof (live_range_t), cmp_by_end);
+
+    int next_slot = base_slot;
+    int free_cnt  = 0;
+    int expired   = 0;
+
+    for (int i = 0; i < ranges_cnt; ++i)
+    {
+        // Range ending before this one starts has started earlier too, so it has a slot
+        while (expired < ranges_cnt && by_end[expired].end < ranges[i].beg) {
+            free_slots[free_cnt++] = symtab::get (symbols, by_end[expired++].symbol)->slot;
+        }
+
+        int slot = free_cnt > 0 ? free_slots[--free_cnt] : next_slot++;
+        symtab::set_slot (symbols, ranges[i].symbol, slot);
+    }
+
+    free (by_end);
+    free (free_slots);
+
+    return next_slot;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int cmp_by_beg (const void *lhs, const void *rhs)
+{
+    const live_range_t *lhs_range = (const live_range_t *) lhs;
+    const live_range_t *rhs_range = (const live_range_t *) rhs;
+
+    if (lhs_range->beg != rhs_range->beg) {
+        return lhs_range->beg < rhs_range->beg ? -1 : 1;
+    }
+
+    return lhs_range->symbol - rhs_range->symbol;
+}
+
+static int cmp_by_end (const void *lhs, const void *rhs)
+{
+    const live_range_t *lhs_range = (const live_range_t *) lhs;
+    const live_range_t *rhs_range = (const live_range_t *) rhs;
+
+    if (lhs_range->end != rhs_range->end) {
+        return lhs_range->end < rhs_range->end ? -1 : 1;
+    }
+
+    return lhs_range->symbol - rhs_range->symbol;
+}
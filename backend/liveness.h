@@ -0,0 +1,24 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include "../lib/tree.h"
+#include "symtab.h"
+
+namespace liveness
+{
+    /**
+     * @brief      Reassign frame slots of function locals so that variables with disjoint
+     *             live ranges share a slot. Live range spans from definition to the last use
+     *             and covers whole loop if variable is touched inside it.
+     *
+     * @param      var_refs      VAR and VAR_DEF node address to symbol index
+     * @param      first_symbol  Symbols from this index to the end of table are locals of body
+     * @param      base_slot     First slot free for locals, lower ones are pinned params
+     *
+     * @return     New frame size or -1 on OOM
+     */
+    int share_slots (symtab_t *symbols, const int_map_t *var_refs, const tree::node_t *body,
+                                                                int first_symbol, int base_slot);
+}
+
+#endif
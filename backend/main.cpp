@@ -1,11 +1,39 @@
+#include <assert.h>
 #include <cstdio>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "compiler.h"
+#include "../lib/batch.h"
+#include "../lib/bytecode.h"
+#include "../lib/cache.h"
 #include "../lib/file.h"
+#include "../lib/server.h"
 #include "../lib/common.h"
 
 // -------------------------------------------------------------------------------------------------
 
+const int MAX_NAME_LEN = 128;
+
+struct back_opts_t
+{
+    compile_opts_t compile;     ///< Per file fields are filled by each file's own copy
+    bool disasm;
+
+    const char *const *flags;   ///< Flags as given, they are part of cache key
+    int flags_cnt;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static int    compile_file    (const char *input, const char *output, const back_opts_t *opts);
+static int    batch_job       (const char *input, const char *output, const void *opts);
+static char **load_func_names (const char *header, unsigned int *count);
+static void   free_names      (char **names, unsigned int count);
+static int    disasm_file     (const char *input, const char *output);
+
+// -------------------------------------------------------------------------------------------------
+
 #define ERR_CASE(cond, fmt, ...)                    \
 {                                                   \
     if (cond) {                                     \
@@ -20,24 +48,237 @@
 int main (int argc, const char *argv[])
 {
     tree::node_t *ast = nullptr;
+    back_opts_t opts = {};
+
+    batch_opts_t batch = {};
+    int batch_flags = batch::parse_flags (argc, argv, &batch);
+    ERR_CASE (batch_flags == ERROR,
+                    "Usage: ./back --batch=<manifest> [--jobs=<n>] | --serve=<socket> [flags]");
 
-    ERR_CASE (argc != 3 || (strcmp (argv[1], "-h") == 0), "Usage: ./back <input ast file> <output asm file>");
-    
-    const file_t src = open_ro_file (argv[1]);
-    ERR_CASE (src.content == nullptr, "Failed to open file %s", argv[1]);
+    argc -= batch_flags;
+    argv += batch_flags;
+
+    int flag_cnt = 0;
+    for (; 1 + flag_cnt < argc && strncmp (argv[1 + flag_cnt], "--", 2) == 0; ++flag_cnt)
+    {
+        const char *flag = argv[1 + flag_cnt];
+        compile_opts_t *copts = &opts.compile;
+
+        if      (strcmp (flag, "--memoize")        == 0) { copts->memoize        = true; }
+        else if (strcmp (flag, "--no-peephole")    == 0) { copts->no_peephole    = true; }
+        else if (strcmp (flag, "--peephole-stats") == 0) { copts->peephole_stats = true; }
+        else if (strcmp (flag, "--annotate")       == 0) { copts->annotate       = true; }
+        else if (strcmp (flag, "--regs")           == 0) { copts->regs           = true; }
+        else if (strcmp (flag, "--emit=asm")       == 0) { copts->emit = emit_format_t::ASM; }
+        else if (strcmp (flag, "--emit=bin")       == 0) { copts->emit = emit_format_t::BIN; }
+        else if (strcmp (flag, "--emit=elf")       == 0) { copts->emit = emit_format_t::ELF; }
+        else if (strcmp (flag, "--emit=c")         == 0) { copts->emit = emit_format_t::C;   }
+        else if (strcmp (flag, "--strip")          == 0) { copts->strip_symbols  = true; }
+        else if (strcmp (flag, "--disasm")         == 0) { opts.disasm           = true; }
+        else {
+            ERR_CASE (true, "Unknown flag %s", flag);
+        }
+    }
+
+    opts.flags     = argv + 1;
+    opts.flags_cnt = flag_cnt;
+
+    if (batch_flags != 0)
+    {
+        // Reports of parallel files would interleave
+        ERR_CASE (opts.compile.peephole_stats, "--peephole-stats is not supported in batch and server modes");
+        ERR_CASE (argc != 1 + flag_cnt, "No input files are expected with --batch and --serve");
+
+        // Files already run in parallel, functions of each file stay on its thread
+        opts.compile.threads = 1;
+
+        if (batch.socket != nullptr) {
+            return server::serve (batch.socket, batch_job, &opts);
+        }
+
+        return batch::run (&batch, batch_job, &opts);
+    }
+
+    ERR_CASE (argc != 3 + flag_cnt || (strcmp (argv[1], "-h") == 0),
+                "Usage: ./back [flags] <input ast file> <output asm file>\n"
+                "       ./back --batch=<manifest> [--jobs=<n>] [flags]\n"
+                "       ./back --serve=<socket> [flags]\n"
+                "      --memoize         cache results of pure recursive functions\n"
+                "      --no-peephole     print asm exactly as emitted\n"
+                "      --peephole-stats  print per rule peephole statistics\n"
+                "      --annotate        mark each asm line with the place that emitted it\n"
+                "      --regs            keep expression temporaries in registers (vm only)\n"
+                "      --emit=asm|bin|elf|c  output text asm (default), bytecode, native executable or C\n"
+                "      --strip           do not put label names to bytecode\n"
+                "      --disasm          input is bytecode, print it as text asm\n"
+                "      --batch           compile each \"<input> <output>\" line of manifest in parallel\n"
+                "      --serve           stay resident and compile files sent by bin/client");
+
+    return compile_file (argv[1+flag_cnt], argv[2+flag_cnt], &opts);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int compile_file (const char *input, const char *output, const back_opts_t *opts)
+{
+    assert (input  != nullptr && "invalid pointer");
+    assert (output != nullptr && "invalid pointer");
+    assert (opts   != nullptr && "invalid pointer");
+
+    if (opts->disasm) {
+        return disasm_file (input, output);
+    }
+
+    tree::node_t *ast = nullptr;
+    compile_opts_t copts = opts->compile;
+
+    const file_t src = open_ro_file (input);
+    ERR_CASE (src.content == nullptr, "Failed to open file %s", input);
+
+    // Peephole report is wanted from the real run
+    cache_t cache = {};
+    if (!copts.peephole_stats) {
+        cache::ctor (&cache, "back", opts->flags, opts->flags_cnt, src.content, src.size);
+    }
+
+    if (cache::fetch (&cache, output))
+    {
+        unmap_ro_file (src);
+        ERR_CASE (copts.emit == emit_format_t::ELF && chmod (output, 0755) != 0,
+                                                        "Failed to make %s executable", output);
+        return 0;
+    }
 
     const char *tree_section = src.content;
     while (*tree_section != '{') tree_section++;
 
+    copts.func_names = load_func_names (src.content, &copts.func_names_cnt);
+    copts.report     = stderr;
+    copts.cache      = &cache;
+
     ast = tree::load_tree (tree_section);
-    ERR_CASE (ast == nullptr, "Failed to load AST tree");
     unmap_ro_file (src);
 
-    FILE *output_file = fopen (argv[2], "w");
-    ERR_CASE (output_file == nullptr, "Failed to open file %s", argv[2]);
+    if (ast == nullptr) { free_names (copts.func_names, copts.func_names_cnt); }
+    ERR_CASE (ast == nullptr, "Failed to load AST tree");
 
-    ERR_CASE (!compiler::compile (ast, output_file), "Failed to compile, see logs");
+    FILE *output_file = fopen (output, "w");
+    if (output_file == nullptr) { free_names (copts.func_names, copts.func_names_cnt); }
+    ERR_CASE (output_file == nullptr, "Failed to open file %s", output);
+
+    bool success = compiler::compile (ast, output_file, &copts);
 
     fclose (output_file);
+    free_names (copts.func_names, copts.func_names_cnt);
+
+    ERR_CASE (!success, "Failed to compile, see logs");
+
+    if (copts.emit == emit_format_t::ELF) {
+        ERR_CASE (chmod (output, 0755) != 0, "Failed to make %s executable", output);
+    }
+
+    cache::store (&cache, output);
+
     tree::del_node (ast);
-}
\ No newline at end of file
+    return 0;
+}
+
+static int batch_job (const char *input, const char *output, const void *opts)
+{
+    return compile_file (input, output, (const back_opts_t *) opts);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Read function names from AST dump header (var names block, then func names block).
+ *             Returns nullptr on malformed header, names are used only for reports.
+ */
+static char **load_func_names (const char *header, unsigned int *count)
+{
+    assert (header != nullptr && "invalid pointer");
+    assert (count  != nullptr && "invalid pointer");
+
+    char name[MAX_NAME_LEN] = "";
+    int read_len = 0;
+    unsigned int var_cnt = 0;
+    *count = 0;
+
+    if (sscanf (header, "%u%n", &var_cnt, &read_len) != 1) { return nullptr; }
+    header += read_len;
+
+    for (unsigned int i = 0; i < var_cnt; ++i)
+    {
+        if (sscanf (header, "%127s%n", name, &read_len) != 1) { return nullptr; }
+        header += read_len;
+    }
+
+    unsigned int func_cnt = 0;
+    if (sscanf (header, "%u%n", &func_cnt, &read_len) != 1) { return nullptr; }
+    header += read_len;
+
+    char **names = (char **) calloc (func_cnt + 1, sizeof (char *));
+    if (names == nullptr) { return nullptr; }
+
+    for (unsigned int i = 0; i < func_cnt; ++i)
+    {
+        if (sscanf (header, "%127s%n", name, &read_len) != 1) { break; }
+        header += read_len;
+
+        names[i] = strdup (name);
+        *count   = i + 1;
+    }
+
+    return names;
+}
+
+static void free_names (char **names, unsigned int count)
+{
+    if (names == nullptr) { return; }
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        free (names[i]);
+    }
+
+    free (names);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int disasm_file (const char *input, const char *output)
+{
+    assert (input  != nullptr && "invalid pointer");
+    assert (output != nullptr && "invalid pointer");
+
+    const file_t src = open_ro_file (input);
+    if (src.content == nullptr)
+    {
+        fprintf (stderr, "Failed to open file %s\n", input);
+        return ERROR;
+    }
+
+    bytecode_t bc = {};
+    int res = bytecode::load (&bc, src.content, src.size);
+    unmap_ro_file (src);
+
+    if (res == ERROR)
+    {
+        fprintf (stderr, "Invalid bytecode file %s, see logs\n", input);
+        return ERROR;
+    }
+
+    FILE *output_file = fopen (output, "w");
+    if (output_file == nullptr)
+    {
+        fprintf (stderr, "Failed to open file %s\n", output);
+        bytecode::dtor (&bc);
+        return ERROR;
+    }
+
+    bytecode::disasm (&bc, output_file);
+
+    fclose (output_file);
+    bytecode::dtor (&bc);
+    return 0;
+}
@@ -0,0 +1,1383 @@
+#include <assert.h>
+#include <elf.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/common.h"
+#include "../lib/func_table.h"
+#include "../lib/log.h"
+#include "../lib/x86.h"
+#include "native.h"
+
+// -------------------------------------------------------------------------------------------------
+
+using enum x86::reg_t;
+using enum x86::cond_t;
+
+const uint64_t TEXT_VADDR    = 0x400000;
+const uint64_t BSS_VADDR     = 0x600000;
+const uint64_t SEGMENT_ALIGN = 0x1000;
+const size_t   HEADERS_SIZE  = sizeof (Elf64_Ehdr) + 2 * sizeof (Elf64_Phdr);
+
+// Bss layout, r12 points to its beginning all the time
+const int32_t OUT_LEN      = 0;             // Bytes in output buffer
+const int32_t IN_BYTE      = 4;             // Last byte read by rt_read_char
+const int32_t STACK_LIMIT  = 8;             // Calls below it fail with stack overflow
+const int32_t SCRATCH      = 16;            // Digits of printed number
+const int32_t SCRATCH_SIZE = 32;
+const int32_t OUT_BUF      = SCRATCH + SCRATCH_SIZE;
+const int32_t OUT_BUF_SIZE = 4096;
+const int32_t GLOBALS      = OUT_BUF + OUT_BUF_SIZE;
+
+const int DEFAULT_LIST_CAPACITY  = 64;
+const int DEFAULT_SCOPE_CAPACITY = 16;
+
+const size_t UNBOUND = SIZE_MAX;
+
+// Linux syscall numbers
+const uint32_t SYS_READ  = 0;
+const uint32_t SYS_WRITE = 1;
+const uint32_t SYS_EXIT  = 60;
+
+const uint32_t EXIT_FAILURE_CODE = 255;     // Same as vm returning ERROR
+
+// -------------------------------------------------------------------------------------------------
+
+enum fail_t
+{
+    FAIL_DIV_BY_ZERO = 0,
+    FAIL_NEGATIVE_SQRT,
+    FAIL_INPUT,
+    FAIL_STACK_OVERFLOW,
+    FAIL_NO_RETURN,
+    FAIL_RETURN_OUTSIDE,
+
+    FAILS_CNT
+};
+
+static const char *FAIL_MESSAGES[FAILS_CNT] =
+{
+    "Runtime error: division by zero\n",
+    "Runtime error: sqrt of negative number\n",
+    "Runtime error: failed to read input\n",
+    "Runtime error: call stack overflow\n",
+    "Runtime error: function ended without return\n",
+    "Runtime error: return outside of function\n",
+};
+
+// -------------------------------------------------------------------------------------------------
+
+struct scope_t
+{
+    int *names;
+    int  size;
+    int  capacity;
+};
+
+struct fixup_t
+{
+    size_t pos;         ///< rel32 to patch
+    int    label;
+};
+
+struct native_t
+{
+    x86_code_t code;
+
+    size_t *labels;         ///< Code offset of each label, UNBOUND until it is placed
+    int     labels_cnt;
+    int     labels_capacity;
+
+    fixup_t *fixups;
+    int      fixups_cnt;
+    int      fixups_capacity;
+
+    func_table_t funcs;
+    int *func_labels;
+
+    scope_t globals;
+    scope_t locals;
+    bool    in_func;
+    int     func_args;      ///< Params of function being compiled
+
+    int rt_flush;
+    int rt_read_char;
+    int rt_output;
+    int rt_input;
+    int rt_fail;
+    int fail_labels[FAILS_CNT];
+
+    bool oom;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ctor (native_t *gen, tree::node_t *ast);
+static void dtor (native_t *gen);
+
+static bool compile_node       (native_t *gen, tree::node_t *node);
+static bool compile_op         (native_t *gen, tree::node_t *node);
+static bool compile_operands   (native_t *gen, tree::node_t *node);
+static bool compile_logic_op   (native_t *gen, tree::node_t *node);
+static bool compile_cond_jump  (native_t *gen, tree::node_t *node, bool jump_if, int label);
+static bool compile_if         (native_t *gen, tree::node_t *node);
+static bool compile_while      (native_t *gen, tree::node_t *node);
+static bool compile_func_def   (native_t *gen, tree::node_t *node);
+static int  compile_func_params (native_t *gen, tree::node_t *node);
+static bool compile_func_call  (native_t *gen, tree::node_t *node);
+static bool compile_return     (native_t *gen, tree::node_t *node);
+static bool compile_call_args  (native_t *gen, tree::node_t *node, int *count);
+static bool check_arity        (native_t *gen, tree::node_t *call, int count);
+
+static void compile_start     (native_t *gen);
+static void compile_exit      (native_t *gen);
+static void compile_runtime   (native_t *gen);
+static void compile_rt_flush  (native_t *gen);
+static void compile_rt_read   (native_t *gen);
+static void compile_rt_output (native_t *gen);
+static void compile_rt_input  (native_t *gen);
+static void compile_fails     (native_t *gen);
+
+static bool write_elf      (native_t *gen, FILE *stream);
+static bool resolve_fixups (native_t *gen);
+
+static int  new_label     (native_t *gen);
+static void bind_label    (native_t *gen, int label);
+static void add_fixup     (native_t *gen, size_t pos, int label);
+static void emit_jump     (native_t *gen, int label);
+static void emit_jump_if  (native_t *gen, x86::cond_t cond, int label);
+static void emit_call     (native_t *gen, int label);
+static void emit_syscall  (native_t *gen, uint32_t number);
+static void emit_save     (native_t *gen, const x86::reg_t *regs, int cnt);
+static void emit_restore  (native_t *gen, const x86::reg_t *regs, int cnt);
+
+static void register_var (native_t *gen, int number);
+static bool get_var      (native_t *gen, int number, x86::reg_t *base, int32_t *disp);
+static bool scope_add    (native_t *gen, scope_t *scope, int number);
+
+static x86::cond_t cmp_cond (tree::op_t op);
+
+static bool grow (native_t *gen, void **array, int *capacity, int cnt, size_t elem_size);
+
+// -------------------------------------------------------------------------------------------------
+
+#define TRY(cond)       \
+{                       \
+    if (!(cond))        \
+    {                   \
+        return false;   \
+    }                   \
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+bool native::compile (tree::node_t *ast, FILE *stream)
+{
+    assert (ast    != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    native_t gen = {};
+    if (!ctor (&gen, ast))
+    {
+        LOG (log::ERR, "Failed to allocate native code generator");
+        dtor (&gen);
+        return false;
+    }
+
+    compile_start (&gen);
+    bool success = compile_node (&gen, ast);
+    compile_exit    (&gen);
+    compile_runtime (&gen);
+
+    success = success && resolve_fixups (&gen);
+
+    if (gen.oom || gen.code.oom)
+    {
+        LOG (log::ERR, "Failed to allocate memory for native code");
+        success = false;
+    }
+
+    success = success && write_elf (&gen, stream);
+
+    dtor (&gen);
+    return success;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static bool ctor (native_t *gen, tree::node_t *ast)
+{
+    assert (gen != nullptr && "invalid pointer");
+    assert (ast != nullptr && "invalid pointer");
+
+    *gen = {};
+
+    gen->labels_capacity  = DEFAULT_LIST_CAPACITY;
+    gen->fixups_capacity  = DEFAULT_LIST_CAPACITY;
+    gen->globals.capacity = DEFAULT_SCOPE_CAPACITY;
+    gen->locals.capacity  = DEFAULT_SCOPE_CAPACITY;
+
+    x86::ctor (&gen->code);
+    gen->labels        = (size_t *)  calloc ((size_t) gen->labels_capacity,  sizeof (size_t));
+    gen->fixups        = (fixup_t *) calloc ((size_t) gen->fixups_capacity,  sizeof (fixup_t));
+    gen->globals.names = (int *)     calloc ((size_t) gen->globals.capacity, sizeof (int));
+    gen->locals.names  = (int *)     calloc ((size_t) gen->locals.capacity,  sizeof (int));
+
+    if (gen->code.oom || gen->labels == nullptr || gen->fixups == nullptr ||
+        gen->globals.names == nullptr || gen->locals.names == nullptr)
+    {
+        return false;
+    }
+
+    if (func_table::ctor (&gen->funcs, ast) == ERROR) { return false; }
+
+    gen->func_labels = (int *) calloc (gen->funcs.size + 1, sizeof (int));
+    if (gen->func_labels == nullptr) { return false; }
+
+    for (unsigned int i = 0; i < gen->funcs.size; ++i) {
+        gen->func_labels[i] = new_label (gen);
+    }
+
+    gen->rt_flush     = new_label (gen);
+    gen->rt_read_char = new_label (gen);
+    gen->rt_output    = new_label (gen);
+    gen->rt_input     = new_label (gen);
+    gen->rt_fail      = new_label (gen);
+
+    for (int i = 0; i < FAILS_CNT; ++i) {
+        gen->fail_labels[i] = new_label (gen);
+    }
+
+    return !gen->oom;
+}
+
+static void dtor (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    x86::dtor (&gen->code);
+    free (gen->labels);
+    free (gen->fixups);
+    free (gen->globals.names);
+    free (gen->locals.names);
+    free (gen->func_labels);
+    func_table::dtor (&gen->funcs);
+
+    *gen = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Statement or expression, value of expression is left in eax
+static bool compile_node (native_t *gen, tree::node_t *node)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return true;
+    }
+
+    x86::reg_t base = RAX;
+    int32_t    disp = 0;
+
+    switch (node->type)
+    {
+        case tree::node_type_t::FICTIOUS:
+            TRY (compile_node (gen, node->left));
+            TRY (compile_node (gen, node->right));
+            break;
+
+        case tree::node_type_t::VAL:
+            x86::emit_mov_imm (&gen->code, RAX, (uint32_t) node->data);
+            break;
+
+        case tree::node_type_t::VAR:
+            TRY (get_var (gen, node->data, &base, &disp));
+            x86::emit_rm (&gen->code, 0x8B, RAX, base, -1, disp, false);
+            break;
+
+        case tree::node_type_t::VAR_DEF:
+            register_var (gen, node->data);
+            break;
+
+        case tree::node_type_t::OP:
+            TRY (compile_op (gen, node));
+            break;
+
+        case tree::node_type_t::IF:
+            TRY (compile_if (gen, node));
+            break;
+
+        case tree::node_type_t::WHILE:
+            TRY (compile_while (gen, node));
+            break;
+
+        case tree::node_type_t::FUNC_DEF:
+            TRY (compile_func_def (gen, node));
+            break;
+
+        case tree::node_type_t::FUNC_CALL:
+            TRY (compile_func_call (gen, node));
+            break;
+
+        case tree::node_type_t::RETURN:
+            TRY (compile_return (gen, node));
+            break;
+
+        case tree::node_type_t::ELSE:
+            assert (0 && "Already compiled in IF node");
+            return false;
+
+        case tree::node_type_t::NOT_SET:
+            assert (0 && "Invalid node");
+            return false;
+
+        default:
+            LOG (log::ERR, "Node type: %d\n", node->type);
+            assert (0 && "Unexpected node");
+            return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool compile_op (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::OP);
+
+    x86::reg_t base = RAX;
+    int32_t    disp = 0;
+    int div_label = -1;
+    int end_label = -1;
+
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD:
+            TRY (compile_operands (gen, node));
+            x86::emit_rr (&gen->code, 0x01, RCX, RAX, false);                   // add eax, ecx
+            break;
+
+        case tree::op_t::SUB:
+            TRY (compile_operands (gen, node));
+            x86::emit_rr (&gen->code, 0x29, RCX, RAX, false);                   // sub eax, ecx
+            break;
+
+        case tree::op_t::MUL:
+            TRY (compile_operands (gen, node));
+            x86::emit_rr (&gen->code, 0x0FAF, RAX, RCX, false);                 // imul eax, ecx
+            break;
+
+        case tree::op_t::DIV:
+            TRY (compile_operands (gen, node));
+            x86::emit_rr (&gen->code, 0x85, RCX, RCX, false);
+            emit_jump_if (gen, CC_E, gen->fail_labels[FAIL_DIV_BY_ZERO]);
+
+            // idiv traps on INT_MIN / -1, vm wraps it to negation
+            div_label = new_label (gen);
+            end_label = new_label (gen);
+            x86::emit_rr (&gen->code, 0x83, 7, RCX, false);                     // cmp ecx, -1
+            x86::emit_byte (&gen->code, 0xFF);
+            emit_jump_if (gen, CC_NE, div_label);
+            x86::emit_rr (&gen->code, 0xF7, 3, RAX, false);                     // neg eax
+            emit_jump (gen, end_label);
+            bind_label (gen, div_label);
+            x86::emit_byte (&gen->code, 0x99);                                  // cdq
+            x86::emit_rr (&gen->code, 0xF7, 7, RCX, false);                     // idiv ecx
+            bind_label (gen, end_label);
+            break;
+
+        case tree::op_t::SQRT:
+            TRY (compile_node (gen, node->right));
+            x86::emit_rr (&gen->code, 0x85, RAX, RAX, false);
+            emit_jump_if (gen, CC_S, gen->fail_labels[FAIL_NEGATIVE_SQRT]);
+            x86::emit_byte (&gen->code, 0xF2);
+            x86::emit_rr (&gen->code, 0x0F2A, 0, RAX, false);                   // cvtsi2sd xmm0, eax
+            x86::emit_byte (&gen->code, 0xF2);
+            x86::emit_rr (&gen->code, 0x0F51, 0, 0, false);                     // sqrtsd xmm0, xmm0
+            x86::emit_byte (&gen->code, 0xF2);
+            x86::emit_rr (&gen->code, 0x0F2C, RAX, 0, false);                   // cvttsd2si eax, xmm0
+            break;
+
+        case tree::op_t::SIN:
+        case tree::op_t::COS:
+            TRY (compile_node (gen, node->right));
+            x86::emit_push (&gen->code, RAX);
+            x86::emit_rm (&gen->code, 0xDB, 0, RSP, -1, 0, false);              // fild dword [rsp]
+            x86::emit_byte (&gen->code, 0xD9);
+            x86::emit_byte (&gen->code, (tree::op_t) node->data == tree::op_t::SIN ? 0xFE     // fsin
+                                                                                  : 0xFF);   // fcos
+            x86::emit_rm (&gen->code, 0xDD, 3, RSP, -1, 0, false);              // fstp qword [rsp]
+            x86::emit_byte (&gen->code, 0xF2);
+            x86::emit_rm (&gen->code, 0x0F2C, RAX, RSP, -1, 0, false);          // cvttsd2si eax, [rsp]
+            x86::emit_pop (&gen->code, RCX);
+            break;
+
+        case tree::op_t::INPUT:
+            emit_call (gen, gen->rt_input);
+            break;
+
+        case tree::op_t::OUTPUT:
+            TRY (compile_node (gen, node->right));
+            emit_call (gen, gen->rt_output);
+            break;
+
+        case tree::op_t::ASSIG:
+            TRY (compile_node (gen, node->right));
+            TRY (get_var (gen, node->left->data, &base, &disp));
+            x86::emit_rm (&gen->code, 0x89, RAX, base, -1, disp, false);
+            break;
+
+        case tree::op_t::EQ:
+        case tree::op_t::GT:
+        case tree::op_t::LT:
+        case tree::op_t::GE:
+        case tree::op_t::LE:
+        case tree::op_t::NEQ:
+            TRY (compile_operands (gen, node));
+            x86::emit_rr (&gen->code, 0x39, RCX, RAX, false);                   // cmp eax, ecx
+            x86::emit_setcc (&gen->code, cmp_cond ((tree::op_t) node->data), RAX);
+            break;
+
+        case tree::op_t::NOT:
+            TRY (compile_node (gen, node->right));
+            x86::emit_rr (&gen->code, 0x85, RAX, RAX, false);
+            x86::emit_setcc (&gen->code, CC_E, RAX);
+            break;
+
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+            TRY (compile_logic_op (gen, node));
+            break;
+
+        default:
+            assert (0 && "Unexpected op type");
+            return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Left operand to eax, right one to ecx. Leaf right operand is loaded without spilling eax.
+static bool compile_operands (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+
+    TRY (compile_node (gen, node->left));
+
+    tree::node_t *right = node->right;
+    assert (right != nullptr && "Binary op without right operand");
+
+    if (right->type == tree::node_type_t::VAL)
+    {
+        x86::emit_mov_imm (&gen->code, RCX, (uint32_t) right->data);
+        return true;
+    }
+
+    if (right->type == tree::node_type_t::VAR)
+    {
+        x86::reg_t base = RAX;
+        int32_t    disp = 0;
+
+        TRY (get_var (gen, right->data, &base, &disp));
+        x86::emit_rm (&gen->code, 0x8B, RCX, base, -1, disp, false);
+        return true;
+    }
+
+    x86::emit_push (&gen->code, RAX);
+    TRY (compile_node (gen, right));
+    x86::emit_rr (&gen->code, 0x89, RAX, RCX, false);                           // mov ecx, eax
+    x86::emit_pop (&gen->code, RAX);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool compile_logic_op (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+
+    int short_label = new_label (gen);
+    int end_label   = new_label (gen);
+
+    bool is_and = ((tree::op_t) node->data == tree::op_t::AND);
+
+    TRY (compile_cond_jump (gen, node, !is_and, short_label));
+
+    x86::emit_mov_imm (&gen->code, RAX, is_and ? 1 : 0);
+    emit_jump  (gen, end_label);
+    bind_label (gen, short_label);
+    x86::emit_mov_imm (&gen->code, RAX, is_and ? 0 : 1);
+    bind_label (gen, end_label);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Jump to label if condition value is jump_if, same shape as bytecode backend
+static bool compile_cond_jump (native_t *gen, tree::node_t *node, bool jump_if, int label)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+
+    if (node->type == tree::node_type_t::VAL)
+    {
+        if ((node->data != 0) == jump_if) {
+            emit_jump (gen, label);
+        }
+
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::OP)
+    {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wswitch-enum"
+        switch ((tree::op_t) node->data)
+        {
+            case tree::op_t::NOT:
+                return compile_cond_jump (gen, node->right, !jump_if, label);
+
+            case tree::op_t::EQ:
+            case tree::op_t::GT:
+            case tree::op_t::LT:
+            case tree::op_t::GE:
+            case tree::op_t::LE:
+            case tree::op_t::NEQ:
+            {
+                TRY (compile_operands (gen, node));
+                x86::emit_rr (&gen->code, 0x39, RCX, RAX, false);
+
+                x86::cond_t cond = cmp_cond ((tree::op_t) node->data);
+                emit_jump_if (gen, jump_if ? cond : (x86::cond_t) (cond ^ 1), label);
+                return true;
+            }
+
+            case tree::op_t::AND:
+            case tree::op_t::OR:
+            {
+                bool is_and = ((tree::op_t) node->data == tree::op_t::AND);
+
+                if (jump_if != is_and)
+                {
+                    TRY (compile_cond_jump (gen, node->left,  jump_if, label));
+                    TRY (compile_cond_jump (gen, node->right, jump_if, label));
+                    return true;
+                }
+
+                int skip_label = new_label (gen);
+                TRY (compile_cond_jump (gen, node->left, !jump_if, skip_label));
+                TRY (compile_cond_jump (gen, node->right, jump_if, label));
+                bind_label (gen, skip_label);
+                return true;
+            }
+
+            default:
+                break;
+        }
+        #pragma GCC diagnostic pop
+    }
+
+    TRY (compile_node (gen, node));
+    x86::emit_rr (&gen->code, 0x85, RAX, RAX, false);
+    emit_jump_if (gen, jump_if ? CC_NE : CC_E, label);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool compile_if (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::IF && "Invalid call");
+
+    int end_label = new_label (gen);
+
+    if (node->right->left != nullptr)
+    {
+        int else_label = new_label (gen);
+
+        TRY (compile_cond_jump (gen, node->left, false, else_label));
+        TRY (compile_node (gen, node->right->left));
+        emit_jump  (gen, end_label);
+        bind_label (gen, else_label);
+        TRY (compile_node (gen, node->right->right));
+    }
+    else
+    {
+        TRY (compile_cond_jump (gen, node->left, false, end_label));
+        TRY (compile_node (gen, node->right->right));
+    }
+
+    bind_label (gen, end_label);
+
+    return true;
+}
+
+static bool compile_while (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::WHILE && "Invalid call");
+
+    int beg_label = new_label (gen);
+    int end_label = new_label (gen);
+
+    bind_label (gen, beg_label);
+    TRY (compile_cond_jump (gen, node->left, false, end_label));
+    TRY (compile_node (gen, node->right));
+    emit_jump  (gen, beg_label);
+    bind_label (gen, end_label);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Function body is placed inline and jumped over, as in bytecode backend.
+ *             Frame: args pushed by caller are at [rbp+16..], params and locals are copied
+ *             to [rbp-8*(i+1)]. Frame size is known only after the body, so it is patched.
+ *             Frame is zeroed like locals of C translation, so a local read before it is
+ *             assigned gives 0 and not a value left by an earlier call.
+ */
+static bool compile_func_def (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::FUNC_DEF && "Invalid call");
+
+    if (gen->in_func)
+    {
+        LOG (log::ERR, "Nested function definitions are not supported");
+        return false;
+    }
+
+    int def_end_label = new_label (gen);
+
+    emit_jump  (gen, def_end_label);
+    bind_label (gen, gen->func_labels[node->data]);
+
+    gen->in_func     = true;
+    gen->locals.size = 0;
+
+    x86::emit_push (&gen->code, RBP);
+    x86::emit_rr (&gen->code, 0x89, RSP, RBP, true);                            // mov rbp, rsp
+    x86::emit_rr (&gen->code, 0x81, 5, RSP, true);                              // sub rsp, frame
+    size_t frame_pos = gen->code.size;
+    x86::emit_u32 (&gen->code, 0);
+
+    x86::emit_rm (&gen->code, 0x3B, RSP, R12, -1, STACK_LIMIT, true);           // cmp rsp, [limit]
+    emit_jump_if (gen, CC_B, gen->fail_labels[FAIL_STACK_OVERFLOW]);
+
+    x86::emit_mov_imm (&gen->code, RCX, 0);                                     // mov ecx, frame / 8
+    size_t frame_qwords_pos = gen->code.size - sizeof (uint32_t);
+    x86::emit_rr (&gen->code, 0x89, RSP, RDI, true);                            // mov rdi, rsp
+    x86::emit_rr (&gen->code, 0x31, RAX, RAX, false);                           // xor eax, eax
+    x86::emit_byte (&gen->code, 0xF3);                                          // rep stosq
+    x86::emit_byte (&gen->code, 0x48);
+    x86::emit_byte (&gen->code, 0xAB);
+
+    int args = compile_func_params (gen, node->left);
+    gen->func_args = args;
+
+    for (int i = 0; i < args; ++i)
+    {
+        x86::emit_rm (&gen->code, 0x8B, RAX, RBP, -1, 16 + 8 * (args - 1 - i), false);
+        x86::emit_rm (&gen->code, 0x89, RAX, RBP, -1, -8 * (i + 1),            false);
+    }
+
+    TRY (compile_node (gen, node->right));
+    emit_jump (gen, gen->fail_labels[FAIL_NO_RETURN]);
+
+    // Keep rsp 16-aligned inside functions
+    uint32_t frame_size   = (uint32_t) (8 * gen->locals.size + 15) & ~15u;
+    uint32_t frame_qwords = frame_size / 8;
+    if (!gen->code.oom)
+    {
+        memcpy (gen->code.data + frame_pos,        &frame_size,   sizeof (frame_size));
+        memcpy (gen->code.data + frame_qwords_pos, &frame_qwords, sizeof (frame_qwords));
+    }
+
+    bind_label (gen, def_end_label);
+
+    gen->in_func     = false;
+    gen->locals.size = 0;
+
+    return true;
+}
+
+static int compile_func_params (native_t *gen, tree::node_t *node)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return 0;
+    }
+
+    if (node->type == tree::node_type_t::VAR)
+    {
+        register_var (gen, node->data);
+        return 1;
+    }
+
+    assert (node->type == tree::node_type_t::FICTIOUS && "Broken func def params subtree");
+
+    return compile_func_params (gen, node->left) + compile_func_params (gen, node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool compile_func_call (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::FUNC_CALL && "Invalid call");
+
+    int count = 0;
+    TRY (compile_call_args (gen, node->right, &count));
+    TRY (check_arity (gen, node, count));
+
+    emit_call (gen, gen->func_labels[node->data]);
+
+    if (count > 0)
+    {
+        x86::emit_rr (&gen->code, 0x81, 0, RSP, true);                          // add rsp, args
+        x86::emit_u32 (&gen->code, (uint32_t) (8 * count));
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Tail call to function with the same number of params reuses caller's arg
+ *             slots and jumps, so deep tail recursion does not grow native stack.
+ */
+static bool compile_return (native_t *gen, tree::node_t *node)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+
+    tree::node_t *call = node->right;
+
+    if (!gen->in_func)
+    {
+        TRY (compile_node (gen, call));
+        emit_jump (gen, gen->fail_labels[FAIL_RETURN_OUTSIDE]);
+        return true;
+    }
+
+    const tree::node_t *def = (call != nullptr && call->type == tree::node_type_t::FUNC_CALL) ?
+                                        func_table::get_def (&gen->funcs, call->data) : nullptr;
+
+    if (def == nullptr || func_table::count_args (def) != gen->func_args)
+    {
+        TRY (compile_node (gen, call));
+        x86::emit_byte (&gen->code, 0xC9);                                      // leave
+        x86::emit_byte (&gen->code, 0xC3);                                      // ret
+        return true;
+    }
+
+    // All args are evaluated before the first one is stored, old params are still valid
+    int count = 0;
+    TRY (compile_call_args (gen, call->right, &count));
+    TRY (check_arity (gen, call, count));
+
+    for (int i = count - 1; i >= 0; --i)
+    {
+        x86::emit_pop (&gen->code, RAX);
+        x86::emit_rm (&gen->code, 0x89, RAX, RBP, -1, 16 + 8 * (count - 1 - i), false);
+    }
+
+    x86::emit_byte (&gen->code, 0xC9);                                          // leave
+    emit_jump (gen, gen->func_labels[call->data]);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Push args left to right, the first arg ends up deepest
+static bool compile_call_args (native_t *gen, tree::node_t *node, int *count)
+{
+    assert (gen   != nullptr && "invalid pointer");
+    assert (count != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::FICTIOUS)
+    {
+        TRY (compile_call_args (gen, node->left,  count));
+        TRY (compile_call_args (gen, node->right, count));
+        return true;
+    }
+
+    TRY (compile_node (gen, node));
+    x86::emit_push (&gen->code, RAX);
+    (*count)++;
+
+    return true;
+}
+
+static bool check_arity (native_t *gen, tree::node_t *call, int count)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (call != nullptr && "invalid pointer");
+
+    const tree::node_t *def = func_table::get_def (&gen->funcs, call->data);
+
+    if (def == nullptr)
+    {
+        LOG (log::ERR, "Call of undefined function %d", call->data);
+        return false;
+    }
+
+    if (func_table::count_args (def) != count)
+    {
+        LOG (log::ERR, "Function %d takes %d args, but %d given", call->data,
+                                                        func_table::count_args (def), count);
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_start (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    x86::emit_mov_imm (&gen->code, R12, (uint32_t) BSS_VADDR);
+
+    x86::emit_rm (&gen->code, 0x8D, RAX, RSP, -1, -NATIVE_STACK_RESERVE, true);        // lea rax, [rsp-reserve]
+    x86::emit_rm (&gen->code, 0x89, RAX, R12, -1, STACK_LIMIT,    true);
+    x86::emit_rr (&gen->code, 0x89, RSP, RBP, true);
+}
+
+static void compile_exit (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    emit_call (gen, gen->rt_flush);
+    x86::emit_mov_imm (&gen->code, RDI, 0);
+    emit_syscall (gen, SYS_EXIT);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_runtime (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    compile_rt_flush  (gen);
+    compile_rt_read   (gen);
+    compile_rt_output (gen);
+    compile_rt_input  (gen);
+    compile_fails     (gen);
+}
+
+/// Write output buffer to stdout, preserves all registers
+static void compile_rt_flush (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    const x86::reg_t saved[] = {RAX, RCX, RDX, RSI, RDI, R11};
+    const int saved_cnt = (int) (sizeof (saved) / sizeof (saved[0]));
+
+    int done_label = new_label (gen);
+
+    bind_label (gen, gen->rt_flush);
+    emit_save (gen, saved, saved_cnt);
+
+    x86::emit_rm (&gen->code, 0x8B, RDX, R12, -1, OUT_LEN, false);
+    x86::emit_rr (&gen->code, 0x85, RDX, RDX, false);
+    emit_jump_if (gen, CC_E, done_label);
+
+    x86::emit_rm (&gen->code, 0x8D, RSI, R12, -1, OUT_BUF, true);               // lea rsi, [buf]
+    x86::emit_mov_imm (&gen->code, RDI, 1);
+    emit_syscall (gen, SYS_WRITE);
+    x86::emit_rm (&gen->code, 0xC7, 0, R12, -1, OUT_LEN, false);                // mov [len], 0
+    x86::emit_u32 (&gen->code, 0);
+
+    bind_label (gen, done_label);
+    emit_restore (gen, saved, saved_cnt);
+    x86::emit_byte (&gen->code, 0xC3);
+}
+
+/// Read one byte from stdin to eax, -1 on EOF or error. Clobbers rcx, rdx, rsi, rdi, r11.
+static void compile_rt_read (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    int eof_label = new_label (gen);
+
+    bind_label (gen, gen->rt_read_char);
+
+    x86::emit_mov_imm (&gen->code, RDI, 0);
+    x86::emit_rm (&gen->code, 0x8D, RSI, R12, -1, IN_BYTE, true);
+    x86::emit_mov_imm (&gen->code, RDX, 1);
+    emit_syscall (gen, SYS_READ);
+
+    x86::emit_rr (&gen->code, 0x85, RAX, RAX, false);
+    emit_jump_if (gen, CC_LE, eof_label);
+    x86::emit_rm (&gen->code, 0x0FB6, RAX, R12, -1, IN_BYTE, false);            // movzx eax, byte [in]
+    x86::emit_byte (&gen->code, 0xC3);
+
+    bind_label (gen, eof_label);
+    x86::emit_mov_imm (&gen->code, RAX, (uint32_t) -1);
+    x86::emit_byte (&gen->code, 0xC3);
+}
+
+/// Print eax and newline to output buffer, preserves all registers
+static void compile_rt_output (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    const x86::reg_t saved[] = {RCX, RDX, RSI, RDI, RAX};
+    const int saved_cnt = (int) (sizeof (saved) / sizeof (saved[0]));
+
+    int room_label  = new_label (gen);
+    int pos_label   = new_label (gen);
+    int digit_label = new_label (gen);
+    int copy_label  = new_label (gen);
+
+    bind_label (gen, gen->rt_output);
+    emit_save (gen, saved, saved_cnt);
+
+    x86::emit_rm (&gen->code, 0x81, 7, R12, -1, OUT_LEN, false);                // cmp [len], size-scratch
+    x86::emit_u32 (&gen->code, (uint32_t) (OUT_BUF_SIZE - SCRATCH_SIZE));
+    emit_jump_if (gen, CC_BE, room_label);
+    emit_call (gen, gen->rt_flush);
+    bind_label (gen, room_label);
+
+    // Digits are written backwards from the end of scratch area, rsi is the first one
+    x86::emit_rm (&gen->code, 0x8D, RSI, R12, -1, SCRATCH + SCRATCH_SIZE - 1, true);
+    x86::emit_rm (&gen->code, 0xC6, 0, RSI, -1, 0, false);                      // mov byte [rsi], '\n'
+    x86::emit_byte (&gen->code, '\n');
+
+    // Unsigned division of negated value works for INT_MIN too
+    x86::emit_rr (&gen->code, 0x89, RAX, RCX, false);
+    x86::emit_rr (&gen->code, 0x85, RAX, RAX, false);
+    emit_jump_if (gen, CC_NS, pos_label);
+    x86::emit_rr (&gen->code, 0xF7, 3, RCX, false);                             // neg ecx
+    bind_label (gen, pos_label);
+    x86::emit_mov_imm (&gen->code, RDI, 10);
+
+    bind_label (gen, digit_label);
+    x86::emit_rr (&gen->code, 0xFF, 1, RSI, true);                              // dec rsi
+    x86::emit_rr (&gen->code, 0x89, RCX, RAX, false);
+    x86::emit_rr (&gen->code, 0x31, RDX, RDX, false);                           // xor edx, edx
+    x86::emit_rr (&gen->code, 0xF7, 6, RDI, false);                             // div edi
+    x86::emit_rr (&gen->code, 0x83, 0, RDX, false);                             // add edx, '0'
+    x86::emit_byte (&gen->code, '0');
+    x86::emit_rm (&gen->code, 0x88, RDX, RSI, -1, 0, false);                    // mov [rsi], dl
+    x86::emit_rr (&gen->code, 0x89, RAX, RCX, false);
+    x86::emit_rr (&gen->code, 0x85, RCX, RCX, false);
+    emit_jump_if (gen, CC_NE, digit_label);
+
+    x86::emit_rm (&gen->code, 0x8B, RAX, RSP, -1, 0, false);                    // original value
+    x86::emit_rr (&gen->code, 0x85, RAX, RAX, false);
+    emit_jump_if (gen, CC_NS, copy_label);
+    x86::emit_rr (&gen->code, 0xFF, 1, RSI, true);
+    x86::emit_rm (&gen->code, 0xC6, 0, RSI, -1, 0, false);                      // mov byte [rsi], '-'
+    x86::emit_byte (&gen->code, '-');
+    bind_label (gen, copy_label);
+
+    // rcx = length, rdi = end of buffered output
+    x86::emit_rm (&gen->code, 0x8D, RCX, R12, -1, SCRATCH + SCRATCH_SIZE, true);
+    x86::emit_rr (&gen->code, 0x29, RSI, RCX, true);                            // sub rcx, rsi
+    x86::emit_rm (&gen->code, 0x8B, RDI, R12, -1, OUT_LEN, false);
+    x86::emit_rr (&gen->code, 0x01, R12, RDI, true);                            // add rdi, r12
+    x86::emit_rr (&gen->code, 0x81, 0, RDI, true);                              // add rdi, buf
+    x86::emit_u32 (&gen->code, (uint32_t) OUT_BUF);
+    x86::emit_rm (&gen->code, 0x01, RCX, R12, -1, OUT_LEN, false);              // add [len], ecx
+    x86::emit_byte (&gen->code, 0xF3);                                          // rep movsb
+    x86::emit_byte (&gen->code, 0xA4);
+
+    emit_restore (gen, saved, saved_cnt);
+    x86::emit_byte (&gen->code, 0xC3);
+}
+
+/// Read decimal number to eax like scanf ("%d"), fails on EOF or missing digits
+static void compile_rt_input (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    const x86::reg_t saved[] = {RBX, RCX, RDX, RSI, RDI, R8, R9, R11};
+    const int saved_cnt = (int) (sizeof (saved) / sizeof (saved[0]));
+
+    int skip_label  = new_label (gen);
+    int plus_label  = new_label (gen);
+    int first_label = new_label (gen);
+    int digit_label = new_label (gen);
+    int end_label   = new_label (gen);
+    int ret_label   = new_label (gen);
+
+    bind_label (gen, gen->rt_input);
+    emit_save (gen, saved, saved_cnt);
+
+    // Prompt printed before input should be visible
+    emit_call (gen, gen->rt_flush);
+
+    bind_label (gen, skip_label);
+    emit_call (gen, gen->rt_read_char);
+    x86::emit_rr (&gen->code, 0x83, 7, RAX, false);                             // cmp eax, -1
+    x86::emit_byte (&gen->code, 0xFF);
+    emit_jump_if (gen, CC_E, gen->fail_labels[FAIL_INPUT]);
+    x86::emit_rr (&gen->code, 0x83, 7, RAX, false);                             // cmp eax, ' '
+    x86::emit_byte (&gen->code, ' ');
+    emit_jump_if (gen, CC_BE, skip_label);
+
+    // r8d is sign flag, r9d counts digits, ebx accumulates value
+    x86::emit_rr (&gen->code, 0x31, R8, R8, false);
+    x86::emit_rr (&gen->code, 0x83, 7, RAX, false);                             // cmp eax, '-'
+    x86::emit_byte (&gen->code, '-');
+    emit_jump_if (gen, CC_NE, plus_label);
+    x86::emit_mov_imm (&gen->code, R8, 1);
+    emit_call (gen, gen->rt_read_char);
+    emit_jump (gen, first_label);
+
+    bind_label (gen, plus_label);
+    x86::emit_rr (&gen->code, 0x83, 7, RAX, false);                             // cmp eax, '+'
+    x86::emit_byte (&gen->code, '+');
+    emit_jump_if (gen, CC_NE, first_label);
+    emit_call (gen, gen->rt_read_char);
+
+    bind_label (gen, first_label);
+    x86::emit_rr (&gen->code, 0x31, RBX, RBX, false);
+    x86::emit_rr (&gen->code, 0x31, R9, R9, false);
+
+    bind_label (gen, digit_label);
+    x86::emit_rr (&gen->code, 0x83, 5, RAX, false);                             // sub eax, '0'
+    x86::emit_byte (&gen->code, '0');
+    x86::emit_rr (&gen->code, 0x83, 7, RAX, false);                             // cmp eax, 9
+    x86::emit_byte (&gen->code, 9);
+    emit_jump_if (gen, CC_A, end_label);
+    x86::emit_rr (&gen->code, 0x6B, RBX, RBX, false);                           // imul ebx, ebx, 10
+    x86::emit_byte (&gen->code, 10);
+    x86::emit_rr (&gen->code, 0x01, RAX, RBX, false);                           // add ebx, eax
+    x86::emit_rr (&gen->code, 0xFF, 0, R9, false);                              // inc r9d
+    emit_call (gen, gen->rt_read_char);
+    emit_jump (gen, digit_label);
+
+    bind_label (gen, end_label);
+    x86::emit_rr (&gen->code, 0x85, R9, R9, false);
+    emit_jump_if (gen, CC_E, gen->fail_labels[FAIL_INPUT]);
+    x86::emit_rr (&gen->code, 0x89, RBX, RAX, false);
+    x86::emit_rr (&gen->code, 0x85, R8, R8, false);
+    emit_jump_if (gen, CC_E, ret_label);
+    x86::emit_rr (&gen->code, 0xF7, 3, RAX, false);                             // neg eax
+
+    bind_label (gen, ret_label);
+    emit_restore (gen, saved, saved_cnt);
+    x86::emit_byte (&gen->code, 0xC3);
+}
+
+/// Message texts, then stubs that print them and exit with EXIT_FAILURE_CODE
+static void compile_fails (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    size_t messages[FAILS_CNT] = {};
+
+    for (int i = 0; i < FAILS_CNT; ++i)
+    {
+        messages[i] = gen->code.size;
+
+        for (const char *c = FAIL_MESSAGES[i]; *c != '\0'; ++c) {
+            x86::emit_byte (&gen->code, (uint8_t) *c);
+        }
+    }
+
+    for (int i = 0; i < FAILS_CNT; ++i)
+    {
+        bind_label (gen, gen->fail_labels[i]);
+        x86::emit_mov_imm (&gen->code, RSI, (uint32_t) (TEXT_VADDR + HEADERS_SIZE + messages[i]));
+        x86::emit_mov_imm (&gen->code, RDX, (uint32_t) strlen (FAIL_MESSAGES[i]));
+        emit_jump (gen, gen->rt_fail);
+    }
+
+    // Program output so far goes first, as vm prints it before the error
+    bind_label (gen, gen->rt_fail);
+    emit_call (gen, gen->rt_flush);
+    x86::emit_mov_imm (&gen->code, RDI, 2);
+    emit_syscall (gen, SYS_WRITE);
+    x86::emit_mov_imm (&gen->code, RDI, EXIT_FAILURE_CODE);
+    emit_syscall (gen, SYS_EXIT);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Headers and code go to one R+X segment at TEXT_VADDR, bss is zero-filled R+W segment
+static bool write_elf (native_t *gen, FILE *stream)
+{
+    assert (gen    != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    uint64_t text_size = HEADERS_SIZE + gen->code.size;
+    uint64_t bss_size  = (uint64_t) GLOBALS + sizeof (int) * (uint64_t) gen->globals.size;
+
+    if (TEXT_VADDR + text_size > BSS_VADDR)
+    {
+        LOG (log::ERR, "Native code is too big: %zu bytes", gen->code.size);
+        return false;
+    }
+
+    Elf64_Ehdr ehdr = {};
+    memcpy (ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS]   = ELFCLASS64;
+    ehdr.e_ident[EI_DATA]    = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI]   = ELFOSABI_SYSV;
+
+    ehdr.e_type      = ET_EXEC;
+    ehdr.e_machine   = EM_X86_64;
+    ehdr.e_version   = EV_CURRENT;
+    ehdr.e_entry     = TEXT_VADDR + HEADERS_SIZE;       // _start is the first code byte
+    ehdr.e_phoff     = sizeof (Elf64_Ehdr);
+    ehdr.e_ehsize    = sizeof (Elf64_Ehdr);
+    ehdr.e_phentsize = sizeof (Elf64_Phdr);
+    ehdr.e_phnum     = 2;
+
+    Elf64_Phdr text = {};
+    text.p_type   = PT_LOAD;
+    text.p_flags  = PF_R | PF_X;
+    text.p_offset = 0;
+    text.p_vaddr  = TEXT_VADDR;
+    text.p_paddr  = TEXT_VADDR;
+    text.p_filesz = text_size;
+    text.p_memsz  = text_size;
+    text.p_align  = SEGMENT_ALIGN;
+
+    Elf64_Phdr bss = {};
+    bss.p_type   = PT_LOAD;
+    bss.p_flags  = PF_R | PF_W;
+    bss.p_offset = 0;
+    bss.p_vaddr  = BSS_VADDR;
+    bss.p_paddr  = BSS_VADDR;
+    bss.p_filesz = 0;
+    bss.p_memsz  = bss_size;
+    bss.p_align  = SEGMENT_ALIGN;
+
+    if (fwrite (&ehdr, sizeof (ehdr), 1, stream) != 1 ||
+        fwrite (&text, sizeof (text), 1, stream) != 1 ||
+        fwrite (&bss,  sizeof (bss),  1, stream) != 1 ||
+        fwrite (gen->code.data, 1, gen->code.size, stream) != gen->code.size)
+    {
+        LOG (log::ERR, "Failed to write ELF file");
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool resolve_fixups (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    for (int i = 0; i < gen->fixups_cnt; ++i)
+    {
+        size_t target = gen->labels[gen->fixups[i].label];
+
+        if (target == UNBOUND)
+        {
+            assert (0 && "Jump to unbound label");
+            return false;
+        }
+
+        x86::patch_rel32 (&gen->code, gen->fixups[i].pos, target);
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int new_label (native_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (!grow (gen, (void **) &gen->labels, &gen->labels_capacity, gen->labels_cnt, sizeof (size_t))) {
+        return 0;
+    }
+
+    gen->labels[gen->labels_cnt] = UNBOUND;
+    return gen->labels_cnt++;
+}
+
+static void bind_label (native_t *gen, int label)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (gen->oom) { return; }
+
+    assert (gen->labels[label] == UNBOUND && "Label is bound twice");
+    gen->labels[label] = gen->code.size;
+}
+
+static void add_fixup (native_t *gen, size_t pos, int label)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (grow (gen, (void **) &gen->fixups, &gen->fixups_capacity, gen->fixups_cnt, sizeof (fixup_t))) {
+        gen->fixups[gen->fixups_cnt++] = {pos, label};
+    }
+}
+
+static void emit_jump (native_t *gen, int label)
+{
+    add_fixup (gen, x86::emit_jmp (&gen->code), label);
+}
+
+static void emit_jump_if (native_t *gen, x86::cond_t cond, int label)
+{
+    add_fixup (gen, x86::emit_jcc (&gen->code, cond), label);
+}
+
+static void emit_call (native_t *gen, int label)
+{
+    add_fixup (gen, x86::emit_call (&gen->code), label);
+}
+
+static void emit_syscall (native_t *gen, uint32_t number)
+{
+    x86::emit_mov_imm (&gen->code, RAX, number);
+    x86::emit_byte (&gen->code, 0x0F);
+    x86::emit_byte (&gen->code, 0x05);
+}
+
+static void emit_save (native_t *gen, const x86::reg_t *regs, int cnt)
+{
+    for (int i = 0; i < cnt; ++i) {
+        x86::emit_push (&gen->code, regs[i]);
+    }
+}
+
+static void emit_restore (native_t *gen, const x86::reg_t *regs, int cnt)
+{
+    for (int i = cnt - 1; i >= 0; --i) {
+        x86::emit_pop (&gen->code, regs[i]);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void register_var (native_t *gen, int number)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    scope_add (gen, gen->in_func ? &gen->locals : &gen->globals, number);
+}
+
+/// Locals first, then globals, same lookup order as bytecode backend
+static bool get_var (native_t *gen, int number, x86::reg_t *base, int32_t *disp)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (base != nullptr && "invalid pointer");
+    assert (disp != nullptr && "invalid pointer");
+
+    for (int i = 0; i < gen->locals.size; ++i)
+    {
+        if (gen->locals.names[i] == number)
+        {
+            *base = RBP;
+            *disp = -8 * (i + 1);
+            return true;
+        }
+    }
+
+    for (int i = 0; i < gen->globals.size; ++i)
+    {
+        if (gen->globals.names[i] == number)
+        {
+            *base = R12;
+            *disp = GLOBALS + (int32_t) sizeof (int) * i;
+            return true;
+        }
+    }
+
+    LOG (log::ERR, "FAILED to get var code %d", number);
+    return false;
+}
+
+static bool scope_add (native_t *gen, scope_t *scope, int number)
+{
+    assert (gen   != nullptr && "invalid pointer");
+    assert (scope != nullptr && "invalid pointer");
+
+    if (!grow (gen, (void **) &scope->names, &scope->capacity, scope->size, sizeof (int))) {
+        return false;
+    }
+
+    scope->names[scope->size++] = number;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static x86::cond_t cmp_cond (tree::op_t op)
+{
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (op)
+    {
+        case tree::op_t::EQ:  return CC_E;
+        case tree::op_t::GT:  return CC_G;
+        case tree::op_t::LT:  return CC_L;
+        case tree::op_t::GE:  return CC_GE;
+        case tree::op_t::LE:  return CC_LE;
+        case tree::op_t::NEQ: return CC_NE;
+
+        default:
+            assert (0 && "Not a comparison");
+            return CC_E;
+    }
+    #pragma GCC diagnostic pop
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// @return false on OOM, gen->oom is set then
+static bool grow (native_t *gen, void **array, int *capacity, int cnt, size_t elem_size)
+{
+    assert (gen      != nullptr && "invalid pointer");
+    assert (array    != nullptr && "invalid pointer");
+    assert (capacity != nullptr && "invalid pointer");
+
+    if (gen->oom)        { return false; }
+    if (cnt < *capacity) { return true;  }
+
+    void *new_array = realloc (*array, 2 * (size_t) *capacity * elem_size);
+    if (new_array == nullptr)
+    {
+        gen->oom = true;
+        return false;
+    }
+
+    *array     = new_array;
+    *capacity *= 2;
+
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stdio.h>
+#include "../lib/tree.h"
+
+/// Bytes of stack calls may take, deeper calls fail with stack overflow. Default limit is 8M
+const int NATIVE_STACK_RESERVE = 1 << 22;
+
+namespace native
+{
+    /**
+     * @brief      Compile AST to standalone x86-64 Linux ELF executable, no libc and no VM
+     *             needed. Calls use native stack with rbp frames, globals live in bss.
+     *             Runtime errors are printed to stderr, exit code is 255 then.
+     *
+     * @return     false on unsupported AST (undefined function, arity mismatch) or OOM
+     */
+    bool compile (tree::node_t *ast, FILE *stream);
+}
+
+#endif
@@ -0,0 +1,326 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const int MAX_CAPTURES      = 3;
+const int MAX_PATTERN_TOKEN = 16;
+
+static const peephole_rule_t RULES[] =
+{
+    {"push-pop",       {"push $1", "pop $1"},                                      0, false},
+    {"add-zero",       {"push 0", "add"},                                          0, false},
+    {"sub-zero",       {"push 0", "sub"},                                          0, false},
+    {"mul-one",        {"push 1", "mul"},                                          0, false},
+    {"div-one",        {"push 1", "div"},                                          0, false},
+    {"unused-assig",   {"pop rax", "push rax", "push rax", "pop $1", "pop rax"}, 1 << 3, true},
+    {"unused-out",     {"pop rax", "push rax", "push rax", "out",    "pop rax"}, 1 << 3, true},
+    {"dead-rax-load",  {"push $1", "pop rax"},                                     0, true },
+    {"dead-rax-copy",  {"pop rax", "push rax"},                                    0, true },
+    {"jump-to-next",   {"jmp $1", "$1:"},                                     1 << 1, false},
+};
+
+static const size_t RULES_CNT = sizeof (RULES) / sizeof (RULES[0]);
+
+enum class arg_match_t
+{
+    EXACT,
+    CAPTURE,
+};
+
+/// Pattern line parsed to typed form once per optimize call
+struct pattern_insn_t
+{
+    asm_kind_t     kind;
+    isa::opcode_t  opcode;
+    arg_match_t    match;
+    isa::operand_t arg;
+    int            capture;
+};
+
+struct compiled_rule_t
+{
+    pattern_insn_t insns[MAX_PATTERN_LEN];
+    int len;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_rule       (const peephole_rule_t *rule, compiled_rule_t *compiled);
+static void parse_pattern_arg  (const char *text, pattern_insn_t *insn);
+static bool match_rule         (const peephole_rule_t *rule, const compiled_rule_t *compiled,
+                                        const asm_code_t *code, size_t start, size_t *matched);
+static bool is_rax_dead        (const asm_code_t *code, size_t start);
+static bool is_block_end       (const asm_insn_t *insn);
+static unsigned int remove_unreachable (asm_code_t *code);
+
+static inline bool is_visible (const asm_insn_t *insn)
+{
+    return !insn->deleted && insn->kind != asm_kind_t::NOTE;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+unsigned int peephole::optimize (asm_code_t *code, FILE *report)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    compiled_rule_t compiled[RULES_CNT] = {};
+    for (size_t r = 0; r < RULES_CNT; ++r) {
+        compile_rule (&RULES[r], &compiled[r]);
+    }
+
+    unsigned int hits[RULES_CNT] = {};
+    unsigned int unreachable     = 0;
+    unsigned int removed         = 0;
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        for (size_t i = 0; i < code->size; ++i)
+        {
+            if (!is_visible (&code->insns[i])) { continue; }
+
+            for (size_t r = 0; r < RULES_CNT; ++r)
+            {
+                size_t matched[MAX_PATTERN_LEN] = {};
+                if (!match_rule (&RULES[r], &compiled[r], code, i, matched)) { continue; }
+
+                for (int k = 0; k < compiled[r].len; ++k)
+                {
+                    if (!(RULES[r].keep & (1u << k)))
+                    {
+                        code->insns[matched[k]].deleted = true;
+                        removed++;
+                    }
+                }
+
+                hits[r]++;
+                changed = true;
+                break;
+            }
+        }
+
+        unsigned int cnt = remove_unreachable (code);
+        unreachable += cnt;
+        removed     += cnt;
+        if (cnt > 0) { changed = true; }
+    }
+
+    if (report != nullptr)
+    {
+        fprintf (report, "peephole:\n");
+        for (size_t r = 0; r < RULES_CNT; ++r) {
+            fprintf (report, "  %-16s %6u\n", RULES[r].name, hits[r]);
+        }
+        fprintf (report, "  %-16s %6u\n", "unreachable", unreachable);
+        fprintf (report, "  removed %u instruction(s)\n", removed);
+    }
+
+    return removed;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static void compile_rule (const peephole_rule_t *rule, compiled_rule_t *compiled)
+{
+    assert (rule     != nullptr && "invalid pointer");
+    assert (compiled != nullptr && "invalid pointer");
+
+    char opcode[MAX_PATTERN_TOKEN] = "";
+    char arg   [MAX_PATTERN_TOKEN] = "";
+
+    for (compiled->len = 0; compiled->len < MAX_PATTERN_LEN; compiled->len++)
+    {
+        const char *text = rule->pattern[compiled->len];
+        if (text == nullptr) { break; }
+
+        pattern_insn_t *insn = &compiled->insns[compiled->len];
+        size_t len = strlen (text);
+
+        if (text[len - 1] == ':')
+        {
+            assert (len < MAX_PATTERN_TOKEN && "Too long pattern");
+            strncpy (arg, text, len - 1);
+            arg[len - 1] = '\0';
+
+            insn->kind = asm_kind_t::LABEL;
+            parse_pattern_arg (arg, insn);
+            continue;
+        }
+
+        arg[0] = '\0';
+        int read = sscanf (text, "%15s %15s", opcode, arg);
+        assert (read >= 1 && "Empty pattern line");
+
+        insn->kind   = asm_kind_t::INSN;
+        insn->opcode = isa::find_opcode (opcode);
+        assert (insn->opcode != isa::opcode_t::NOP && "Unknown opcode in peephole rule");
+
+        parse_pattern_arg (arg, insn);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void parse_pattern_arg (const char *text, pattern_insn_t *insn)
+{
+    assert (text != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    insn->match = arg_match_t::EXACT;
+
+    if (text[0] == '\0')
+    {
+        insn->arg = {};
+    }
+    else if (text[0] == '$')
+    {
+        insn->match   = arg_match_t::CAPTURE;
+        insn->capture = text[1] - '1';
+        assert (0 <= insn->capture && insn->capture < MAX_CAPTURES && "Invalid wildcard");
+    }
+    else if (isa::find_reg (text) != -1)
+    {
+        insn->arg = isa::reg ((isa::reg_t) isa::find_reg (text));
+    }
+    else
+    {
+        insn->arg = isa::imm (atoi (text));
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool match_rule (const peephole_rule_t *rule, const compiled_rule_t *compiled,
+                                        const asm_code_t *code, size_t start, size_t *matched)
+{
+    assert (rule     != nullptr && "invalid pointer");
+    assert (compiled != nullptr && "invalid pointer");
+    assert (code     != nullptr && "invalid pointer");
+    assert (matched  != nullptr && "invalid pointer");
+
+    isa::operand_t captures[MAX_CAPTURES] = {};
+    size_t pos = start;
+
+    for (int k = 0; k < compiled->len; ++k)
+    {
+        while (pos < code->size && !is_visible (&code->insns[pos])) pos++;
+        if (pos == code->size) { return false; }
+
+        const pattern_insn_t *pattern = &compiled->insns[k];
+        const asm_insn_t     *insn    = &code->insns[pos];
+
+        if (pattern->kind != insn->kind) { return false; }
+        if (pattern->kind == asm_kind_t::INSN && pattern->opcode != insn->opcode) { return false; }
+
+        if (pattern->match == arg_match_t::EXACT)
+        {
+            if (!isa::operand_eq (&pattern->arg, &insn->arg)) { return false; }
+        }
+        else
+        {
+            isa::operand_t *capture = &captures[pattern->capture];
+
+            if (insn->arg.type == isa::operand_type_t::NONE) { return false; }
+
+            if (capture->type == isa::operand_type_t::NONE) {
+                *capture = insn->arg;
+            } else if (!isa::operand_eq (capture, &insn->arg)) {
+                return false;
+            }
+        }
+
+        matched[k] = pos++;
+    }
+
+    return !rule->rax_dead || is_rax_dead (code, pos);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief rax is scratch register and never lives across basic block border,
+ *        so it is dead if it's overwritten or block ends before the next read.
+ */
+static bool is_rax_dead (const asm_code_t *code, size_t start)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    for (size_t i = start; i < code->size; ++i)
+    {
+        const asm_insn_t *insn = &code->insns[i];
+        if (!is_visible (insn)) { continue; }
+
+        if (insn->kind == asm_kind_t::LABEL || isa::is_jump (insn->opcode) || is_block_end (insn) ||
+            insn->opcode == isa::opcode_t::CALL) {
+            return true;
+        }
+
+        bool uses_rax = (insn->arg.type == isa::operand_type_t::REG ||
+                         insn->arg.type == isa::operand_type_t::MEM_REG) &&
+                         insn->arg.reg  == isa::reg_t::RAX;
+
+        if (uses_rax) {
+            return insn->opcode == isa::opcode_t::POP && insn->arg.type == isa::operand_type_t::REG;
+        }
+
+        // Only mov overwrites its register operand without reading it
+        if (isa::is_reg_form (insn->opcode) && insn->reg == isa::reg_t::RAX) {
+            return insn->opcode == isa::opcode_t::MOV;
+        }
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool is_block_end (const asm_insn_t *insn)
+{
+    assert (insn != nullptr && "invalid pointer");
+
+    return insn->kind == asm_kind_t::INSN && (insn->opcode == isa::opcode_t::JMP ||
+                                              insn->opcode == isa::opcode_t::RET ||
+                                              insn->opcode == isa::opcode_t::HALT);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static unsigned int remove_unreachable (asm_code_t *code)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    unsigned int removed = 0;
+    bool reachable = true;
+
+    for (size_t i = 0; i < code->size; ++i)
+    {
+        asm_insn_t *insn = &code->insns[i];
+        if (!is_visible (insn)) { continue; }
+
+        if (insn->kind == asm_kind_t::LABEL)
+        {
+            reachable = true;
+        }
+        else if (!reachable)
+        {
+            insn->deleted = true;
+            removed++;
+        }
+        else if (is_block_end (insn))
+        {
+            reachable = false;
+        }
+    }
+
+    return removed;
+}
@@ -0,0 +1,35 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include "asm_code.h"
+
+const int MAX_PATTERN_LEN = 6;
+
+/**
+ * @brief Pattern line is "opcode arg" or "label:". Arg may be a wildcard $1..$3, all its
+ *        occurrences in one pattern must match the same text. Comments and blank lines are
+ *        invisible for matcher, labels are not: rule never crosses a basic block border.
+ */
+struct peephole_rule_t
+{
+    const char *name;
+    const char *pattern[MAX_PATTERN_LEN];
+
+    unsigned int keep;      ///< Bit mask of matched lines that survive, others are removed
+    bool rax_dead;          ///< Rule is valid only if rax is not read after the match
+};
+
+namespace peephole
+{
+    /**
+     * @brief      Apply rules until fixpoint. Removed lines are only marked deleted.
+     *
+     * @param      report  If not nullptr, per rule hits are printed here
+     *
+     * @return     Number of removed instructions
+     */
+    unsigned int optimize (asm_code_t *code, FILE *report);
+}
+
+#endif
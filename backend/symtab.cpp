@@ -0,0 +1,273 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "symtab.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const size_t DEFAULT_MAP_CAPACITY     = 64;
+const int    DEFAULT_SYMBOLS_CAPACITY = 32;
+const int    DEFAULT_SCOPES_CAPACITY  = 8;
+
+// -------------------------------------------------------------------------------------------------
+
+static size_t find_entry (const int_map_t *map, int64_t key);
+static bool   rehash     (int_map_t *map);
+
+static bool grow (void **array, int *capacity, int cnt, size_t elem_size);
+
+static inline size_t hash (int64_t key)
+{
+    // Fibonacci hashing spreads both small names and aligned pointers
+    return (size_t) (((uint64_t) key * 0x9E3779B97F4A7C15ull) >> 17);
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+void int_map::ctor (int_map_t *map)
+{
+    assert (map != nullptr && "invalid pointer");
+
+    map->entries  = (int_map_entry_t *) calloc (DEFAULT_MAP_CAPACITY, sizeof (int_map_entry_t));
+    map->size     = 0;
+    map->capacity = DEFAULT_MAP_CAPACITY;
+    map->oom      = (map->entries == nullptr);
+}
+
+void int_map::dtor (int_map_t *map)
+{
+    assert (map != nullptr && "invalid pointer");
+
+    free (map->entries);
+    *map = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void int_map::set (int_map_t *map, int64_t key, int value)
+{
+    assert (map != nullptr && "invalid pointer");
+
+    if (map->oom) { return; }
+
+    // Load factor stays below 1/2, so probe sequences are short
+    if (2 * (map->size + 1) > map->capacity && !rehash (map))
+    {
+        map->oom = true;
+        return;
+    }
+
+    int_map_entry_t *entry = &map->entries[find_entry (map, key)];
+
+    if (!entry->used)
+    {
+        entry->used = true;
+        entry->key  = key;
+        map->size++;
+    }
+
+    entry->value = value;
+}
+
+int int_map::get (const int_map_t *map, int64_t key, int dflt)
+{
+    assert (map != nullptr && "invalid pointer");
+
+    if (map->entries == nullptr) { return dflt; }
+
+    const int_map_entry_t *entry = &map->entries[find_entry (map, key)];
+
+    return entry->used ? entry->value : dflt;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void symtab::ctor (symtab_t *table)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    int_map::ctor (&table->visible);
+
+    table->symbols          = (symbol_t *) calloc (DEFAULT_SYMBOLS_CAPACITY, sizeof (symbol_t));
+    table->symbols_cnt      = 0;
+    table->symbols_capacity = DEFAULT_SYMBOLS_CAPACITY;
+
+    table->scopes           = (scope_t *) calloc (DEFAULT_SCOPES_CAPACITY, sizeof (scope_t));
+    table->depth            = 0;
+    table->scopes_capacity  = DEFAULT_SCOPES_CAPACITY;
+
+    table->oom = table->visible.oom || table->symbols == nullptr || table->scopes == nullptr;
+}
+
+void symtab::dtor (symtab_t *table)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    int_map::dtor (&table->visible);
+    free (table->symbols);
+    free (table->scopes);
+
+    *table = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void symtab::push_scope (symtab_t *table, scope_kind_t kind)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    // Scope is pushed even on OOM, so that pops stay balanced
+    if (!grow ((void **) &table->scopes, &table->scopes_capacity, table->depth, sizeof (scope_t)))
+    {
+        table->oom = true;
+        table->depth++;
+        return;
+    }
+
+    table->scopes[table->depth++] = {kind, table->symbols_cnt, 0};
+}
+
+int symtab::pop_scope (symtab_t *table)
+{
+    assert (table != nullptr && "invalid pointer");
+    assert (table->depth > 0 && "Pop of empty scope stack");
+
+    table->depth--;
+    if (table->oom) { return 0; }
+
+    const scope_t *scope = &table->scopes[table->depth];
+
+    // Symbols of already popped children are not visible, so only ours are restored
+    for (int i = table->symbols_cnt - 1; i >= scope->first_symbol; --i)
+    {
+        const symbol_t *symbol = &table->symbols[i];
+
+        if (int_map::get (&table->visible, symbol->name, -1) == i) {
+            int_map::set (&table->visible, symbol->name, symbol->shadowed);
+        }
+    }
+
+    return scope->kind == scope_kind_t::BLOCK ? 0 : scope->frame_size;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int symtab::define (symtab_t *table, int name)
+{
+    assert (table != nullptr && "invalid pointer");
+    assert (table->depth > 0 && "Define outside of any scope");
+
+    if (table->oom) { return -1; }
+
+    scope_t *scope    = &table->scopes[table->depth - 1];
+    int      existing = int_map::get (&table->visible, name, -1);
+
+    if (existing >= scope->first_symbol) { return existing; }
+
+    scope_t *frame = scope;
+    while (frame->kind == scope_kind_t::BLOCK)
+    {
+        assert (frame > table->scopes && "Block outside of frame scope");
+        frame--;
+    }
+
+    if (!grow ((void **) &table->symbols, &table->symbols_capacity, table->symbols_cnt, sizeof (symbol_t)))
+    {
+        table->oom = true;
+        return -1;
+    }
+
+    int index = table->symbols_cnt++;
+    table->symbols[index] = {name, frame->frame_size++, frame->kind == scope_kind_t::FUNCTION, existing};
+
+    int_map::set (&table->visible, name, index);
+    table->oom = table->visible.oom;
+
+    return table->oom ? -1 : index;
+}
+
+int symtab::lookup (const symtab_t *table, int name)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    return int_map::get (&table->visible, name, -1);
+}
+
+const symbol_t *symtab::get (const symtab_t *table, int index)
+{
+    assert (table != nullptr && "invalid pointer");
+    assert (0 <= index && index < table->symbols_cnt && "Invalid symbol index");
+
+    return &table->symbols[index];
+}
+
+void symtab::set_slot (symtab_t *table, int index, int slot)
+{
+    assert (table != nullptr && "invalid pointer");
+    assert (0 <= index && index < table->symbols_cnt && "Invalid symbol index");
+    assert (slot >= 0 && "Invalid slot");
+
+    table->symbols[index].slot = slot;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+/// @return Index of entry with key or of empty entry where it should be inserted
+static size_t find_entry (const int_map_t *map, int64_t key)
+{
+    assert (map != nullptr && "invalid pointer");
+
+    size_t mask = map->capacity - 1;
+    size_t i    = hash (key) & mask;
+
+    while (map->entries[i].used && map->entries[i].key != key) {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+static bool rehash (int_map_t *map)
+{
+    assert (map != nullptr && "invalid pointer");
+
+    int_map_t new_map = {};
+    new_map.capacity  = 2 * map->capacity;
+    new_map.entries   = (int_map_entry_t *) calloc (new_map.capacity, sizeof (int_map_entry_t));
+    if (new_map.entries == nullptr) { return false; }
+
+    for (size_t i = 0; i < map->capacity; ++i)
+    {
+        if (!map->entries[i].used) { continue; }
+
+        new_map.entries[find_entry (&new_map, map->entries[i].key)] = map->entries[i];
+        new_map.size++;
+    }
+
+    free (map->entries);
+    *map = new_map;
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Make room for one more element
+static bool grow (void **array, int *capacity, int cnt, size_t elem_size)
+{
+    assert (array    != nullptr && "invalid pointer");
+    assert (capacity != nullptr && "invalid pointer");
+
+    if (cnt < *capacity) { return true; }
+
+    void *new_array = realloc (*array, 2 * (size_t) *capacity * elem_size);
+    if (new_array == nullptr) { return false; }
+
+    *array     = new_array;
+    *capacity *= 2;
+
+    return true;
+}
@@ -0,0 +1,107 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct int_map_entry_t
+{
+    int64_t key;
+    int     value;
+    bool    used;
+};
+
+/// Open addressing hash map from integer key to int, keys are never removed
+struct int_map_t
+{
+    int_map_entry_t *entries;
+    size_t size;
+    size_t capacity;        ///< Power of two
+
+    bool oom;
+};
+
+namespace int_map
+{
+    void ctor (int_map_t *map);
+    void dtor (int_map_t *map);
+
+    /// Insert or overwrite. On OOM map is marked broken and value is lost
+    void set (int_map_t *map, int64_t key, int value);
+
+    /// @return value by key or dflt if there is no such key
+    int  get (const int_map_t *map, int64_t key, int dflt);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+enum class scope_kind_t
+{
+    GLOBAL,
+    FUNCTION,
+    BLOCK,              ///< Takes slots from enclosing frame, no syntax opens it yet
+};
+
+struct symbol_t
+{
+    int  name;
+    int  slot;          ///< Index of cell in globals or in function frame
+    bool local;         ///< Slot is relative to frame base
+
+    int  shadowed;      ///< Symbol hidden by this one, -1 if none
+};
+
+struct scope_t
+{
+    scope_kind_t kind;
+    int first_symbol;   ///< Symbols from this index are defined in scope or its children
+    int frame_size;     ///< Used slots, counted only in GLOBAL and FUNCTION scopes
+};
+
+/**
+ * @brief Scope stack with O(1) lookup of visible symbol by name. Symbols outlive their
+ *        scopes, so index returned by define/lookup stays valid until dtor.
+ */
+struct symtab_t
+{
+    int_map_t visible;  ///< Name to index of visible symbol, -1 once it goes out of scope
+
+    symbol_t *symbols;
+    int symbols_cnt;
+    int symbols_capacity;
+
+    scope_t *scopes;
+    int depth;
+    int scopes_capacity;
+
+    bool oom;
+};
+
+namespace symtab
+{
+    void ctor (symtab_t *table);
+    void dtor (symtab_t *table);
+
+    void push_scope (symtab_t *table, scope_kind_t kind);
+
+    /// @return Frame size of popped scope, 0 for block
+    int  pop_scope  (symtab_t *table);
+
+    /**
+     * @brief Define name in the innermost scope. Repeated definition in the same scope
+     *        returns existing symbol, definition in inner scope shadows outer one.
+     *
+     * @return Symbol index or -1 on OOM
+     */
+    int  define (symtab_t *table, int name);
+
+    /// @return Index of visible symbol or -1 if name is not defined
+    int  lookup (const symtab_t *table, int name);
+
+    const symbol_t *get (const symtab_t *table, int index);
+
+    /// Move symbol to another slot of the same frame, e.g. one shared with dead variable
+    void set_slot (symtab_t *table, int index, int slot);
+}
+
+#endif
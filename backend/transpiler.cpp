@@ -0,0 +1,1185 @@
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/common.h"
+#include "../lib/func_table.h"
+#include "../lib/log.h"
+#include "native.h"
+#include "transpiler.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const int DEFAULT_SCOPE_CAPACITY = 16;
+const int INDENT_WIDTH           = 4;
+
+static const char *HEADER =
+    "/* Generated by ReverseLang backend, build with `cc -O2 <file> -lm` */\n"
+    "\n"
+    "#include <math.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "\n";
+
+/// Runtime of generated program, error messages are the same as in native executables
+static const char *PRELUDE =
+    "static _Noreturn void rl_fail (const char *msg)\n"
+    "{\n"
+    "    fflush (stdout);\n"
+    "    fprintf (stderr, \"Runtime error: %s\\n\", msg);\n"
+    "    exit (255);\n"
+    "}\n"
+    "\n"
+    "/* Arithmetic wraps on 32 bits as in vm, signed overflow is undefined in C */\n"
+    "static int rl_add (int a, int b) { return (int) ((unsigned) a + (unsigned) b); }\n"
+    "static int rl_sub (int a, int b) { return (int) ((unsigned) a - (unsigned) b); }\n"
+    "static int rl_mul (int a, int b) { return (int) ((unsigned) a * (unsigned) b); }\n"
+    "\n"
+    "static int rl_div (int a, int b)\n"
+    "{\n"
+    "    if (b == 0)  { rl_fail (\"division by zero\"); }\n"
+    "    if (b == -1) { return (int) (0u - (unsigned) a); }\n"
+    "    return a / b;\n"
+    "}\n"
+    "\n"
+    "static int rl_sqrt (int a)\n"
+    "{\n"
+    "    if (a < 0) { rl_fail (\"sqrt of negative number\"); }\n"
+    "    return (int) sqrt ((double) a);\n"
+    "}\n"
+    "\n"
+    "static int rl_sin (int a) { return (int) sin ((double) a); }\n"
+    "static int rl_cos (int a) { return (int) cos ((double) a); }\n"
+    "\n"
+    "static int rl_input (void)\n"
+    "{\n"
+    "    int val = 0;\n"
+    "    if (scanf (\"%d\", &val) != 1) { rl_fail (\"failed to read input\"); }\n"
+    "    return val;\n"
+    "}\n"
+    "\n"
+    "static int rl_output (int val)\n"
+    "{\n"
+    "    printf (\"%d\\n\", val);\n"
+    "    return val;\n"
+    "}\n"
+    "\n"
+    "/* Bytes of stack native executable would take for active calls, it fails at the same depth */\n"
+    "static long rl_stack = 0;\n"
+    "\n"
+    "static void rl_enter (int frame)\n"
+    "{\n"
+    "    rl_stack += frame;\n"
+    "    if (rl_stack > RL_STACK_LIMIT) { rl_fail (\"call stack overflow\"); }\n"
+    "}\n"
+    "\n"
+    "static void rl_leave (int frame) { rl_stack -= frame; }\n"
+    "\n";
+
+// -------------------------------------------------------------------------------------------------
+
+struct scope_t
+{
+    int *names;
+    int  size;
+    int  capacity;
+};
+
+/// Value of expression: pure subtree printed inline, temporary or constant zero
+struct operand_t
+{
+    const tree::node_t *pure;
+    int temp;                   ///< Negative if there is no temporary
+};
+
+struct transpiler_t
+{
+    FILE *out;                  ///< Current function body or main
+
+    FILE  *main_stream;
+    char  *main_buf;
+    size_t main_size;
+
+    FILE  *funcs_stream;
+    char  *funcs_buf;
+    size_t funcs_size;
+
+    func_table_t funcs;
+    char **func_names;
+    unsigned int func_names_cnt;
+
+    scope_t globals;
+    scope_t locals;
+    bool    in_func;
+    int     func_params;        ///< Tail call to function with as many params reuses native frame
+
+    int indent;
+    int temps_cnt;
+
+    bool oom;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ctor (transpiler_t *tr, tree::node_t *ast);
+static void dtor (transpiler_t *tr);
+
+static bool emit_stmt      (transpiler_t *tr, tree::node_t *node);
+static bool emit_value     (transpiler_t *tr, tree::node_t *node, operand_t *res);
+static bool emit_op        (transpiler_t *tr, tree::node_t *node, operand_t *res);
+static bool emit_binary    (transpiler_t *tr, tree::node_t *node, operand_t *lhs, operand_t *rhs);
+static bool emit_logic_op  (transpiler_t *tr, tree::node_t *node, operand_t *res);
+static bool emit_call      (transpiler_t *tr, tree::node_t *node, operand_t *res,
+                                                                   bool tail = false);
+static bool emit_if        (transpiler_t *tr, tree::node_t *node);
+static bool emit_while     (transpiler_t *tr, tree::node_t *node);
+static bool emit_func_def  (transpiler_t *tr, tree::node_t *node);
+static int  emit_params    (transpiler_t *tr, tree::node_t *node);
+static bool emit_return    (transpiler_t *tr, tree::node_t *node);
+static bool emit_block     (transpiler_t *tr, tree::node_t *node);
+static bool collect_args   (transpiler_t *tr, tree::node_t *node, tree::node_t **args,
+                                                                   int capacity, int *count);
+
+static bool is_pure        (const tree::node_t *node);
+static bool write_pure     (transpiler_t *tr, const tree::node_t *node);
+static bool write_operand  (transpiler_t *tr, const operand_t *op);
+static bool write_var      (transpiler_t *tr, int number);
+static void write_func     (transpiler_t *tr, FILE *stream, int func);
+static bool materialize    (transpiler_t *tr, operand_t *op);
+static int  new_temp       (transpiler_t *tr);
+
+__attribute__((format (printf, 2, 3)))
+static void line   (transpiler_t *tr, const char *fmt, ...);
+static void indent (transpiler_t *tr);
+
+static void register_var (transpiler_t *tr, int number);
+static bool find_var     (transpiler_t *tr, int number, bool *local, int *slot);
+static bool write_output (transpiler_t *tr, FILE *stream);
+
+// -------------------------------------------------------------------------------------------------
+
+#define TRY(cond)       \
+{                       \
+    if (!(cond))        \
+    {                   \
+        return false;   \
+    }                   \
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+bool transpiler::compile (tree::node_t *ast, FILE *stream, char **func_names,
+                                                             unsigned int func_names_cnt)
+{
+    assert (ast    != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    transpiler_t tr = {};
+    if (!ctor (&tr, ast))
+    {
+        LOG (log::ERR, "Failed to allocate transpiler");
+        dtor (&tr);
+        return false;
+    }
+
+    tr.func_names     = func_names;
+    tr.func_names_cnt = func_names_cnt;
+
+    bool success = emit_stmt (&tr, ast);
+
+    if (tr.oom)
+    {
+        LOG (log::ERR, "Failed to allocate memory for C code");
+        success = false;
+    }
+
+    success = success && write_output (&tr, stream);
+
+    dtor (&tr);
+    return success;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static bool ctor (transpiler_t *tr, tree::node_t *ast)
+{
+    assert (tr  != nullptr && "invalid pointer");
+    assert (ast != nullptr && "invalid pointer");
+
+    *tr = {};
+
+    tr->globals.capacity = DEFAULT_SCOPE_CAPACITY;
+    tr->locals.capacity  = DEFAULT_SCOPE_CAPACITY;
+    tr->globals.names    = (int *) calloc ((size_t) tr->globals.capacity, sizeof (int));
+    tr->locals.names     = (int *) calloc ((size_t) tr->locals.capacity,  sizeof (int));
+
+    tr->main_stream  = open_memstream (&tr->main_buf,  &tr->main_size);
+    tr->funcs_stream = open_memstream (&tr->funcs_buf, &tr->funcs_size);
+
+    if (tr->globals.names == nullptr || tr->locals.names  == nullptr ||
+        tr->main_stream   == nullptr || tr->funcs_stream == nullptr)
+    {
+        return false;
+    }
+
+    tr->out    = tr->main_stream;
+    tr->indent = 1;
+
+    return func_table::ctor (&tr->funcs, ast) != ERROR;
+}
+
+static void dtor (transpiler_t *tr)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    if (tr->main_stream  != nullptr) { fclose (tr->main_stream);  }
+    if (tr->funcs_stream != nullptr) { fclose (tr->funcs_stream); }
+
+    free (tr->main_buf);
+    free (tr->funcs_buf);
+    free (tr->globals.names);
+    free (tr->locals.names);
+    func_table::dtor (&tr->funcs);
+
+    *tr = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool emit_stmt (transpiler_t *tr, tree::node_t *node)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return true;
+    }
+
+    operand_t value = {nullptr, -1};
+
+    switch (node->type)
+    {
+        case tree::node_type_t::FICTIOUS:
+            TRY (emit_stmt (tr, node->left));
+            TRY (emit_stmt (tr, node->right));
+            break;
+
+        case tree::node_type_t::VAL:
+        case tree::node_type_t::VAR:
+            break;
+
+        case tree::node_type_t::VAR_DEF:
+            register_var (tr, node->data);
+            break;
+
+        case tree::node_type_t::OP:
+            // Result of pure expression is unused, it can't fail either
+            if (is_pure (node)) { break; }
+
+            #pragma GCC diagnostic push
+            #pragma GCC diagnostic ignored "-Wswitch-enum"
+            switch ((tree::op_t) node->data)
+            {
+                case tree::op_t::ASSIG:
+                    TRY (emit_value (tr, node->right, &value));
+                    indent (tr);
+                    TRY (write_var (tr, node->left->data));
+                    fprintf (tr->out, " = ");
+                    TRY (write_operand (tr, &value));
+                    fprintf (tr->out, ";\n");
+                    break;
+
+                case tree::op_t::OUTPUT:
+                    TRY (emit_value (tr, node->right, &value));
+                    indent (tr);
+                    fprintf (tr->out, "rl_output (");
+                    TRY (write_operand (tr, &value));
+                    fprintf (tr->out, ");\n");
+                    break;
+
+                case tree::op_t::INPUT:
+                    line (tr, "rl_input ();");
+                    break;
+
+                default:
+                    TRY (emit_value (tr, node, &value));
+                    break;
+            }
+            #pragma GCC diagnostic pop
+            break;
+
+        case tree::node_type_t::IF:
+            TRY (emit_if (tr, node));
+            break;
+
+        case tree::node_type_t::WHILE:
+            TRY (emit_while (tr, node));
+            break;
+
+        case tree::node_type_t::FUNC_DEF:
+            TRY (emit_func_def (tr, node));
+            break;
+
+        case tree::node_type_t::FUNC_CALL:
+            TRY (emit_call (tr, node, nullptr));
+            break;
+
+        case tree::node_type_t::RETURN:
+            TRY (emit_return (tr, node));
+            break;
+
+        case tree::node_type_t::ELSE:
+            assert (0 && "Already compiled in IF node");
+            return false;
+
+        case tree::node_type_t::NOT_SET:
+            assert (0 && "Invalid node");
+            return false;
+
+        default:
+            LOG (log::ERR, "Node type: %d\n", node->type);
+            assert (0 && "Unexpected node");
+            return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Emit statements computing node, res tells how to read the value. Pure
+ *             subtrees are not emitted at all, they are printed inline where used.
+ */
+static bool emit_value (transpiler_t *tr, tree::node_t *node, operand_t *res)
+{
+    assert (tr  != nullptr && "invalid pointer");
+    assert (res != nullptr && "invalid pointer");
+
+    *res = {nullptr, -1};
+
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (is_pure (node))
+    {
+        res->pure = node;
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::OP) {
+        return emit_op (tr, node, res);
+    }
+
+    if (node->type == tree::node_type_t::FUNC_CALL) {
+        return emit_call (tr, node, res);
+    }
+
+    // Statements have no value, bytecode leaves garbage there
+    return emit_stmt (tr, node);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define UNARY_CALL(func)                                        \
+    TRY (emit_value (tr, node->right, &rhs));                   \
+    res->temp = new_temp (tr);                                  \
+    indent (tr);                                                \
+    fprintf (tr->out, "int t%d = " func " (", res->temp);       \
+    TRY (write_operand (tr, &rhs));                             \
+    fprintf (tr->out, ");\n");
+
+#define BINARY(prefix, infix, suffix)                           \
+    TRY (emit_binary (tr, node, &lhs, &rhs));                   \
+    res->temp = new_temp (tr);                                  \
+    indent (tr);                                                \
+    fprintf (tr->out, "int t%d = " prefix, res->temp);          \
+    TRY (write_operand (tr, &lhs));                             \
+    fprintf (tr->out, infix);                                   \
+    TRY (write_operand (tr, &rhs));                             \
+    fprintf (tr->out, suffix ";\n");
+
+/// Impure operator, result goes to new temporary
+static bool emit_op (transpiler_t *tr, tree::node_t *node, operand_t *res)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (res  != nullptr && "invalid pointer");
+
+    operand_t lhs = {nullptr, -1};
+    operand_t rhs = {nullptr, -1};
+
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD: BINARY ("rl_add (", ", ",   ")"); break;
+        case tree::op_t::SUB: BINARY ("rl_sub (", ", ",   ")"); break;
+        case tree::op_t::MUL: BINARY ("rl_mul (", ", ",   ")"); break;
+        case tree::op_t::DIV: BINARY ("rl_div (", ", ",   ")"); break;
+        case tree::op_t::EQ:  BINARY ("(",        " == ", ")"); break;
+        case tree::op_t::GT:  BINARY ("(",        " > ",  ")"); break;
+        case tree::op_t::LT:  BINARY ("(",        " < ",  ")"); break;
+        case tree::op_t::GE:  BINARY ("(",        " >= ", ")"); break;
+        case tree::op_t::LE:  BINARY ("(",        " <= ", ")"); break;
+        case tree::op_t::NEQ: BINARY ("(",        " != ", ")"); break;
+
+        case tree::op_t::SQRT:   UNARY_CALL ("rl_sqrt");   break;
+        case tree::op_t::SIN:    UNARY_CALL ("rl_sin");    break;
+        case tree::op_t::COS:    UNARY_CALL ("rl_cos");    break;
+        case tree::op_t::OUTPUT: UNARY_CALL ("rl_output"); break;
+        case tree::op_t::NOT:    UNARY_CALL ("!");         break;
+
+        case tree::op_t::INPUT:
+            res->temp = new_temp (tr);
+            line (tr, "int t%d = rl_input ();", res->temp);
+            break;
+
+        case tree::op_t::ASSIG:
+            TRY (emit_value (tr, node->right, &rhs));
+            res->temp = new_temp (tr);
+            indent (tr);
+            fprintf (tr->out, "int t%d = (", res->temp);
+            TRY (write_var (tr, node->left->data));
+            fprintf (tr->out, " = ");
+            TRY (write_operand (tr, &rhs));
+            fprintf (tr->out, ");\n");
+            break;
+
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+            TRY (emit_logic_op (tr, node, res));
+            break;
+
+        default:
+            assert (0 && "Unexpected op type");
+            return false;
+    }
+
+    return true;
+}
+
+#undef UNARY_CALL
+#undef BINARY
+
+// -------------------------------------------------------------------------------------------------
+
+/// Left operand is read before right one runs its side effects, as in bytecode
+static bool emit_binary (transpiler_t *tr, tree::node_t *node, operand_t *lhs, operand_t *rhs)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+
+    TRY (emit_value (tr, node->left, lhs));
+
+    if (!is_pure (node->right)) {
+        TRY (materialize (tr, lhs));
+    }
+
+    TRY (emit_value (tr, node->right, rhs));
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Value of AND/OR with side effects in right operand, it runs only if left doesn't decide
+static bool emit_logic_op (transpiler_t *tr, tree::node_t *node, operand_t *res)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (res  != nullptr && "invalid pointer");
+
+    bool is_and = ((tree::op_t) node->data == tree::op_t::AND);
+
+    operand_t lhs = {nullptr, -1};
+    operand_t rhs = {nullptr, -1};
+
+    res->temp = new_temp (tr);
+    line (tr, "int t%d = %d;", res->temp, is_and ? 0 : 1);
+
+    TRY (emit_value (tr, node->left, &lhs));
+    indent (tr);
+    fprintf (tr->out, is_and ? "if (" : "if (!(");
+    TRY (write_operand (tr, &lhs));
+    fprintf (tr->out, is_and ? ")\n" : "))\n");
+
+    line (tr, "{");
+    tr->indent++;
+
+    TRY (emit_value (tr, node->right, &rhs));
+    indent (tr);
+    fprintf (tr->out, "t%d = (", res->temp);
+    TRY (write_operand (tr, &rhs));
+    fprintf (tr->out, " != 0);\n");
+
+    tr->indent--;
+    line (tr, "}");
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// @param res  Nullable for call as a statement
+/// Tail call leaves frame of caller before callee enters its own, as native executable does
+static bool emit_call (transpiler_t *tr, tree::node_t *node, operand_t *res, bool tail)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::FUNC_CALL && "Invalid call");
+
+    const tree::node_t *def = func_table::get_def (&tr->funcs, node->data);
+    if (def == nullptr)
+    {
+        LOG (log::ERR, "Call of undefined function %d", node->data);
+        return false;
+    }
+
+    int params = func_table::count_args (def);
+    int count  = 0;
+
+    tree::node_t **args = (tree::node_t **) calloc ((size_t) params + 1, sizeof (tree::node_t *));
+    operand_t     *ops  = (operand_t *)     calloc ((size_t) params + 1, sizeof (operand_t));
+    bool success = (args != nullptr && ops != nullptr);
+
+    if (!success) { tr->oom = true; }
+
+    success = success && collect_args (tr, node->right, args, params, &count);
+
+    if (success && count != params)
+    {
+        LOG (log::ERR, "Function %d takes %d args, but %d given", node->data, params, count);
+        success = false;
+    }
+
+    // Values of earlier args are captured before side effects of later ones
+    for (int i = 0; success && i < count; ++i)
+    {
+        if (!is_pure (args[i]))
+        {
+            for (int j = 0; success && j < i; ++j) {
+                success = materialize (tr, &ops[j]);
+            }
+        }
+
+        success = success && emit_value (tr, args[i], &ops[i]);
+    }
+
+    if (success)
+    {
+        if (tail) {
+            line (tr, "rl_leave (rl_frame);");
+        }
+
+        indent (tr);
+
+        if (res != nullptr)
+        {
+            res->temp = new_temp (tr);
+            fprintf (tr->out, "int t%d = ", res->temp);
+        }
+
+        write_func (tr, tr->out, node->data);
+        fprintf (tr->out, " (");
+
+        for (int i = 0; success && i < count; ++i)
+        {
+            if (i > 0) { fprintf (tr->out, ", "); }
+            success = write_operand (tr, &ops[i]);
+        }
+
+        fprintf (tr->out, ");\n");
+    }
+
+    free (args);
+    free (ops);
+    return success;
+}
+
+static bool collect_args (transpiler_t *tr, tree::node_t *node, tree::node_t **args,
+                                                                  int capacity, int *count)
+{
+    assert (tr    != nullptr && "invalid pointer");
+    assert (args  != nullptr && "invalid pointer");
+    assert (count != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::FICTIOUS)
+    {
+        TRY (collect_args (tr, node->left,  args, capacity, count));
+        TRY (collect_args (tr, node->right, args, capacity, count));
+        return true;
+    }
+
+    // Array has room for declared params only, extra args are counted for the error message
+    if (*count < capacity) {
+        args[*count] = node;
+    }
+
+    (*count)++;
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool emit_if (transpiler_t *tr, tree::node_t *node)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::IF && "Invalid call");
+
+    operand_t cond = {nullptr, -1};
+    TRY (emit_value (tr, node->left, &cond));
+
+    indent (tr);
+    fprintf (tr->out, "if (");
+    TRY (write_operand (tr, &cond));
+    fprintf (tr->out, ")\n");
+
+    if (node->right->left != nullptr)
+    {
+        TRY (emit_block (tr, node->right->left));
+        line (tr, "else");
+    }
+
+    TRY (emit_block (tr, node->right->right));
+
+    return true;
+}
+
+static bool emit_while (transpiler_t *tr, tree::node_t *node)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::WHILE && "Invalid call");
+
+    if (is_pure (node->left))
+    {
+        indent (tr);
+        fprintf (tr->out, "while (");
+        TRY (write_pure (tr, node->left));
+        fprintf (tr->out, ")\n");
+
+        return emit_block (tr, node->right);
+    }
+
+    // Condition with side effects is recomputed inside the loop
+    line (tr, "while (1)");
+    line (tr, "{");
+    tr->indent++;
+
+    operand_t cond = {nullptr, -1};
+    TRY (emit_value (tr, node->left, &cond));
+
+    indent (tr);
+    fprintf (tr->out, "if (!(");
+    TRY (write_operand (tr, &cond));
+    fprintf (tr->out, ")) { break; }\n");
+
+    TRY (emit_stmt (tr, node->right));
+
+    tr->indent--;
+    line (tr, "}");
+
+    return true;
+}
+
+static bool emit_block (transpiler_t *tr, tree::node_t *node)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    line (tr, "{");
+    tr->indent++;
+
+    TRY (emit_stmt (tr, node));
+
+    tr->indent--;
+    line (tr, "}");
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Body goes to its own stream first: locals may be declared anywhere in it, but
+ *             all of them live until function end, so declarations are put on top.
+ */
+static bool emit_func_def (transpiler_t *tr, tree::node_t *node)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (node->type == tree::node_type_t::FUNC_DEF && "Invalid call");
+
+    if (tr->in_func)
+    {
+        LOG (log::ERR, "Nested function definitions are not supported");
+        return false;
+    }
+
+    char  *body      = nullptr;
+    size_t body_size = 0;
+
+    FILE *body_stream = open_memstream (&body, &body_size);
+    if (body_stream == nullptr)
+    {
+        tr->oom = true;
+        return false;
+    }
+
+    FILE *saved_out    = tr->out;
+    int   saved_indent = tr->indent;
+
+    tr->out         = body_stream;
+    tr->indent      = 1;
+    tr->in_func     = true;
+    tr->locals.size = 0;
+
+    int params = emit_params (tr, node->left);
+    tr->func_params = params;
+
+    bool success = emit_stmt (tr, node->right);
+
+    line (tr, "rl_fail (\"function ended without return\");");
+    fclose (body_stream);
+
+    tr->out    = saved_out;
+    tr->indent = saved_indent;
+
+    if (success)
+    {
+        FILE *funcs = tr->funcs_stream;
+
+        fprintf (funcs, "static int ");
+        write_func (tr, funcs, node->data);
+
+        fprintf (funcs, " (");
+        for (int i = 0; i < params; ++i) {
+            fprintf (funcs, "%sint l%d", i > 0 ? ", " : "", i);
+        }
+        fprintf (funcs, params == 0 ? "void)\n{\n" : ")\n{\n");
+
+        for (int i = params; i < tr->locals.size; ++i) {
+            fprintf (funcs, "%*sint l%d = 0;\n", INDENT_WIDTH, "", i);
+        }
+
+        // Args, return address, rbp and 16-aligned frame of native function
+        int frame = 8 * params + 16 + ((8 * tr->locals.size + 15) & ~15);
+
+        fprintf (funcs, "%*sconst int rl_frame = %d;\n", INDENT_WIDTH, "", frame);
+        fprintf (funcs, "%*srl_enter (rl_frame);\n\n",   INDENT_WIDTH, "");
+
+        fwrite (body, 1, body_size, funcs);
+        fprintf (funcs, "}\n\n");
+    }
+
+    free (body);
+
+    tr->in_func     = false;
+    tr->locals.size = 0;
+
+    return success;
+}
+
+static int emit_params (transpiler_t *tr, tree::node_t *node)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return 0;
+    }
+
+    if (node->type == tree::node_type_t::VAR)
+    {
+        register_var (tr, node->data);
+        return 1;
+    }
+
+    assert (node->type == tree::node_type_t::FICTIOUS && "Broken func def params subtree");
+
+    return emit_params (tr, node->left) + emit_params (tr, node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool emit_return (transpiler_t *tr, tree::node_t *node)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+
+    if (!tr->in_func)
+    {
+        TRY (emit_stmt (tr, node->right));
+        line (tr, "rl_fail (\"return outside of function\");");
+        return true;
+    }
+
+    operand_t value = {nullptr, -1};
+
+    tree::node_t       *call = node->right;
+    const tree::node_t *def  = (call != nullptr && call->type == tree::node_type_t::FUNC_CALL) ?
+                                        func_table::get_def (&tr->funcs, call->data) : nullptr;
+
+    if (def != nullptr && func_table::count_args (def) == tr->func_params)
+    {
+        TRY (emit_call (tr, call, &value, true));
+    }
+    else
+    {
+        TRY (emit_value (tr, node->right, &value));
+        line (tr, "rl_leave (rl_frame);");
+    }
+
+    indent (tr);
+    fprintf (tr->out, "return ");
+    TRY (write_operand (tr, &value));
+    fprintf (tr->out, ";\n");
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// No side effects and no runtime errors, so evaluation order doesn't matter
+static bool is_pure (const tree::node_t *node)
+{
+    if (node == nullptr) {
+        return true;
+    }
+
+    switch (node->type)
+    {
+        case tree::node_type_t::VAL:
+        case tree::node_type_t::VAR:
+            return true;
+
+        case tree::node_type_t::OP:
+            break;
+
+        case tree::node_type_t::NOT_SET:
+        case tree::node_type_t::FICTIOUS:
+        case tree::node_type_t::IF:
+        case tree::node_type_t::ELSE:
+        case tree::node_type_t::WHILE:
+        case tree::node_type_t::VAR_DEF:
+        case tree::node_type_t::FUNC_DEF:
+        case tree::node_type_t::FUNC_CALL:
+        case tree::node_type_t::RETURN:
+        default:
+            return false;
+    }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD:
+        case tree::op_t::SUB:
+        case tree::op_t::MUL:
+        case tree::op_t::EQ:
+        case tree::op_t::GT:
+        case tree::op_t::LT:
+        case tree::op_t::GE:
+        case tree::op_t::LE:
+        case tree::op_t::NEQ:
+        case tree::op_t::NOT:
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+        case tree::op_t::SIN:
+        case tree::op_t::COS:
+            return is_pure (node->left) && is_pure (node->right);
+
+        default:
+            return false;
+    }
+    #pragma GCC diagnostic pop
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define WRITE_BINARY(prefix, infix, suffix)         \
+    fprintf (tr->out, prefix);                      \
+    TRY (write_pure (tr, node->left));              \
+    fprintf (tr->out, infix);                       \
+    TRY (write_pure (tr, node->right));             \
+    fprintf (tr->out, suffix);
+
+#define WRITE_UNARY(prefix)                         \
+    fprintf (tr->out, prefix);                      \
+    TRY (write_pure (tr, node->right));             \
+    fprintf (tr->out, ")");
+
+static bool write_pure (transpiler_t *tr, const tree::node_t *node)
+{
+    assert (tr   != nullptr && "invalid pointer");
+    assert (node != nullptr && "invalid pointer");
+    assert (is_pure (node) && "Expression has side effects");
+
+    if (node->type == tree::node_type_t::VAL)
+    {
+        if (node->data == INT_MIN) {
+            fprintf (tr->out, "(-2147483647 - 1)");
+        } else {
+            fprintf (tr->out, node->data < 0 ? "(%d)" : "%d", node->data);
+        }
+
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::VAR) {
+        return write_var (tr, node->data);
+    }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD: WRITE_BINARY ("rl_add (", ", ",   ")"); break;
+        case tree::op_t::SUB: WRITE_BINARY ("rl_sub (", ", ",   ")"); break;
+        case tree::op_t::MUL: WRITE_BINARY ("rl_mul (", ", ",   ")"); break;
+        case tree::op_t::EQ:  WRITE_BINARY ("(",        " == ", ")"); break;
+        case tree::op_t::GT:  WRITE_BINARY ("(",        " > ",  ")"); break;
+        case tree::op_t::LT:  WRITE_BINARY ("(",        " < ",  ")"); break;
+        case tree::op_t::GE:  WRITE_BINARY ("(",        " >= ", ")"); break;
+        case tree::op_t::LE:  WRITE_BINARY ("(",        " <= ", ")"); break;
+        case tree::op_t::NEQ: WRITE_BINARY ("(",        " != ", ")"); break;
+        case tree::op_t::AND: WRITE_BINARY ("(",        " && ", ")"); break;
+        case tree::op_t::OR:  WRITE_BINARY ("(",        " || ", ")"); break;
+
+        case tree::op_t::NOT: WRITE_UNARY ("(!");        break;
+        case tree::op_t::SIN: WRITE_UNARY ("rl_sin (");  break;
+        case tree::op_t::COS: WRITE_UNARY ("rl_cos (");  break;
+
+        default:
+            assert (0 && "Not a pure op");
+            return false;
+    }
+    #pragma GCC diagnostic pop
+
+    return true;
+}
+
+#undef WRITE_BINARY
+#undef WRITE_UNARY
+
+// -------------------------------------------------------------------------------------------------
+
+static bool write_operand (transpiler_t *tr, const operand_t *op)
+{
+    assert (tr != nullptr && "invalid pointer");
+    assert (op != nullptr && "invalid pointer");
+
+    if (op->pure != nullptr) {
+        return write_pure (tr, op->pure);
+    }
+
+    if (op->temp >= 0) {
+        fprintf (tr->out, "t%d", op->temp);
+    } else {
+        fprintf (tr->out, "0");
+    }
+
+    return true;
+}
+
+static bool write_var (transpiler_t *tr, int number)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    bool local = false;
+    int  slot  = 0;
+
+    TRY (find_var (tr, number, &local, &slot));
+    fprintf (tr->out, local ? "l%d" : "g%d", slot);
+
+    return true;
+}
+
+/// Function index with its source name when that is a valid C identifier
+static void write_func (transpiler_t *tr, FILE *stream, int func)
+{
+    assert (tr     != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    fprintf (stream, "f%d", func);
+
+    if (tr->func_names == nullptr || func < 0 || (unsigned int) func >= tr->func_names_cnt ||
+        tr->func_names[func] == nullptr)
+    {
+        return;
+    }
+
+    for (const char *c = tr->func_names[func]; *c != '\0'; ++c)
+    {
+        if (!isalnum ((unsigned char) *c) && *c != '_') { return; }
+    }
+
+    fprintf (stream, "_%s", tr->func_names[func]);
+}
+
+/// Capture current value of operand that may be changed by following statements
+static bool materialize (transpiler_t *tr, operand_t *op)
+{
+    assert (tr != nullptr && "invalid pointer");
+    assert (op != nullptr && "invalid pointer");
+
+    if (op->pure == nullptr || op->pure->type == tree::node_type_t::VAL) {
+        return true;
+    }
+
+    int temp = new_temp (tr);
+
+    indent (tr);
+    fprintf (tr->out, "int t%d = ", temp);
+    TRY (write_pure (tr, op->pure));
+    fprintf (tr->out, ";\n");
+
+    *op = {nullptr, temp};
+    return true;
+}
+
+static int new_temp (transpiler_t *tr)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    return tr->temps_cnt++;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void line (transpiler_t *tr, const char *fmt, ...)
+{
+    assert (tr  != nullptr && "invalid pointer");
+    assert (fmt != nullptr && "invalid pointer");
+
+    indent (tr);
+
+    va_list args;
+    va_start (args, fmt);
+    vfprintf (tr->out, fmt, args);
+    va_end (args);
+
+    fputc ('\n', tr->out);
+}
+
+static void indent (transpiler_t *tr)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    fprintf (tr->out, "%*s", tr->indent * INDENT_WIDTH, "");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void register_var (transpiler_t *tr, int number)
+{
+    assert (tr != nullptr && "invalid pointer");
+
+    scope_t *scope = tr->in_func ? &tr->locals : &tr->globals;
+
+    if (scope->size == scope->capacity)
+    {
+        int *new_names = (int *) realloc (scope->names, 2 * (size_t) scope->capacity * sizeof (int));
+        if (new_names == nullptr)
+        {
+            tr->oom = true;
+            return;
+        }
+
+        scope->names     = new_names;
+        scope->capacity *= 2;
+    }
+
+    scope->names[scope->size++] = number;
+}
+
+/// Locals first, then globals, same lookup order as bytecode backend
+static bool find_var (transpiler_t *tr, int number, bool *local, int *slot)
+{
+    assert (tr    != nullptr && "invalid pointer");
+    assert (local != nullptr && "invalid pointer");
+    assert (slot  != nullptr && "invalid pointer");
+
+    for (int i = 0; i < tr->locals.size; ++i)
+    {
+        if (tr->locals.names[i] == number)
+        {
+            *local = true;
+            *slot  = i;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < tr->globals.size; ++i)
+    {
+        if (tr->globals.names[i] == number)
+        {
+            *local = false;
+            *slot  = i;
+            return true;
+        }
+    }
+
+    LOG (log::ERR, "FAILED to get var code %d", number);
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool write_output (transpiler_t *tr, FILE *stream)
+{
+    assert (tr     != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    if (fflush (tr->main_stream) != 0 || fflush (tr->funcs_stream) != 0)
+    {
+        tr->oom = true;
+        return false;
+    }
+
+    fputs   (HEADER, stream);
+    fprintf (stream, "#define RL_STACK_LIMIT %d\n\n", NATIVE_STACK_RESERVE);
+    fputs   (PRELUDE, stream);
+
+    for (int i = 0; i < tr->globals.size; ++i) {
+        fprintf (stream, "static int g%d;\n", i);
+    }
+    if (tr->globals.size > 0) {
+        fprintf (stream, "\n");
+    }
+
+    // Prototypes, functions may call each other in any order
+    for (unsigned int i = 0; i < tr->funcs.size; ++i)
+    {
+        const tree::node_t *def = func_table::get_def (&tr->funcs, (int) i);
+        if (def == nullptr) { continue; }
+
+        int params = func_table::count_args (def);
+
+        fprintf (stream, "static int ");
+        write_func (tr, stream, (int) i);
+        fprintf (stream, " (");
+        for (int j = 0; j < params; ++j) {
+            fprintf (stream, "%sint", j > 0 ? ", " : "");
+        }
+        fprintf (stream, params == 0 ? "void);\n" : ");\n");
+    }
+
+    fprintf (stream, "\n");
+    fwrite (tr->funcs_buf, 1, tr->funcs_size, stream);
+
+    fprintf (stream, "int main (void)\n{\n");
+    fwrite (tr->main_buf, 1, tr->main_size, stream);
+    fprintf (stream, "%*sreturn 0;\n}\n", INDENT_WIDTH, "");
+
+    return ferror (stream) == 0;
+}
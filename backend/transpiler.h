@@ -0,0 +1,22 @@
+#ifndef TRANSPILER_H
+#define TRANSPILER_H
+
+#include <stdio.h>
+#include "../lib/tree.h"
+
+namespace transpiler
+{
+    /**
+     * @brief      Translate AST to portable C: one static function per FUNC_DEF, locals as
+     *             C locals, globals as statics. Evaluation order and 32-bit wraparound follow
+     *             bytecode backend, runtime errors are reported like in native executables.
+     *             Build result with `cc -O2 file.c -lm`.
+     *
+     * @param      func_names  Nullable, used to make function names readable
+     *
+     * @return     false on unsupported AST (undefined function, arity mismatch) or OOM
+     */
+    bool compile (tree::node_t *ast, FILE *stream, char **func_names, unsigned int func_names_cnt);
+}
+
+#endif
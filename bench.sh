@@ -0,0 +1,26 @@
+#!/usr/bin/bash
+# VM throughput on examples. Usage: ./bench.sh [runs per example], expects `make bench` build
+
+RUNS=${1:-2000}
+VM=./bin/vm-release
+[ -x $VM ] || VM=./bin/vm
+
+mkdir -p /tmp/bench
+
+for name in fib fact; do
+    # No const-calls: it would evaluate pure calls like fact(5) at compile time, leaving nothing to run
+    ./bin/front   examples/$name.edoc     /tmp/bench/$name.ast     > /dev/null && \
+    ./bin/middle  --passes=const-fold /tmp/bench/$name.ast /tmp/bench/$name.opt.ast > /dev/null && \
+    ./bin/back    --emit=bin /tmp/bench/$name.opt.ast /tmp/bench/$name.bin    && \
+    ./bin/back    --emit=elf /tmp/bench/$name.opt.ast /tmp/bench/$name.elf    || exit 1
+
+    echo "== $name ($RUNS runs, $VM)"
+    yes 1 | $VM --stats --repeat=$RUNS /tmp/bench/$name.bin > /dev/null
+
+    echo "== $name ($RUNS runs, $VM --jit)"
+    yes 1 | $VM --jit --stats --repeat=$RUNS /tmp/bench/$name.bin > /dev/null
+
+    # Every native run is a separate process, so its startup is included
+    echo "== $name ($RUNS runs, native)"
+    time (for i in $(seq $RUNS); do yes 1 | head -n 16 | /tmp/bench/$name.elf > /dev/null; done)
+done
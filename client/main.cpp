@@ -0,0 +1,37 @@
+#include <cstdio>
+#include <string.h>
+#include "../lib/common.h"
+#include "../lib/server.h"
+
+// -------------------------------------------------------------------------------------------------
+
+int main (int argc, const char *argv[])
+{
+    // Client is started right after server in scripts, so it may wait for it to listen
+    bool wait = (argc >= 2 && strcmp (argv[1], "--wait") == 0);
+    if (wait)
+    {
+        argc--;
+        argv++;
+    }
+
+    if (argc != 4)
+    {
+        fprintf (stderr, "Usage: ./client [--wait] <socket> <input file> <output file>\n"
+                         "      Compile file on server started with --serve=<socket>\n"
+                         "      --wait  give just started server time to listen\n"
+                         "      Exit code is %d if nobody listens on socket\n", NO_SERVER);
+        return ERROR;
+    }
+
+    int res = server::request (argv[1], argv[2], argv[3], stdout, wait);
+
+    // Scripts probe for server without --wait and start it on NO_SERVER, that is not an error
+    if (res == NO_SERVER && wait) {
+        fprintf (stderr, "No server on %s\n", argv[1]);
+    } else if (res != 0 && res != NO_SERVER) {
+        fprintf (stderr, "Failed to compile %s on %s, see server log\n", argv[2], argv[1]);
+    }
+
+    return res;
+}
@@ -2,8 +2,32 @@
 
 mkdir -p /tmp/examples
 
-./bin/front        $1           /tmp/$1.ast         && \
-./bin/middle  /tmp/$1.ast       /tmp/$1.opt.ast     && \
-./bin/back    /tmp/$1.opt.ast   /tmp/$1.asm         && \
-./cpu/bin/asm /tmp/$1.asm       /tmp/$1.bin         && \
-./cpu/bin/cpu /tmp/$1.bin
\ No newline at end of file
+# Stages stay resident between runs, each one is started on first use
+SOCKETS=/tmp/edoc-servers
+NO_SERVER=3
+
+mkdir -p $SOCKETS
+
+# Usage: compile <server name> <input> <output> <stage> [stage flags]
+compile () {
+    local sock=$SOCKETS/$1.sock
+    local input=$2
+    local output=$3
+    shift 3
+
+    ./bin/client $sock $input $output
+    local res=$?
+
+    if [ $res -eq $NO_SERVER ]; then
+        nohup ./bin/$1 --serve=$sock "${@:2}" >> $SOCKETS/$1.log 2>&1 &
+        ./bin/client --wait $sock $input $output
+        res=$?
+    fi
+
+    return $res
+}
+
+compile front     $1                /tmp/$1.ast         front           && \
+compile middle    /tmp/$1.ast       /tmp/$1.opt.ast     middle          && \
+compile back      /tmp/$1.opt.ast   /tmp/$1.bin         back --emit=bin && \
+./bin/vm      /tmp/$1.bin
@@ -0,0 +1,83 @@
+#!/usr/bin/bash
+# Differential test of jit against vm, register lowering and memoization against plain stack code
+# and native executable against C translation on examples.
+# Usage: ./difftest.sh [files...]
+
+FILES=${@:-examples/*.edoc}
+
+mkdir -p /tmp/difftest
+
+failed=0
+
+for file in $FILES; do
+    name=/tmp/difftest/$(basename $file)
+
+    ./bin/front           $file          $name.ast     > /dev/null 2>&1 && \
+    ./bin/middle          $name.ast      $name.opt.ast > /dev/null 2>&1 && \
+    ./bin/back --emit=bin $name.opt.ast  $name.bin     > /dev/null 2>&1
+
+    if [ $? -ne 0 ]; then
+        echo "FAIL $file: compilation"
+        failed=1
+        continue
+    fi
+
+    # Same input for every example, programs read as many numbers as they need
+    if yes 3 | head -n 1000 | ./bin/vm --diff $name.bin > /dev/null 2> $name.log; then
+        echo "OK   $file"
+    elif grep -q mismatch $name.log; then
+        echo "FAIL $file: $(grep mismatch $name.log)"
+        failed=1
+    else
+        echo "OK   $file ($(cat $name.log))"
+    fi
+
+    # Register lowering must not change behaviour of the program
+    ./bin/back --regs --emit=bin $name.opt.ast $name.regs.bin > /dev/null 2>&1
+    stack_out=$(yes 3 | head -n 1000 | ./bin/vm $name.bin      2>&1 | sed 's/ at [0-9]*//')
+    regs_out=$(yes 3 | head -n 1000 | ./bin/vm $name.regs.bin 2>&1 | sed 's/ at [0-9]*//')
+
+    if [ "$stack_out" != "$regs_out" ]; then
+        echo "FAIL $file: --regs changes output"
+        failed=1
+    elif yes 3 | head -n 1000 | ./bin/vm --diff $name.regs.bin 2>&1 > /dev/null | grep -q mismatch; then
+        echo "FAIL $file: jit mismatch with --regs"
+        failed=1
+    else
+        echo "OK   $file (regs)"
+    fi
+
+    # Memoization must not change behaviour of the program either
+    ./bin/back --memoize --emit=bin $name.opt.ast $name.memo.bin > /dev/null 2>&1
+    memo_out=$(yes 3 | head -n 1000 | ./bin/vm $name.memo.bin 2>&1 | sed 's/ at [0-9]*//')
+
+    if [ "$stack_out" != "$memo_out" ]; then
+        echo "FAIL $file: --memoize changes output"
+        failed=1
+    else
+        echo "OK   $file (memoize)"
+    fi
+
+    # C translation is the reference for native code, both compute real cos unlike bytecode
+    ./bin/back --emit=elf $name.opt.ast $name.elf > /dev/null 2>&1 && \
+    ./bin/back --emit=c   $name.opt.ast $name.c   > /dev/null 2>&1 && \
+    cc -O2 -w $name.c -o $name.cexe -lm
+
+    if [ $? -ne 0 ]; then
+        echo "FAIL $file: native or C compilation"
+        failed=1
+        continue
+    fi
+
+    native=$(yes 3 | head -n 1000 | $name.elf  2>&1; echo "exit $?")
+    c_ref=$(yes 3 | head -n 1000 | $name.cexe 2>&1; echo "exit $?")
+
+    if [ "$native" == "$c_ref" ]; then
+        echo "OK   $file (native)"
+    else
+        echo "FAIL $file: native and C outputs differ"
+        failed=1
+    fi
+done
+
+exit $failed
@@ -0,0 +1,817 @@
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "../lib/common.h"
+#include "interp.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const size_t INTERP_MEMORY_SIZE     = 1 << 20;
+const size_t INTERP_ARGS_STACK_SIZE = 1 << 16;
+const size_t INTERP_STACK_SIZE      = 1 << 28;  // Eval recurses on native stack, it runs on own thread
+const size_t INTERP_STACK_RESERVE   = 1 << 20;  // Left for expressions of the deepest call
+const int    DEFAULT_SCOPE_CAPACITY = 16;
+
+/// AST node with variable resolved to memory slot
+struct inode_t
+{
+    tree::node_type_t type;
+    int data;
+
+    int  slot;      ///< VAR: cell index; FUNC_CALL: how far rdx moves, i.e. caller frame size
+    bool local;     ///< VAR: slot is relative to rdx
+
+    inode_t *left;
+    inode_t *right;
+};
+
+enum class exec_t
+{
+    OK = 0,
+    RETURN,
+    TAIL_CALL,      ///< Returned call, args are already in frame of function that returns
+    DIV_BY_ZERO,
+    NEGATIVE_SQRT,
+    BAD_ADDRESS,
+    INPUT_ERROR,
+    CALL_DEPTH,
+    ARGS_OVERFLOW,
+    NO_RETURN,
+    UNDEFINED_FUNC,
+};
+
+struct scope_t
+{
+    int *names;
+    int  size;
+    int  capacity;
+};
+
+struct interp_t
+{
+    inode_t *nodes;
+    size_t   nodes_cnt;
+
+    inode_t **funcs;        ///< FUNC_DEF node by function name index
+    int       funcs_cnt;
+
+    scope_t globals;
+    scope_t locals;
+    bool    in_func;
+
+    int   *memory;
+    int    rdx;
+    int   *args;
+    size_t args_top;
+    int    depth;
+    int    ret_val;
+    int    tail_func;       ///< Callee of TAIL_CALL
+
+    uintptr_t stack_limit;  ///< Calls fail when native stack gets below it
+
+    FILE *in;
+    FILE *out;
+
+    uint64_t counts[NODE_TYPES_CNT];
+    double   start_sec;
+    double   first_output_ms;
+};
+
+static const char *NODE_TYPE_NAMES[NODE_TYPES_CNT] =
+{
+    "FICTIOUS", "VAL", "VAR", "IF", "ELSE", "WHILE", "OP",
+    "VAR_DEF", "FUNC_DEF", "FUNC_CALL", "RETURN",
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static int  ctor (interp_t *interp, const tree::node_t *ast);
+static void dtor (interp_t *interp);
+
+static bool resolve        (interp_t *interp, const tree::node_t *node, inode_t **result);
+static bool resolve_params (interp_t *interp, const tree::node_t *node);
+static bool declare_var    (interp_t *interp, int name);
+static bool lookup_var     (interp_t *interp, int name, inode_t *inode);
+static int  max_func_id    (const tree::node_t *node);
+
+static exec_t eval      (interp_t *interp, const inode_t *node, int *val);
+static exec_t eval_op   (interp_t *interp, const inode_t *node, int *val);
+static exec_t eval_call (interp_t *interp, const inode_t *node, int *val);
+static exec_t eval_tail (interp_t *interp, const inode_t *node);
+static exec_t push_args (interp_t *interp, const inode_t *node);
+
+static exec_t eval_root   (interp_t *interp, const inode_t *root);
+static void  *eval_thread (void *job);
+
+static const char *exec_str (exec_t res);
+static double      now_sec  ();
+
+// -------------------------------------------------------------------------------------------------
+
+#define TRY(cond)       \
+{                       \
+    if (!(cond))        \
+    {                   \
+        return false;   \
+    }                   \
+}
+
+#define TRY_EXEC(expr)                  \
+{                                       \
+    exec_t _res = (expr);               \
+    if (_res != exec_t::OK) {           \
+        return _res;                    \
+    }                                   \
+}
+
+// Arithmetic wraps around as in VM
+#define WRAP(lhs, op, rhs) ((int) ((uint32_t) (lhs) op (uint32_t) (rhs)))
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int interp::run (const tree::node_t *ast, FILE *in, FILE *out, interp_stats_t *stats)
+{
+    assert (ast != nullptr && "invalid pointer");
+    assert (in  != nullptr && "invalid pointer");
+    assert (out != nullptr && "invalid pointer");
+
+    interp_t interp = {};
+
+    if (ctor (&interp, ast) == ERROR)
+    {
+        fprintf (stderr, "interp: out of memory\n");
+        return ERROR;
+    }
+
+    interp.in              = in;
+    interp.out             = out;
+    interp.start_sec       = (stats != nullptr) ? stats->start_sec : now_sec ();
+    interp.first_output_ms = -1;
+
+    inode_t *root = nullptr;
+    if (!resolve (&interp, ast, &root))
+    {
+        dtor (&interp);
+        return ERROR;
+    }
+
+    exec_t res = eval_root (&interp, root);
+
+    if (res == exec_t::RETURN || res == exec_t::TAIL_CALL) {
+        fprintf (stderr, "interp: return outside of function\n");
+    } else if (res != exec_t::OK) {
+        fprintf (stderr, "interp: %s\n", exec_str (res));
+    }
+
+    if (stats != nullptr)
+    {
+        memcpy (stats->node_counts, interp.counts, sizeof (interp.counts));
+        stats->first_output_ms = interp.first_output_ms;
+    }
+
+    dtor (&interp);
+    return (res == exec_t::OK) ? 0 : ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void interp::print_stats (const interp_stats_t *stats, FILE *stream)
+{
+    assert (stats  != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    uint64_t total = 0;
+
+    fprintf (stream, "Executed nodes:\n");
+
+    for (int i = 0; i < NODE_TYPES_CNT; ++i)
+    {
+        if (stats->node_counts[i] == 0) { continue; }
+
+        fprintf (stream, "  %-10s %12lu\n", NODE_TYPE_NAMES[i], stats->node_counts[i]);
+        total += stats->node_counts[i];
+    }
+
+    fprintf (stream, "  %-10s %12lu\n", "Total", total);
+
+    if (stats->first_output_ms >= 0) {
+        fprintf (stream, "First output after %.3lf ms\n", stats->first_output_ms);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static int ctor (interp_t *interp, const tree::node_t *ast)
+{
+    assert (interp != nullptr && "invalid pointer");
+    assert (ast    != nullptr && "invalid pointer");
+
+    // Nodes never move, so inode_t pointers stay valid
+    interp->nodes     = (inode_t *)  calloc ((size_t) tree::count_nodes (ast), sizeof (inode_t));
+    interp->funcs_cnt = max_func_id (ast) + 1;
+    interp->funcs     = (inode_t **) calloc ((size_t) interp->funcs_cnt + 1, sizeof (inode_t *));
+    interp->memory    = (int *)      calloc (INTERP_MEMORY_SIZE,     sizeof (int));
+    interp->args      = (int *)      calloc (INTERP_ARGS_STACK_SIZE, sizeof (int));
+
+    interp->globals = {(int *) calloc (DEFAULT_SCOPE_CAPACITY, sizeof (int)), 0, DEFAULT_SCOPE_CAPACITY};
+    interp->locals  = {(int *) calloc (DEFAULT_SCOPE_CAPACITY, sizeof (int)), 0, DEFAULT_SCOPE_CAPACITY};
+
+    if (interp->nodes  == nullptr || interp->funcs         == nullptr || interp->memory == nullptr ||
+        interp->args   == nullptr || interp->globals.names == nullptr || interp->locals.names == nullptr)
+    {
+        dtor (interp);
+        return ERROR;
+    }
+
+    return 0;
+}
+
+static void dtor (interp_t *interp)
+{
+    assert (interp != nullptr && "invalid pointer");
+
+    free (interp->nodes);
+    free (interp->funcs);
+    free (interp->memory);
+    free (interp->args);
+    free (interp->globals.names);
+    free (interp->locals.names);
+
+    *interp = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Copy tree with variables resolved. Nodes are visited in the order backend compiles
+ *        them, so declarations and frame sizes are the same as in compiled code.
+ */
+static bool resolve (interp_t *interp, const tree::node_t *node, inode_t **result)
+{
+    assert (interp != nullptr && "invalid pointer");
+    assert (result != nullptr && "invalid pointer");
+
+    *result = nullptr;
+    if (node == nullptr) { return true; }
+
+    inode_t *inode = &interp->nodes[interp->nodes_cnt++];
+    *inode  = {node->type, node->data, 0, false, nullptr, nullptr};
+    *result = inode;
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (node->type)
+    {
+        case tree::node_type_t::VAR:
+            return lookup_var (interp, node->data, inode);
+
+        case tree::node_type_t::VAR_DEF:
+            return declare_var (interp, node->data);
+
+        case tree::node_type_t::OP:
+            // Assigned value is compiled before its destination
+            if ((tree::op_t) node->data == tree::op_t::ASSIG)
+            {
+                TRY (resolve (interp, node->right, &inode->right));
+                TRY (resolve (interp, node->left,  &inode->left));
+                return true;
+            }
+            break;
+
+        case tree::node_type_t::FUNC_DEF:
+            if (node->data >= interp->funcs_cnt || interp->in_func)
+            {
+                fprintf (stderr, "interp: nested function definition\n");
+                return false;
+            }
+
+            interp->funcs[node->data] = inode;
+            interp->in_func     = true;
+            interp->locals.size = 0;
+
+            TRY (resolve_params (interp, node->left));
+            TRY (resolve (interp, node->right, &inode->right));
+
+            interp->in_func     = false;
+            interp->locals.size = 0;
+            return true;
+
+        case tree::node_type_t::FUNC_CALL:
+            inode->slot = interp->in_func ? interp->locals.size : interp->globals.size;
+            break;
+
+        default:
+            break;
+    }
+    #pragma GCC diagnostic pop
+
+    TRY (resolve (interp, node->left,  &inode->left));
+    TRY (resolve (interp, node->right, &inode->right));
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool resolve_params (interp_t *interp, const tree::node_t *node)
+{
+    assert (interp != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return true; }
+
+    if (node->type == tree::node_type_t::VAR) {
+        return declare_var (interp, node->data);
+    }
+
+    TRY (resolve_params (interp, node->left));
+    TRY (resolve_params (interp, node->right));
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool declare_var (interp_t *interp, int name)
+{
+    assert (interp != nullptr && "invalid pointer");
+
+    scope_t *scope = interp->in_func ? &interp->locals : &interp->globals;
+
+    if (scope->size == scope->capacity)
+    {
+        int *new_names = (int *) realloc (scope->names, 2 * (size_t) scope->capacity * sizeof (int));
+        if (new_names == nullptr)
+        {
+            fprintf (stderr, "interp: out of memory\n");
+            return false;
+        }
+
+        scope->names     = new_names;
+        scope->capacity *= 2;
+    }
+
+    scope->names[scope->size++] = name;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool lookup_var (interp_t *interp, int name, inode_t *inode)
+{
+    assert (interp != nullptr && "invalid pointer");
+    assert (inode  != nullptr && "invalid pointer");
+
+    for (int i = 0; i < interp->locals.size; ++i)
+    {
+        if (interp->locals.names[i] == name)
+        {
+            inode->slot  = i;
+            inode->local = true;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < interp->globals.size; ++i)
+    {
+        if (interp->globals.names[i] == name)
+        {
+            inode->slot  = i;
+            inode->local = false;
+            return true;
+        }
+    }
+
+    fprintf (stderr, "interp: undeclared variable #%d\n", name);
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int max_func_id (const tree::node_t *node)
+{
+    if (node == nullptr) { return -1; }
+
+    int max_id = -1;
+
+    if (node->type == tree::node_type_t::FUNC_DEF || node->type == tree::node_type_t::FUNC_CALL) {
+        max_id = node->data;
+    }
+
+    int left  = max_func_id (node->left);
+    int right = max_func_id (node->right);
+
+    if (left  > max_id) max_id = left;
+    if (right > max_id) max_id = right;
+
+    return max_id;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define CHECK_ADDR(addr)                                \
+    if ((uint32_t) (addr) >= INTERP_MEMORY_SIZE) {      \
+        return exec_t::BAD_ADDRESS;                     \
+    }
+
+static exec_t eval (interp_t *interp, const inode_t *node, int *val)
+{
+    assert (interp != nullptr && "invalid pointer");
+    assert (val    != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return exec_t::OK; }
+
+    interp->counts[(int) node->type]++;
+
+    int cond = 0;
+    int addr = 0;
+
+    switch (node->type)
+    {
+        case tree::node_type_t::FICTIOUS:
+            TRY_EXEC (eval (interp, node->left,  val));
+            TRY_EXEC (eval (interp, node->right, val));
+            return exec_t::OK;
+
+        case tree::node_type_t::VAL:
+            *val = node->data;
+            return exec_t::OK;
+
+        case tree::node_type_t::VAR:
+            addr = node->local ? WRAP (interp->rdx, +, node->slot) : node->slot;
+            CHECK_ADDR (addr);
+            *val = interp->memory[addr];
+            return exec_t::OK;
+
+        case tree::node_type_t::VAR_DEF:
+        case tree::node_type_t::FUNC_DEF:
+            return exec_t::OK;
+
+        case tree::node_type_t::OP:
+            return eval_op (interp, node, val);
+
+        case tree::node_type_t::IF:
+            TRY_EXEC (eval (interp, node->left, &cond));
+
+            if (node->right->left != nullptr) {
+                return eval (interp, cond ? node->right->left : node->right->right, val);
+            }
+
+            return cond ? eval (interp, node->right->right, val) : exec_t::OK;
+
+        case tree::node_type_t::WHILE:
+            while (true)
+            {
+                TRY_EXEC (eval (interp, node->left, &cond));
+                if (!cond) { return exec_t::OK; }
+
+                TRY_EXEC (eval (interp, node->right, val));
+            }
+
+        case tree::node_type_t::FUNC_CALL:
+            return eval_call (interp, node, val);
+
+        case tree::node_type_t::RETURN:
+            // Returned call reuses the frame, so tail recursion runs in a loop like compiled code
+            if (interp->depth > 0 && node->right != nullptr &&
+                node->right->type == tree::node_type_t::FUNC_CALL)
+            {
+                return eval_tail (interp, node->right);
+            }
+
+            TRY_EXEC (eval (interp, node->right, &interp->ret_val));
+            return exec_t::RETURN;
+
+        case tree::node_type_t::ELSE:
+            assert (0 && "Executed as part of IF");
+            return exec_t::OK;
+
+        case tree::node_type_t::NOT_SET:
+        default:
+            assert (0 && "Unexpected node");
+            return exec_t::OK;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define BINARY_OP(expr)                                     \
+{                                                           \
+    TRY_EXEC (eval (interp, node->left,  &lhs));            \
+    TRY_EXEC (eval (interp, node->right, &rhs));            \
+    *val = (expr);                                          \
+    return exec_t::OK;                                      \
+}
+
+static exec_t eval_op (interp_t *interp, const inode_t *node, int *val)
+{
+    assert (interp != nullptr && "invalid pointer");
+    assert (node   != nullptr && "invalid pointer");
+    assert (val    != nullptr && "invalid pointer");
+
+    int lhs  = 0;
+    int rhs  = 0;
+    int addr = 0;
+
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD: BINARY_OP (WRAP (lhs, +, rhs));
+        case tree::op_t::SUB: BINARY_OP (WRAP (lhs, -, rhs));
+        case tree::op_t::MUL: BINARY_OP (WRAP (lhs, *, rhs));
+        case tree::op_t::EQ:  BINARY_OP (lhs == rhs);
+        case tree::op_t::GT:  BINARY_OP (lhs >  rhs);
+        case tree::op_t::LT:  BINARY_OP (lhs <  rhs);
+        case tree::op_t::GE:  BINARY_OP (lhs >= rhs);
+        case tree::op_t::LE:  BINARY_OP (lhs <= rhs);
+        case tree::op_t::NEQ: BINARY_OP (lhs != rhs);
+
+        case tree::op_t::DIV:
+            TRY_EXEC (eval (interp, node->left,  &lhs));
+            TRY_EXEC (eval (interp, node->right, &rhs));
+            if (rhs == 0) { return exec_t::DIV_BY_ZERO; }
+
+            *val = (rhs == -1) ? WRAP (0, -, lhs) : lhs / rhs;
+            return exec_t::OK;
+
+        case tree::op_t::SQRT:
+            TRY_EXEC (eval (interp, node->right, &rhs));
+            if (rhs < 0) { return exec_t::NEGATIVE_SQRT; }
+
+            *val = (int) sqrt ((double) rhs);
+            return exec_t::OK;
+
+        case tree::op_t::SIN:
+            TRY_EXEC (eval (interp, node->right, &rhs));
+            *val = (int) sin ((double) rhs);
+            return exec_t::OK;
+
+        case tree::op_t::COS:
+            TRY_EXEC (eval (interp, node->right, &rhs));
+            *val = (int) cos ((double) rhs);
+            return exec_t::OK;
+
+        case tree::op_t::NOT:
+            TRY_EXEC (eval (interp, node->right, &rhs));
+            *val = !rhs;
+            return exec_t::OK;
+
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+        {
+            bool is_and = ((tree::op_t) node->data == tree::op_t::AND);
+
+            TRY_EXEC (eval (interp, node->left, &lhs));
+            if ((lhs != 0) != is_and)
+            {
+                *val = !is_and;
+                return exec_t::OK;
+            }
+
+            TRY_EXEC (eval (interp, node->right, &rhs));
+            *val = (rhs != 0);
+            return exec_t::OK;
+        }
+
+        case tree::op_t::INPUT:
+            if (fscanf (interp->in, "%d", val) != 1) { return exec_t::INPUT_ERROR; }
+            return exec_t::OK;
+
+        case tree::op_t::OUTPUT:
+            TRY_EXEC (eval (interp, node->right, val));
+            fprintf (interp->out, "%d\n", *val);
+
+            if (interp->first_output_ms < 0)
+            {
+                fflush (interp->out);
+                interp->first_output_ms = (now_sec () - interp->start_sec) * 1e3;
+            }
+            return exec_t::OK;
+
+        case tree::op_t::ASSIG:
+            TRY_EXEC (eval (interp, node->right, val));
+
+            addr = node->left->local ? WRAP (interp->rdx, +, node->left->slot) : node->left->slot;
+            CHECK_ADDR (addr);
+            interp->memory[addr] = *val;
+            return exec_t::OK;
+
+        default:
+            assert (0 && "Unexpected op");
+            return exec_t::OK;
+    }
+}
+
+#undef BINARY_OP
+
+// -------------------------------------------------------------------------------------------------
+
+static exec_t eval_call (interp_t *interp, const inode_t *node, int *val)
+{
+    assert (interp != nullptr && "invalid pointer");
+    assert (node   != nullptr && "invalid pointer");
+    assert (val    != nullptr && "invalid pointer");
+
+    if (node->data >= interp->funcs_cnt || interp->funcs[node->data] == nullptr) {
+        return exec_t::UNDEFINED_FUNC;
+    }
+
+    if ((uintptr_t) __builtin_frame_address (0) < interp->stack_limit) {
+        return exec_t::CALL_DEPTH;
+    }
+
+    // All args are evaluated in caller frame before the first one is stored
+    size_t base = interp->args_top;
+    TRY_EXEC (push_args (interp, node->right));
+
+    int frame = WRAP (interp->rdx, +, node->slot);
+
+    for (size_t i = base; i < interp->args_top; ++i)
+    {
+        int addr = WRAP (frame, +, (int) (i - base));
+        CHECK_ADDR (addr);
+        interp->memory[addr] = interp->args[i];
+    }
+
+    interp->args_top = base;
+
+    int saved_rdx = interp->rdx;
+    interp->rdx = frame;
+    interp->depth++;
+
+    exec_t res = eval (interp, interp->funcs[node->data]->right, val);
+
+    while (res == exec_t::TAIL_CALL) {
+        res = eval (interp, interp->funcs[interp->tail_func]->right, val);
+    }
+
+    interp->depth--;
+    interp->rdx = saved_rdx;
+
+    if (res == exec_t::RETURN)
+    {
+        *val = interp->ret_val;
+        return exec_t::OK;
+    }
+
+    return (res == exec_t::OK) ? exec_t::NO_RETURN : res;
+}
+
+/// Like call, but args go over the current frame and the callee is run by eval_call loop
+static exec_t eval_tail (interp_t *interp, const inode_t *node)
+{
+    assert (interp != nullptr && "invalid pointer");
+    assert (node   != nullptr && "invalid pointer");
+
+    interp->counts[(int) node->type]++;
+
+    if (node->data >= interp->funcs_cnt || interp->funcs[node->data] == nullptr) {
+        return exec_t::UNDEFINED_FUNC;
+    }
+
+    // All args are evaluated before the first one is stored, so old param values are still valid
+    size_t base = interp->args_top;
+    TRY_EXEC (push_args (interp, node->right));
+
+    for (size_t i = base; i < interp->args_top; ++i)
+    {
+        int addr = WRAP (interp->rdx, +, (int) (i - base));
+        CHECK_ADDR (addr);
+        interp->memory[addr] = interp->args[i];
+    }
+
+    interp->args_top  = base;
+    interp->tail_func = node->data;
+
+    return exec_t::TAIL_CALL;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static exec_t push_args (interp_t *interp, const inode_t *node)
+{
+    assert (interp != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return exec_t::OK; }
+
+    if (node->type == tree::node_type_t::FICTIOUS)
+    {
+        TRY_EXEC (push_args (interp, node->left));
+        TRY_EXEC (push_args (interp, node->right));
+        return exec_t::OK;
+    }
+
+    int val = 0;
+    TRY_EXEC (eval (interp, node, &val));
+
+    if (interp->args_top == INTERP_ARGS_STACK_SIZE) {
+        return exec_t::ARGS_OVERFLOW;
+    }
+
+    interp->args[interp->args_top++] = val;
+    return exec_t::OK;
+}
+
+#undef CHECK_ADDR
+
+// -------------------------------------------------------------------------------------------------
+
+struct eval_job_t
+{
+    interp_t      *interp;
+    const inode_t *root;
+    size_t         stack_size;
+    exec_t         res;
+};
+
+/**
+ * @brief      Run program on a thread with INTERP_STACK_SIZE stack. Call depth is limited by
+ *             the stack left, not by a fixed count. Without the thread program runs on the
+ *             calling one within its stack rlimit.
+ */
+static exec_t eval_root (interp_t *interp, const inode_t *root)
+{
+    assert (interp != nullptr && "invalid pointer");
+
+    eval_job_t job = {interp, root, INTERP_STACK_SIZE, exec_t::OK};
+
+    pthread_attr_t attr = {};
+    pthread_t      thread = {};
+
+    bool started = pthread_attr_init (&attr) == 0;
+    started = started && pthread_attr_setstacksize (&attr, INTERP_STACK_SIZE) == 0 &&
+                         pthread_create (&thread, &attr, eval_thread, &job)   == 0;
+
+    pthread_attr_destroy (&attr);
+
+    if (started)
+    {
+        pthread_join (thread, nullptr);
+        return job.res;
+    }
+
+    struct rlimit limit = {};
+    if (getrlimit (RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        job.stack_size = limit.rlim_cur;
+    }
+
+    eval_thread (&job);
+    return job.res;
+}
+
+static void *eval_thread (void *job_ptr)
+{
+    assert (job_ptr != nullptr && "invalid pointer");
+
+    eval_job_t *job  = (eval_job_t *) job_ptr;
+    uintptr_t   base = (uintptr_t) __builtin_frame_address (0);
+
+    job->interp->stack_limit = (job->stack_size > INTERP_STACK_RESERVE) ?
+                               base - (job->stack_size - INTERP_STACK_RESERVE) : base;
+
+    int val = 0;
+    job->res = eval (job->interp, job->root, &val);
+
+    return nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static const char *exec_str (exec_t res)
+{
+    switch (res)
+    {
+        case exec_t::OK:             return "ok";
+        case exec_t::RETURN:         return "return";
+        case exec_t::TAIL_CALL:      return "return";
+        case exec_t::DIV_BY_ZERO:    return "division by zero";
+        case exec_t::NEGATIVE_SQRT:  return "sqrt of negative number";
+        case exec_t::BAD_ADDRESS:    return "memory access out of bounds";
+        case exec_t::INPUT_ERROR:    return "failed to read input";
+        case exec_t::CALL_DEPTH:     return "call depth limit exceeded";
+        case exec_t::ARGS_OVERFLOW:  return "too many pending call arguments";
+        case exec_t::NO_RETURN:      return "function ended without return";
+        case exec_t::UNDEFINED_FUNC: return "call of undefined function";
+
+        default:
+            assert (0 && "Unexpected result");
+            return "unknown";
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static double now_sec ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,35 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../lib/tree.h"
+
+const int NODE_TYPES_CNT = (int) tree::node_type_t::RETURN + 1;
+
+struct interp_stats_t
+{
+    uint64_t node_counts[NODE_TYPES_CNT];   ///< Executions of each node type
+
+    double start_sec;           ///< Set by caller, first output time is measured from it
+    double first_output_ms;     ///< Negative if program printed nothing
+};
+
+namespace interp
+{
+    /**
+     * @brief      Execute AST directly. Variables are resolved to memory slots before the run
+     *             with the same frame model as backend: globals are [i], locals are [rdx+i],
+     *             call moves rdx by the caller's frame size, returned call reuses the frame.
+     *             Arithmetic wraps on 32-bit ints.
+     *
+     * @param      stats  Nullable
+     *
+     * @return     0 or ERROR on runtime error (reported to stderr)
+     */
+    int run (const tree::node_t *ast, FILE *in, FILE *out, interp_stats_t *stats);
+
+    void print_stats (const interp_stats_t *stats, FILE *stream);
+}
+
+#endif
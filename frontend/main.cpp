@@ -1,17 +1,26 @@
 #include <cassert>
 #include <cstdio>
 #include <string.h>
+#include <time.h>
+#include "../lib/batch.h"
+#include "../lib/cache.h"
 #include "../lib/file.h"
 #include "../lib/log.h"
+#include "../lib/server.h"
 #include "../lib/common.h"
 #include "lexer.h"
 #include "syntax_parser.h"
 #include "frontend.h"
 #include "codegen.h"
+#include "interp.h"
 
 // -------------------------------------------------------------------------------------------------
+static int     compile_file (const char *input, const char *output, bool reverse, bool dump_ast);
+static int        batch_job (const char *input, const char *output, const void *);
 static int  direct_frontend (const file_t *input_file, FILE *output_file);
 static int reverse_frontend (const file_t *input_file, FILE *output_file);
+static int   interp_frontend (const file_t *input_file, bool print_stats, double start_sec);
+static double        now_sec ();
 // -------------------------------------------------------------------------------------------------
 
 #define ERR_CASE(cond, fmt, ...)                    \
@@ -26,10 +35,56 @@ static int reverse_frontend (const file_t *input_file, FILE *output_file);
 
 int main (int argc, const char* argv[])
 {
+    double start_sec = now_sec ();
+
+    batch_opts_t batch = {};
+    int batch_flags = batch::parse_flags (argc, argv, &batch);
+
+    if (batch_flags != 0)
+    {
+        ERR_CASE (batch_flags == ERROR || argc != 1 + batch_flags,
+                        "Usage: ./front --batch=<manifest> [--jobs=<n>] | --serve=<socket>");
+
+        if (batch.socket != nullptr) {
+            return server::serve (batch.socket, batch_job, nullptr);
+        }
+
+        return batch::run (&batch, batch_job, nullptr);
+    }
+
+    if (argc >= 3 && strcmp (argv[1], "-i") == 0)
+    {
+        bool print_stats = (argc == 4 && strcmp (argv[2], "--stats") == 0);
+        ERR_CASE (argc != 3 && !print_stats, "Usage: ./front -i [--stats] <input file>");
+
+        file_t input_file = open_ro_file (argv[argc - 1]);
+        ERR_CASE (input_file.content == nullptr, "Failed to open file %s", argv[argc - 1]);
+
+        int res = interp_frontend (&input_file, print_stats, start_sec);
+
+        unmap_ro_file (input_file);
+        return res;
+    }
+
+    // Rendering of dumps takes longer than compilation, so they are opt-in
+    bool dump_ast = (argc >= 2 && strcmp (argv[1], "--dump") == 0);
+    if (dump_ast)
+    {
+        argc--;
+        argv++;
+    }
+
     if ((argc != 3 && argc != 4) || strcmp (argv[1], "-h") == 0)
     {
-        fprintf (stderr, "Usage: ./front (-r) <input file> <output file>\n");
+        fprintf (stderr, "Usage: ./front [--dump] (-r) <input file> <output file>\n");
+        fprintf (stderr, "       ./front -i [--stats] <input file>\n");
+        fprintf (stderr, "       ./front --batch=<manifest> [--jobs=<n>]\n");
+        fprintf (stderr, "       ./front --serve=<socket>\n");
+        fprintf (stderr, "      --dump to draw AST into dump/ with graphviz\n");
         fprintf (stderr, "      -r for reverse codegen from ast dump\n");
+        fprintf (stderr, "      -i to interpret program without compilation, stdin/stdout are used\n");
+        fprintf (stderr, "      --batch to compile each \"<input> <output>\" line of manifest in parallel\n");
+        fprintf (stderr, "      --serve to stay resident and compile files sent by bin/client\n");
         return ERROR;
     }
 
@@ -38,25 +93,63 @@ int main (int argc, const char* argv[])
         flag_cnt = 1;
     }
 
-    file_t input_file = open_ro_file (argv[1+flag_cnt]);
-    ERR_CASE (input_file.content == nullptr, "Failed to open file %s", argv[1]);
+    tree::enable_graph_dumps (dump_ast);
+
+    int res = compile_file (argv[1+flag_cnt], argv[2+flag_cnt], flag_cnt == 1, dump_ast);
+
+    // Batch render at exit, dot processes run in parallel and never delay the output file
+    tree::render_graph_dumps ();
 
-    FILE *output_file = fopen (argv[2+flag_cnt], "w");
-    ERR_CASE (output_file == nullptr, "Failed to open file %s", argv[2]);
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int compile_file (const char *input, const char *output, bool reverse, bool dump_ast)
+{
+    assert (input  != nullptr && "invalid pointer");
+    assert (output != nullptr && "invalid pointer");
+
+    file_t input_file = open_ro_file (input);
+    ERR_CASE (input_file.content == nullptr, "Failed to open file %s", input);
+
+    // Only source to AST is cached, dumps need the real AST
+    cache_t cache = {};
+    if (!reverse && !dump_ast) {
+        cache::ctor (&cache, "front", nullptr, 0, input_file.content, input_file.size);
+    }
 
-    int res = 15; // random poison value
+    if (cache::fetch (&cache, output))
+    {
+        unmap_ro_file (input_file);
+        return 0;
+    }
 
-    if (flag_cnt == 0) {
-        res = direct_frontend  (&input_file, output_file);
-    } else {
-        res = reverse_frontend (&input_file, output_file);
+    FILE *output_file = fopen (output, "w");
+    if (output_file == nullptr)
+    {
+        unmap_ro_file (input_file);
+        ERR_CASE (true, "Failed to open file %s", output);
     }
 
+    int res = reverse ? reverse_frontend (&input_file, output_file) :
+                        direct_frontend  (&input_file, output_file);
+
     fclose (output_file);
     unmap_ro_file (input_file);
+
+    if (res == 0) {
+        cache::store (&cache, output);
+    }
+
     return res;
 }
 
+static int batch_job (const char *input, const char *output, const void *)
+{
+    return compile_file (input, output, false, false);
+}
+
 // -------------------------------------------------------------------------------------------------
 
 static int direct_frontend (const file_t *input_file, FILE *output_file)
@@ -105,4 +198,51 @@ static int reverse_frontend (const file_t *input_file, FILE *output_file)
     program::dtor (&prog);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int interp_frontend (const file_t *input_file, bool print_stats, double start_sec)
+{
+    assert (input_file != nullptr && "invalid pointer");
+
+    // Program output owns stdout
+    set_log_stream (stderr);
+
+    program_t prog = {};
+    program::ctor (&prog);
+
+    if (program::tokenize (input_file->content, input_file->size, &prog) != 0) {
+        ERR_CASE (true, "Failed to tokenise input file");
+    }
+
+    if (program::parse_into_ast (&prog) == ERROR) {
+        program::dtor (&prog);
+        ERR_CASE (true, "Failed to parse input file into AST");
+    }
+
+    interp_stats_t stats = {};
+    stats.start_sec = start_sec;
+
+    int res = interp::run (prog.ast, stdin, stdout, &stats);
+    fflush (stdout);
+
+    if (print_stats) {
+        interp::print_stats (&stats, stderr);
+    }
+
+    tree::del_node (prog.ast);
+    program::dtor (&prog);
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static double now_sec ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
@@ -29,11 +29,12 @@ using tree::op_t;
 
 // -------------------------------------------------------------------------------------------------
 
+// Parse trace is compiled out of release builds, see LOG_MIN_LEVEL
 #define PREPARE()                       \
     assert ( input_token != nullptr);   \
     assert (*input_token != nullptr);   \
                                         \
-    printf ("Called %s\n", __func__); \
+    LOG (log::DBG, "Called %s", __func__); \
     token_t *token      = *input_token; \
     tree::node_t *node  = nullptr;      \
     
@@ -41,9 +42,7 @@ using tree::op_t;
 #define SUCCESS()               \
 {                               \
     *input_token = token;       \
-    printf ("success in %s with last node on line %d: ", __func__, token->line);\
-    program::print_token_func (token, stdout);          \
-    printf ("\n");              \
+    LOG (log::DBG, "success in %s with last node on line %d", __func__, token->line); \
     return node;                \
 }
 
@@ -63,8 +62,8 @@ using tree::op_t;
     if (!(expr))                \
     {                           \
         LOG (log::INF, "Syntax error on line %d: expected " #expr, token->line) \
-        program::print_token_func (token, stdout);                              \
-        printf ("\n");          \
+        program::print_token_func (token, get_log_stream ());                   \
+        fprintf (get_log_stream (), "\n");                                      \
         del_node (node);        \
         EXTRA_CLEAR_ON_ERROR(); \
         return nullptr;         \
@@ -0,0 +1,35 @@
+#!/usr/bin/bash
+# Startup-to-first-output latency: `front -i` against front -> middle -> back -> vm.
+# Usage: ./latency.sh [examples...]
+
+EXAMPLES=${@:-examples/fib.edoc examples/fact.edoc examples/quad.edoc}
+
+mkdir -p /tmp/latency
+
+now_us () { echo $(( $(date +%s%N) / 1000 )); }
+
+# Prints microseconds from start until the first line appears on stdin
+first_line_us () {
+    read -r line
+    echo $(( $(now_us) - $1 ))
+    cat > /dev/null
+}
+
+pipeline () {
+    local name=/tmp/latency/$(basename $1)
+
+    ./bin/front           $1               $name.ast     > /dev/null 2>&1 && \
+    ./bin/middle          $name.ast        $name.opt.ast > /dev/null 2>&1 && \
+    ./bin/back --emit=bin $name.opt.ast    $name.bin     > /dev/null 2>&1 && \
+    ./bin/vm              $name.bin
+}
+
+for file in $EXAMPLES; do
+    start=$(now_us)
+    interp=$(yes 1 | ./bin/front -i $file 2> /dev/null | first_line_us $start)
+
+    start=$(now_us)
+    compiled=$(yes 1 | pipeline $file | first_line_us $start)
+
+    printf "%-24s interp %8d us    pipeline %8d us\n" $file $interp $compiled
+done
@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "file.h"
+#include "log.h"
+#include "pool.h"
+#include "batch.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const char BATCH_FLAG[] = "--batch=";
+const char JOBS_FLAG[]  = "--jobs=";
+const char SERVE_FLAG[] = "--serve=";
+
+struct batch_entry_t
+{
+    const char *input;
+    const char *output;
+};
+
+struct batch_t
+{
+    char *manifest;             ///< Copy of manifest, entries point into it
+
+    batch_entry_t *entries;
+    int entries_cnt;
+
+    batch_job_f job;
+    const void *ctx;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static bool   load_manifest (batch_t *batch, const char *path);
+static bool   run_entry     (void *batch_ptr, int index);
+static double now_sec       ();
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int batch::parse_flags (int argc, const char *argv[], batch_opts_t *opts)
+{
+    assert (argv != nullptr && "invalid pointer");
+    assert (opts != nullptr && "invalid pointer");
+
+    *opts = {};
+
+    int consumed = 0;
+
+    for (; 1 + consumed < argc; ++consumed)
+    {
+        const char *flag = argv[1 + consumed];
+
+        if (strncmp (flag, BATCH_FLAG, sizeof (BATCH_FLAG) - 1) == 0)
+        {
+            opts->manifest = flag + sizeof (BATCH_FLAG) - 1;
+        }
+        else if (strncmp (flag, SERVE_FLAG, sizeof (SERVE_FLAG) - 1) == 0)
+        {
+            opts->socket = flag + sizeof (SERVE_FLAG) - 1;
+        }
+        else if (strncmp (flag, JOBS_FLAG, sizeof (JOBS_FLAG) - 1) == 0)
+        {
+            char *end = nullptr;
+            long jobs = strtol (flag + sizeof (JOBS_FLAG) - 1, &end, 10);
+
+            if (*end != '\0' || jobs <= 0 || jobs > 1024) { return ERROR; }
+            opts->jobs = (int) jobs;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // Jobs make sense only for manifest, and one process either serves or compiles manifest
+    if (consumed != 0 && (opts->manifest == nullptr) == (opts->socket == nullptr)) { return ERROR; }
+    if (opts->socket != nullptr && opts->jobs != 0) { return ERROR; }
+
+    return consumed;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int batch::run (const batch_opts_t *opts, batch_job_f job, const void *ctx)
+{
+    assert (opts != nullptr && "invalid pointer");
+    assert (job  != nullptr && "invalid pointer");
+    assert (opts->manifest != nullptr && "Not in batch mode");
+
+    batch_t batch = {};
+    batch.job = job;
+    batch.ctx = ctx;
+
+    if (!load_manifest (&batch, opts->manifest))
+    {
+        free (batch.manifest);
+        free (batch.entries);
+        return ERROR;
+    }
+
+    int threads_cnt = opts->jobs > 0 ? opts->jobs : pool::default_threads_cnt ();
+
+    double start_sec = now_sec ();
+    int    failed    = pool::run (batch.entries_cnt, threads_cnt, run_entry, &batch);
+    double elapsed   = now_sec () - start_sec;
+
+    if (failed == ERROR)
+    {
+        fprintf (stderr, "Failed to start batch of %s\n", opts->manifest);
+    }
+    else
+    {
+        fprintf (stderr, "Compiled %d of %d files in %.3f s on %d threads, %.1f files/sec\n",
+                            batch.entries_cnt - failed, batch.entries_cnt, elapsed, threads_cnt,
+                            elapsed > 0 ? (batch.entries_cnt - failed) / elapsed : 0.0);
+    }
+
+    free (batch.manifest);
+    free (batch.entries);
+
+    return failed == 0 ? 0 : ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int batch::run_captured (batch_job_f job, const char *input, const char *output, const void *ctx,
+                                                                    char **log, size_t *log_size)
+{
+    assert (job      != nullptr && "invalid pointer");
+    assert (log      != nullptr && "invalid pointer");
+    assert (log_size != nullptr && "invalid pointer");
+
+    *log      = nullptr;
+    *log_size = 0;
+
+    FILE *stream = open_memstream (log, log_size);
+    if (stream != nullptr) { set_thread_log_stream (stream); }
+
+    int res = job (input, output, ctx);
+
+    if (stream != nullptr)
+    {
+        set_thread_log_stream (nullptr);
+        fclose (stream);
+    }
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static bool load_manifest (batch_t *batch, const char *path)
+{
+    assert (batch != nullptr && "invalid pointer");
+    assert (path  != nullptr && "invalid pointer");
+
+    const file_t src = open_ro_file (path);
+    if (src.content == nullptr)
+    {
+        fprintf (stderr, "Failed to open manifest %s\n", path);
+        return false;
+    }
+
+    // Paths are cut out of the copy in place
+    batch->manifest = (char *) calloc (src.size + 1, sizeof (char));
+    if (batch->manifest != nullptr) {
+        memcpy (batch->manifest, src.content, src.size);
+    }
+    unmap_ro_file (src);
+
+    if (batch->manifest == nullptr) { return false; }
+
+    int lines_cnt = 1;
+    for (const char *cur = batch->manifest; *cur != '\0'; ++cur) {
+        lines_cnt += (*cur == '\n');
+    }
+
+    batch->entries = (batch_entry_t *) calloc ((size_t) lines_cnt, sizeof (batch_entry_t));
+    if (batch->entries == nullptr) { return false; }
+
+    char *save_line = nullptr;
+    int   line_num  = 0;
+
+    for (char *line = strtok_r (batch->manifest, "\n", &save_line); line != nullptr;
+                                                        line = strtok_r (nullptr, "\n", &save_line))
+    {
+        line_num++;
+
+        char *save_word = nullptr;
+        char *input  = strtok_r (line,    " \t\r", &save_word);
+        if (input == nullptr || input[0] == '#') { continue; }
+
+        char *output = strtok_r (nullptr, " \t\r", &save_word);
+
+        if (output == nullptr || strtok_r (nullptr, " \t\r", &save_word) != nullptr)
+        {
+            fprintf (stderr, "%s:%d: expected \"<input> <output>\"\n", path, line_num);
+            return false;
+        }
+
+        batch->entries[batch->entries_cnt++] = {input, output};
+    }
+
+    return true;
+}
+
+static bool run_entry (void *batch_ptr, int index)
+{
+    assert (batch_ptr != nullptr && "invalid pointer");
+
+    const batch_t       *batch = (const batch_t *) batch_ptr;
+    const batch_entry_t *entry = &batch->entries[index];
+
+    // Logs of parallel files would interleave, so each file logs into its own buffer
+    char  *log      = nullptr;
+    size_t log_size = 0;
+
+    int res = batch::run_captured (batch->job, entry->input, entry->output, batch->ctx, &log, &log_size);
+
+    if (log != nullptr)
+    {
+        fwrite (log, sizeof (char), log_size, get_log_stream ());
+        free (log);
+    }
+
+    if (res != 0) {
+        fprintf (stderr, "Failed to compile %s\n", entry->input);
+    }
+
+    return res == 0;
+}
+
+static double now_sec ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
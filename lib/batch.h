@@ -0,0 +1,46 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+/// Leading --batch=<manifest>, --jobs=<n> or --serve=<socket> flags of front, middle and back
+struct batch_opts_t
+{
+    const char *manifest;   ///< nullptr if not in batch mode
+    int jobs;               ///< 0 for number of online cpus
+
+    const char *socket;     ///< Serve requests on it instead, see server.h
+};
+
+/**
+ * @brief      Compile one file of batch. Runs concurrently with other files, so everything it
+ *             changes must be its own, ctx is shared and read only.
+ *
+ * @return     0 on success
+ */
+typedef int (*batch_job_f)(const char *input, const char *output, const void *ctx);
+
+/**
+ * Batch mode compiles many files in one process on a work-stealing pool, see pool.h.
+ * Manifest has one "<input> <output>" pair per line, empty lines and lines starting with '#'
+ * are skipped. Logs of each file are buffered and printed in one piece after it is compiled.
+ */
+namespace batch
+{
+    /**
+     * @brief      Consume batch flags right after program name
+     *
+     * @return     Count of consumed args, ERROR if they are invalid or neither manifest nor
+     *             socket is given
+     */
+    int parse_flags (int argc, const char *argv[], batch_opts_t *opts);
+
+    /// Compile every file of manifest, throughput goes to stderr. @return 0 if all are compiled
+    int run (const batch_opts_t *opts, batch_job_f job, const void *ctx);
+
+    /// Run one job with logs of its thread collected into log, allocated by malloc or nullptr
+    int run_captured (batch_job_f job, const char *input, const char *output, const void *ctx,
+                                                                    char **log, size_t *log_size);
+}
+
+#endif
@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "log.h"
+#include "bytecode.h"
+
+// -------------------------------------------------------------------------------------------------
+
+static bool verify_insn   (const bytecode_t *bc, const bc_insn_t *insn);
+static bool verify_symbol (const bytecode_t *bc, uint32_t index);
+
+static const char *find_symbol (const bytecode_t *bc, uint32_t addr);
+
+// -------------------------------------------------------------------------------------------------
+
+#define ERR_CASE(cond, msg, ...)                    \
+{                                                   \
+    if (cond)                                       \
+    {                                               \
+        LOG (log::ERR, msg, ##__VA_ARGS__);         \
+        dtor (bc);                                  \
+        return ERROR;                               \
+    }                                               \
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+void bytecode::dtor (bytecode_t *bc)
+{
+    assert (bc != nullptr && "invalid pointer");
+
+    free (bc->code);
+    free (bc->symbols);
+
+    *bc = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int bytecode::write (const bytecode_t *bc, FILE *stream)
+{
+    assert (bc     != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    bc_header_t header = {BYTECODE_SIGNATURE, BYTECODE_VERSION, 0, bc->size, bc->symbols_cnt};
+
+    if (fwrite (&header,     sizeof (header),      1,               stream) != 1 ||
+        fwrite (bc->code,    sizeof (bc_insn_t),   bc->size,        stream) != bc->size ||
+        fwrite (bc->symbols, sizeof (bc_symbol_t), bc->symbols_cnt, stream) != bc->symbols_cnt)
+    {
+        return ERROR;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int bytecode::load (bytecode_t *bc, const char *buf, size_t size)
+{
+    assert (bc  != nullptr && "invalid pointer");
+    assert (buf != nullptr && "invalid pointer");
+
+    *bc = {};
+    bc_header_t header = {};
+
+    ERR_CASE (size < sizeof (header), "Bytecode file is too small");
+    memcpy (&header, buf, sizeof (header));
+
+    ERR_CASE (header.signature != BYTECODE_SIGNATURE, "Not a bytecode file");
+    ERR_CASE (header.version   != BYTECODE_VERSION,   "Unsupported bytecode version %u",
+                                                                    (unsigned) header.version);
+
+    size_t expected = sizeof (header) + (size_t) header.code_size   * sizeof (bc_insn_t)
+                                      + (size_t) header.symbols_cnt * sizeof (bc_symbol_t);
+    ERR_CASE (size != expected, "Bytecode size mismatch: %zu bytes instead of %zu", size, expected);
+
+    bc->size        = header.code_size;
+    bc->symbols_cnt = header.symbols_cnt;
+    bc->code        = (bc_insn_t *)   calloc (bc->size + 1,        sizeof (bc_insn_t));
+    bc->symbols     = (bc_symbol_t *) calloc (bc->symbols_cnt + 1, sizeof (bc_symbol_t));
+    ERR_CASE (bc->code == nullptr || bc->symbols == nullptr, "Failed to allocate bytecode");
+
+    buf += sizeof (header);
+    memcpy (bc->code, buf, bc->size * sizeof (bc_insn_t));
+
+    buf += bc->size * sizeof (bc_insn_t);
+    memcpy (bc->symbols, buf, bc->symbols_cnt * sizeof (bc_symbol_t));
+
+    for (uint32_t i = 0; i < bc->size; ++i) {
+        ERR_CASE (!verify_insn (bc, &bc->code[i]), "Invalid instruction at %u", i);
+    }
+
+    for (uint32_t i = 0; i < bc->symbols_cnt; ++i) {
+        ERR_CASE (!verify_symbol (bc, i), "Invalid symbol #%u", i);
+    }
+
+    return 0;
+}
+
+#undef ERR_CASE
+
+// -------------------------------------------------------------------------------------------------
+
+void bytecode::disasm (const bytecode_t *bc, FILE *stream)
+{
+    assert (bc     != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    // Jump targets without symbol get L<addr> labels
+    bool *is_target = (bool *) calloc (bc->size + 1, sizeof (bool));
+
+    for (uint32_t i = 0; is_target != nullptr && i < bc->size; ++i)
+    {
+        if (bc->code[i].arg_type == (uint8_t) isa::operand_type_t::LABEL) {
+            is_target[bc->code[i].value] = true;
+        }
+    }
+
+    uint32_t sym = 0;
+
+    for (uint32_t addr = 0; addr <= bc->size; ++addr)
+    {
+        bool has_symbol = false;
+
+        for (; sym < bc->symbols_cnt && bc->symbols[sym].addr == addr; ++sym)
+        {
+            fprintf (stream, "%s:\n", bc->symbols[sym].name);
+            has_symbol = true;
+        }
+
+        if (!has_symbol && is_target != nullptr && is_target[addr]) {
+            fprintf (stream, "L%u:\n", addr);
+        }
+
+        if (addr == bc->size) { break; }
+
+        const bc_insn_t *insn = &bc->code[addr];
+        isa::operand_t arg = {(isa::operand_type_t) insn->arg_type, (isa::reg_t) insn->reg, insn->value};
+
+        fputs (isa::opcode_name ((isa::opcode_t) insn->opcode), stream);
+
+        if (isa::is_reg_form ((isa::opcode_t) insn->opcode))
+        {
+            fputc (' ', stream);
+            isa::print_reg_form (stream, (isa::opcode_t) insn->opcode, (isa::reg_t) insn->reg2, &arg);
+        }
+        else if (arg.type == isa::operand_type_t::LABEL)
+        {
+            const char *name = find_symbol (bc, (uint32_t) arg.value);
+
+            if (name != nullptr) {
+                fprintf (stream, " %s", name);
+            } else {
+                fprintf (stream, " L%d", arg.value);
+            }
+        }
+        else if (arg.type != isa::operand_type_t::NONE)
+        {
+            fputc (' ', stream);
+            isa::print_operand (stream, &arg, nullptr);
+        }
+
+        fputc ('\n', stream);
+    }
+
+    free (is_target);
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static bool verify_insn (const bytecode_t *bc, const bc_insn_t *insn)
+{
+    assert (bc   != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    if (insn->opcode   >= isa::OPCODES_CNT                      ||
+        insn->arg_type >  (uint8_t) isa::operand_type_t::LABEL  ||
+        insn->reg      >= isa::REGS_CNT                         ||
+        insn->reg2     >= isa::REGS_CNT)
+    {
+        return false;
+    }
+
+    isa::opcode_t       opcode = (isa::opcode_t) insn->opcode;
+    isa::operand_type_t type   = (isa::operand_type_t) insn->arg_type;
+
+    if (isa::is_reg_form (opcode))
+    {
+        if (opcode == isa::opcode_t::STORE) {
+            return type == isa::operand_type_t::MEM || type == isa::operand_type_t::MEM_REG;
+        }
+
+        return type != isa::operand_type_t::NONE && type != isa::operand_type_t::LABEL;
+    }
+
+    if (insn->reg2 != 0) { return false; }
+
+    bool is_branch = isa::is_jump (opcode) || opcode == isa::opcode_t::CALL;
+
+    if (is_branch != (type == isa::operand_type_t::LABEL)) { return false; }
+
+    if (is_branch) {
+        return 0 <= insn->value && (uint32_t) insn->value <= bc->size;
+    }
+
+    if (opcode == isa::opcode_t::PUSH) { return type != isa::operand_type_t::NONE; }
+    if (opcode == isa::opcode_t::POP)  {
+        return type == isa::operand_type_t::REG || type == isa::operand_type_t::MEM ||
+               type == isa::operand_type_t::MEM_REG;
+    }
+
+    return type == isa::operand_type_t::NONE;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool verify_symbol (const bytecode_t *bc, uint32_t index)
+{
+    assert (bc != nullptr && "invalid pointer");
+
+    const bc_symbol_t *symbol = &bc->symbols[index];
+
+    if (symbol->addr > bc->size)                                          { return false; }
+    if (index > 0 && bc->symbols[index - 1].addr > symbol->addr)          { return false; }
+    if (memchr (symbol->name, '\0', BC_SYMBOL_NAME_LEN) == nullptr)       { return false; }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static const char *find_symbol (const bytecode_t *bc, uint32_t addr)
+{
+    assert (bc != nullptr && "invalid pointer");
+
+    // Symbols are sorted, lower bound by address
+    uint32_t left  = 0;
+    uint32_t right = bc->symbols_cnt;
+
+    while (left < right)
+    {
+        uint32_t mid = left + (right - left) / 2;
+
+        if (bc->symbols[mid].addr < addr) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
+    }
+
+    if (left < bc->symbols_cnt && bc->symbols[left].addr == addr) {
+        return bc->symbols[left].name;
+    }
+
+    return nullptr;
+}
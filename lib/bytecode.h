@@ -0,0 +1,78 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "isa.h"
+
+const uint32_t BYTECODE_SIGNATURE = 0x43424C52;     // "RLBC"
+const uint16_t BYTECODE_VERSION   = 1;
+
+const int BC_SYMBOL_NAME_LEN = 32;
+
+/**
+ * @brief Fixed size instruction. Label operands are already resolved: value of jump/call
+ *        operand is index of target instruction. Register forms (isa::is_reg_form) keep
+ *        their register operand in reg2, it is 0 for other opcodes.
+ */
+struct bc_insn_t
+{
+    uint8_t opcode;
+    uint8_t arg_type;
+    uint8_t reg;
+    uint8_t reg2;
+
+    int32_t value;
+};
+
+static_assert (sizeof (bc_insn_t) == 8, "Bytecode instruction must be 8 bytes");
+
+struct bc_symbol_t
+{
+    uint32_t addr;
+    char name[BC_SYMBOL_NAME_LEN];
+};
+
+/// File layout: header, code_size instructions, symbols_cnt symbols. Host byte order
+struct bc_header_t
+{
+    uint32_t signature;
+    uint16_t version;
+    uint16_t flags;         ///< Reserved, must be 0
+
+    uint32_t code_size;
+    uint32_t symbols_cnt;
+};
+
+struct bytecode_t
+{
+    bc_insn_t *code;
+    uint32_t   size;
+
+    bc_symbol_t *symbols;   ///< Sorted by address, nullable
+    uint32_t     symbols_cnt;
+};
+
+namespace bytecode
+{
+    void dtor (bytecode_t *bc);
+
+    int write (const bytecode_t *bc, FILE *stream);
+
+    /**
+     * @brief      Copy bytecode from file content and check it: known opcodes and operand
+     *             types, jump targets inside code, symbols sorted and terminated
+     *
+     * @return     0 or ERROR if file is broken
+     */
+    int load (bytecode_t *bc, const char *buf, size_t size);
+
+    /**
+     * @brief      Print bytecode as text asm. Labels are taken from symbols, jump targets
+     *             without symbol are printed as L<addr>. If several labels share one address,
+     *             jumps there use the first one.
+     */
+    void disasm (const bytecode_t *bc, FILE *stream);
+}
+
+#endif
@@ -0,0 +1,478 @@
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "log.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const char CACHE_DIR_ENV[]  = "EDOC_CACHE_DIR";
+const char CACHE_SIZE_ENV[] = "EDOC_CACHE_SIZE";
+const char STATS_FILE[]     = "stats";
+
+const size_t KEY_HEX_LEN    = 32;
+const size_t COPY_BUF_SIZE  = 4096;
+const size_t STATS_BUF_SIZE = 256;
+
+typedef unsigned __int128 hash_t;
+
+// FNV-1a 128, wide enough that collisions of cached programs are not a concern
+const hash_t FNV_OFFSET = ((hash_t) 0x6c62272e07bb0142ull << 64) | 0x62b821756295c58dull;
+const hash_t FNV_PRIME  = ((hash_t) 1 << 88) | 0x13bu;
+
+enum class cache_stat_t
+{
+    HITS,
+    MISSES,
+    EVICTIONS,
+    FRAGMENT_HITS,
+    FRAGMENT_MISSES,
+    SIZE,               ///< Bytes stored minus evicted, directory is rescanned only when it is over limit
+};
+
+static const char *STAT_NAMES[] = {"hits", "misses", "evictions", "fragment_hits", "fragment_misses",
+                                   "size"};
+static const size_t STATS_CNT   = sizeof (STAT_NAMES) / sizeof (STAT_NAMES[0]);
+
+struct cache_entry_t
+{
+    struct timespec used;
+    off_t size;
+    char name[KEY_HEX_LEN + 1];
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static hash_t hash_bytes   (hash_t hash, const void *data, size_t size);
+static void   entry_path   (const cache_t *cache, hash_t hash, char *path);
+static bool   copy_file    (const char *src_path, const char *dst_path);
+static bool   write_entry  (const char *path, const char *data, size_t size);
+static void   evict        (const cache_t *cache, unsigned long *counters);
+static void   bump_stats   (const cache_t *cache, cache_stat_t stat, unsigned long cnt);
+static void   update_stats (const cache_t *cache, const unsigned long *deltas, bool size_grown);
+static int    cmp_by_use   (const void *lhs, const void *rhs);
+
+static inline hash_t      to_hash (cache_key_t key) { return ((hash_t) key.hi << 64) | key.lo; }
+static inline cache_key_t to_key  (hash_t hash)     { return {(uint64_t) (hash >> 64), (uint64_t) hash}; }
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+void cache::ctor (cache_t *cache, const char *stage, const char *const *flags, int flags_cnt,
+                                                            const char *input, size_t input_size)
+{
+    assert (cache != nullptr && "invalid pointer");
+    assert (stage != nullptr && "invalid pointer");
+    assert (input != nullptr && "invalid pointer");
+
+    *cache = {};
+
+    const char *dir = getenv (CACHE_DIR_ENV);
+    if (dir == nullptr || *dir == '\0') { return; }
+
+    if (strlen (dir) + KEY_HEX_LEN + 2 > CACHE_PATH_LEN || (mkdir (dir, 0755) != 0 && errno != EEXIST))
+    {
+        LOG (log::WRN, "Cache dir '%s' is unusable, cache is disabled", dir);
+        return;
+    }
+
+    // Any rebuild of compiler changes its identity, so old artifacts are never reused
+    struct stat exe = {};
+    if (stat ("/proc/self/exe", &exe) != 0) { return; }
+
+    hash_t hash = FNV_OFFSET;
+    hash = hash_bytes (hash, stage, strlen (stage) + 1);
+    hash = hash_bytes (hash, &exe.st_ino,  sizeof (exe.st_ino));
+    hash = hash_bytes (hash, &exe.st_size, sizeof (exe.st_size));
+    hash = hash_bytes (hash, &exe.st_mtim.tv_sec,  sizeof (exe.st_mtim.tv_sec));
+    hash = hash_bytes (hash, &exe.st_mtim.tv_nsec, sizeof (exe.st_mtim.tv_nsec));
+    for (int i = 0; i < flags_cnt; ++i) {
+        hash = hash_bytes (hash, flags[i], strlen (flags[i]) + 1);
+    }
+    cache->identity = to_key (hash);
+
+    strcpy (cache->dir, dir);
+    entry_path (cache, hash_bytes (hash, input, input_size), cache->entry_path);
+
+    const char *size_str = getenv (CACHE_SIZE_ENV);
+    cache->max_size = size_str != nullptr ? strtoull (size_str, nullptr, 10) : DEFAULT_CACHE_MAX_SIZE;
+    cache->enabled  = true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool cache::fetch (cache_t *cache, const char *output_path)
+{
+    assert (cache       != nullptr && "invalid pointer");
+    assert (output_path != nullptr && "invalid pointer");
+
+    if (!cache->enabled) { return false; }
+
+    if (!copy_file (cache->entry_path, output_path))
+    {
+        bump_stats (cache, cache_stat_t::MISSES, 1);
+        return false;
+    }
+
+    // Modification time of entry is the time of its last use, eviction goes by it
+    utimensat (AT_FDCWD, cache->entry_path, nullptr, 0);
+    bump_stats (cache, cache_stat_t::HITS, 1);
+
+    LOG (log::DBG, "Cache hit %s", cache->entry_path);
+    return true;
+}
+
+void cache::store (cache_t *cache, const char *output_path)
+{
+    assert (cache       != nullptr && "invalid pointer");
+    assert (output_path != nullptr && "invalid pointer");
+
+    if (!cache->enabled) { return; }
+
+    // Thread id is unique among processes too, batch mode stores from many threads at once
+    char tmp_path[CACHE_PATH_LEN + 32] = "";
+    snprintf (tmp_path, sizeof (tmp_path), "%s.tmp.%d", cache->entry_path, gettid ());
+
+    // Fragment counters of the whole run go to stats at once
+    unsigned long deltas[STATS_CNT] = {};
+    deltas[(int) cache_stat_t::FRAGMENT_HITS]   = cache->fragment_hits;
+    deltas[(int) cache_stat_t::FRAGMENT_MISSES] = cache->fragment_misses;
+    deltas[(int) cache_stat_t::SIZE]            = cache->fragments_size;
+
+    struct stat st = {};
+
+    // Rename is atomic, readers see either no entry or the whole one
+    if (!copy_file (output_path, tmp_path) || rename (tmp_path, cache->entry_path) != 0)
+    {
+        LOG (log::WRN, "Failed to store %s to cache", output_path);
+        unlink (tmp_path);
+    }
+    else if (stat (cache->entry_path, &st) == 0)
+    {
+        deltas[(int) cache_stat_t::SIZE] += (unsigned long) st.st_size;
+    }
+
+    update_stats (cache, deltas, true);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+cache_key_t cache::fragment_key (const cache_t *cache)
+{
+    assert (cache != nullptr && "invalid pointer");
+
+    // Fragment key never equals whole artifact key built from the same identity
+    const char tag[] = "fragment";
+    return to_key (hash_bytes (to_hash (cache->identity), tag, sizeof (tag)));
+}
+
+void cache::hash (cache_key_t *key, const void *data, size_t size)
+{
+    assert (key != nullptr && "invalid pointer");
+
+    *key = to_key (hash_bytes (to_hash (*key), data, size));
+}
+
+char *cache::fetch_fragment (cache_t *cache, const cache_key_t *key, size_t *size)
+{
+    assert (cache != nullptr && "invalid pointer");
+    assert (key   != nullptr && "invalid pointer");
+    assert (size  != nullptr && "invalid pointer");
+
+    if (!cache->enabled) { return nullptr; }
+
+    char path[CACHE_PATH_LEN] = "";
+    entry_path (cache, to_hash (*key), path);
+
+    char *data = nullptr;
+    int   fd   = open (path, O_RDONLY);
+    struct stat st = {};
+
+    if (fd >= 0 && fstat (fd, &st) == 0 && (data = (char *) calloc ((size_t) st.st_size + 1, 1)) != nullptr)
+    {
+        if (read (fd, data, (size_t) st.st_size) != st.st_size)
+        {
+            free (data);
+            data = nullptr;
+        }
+    }
+
+    if (fd >= 0) { close (fd); }
+
+    if (data == nullptr)
+    {
+        __atomic_fetch_add (&cache->fragment_misses, 1, __ATOMIC_RELAXED);
+        return nullptr;
+    }
+
+    utimensat (AT_FDCWD, path, nullptr, 0);
+    __atomic_fetch_add (&cache->fragment_hits, 1, __ATOMIC_RELAXED);
+
+    *size = (size_t) st.st_size;
+    return data;
+}
+
+void cache::store_fragment (cache_t *cache, const cache_key_t *key, const char *data, size_t size)
+{
+    assert (cache != nullptr && "invalid pointer");
+    assert (key   != nullptr && "invalid pointer");
+    assert (data  != nullptr && "invalid pointer");
+
+    if (!cache->enabled) { return; }
+
+    char path[CACHE_PATH_LEN] = "";
+    entry_path (cache, to_hash (*key), path);
+
+    if (!write_entry (path, data, size))
+    {
+        LOG (log::WRN, "Failed to store fragment to cache");
+        return;
+    }
+
+    __atomic_fetch_add (&cache->fragments_size, size, __ATOMIC_RELAXED);
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static hash_t hash_bytes (hash_t hash, const void *data, size_t size)
+{
+    assert (data != nullptr && "invalid pointer");
+
+    const unsigned char *bytes = (const unsigned char *) data;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static void entry_path (const cache_t *cache, hash_t hash, char *path)
+{
+    assert (cache != nullptr && "invalid pointer");
+    assert (path  != nullptr && "invalid pointer");
+
+    // Length of dir is checked in ctor
+    int len = snprintf (path, CACHE_PATH_LEN, "%s/%016lx%016lx", cache->dir,
+                                        (unsigned long) (hash >> 64), (unsigned long) hash);
+    assert (len > 0 && (size_t) len < CACHE_PATH_LEN && "Path is truncated");
+    (void) len;
+}
+
+/// Destination is not touched if source can't be opened
+static bool copy_file (const char *src_path, const char *dst_path)
+{
+    assert (src_path != nullptr && "invalid pointer");
+    assert (dst_path != nullptr && "invalid pointer");
+
+    int src = open (src_path, O_RDONLY);
+    if (src < 0) { return false; }
+
+    int dst = open (dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0)
+    {
+        close (src);
+        return false;
+    }
+
+    char buf[COPY_BUF_SIZE] = "";
+    bool success = true;
+
+    while (success)
+    {
+        ssize_t len = read (src, buf, COPY_BUF_SIZE);
+        if (len <= 0)
+        {
+            success = (len == 0);
+            break;
+        }
+
+        success = (write (dst, buf, (size_t) len) == len);
+    }
+
+    close (src);
+    success = (close (dst) == 0) && success;
+
+    return success;
+}
+
+/// Write through temporary file, rename is atomic and readers see either nothing or whole entry
+static bool write_entry (const char *path, const char *data, size_t size)
+{
+    assert (path != nullptr && "invalid pointer");
+    assert (data != nullptr && "invalid pointer");
+
+    char tmp_path[CACHE_PATH_LEN + 32] = "";
+    snprintf (tmp_path, sizeof (tmp_path), "%s.tmp.%d", path, gettid ());
+
+    int fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return false; }
+
+    bool success = (write (fd, data, size) == (ssize_t) size);
+    success = (close (fd) == 0) && success;
+
+    if (!success || rename (tmp_path, path) != 0)
+    {
+        unlink (tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Called under stats lock, so concurrent compilers never scan at once. Sets tracked size to real one
+static void evict (const cache_t *cache, unsigned long *counters)
+{
+    assert (cache    != nullptr && "invalid pointer");
+    assert (counters != nullptr && "invalid pointer");
+
+    DIR *dir = opendir (cache->dir);
+    if (dir == nullptr) { return; }
+
+    cache_entry_t *entries  = nullptr;
+    size_t         cnt      = 0;
+    size_t         capacity = 0;
+    off_t          total    = 0;
+
+    while (const struct dirent *ent = readdir (dir))
+    {
+        // Stats and temporary files have other names
+        if (strlen (ent->d_name) != KEY_HEX_LEN) { continue; }
+
+        struct stat st = {};
+        if (fstatat (dirfd (dir), ent->d_name, &st, 0) != 0 || !S_ISREG (st.st_mode)) { continue; }
+
+        if (cnt == capacity)
+        {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+
+            cache_entry_t *new_entries = (cache_entry_t *) realloc (entries, capacity * sizeof (cache_entry_t));
+            if (new_entries == nullptr) { break; }
+
+            entries = new_entries;
+        }
+
+        entries[cnt].used = st.st_mtim;
+        entries[cnt].size = st.st_size;
+        strcpy (entries[cnt].name, ent->d_name);
+
+        total += st.st_size;
+        cnt++;
+    }
+
+    unsigned long evicted = 0;
+
+    if ((size_t) total > cache->max_size)
+    {
+        qsort (entries, cnt, sizeof (cache_entry_t), cmp_by_use);
+
+        for (size_t i = 0; i < cnt && (size_t) total > cache->max_size; ++i)
+        {
+            // Entry may be already removed by hand
+            if (unlinkat (dirfd (dir), entries[i].name, 0) == 0) { evicted++; }
+
+            total -= entries[i].size;
+        }
+    }
+
+    closedir (dir);
+    free (entries);
+
+    counters[(int) cache_stat_t::EVICTIONS] += evicted;
+    counters[(int) cache_stat_t::SIZE]       = (unsigned long) total;
+}
+
+static int cmp_by_use (const void *lhs, const void *rhs)
+{
+    const struct timespec *lhs_used = &((const cache_entry_t *) lhs)->used;
+    const struct timespec *rhs_used = &((const cache_entry_t *) rhs)->used;
+
+    if (lhs_used->tv_sec != rhs_used->tv_sec) {
+        return lhs_used->tv_sec < rhs_used->tv_sec ? -1 : 1;
+    }
+
+    if (lhs_used->tv_nsec != rhs_used->tv_nsec) {
+        return lhs_used->tv_nsec < rhs_used->tv_nsec ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void bump_stats (const cache_t *cache, cache_stat_t stat, unsigned long cnt)
+{
+    assert (cache != nullptr && "invalid pointer");
+
+    unsigned long deltas[STATS_CNT] = {};
+    deltas[(int) stat] = cnt;
+
+    update_stats (cache, deltas, false);
+}
+
+/// Add deltas to shared counters, evict if tracked size grew over limit or is not known yet
+static void update_stats (const cache_t *cache, const unsigned long *deltas, bool size_grown)
+{
+    assert (cache  != nullptr && "invalid pointer");
+    assert (deltas != nullptr && "invalid pointer");
+
+    char path[CACHE_PATH_LEN + sizeof (STATS_FILE)] = "";
+    snprintf (path, sizeof (path), "%s/%s", cache->dir, STATS_FILE);
+
+    int fd = open (path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) { return; }
+
+    // Counters are shared by all compilers using the cache
+    if (flock (fd, LOCK_EX) == 0)
+    {
+        char buf[STATS_BUF_SIZE] = "";
+        unsigned long counters[STATS_CNT] = {};
+        size_t read_cnt = 0;
+
+        if (pread (fd, buf, STATS_BUF_SIZE - 1, 0) > 0)
+        {
+            // Lines are "name value" in STAT_NAMES order
+            const char *cur = buf;
+            int read_len = 0;
+
+            for (; read_cnt < STATS_CNT && sscanf (cur, "%*s %lu%n", &counters[read_cnt], &read_len) == 1; ++read_cnt) {
+                cur += read_len;
+            }
+        }
+
+        for (size_t i = 0; i < STATS_CNT; ++i) {
+            counters[i] += deltas[i];
+        }
+
+        // Stats of new or older cache have no size line, one scan finds it
+        const unsigned long size = counters[(int) cache_stat_t::SIZE];
+        if (read_cnt <= (size_t) cache_stat_t::SIZE || (size_grown && size > cache->max_size)) {
+            evict (cache, counters);
+        }
+
+        int len = 0;
+        for (size_t i = 0; i < STATS_CNT; ++i) {
+            len += snprintf (buf + len, STATS_BUF_SIZE - (size_t) len, "%s %lu\n", STAT_NAMES[i], counters[i]);
+        }
+
+        if (pwrite (fd, buf, (size_t) len, 0) == len) {
+            ftruncate (fd, len);
+        }
+    }
+
+    close (fd);
+}
@@ -0,0 +1,67 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t CACHE_PATH_LEN         = 512;
+const size_t DEFAULT_CACHE_MAX_SIZE = 64 << 20;
+
+/// 128-bit hash under construction, see cache::hash
+struct cache_key_t
+{
+    uint64_t hi;
+    uint64_t lo;
+};
+
+/**
+ * @brief Content addressed cache of compilation artifacts shared by front, middle and back.
+ *        Key is hash of stage name, compiler binary identity, options and input content, so
+ *        rebuilt compiler never sees stale artifacts. Enabled by EDOC_CACHE_DIR environment
+ *        variable, EDOC_CACHE_SIZE limits its size in bytes. Least recently used artifacts are
+ *        evicted first, hit/miss/eviction counters and total size are kept in EDOC_CACHE_DIR/stats,
+ *        directory is scanned for eviction only when tracked size gets over the limit.
+ *        Fragments (e.g. code of one function) are keyed by stage identity and their own key
+ *        material instead of the whole input and live in the same directory, their counters
+ *        and sizes are gathered during the run and written to stats once by store.
+ */
+struct cache_t
+{
+    bool enabled;
+
+    char dir[CACHE_PATH_LEN];
+    char entry_path[CACHE_PATH_LEN];
+
+    cache_key_t identity;   ///< Stage, compiler binary and options, fragment keys start from it
+
+    size_t max_size;
+
+    // Not yet written to stats. Back end workers fetch fragments at once, so __atomic builtins only
+    unsigned long fragment_hits;
+    unsigned long fragment_misses;
+    unsigned long fragments_size;
+};
+
+namespace cache
+{
+    /// Cache stays disabled if EDOC_CACHE_DIR is not set or can't be created
+    void ctor (cache_t *cache, const char *stage, const char *const *flags, int flags_cnt,
+                                                            const char *input, size_t input_size);
+
+    /// Copy cached artifact to output_path. @return true on hit
+    bool fetch (cache_t *cache, const char *output_path);
+
+    /// Save output_path as artifact, concurrent compilers never see half written entry.
+    /// Updates stats for the whole run and evicts if cache got over the limit
+    void store (cache_t *cache, const char *output_path);
+
+    /// @return Key of fragment seeded with stage identity, extend it with hash
+    cache_key_t fragment_key (const cache_t *cache);
+    void        hash         (cache_key_t *key, const void *data, size_t size);
+
+    /// @return Content allocated with calloc or nullptr on miss
+    char *fetch_fragment (cache_t *cache, const cache_key_t *key, size_t *size);
+    void  store_fragment (cache_t *cache, const cache_key_t *key, const char *data, size_t size);
+}
+
+#endif
@@ -0,0 +1,303 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "log.h"
+#include "func_table.h"
+
+// -------------------------------------------------------------------------------------------------
+
+struct purity_ctx_t
+{
+    const func_table_t *table;
+    int func;
+
+    bool *is_local;
+
+    bool pure;
+    bool recursive;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static int  max_index        (const tree::node_t *node, tree::node_type_t type);
+static void collect_defs     (func_table_t *table, tree::node_t *node);
+static void collect_params   (purity_ctx_t *ctx, const tree::node_t *node);
+static void check_body       (purity_ctx_t *ctx, const tree::node_t *node);
+static bool is_local_pure    (func_table_t *table, int func, int max_var, bool *recursive);
+static bool calls_only_pure  (const func_table_t *table, const tree::node_t *node);
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int func_table::ctor (func_table_t *table, tree::node_t *ast)
+{
+    assert (table != nullptr && "invalid pointer");
+    assert (ast   != nullptr && "invalid pointer");
+
+    int max_func = max_index (ast, tree::node_type_t::FUNC_DEF);
+    int max_call = max_index (ast, tree::node_type_t::FUNC_CALL);
+    if (max_call > max_func) { max_func = max_call; }
+
+    table->size      = (unsigned int) (max_func + 1);
+    table->defs      = (tree::node_t **) calloc (table->size + 1, sizeof (tree::node_t *));
+    table->pure      = (bool *)          calloc (table->size + 1, sizeof (bool));
+    table->recursive = (bool *)          calloc (table->size + 1, sizeof (bool));
+
+    if (table->defs == nullptr || table->pure == nullptr || table->recursive == nullptr)
+    {
+        dtor (table);
+        return ERROR;
+    }
+
+    collect_defs (table, ast);
+
+    int max_var = max_index (ast, tree::node_type_t::VAR);
+    int max_def = max_index (ast, tree::node_type_t::VAR_DEF);
+    if (max_def > max_var) { max_var = max_def; }
+
+    for (unsigned int i = 0; i < table->size; ++i)
+    {
+        if (table->defs[i] != nullptr)
+        {
+            table->pure[i] = is_local_pure (table, (int) i, max_var, &table->recursive[i]);
+        }
+    }
+
+    // Purity of callers depends on purity of callees, so drop functions until fixpoint
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+
+        for (unsigned int i = 0; i < table->size; ++i)
+        {
+            if (table->pure[i] && !calls_only_pure (table, table->defs[i]->right))
+            {
+                table->pure[i] = false;
+                changed        = true;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void func_table::dtor (func_table_t *table)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    free (table->defs);
+    free (table->pure);
+    free (table->recursive);
+
+    table->defs      = nullptr;
+    table->pure      = nullptr;
+    table->recursive = nullptr;
+    table->size      = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+tree::node_t *func_table::get_def (const func_table_t *table, int func)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    if (func < 0 || (unsigned int) func >= table->size) { return nullptr; }
+
+    return table->defs[func];
+}
+
+bool func_table::is_pure (const func_table_t *table, int func)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    if (func < 0 || (unsigned int) func >= table->size) { return false; }
+
+    return table->pure[func];
+}
+
+bool func_table::is_recursive (const func_table_t *table, int func)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    if (func < 0 || (unsigned int) func >= table->size) { return false; }
+
+    return table->recursive[func];
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int func_table::count_args (const tree::node_t *node)
+{
+    if (node == nullptr) { return 0; }
+
+    if (node->type == tree::node_type_t::FUNC_DEF)
+    {
+        return count_args (node->left);
+    }
+
+    if (node->type == tree::node_type_t::VAR)
+    {
+        return 1;
+    }
+
+    return count_args (node->left) + count_args (node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static int max_index (const tree::node_t *node, tree::node_type_t type)
+{
+    if (node == nullptr) { return -1; }
+
+    int res = (node->type == type) ? node->data : -1;
+
+    int left  = max_index (node->left,  type);
+    int right = max_index (node->right, type);
+
+    if (left  > res) { res = left;  }
+    if (right > res) { res = right; }
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void collect_defs (func_table_t *table, tree::node_t *node)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return; }
+
+    if (node->type == tree::node_type_t::FUNC_DEF)
+    {
+        assert (node->data >= 0 && (unsigned int) node->data < table->size);
+
+        if (table->defs[node->data] != nullptr)
+        {
+            LOG (log::WRN, "Function #%d is defined twice, using the last definition", node->data);
+        }
+
+        table->defs[node->data] = node;
+        return;
+    }
+
+    collect_defs (table, node->left);
+    collect_defs (table, node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool is_local_pure (func_table_t *table, int func, int max_var, bool *recursive)
+{
+    assert (table     != nullptr && "invalid pointer");
+    assert (recursive != nullptr && "invalid pointer");
+
+    purity_ctx_t ctx = {};
+    ctx.table     = table;
+    ctx.func      = func;
+    ctx.pure      = true;
+    ctx.recursive = false;
+    ctx.is_local  = (bool *) calloc ((size_t) max_var + 2, sizeof (bool));
+    if (ctx.is_local == nullptr) { return false; }
+
+    tree::node_t *def = table->defs[func];
+
+    collect_params (&ctx, def->left);
+    check_body     (&ctx, def->right);
+
+    free (ctx.is_local);
+
+    *recursive = ctx.recursive;
+    return ctx.pure;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void collect_params (purity_ctx_t *ctx, const tree::node_t *node)
+{
+    assert (ctx != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return; }
+
+    if (node->type == tree::node_type_t::VAR)
+    {
+        ctx->is_local[node->data] = true;
+    }
+
+    collect_params (ctx, node->left);
+    collect_params (ctx, node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define IMPURE()            \
+{                           \
+    ctx->pure = false;      \
+    return;                 \
+}
+
+/// Body is walked in emission order like the resolver does, so name is local only after its VAR_DEF
+static void check_body (purity_ctx_t *ctx, const tree::node_t *node)
+{
+    assert (ctx != nullptr && "invalid pointer");
+
+    if (node == nullptr || !ctx->pure) { return; }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (node->type)
+    {
+        case tree::node_type_t::VAR_DEF:
+            ctx->is_local[node->data] = true;
+            break;
+
+        case tree::node_type_t::VAR:
+            if (!ctx->is_local[node->data]) IMPURE ();
+            break;
+
+        case tree::node_type_t::FUNC_CALL:
+            if (ctx->table->defs[node->data] == nullptr) IMPURE ();
+            if (node->data == ctx->func) { ctx->recursive = true; }
+            break;
+
+        case tree::node_type_t::FUNC_DEF:
+            IMPURE ();
+
+        case tree::node_type_t::OP:
+            if (node->data == (int) tree::op_t::INPUT || node->data == (int) tree::op_t::OUTPUT)
+            {
+                IMPURE ();
+            }
+            break;
+
+        default:
+            break;
+    }
+    #pragma GCC diagnostic pop
+
+    check_body (ctx, node->left);
+    check_body (ctx, node->right);
+}
+
+#undef IMPURE
+
+// -------------------------------------------------------------------------------------------------
+
+static bool calls_only_pure (const func_table_t *table, const tree::node_t *node)
+{
+    assert (table != nullptr && "invalid pointer");
+
+    if (node == nullptr) { return true; }
+
+    if (node->type == tree::node_type_t::FUNC_CALL && !func_table::is_pure (table, node->data))
+    {
+        return false;
+    }
+
+    return calls_only_pure (table, node->left) && calls_only_pure (table, node->right);
+}
@@ -0,0 +1,34 @@
+#ifndef FUNC_TABLE_H
+#define FUNC_TABLE_H
+
+#include "tree.h"
+
+/**
+ * Table of FUNC_DEF nodes indexed by function name index.
+ *
+ * Function is pure if it doesn't do INPUT/OUTPUT, touches only its own params & locals and calls
+ * only pure functions. Result of such function depends only on its arguments.
+ */
+struct func_table_t
+{
+    tree::node_t **defs;
+    bool          *pure;
+    bool          *recursive;
+
+    unsigned int size;
+};
+
+namespace func_table
+{
+    int  ctor (func_table_t *table, tree::node_t *ast);
+    void dtor (func_table_t *table);
+
+    tree::node_t *get_def (const func_table_t *table, int func);
+
+    bool is_pure      (const func_table_t *table, int func);
+    bool is_recursive (const func_table_t *table, int func);
+
+    int count_args (const tree::node_t *func_def);
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include <assert.h>
+#include <string.h>
+#include "isa.h"
+
+// -------------------------------------------------------------------------------------------------
+
+static const char *OPCODE_NAMES[isa::OPCODES_CNT] =
+{
+    "nop", "push", "pop", "add", "sub", "mul", "div", "sqrt", "sin", "inp", "out",
+    "jmp", "je", "jne", "ja", "jae", "jb", "jbe", "call", "ret", "halt",
+    "mov", "mov", "add", "sub", "mul", "div",
+};
+
+static const char *REG_NAMES[isa::REGS_CNT] = {"rax", "rbx", "rcx", "rdx"};
+
+// -------------------------------------------------------------------------------------------------
+
+bool isa::operand_eq (const operand_t *lhs, const operand_t *rhs)
+{
+    assert (lhs != nullptr && "invalid pointer");
+    assert (rhs != nullptr && "invalid pointer");
+
+    if (lhs->type != rhs->type) { return false; }
+
+    switch (lhs->type)
+    {
+        case operand_type_t::NONE:    return true;
+        case operand_type_t::REG:     return lhs->reg == rhs->reg;
+        case operand_type_t::MEM_REG: return lhs->reg == rhs->reg && lhs->value == rhs->value;
+
+        case operand_type_t::IMM:
+        case operand_type_t::MEM:
+        case operand_type_t::LABEL:   return lhs->value == rhs->value;
+
+        default:
+            assert (0 && "Unexpected operand type");
+            return false;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+const char *isa::opcode_name (opcode_t opcode)
+{
+    assert ((int) opcode < OPCODES_CNT && "Invalid opcode");
+
+    return OPCODE_NAMES[(int) opcode];
+}
+
+const char *isa::reg_name (reg_t reg)
+{
+    assert ((int) reg < REGS_CNT && "Invalid register");
+
+    return REG_NAMES[(int) reg];
+}
+
+// -------------------------------------------------------------------------------------------------
+
+isa::opcode_t isa::find_opcode (const char *name)
+{
+    assert (name != nullptr && "invalid pointer");
+
+    for (int i = 0; i < OPCODES_CNT; ++i)
+    {
+        if (strcmp (OPCODE_NAMES[i], name) == 0) {
+            return (opcode_t) i;
+        }
+    }
+
+    return opcode_t::NOP;
+}
+
+int isa::find_reg (const char *name)
+{
+    assert (name != nullptr && "invalid pointer");
+
+    for (int i = 0; i < REGS_CNT; ++i)
+    {
+        if (strcmp (REG_NAMES[i], name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool isa::is_jump (opcode_t opcode)
+{
+    return opcode_t::JMP <= opcode && opcode <= opcode_t::JBE;
+}
+
+bool isa::is_reg_form (opcode_t opcode)
+{
+    return opcode_t::MOV <= opcode && opcode <= opcode_t::DIV_R;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int isa::print_operand (FILE *stream, const operand_t *operand, const char *const *label_names)
+{
+    assert (stream  != nullptr && "invalid pointer");
+    assert (operand != nullptr && "invalid pointer");
+
+    switch (operand->type)
+    {
+        case operand_type_t::NONE:
+            return 0;
+
+        case operand_type_t::IMM:
+            return fprintf (stream, "%d", operand->value);
+
+        case operand_type_t::REG:
+            return fprintf (stream, "%s", reg_name (operand->reg));
+
+        case operand_type_t::MEM:
+            return fprintf (stream, "[%d]", operand->value);
+
+        case operand_type_t::MEM_REG:
+            return fprintf (stream, "[%s+%d]", reg_name (operand->reg), operand->value);
+
+        case operand_type_t::LABEL:
+            if (label_names != nullptr) {
+                return fprintf (stream, "%s", label_names[operand->value]);
+            } else {
+                return fprintf (stream, "L%d", operand->value);
+            }
+
+        default:
+            assert (0 && "Unexpected operand type");
+            return 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int isa::print_reg_form (FILE *stream, opcode_t opcode, reg_t reg, const operand_t *operand)
+{
+    assert (stream  != nullptr && "invalid pointer");
+    assert (operand != nullptr && "invalid pointer");
+    assert (is_reg_form (opcode) && "Not a register form");
+
+    if (opcode == opcode_t::STORE)
+    {
+        int len = print_operand (stream, operand, nullptr);
+        return len + fprintf (stream, ", %s", reg_name (reg));
+    }
+
+    int len = fprintf (stream, "%s, ", reg_name (reg));
+    return len + print_operand (stream, operand, nullptr);
+}
@@ -0,0 +1,107 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdio.h>
+
+/// Stack machine instruction set, shared by backend, bytecode tools and VM
+namespace isa
+{
+    enum class opcode_t : unsigned char
+    {
+        NOP = 0,
+        PUSH,
+        POP,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        SQRT,
+        SIN,
+        INP,
+        OUT,
+        JMP,
+        JE,
+        JNE,
+        JA,
+        JAE,
+        JB,
+        JBE,
+        CALL,
+        RET,
+        HALT,
+
+        // Register forms, first operand is a register kept apart from the main one
+        MOV,        // mov rax, <src>
+        STORE,      // mov <mem>, rax
+        ADD_R,      // add rax, <src>
+        SUB_R,
+        MUL_R,
+        DIV_R,
+    };
+
+    const int OPCODES_CNT = (int) opcode_t::DIV_R + 1;
+
+    enum class reg_t : unsigned char
+    {
+        RAX = 0,
+        RBX,
+        RCX,
+        RDX,
+    };
+
+    const int REGS_CNT = (int) reg_t::RDX + 1;
+
+    enum class operand_type_t : unsigned char
+    {
+        NONE = 0,
+        IMM,        // 5
+        REG,        // rax
+        MEM,        // [5]
+        MEM_REG,    // [rax+5]
+        LABEL,      // Label id, resolved to address by assembler
+    };
+
+    struct operand_t
+    {
+        operand_type_t type;
+        reg_t reg;
+        int   value;
+    };
+
+    inline operand_t imm     (int value)            { return {operand_type_t::IMM,     reg_t::RAX, value}; }
+    inline operand_t reg     (reg_t r)              { return {operand_type_t::REG,     r,          0    }; }
+    inline operand_t mem     (int addr)             { return {operand_type_t::MEM,     reg_t::RAX, addr }; }
+    inline operand_t mem_reg (reg_t r, int offset)  { return {operand_type_t::MEM_REG, r,          offset}; }
+    inline operand_t label   (int id)               { return {operand_type_t::LABEL,   reg_t::RAX, id   }; }
+
+    bool operand_eq (const operand_t *lhs, const operand_t *rhs);
+
+    const char *opcode_name (opcode_t opcode);
+    const char *reg_name    (reg_t reg);
+
+    /// @return opcode/register by its asm name or NOP/-1 if there is no such one.
+    ///         Register forms share names with stack ones, the stack form is returned
+    opcode_t find_opcode (const char *name);
+    int      find_reg    (const char *name);
+
+    bool is_jump     (opcode_t opcode);     ///< jmp and conditional jumps, not call
+    bool is_reg_form (opcode_t opcode);     ///< mov, store and two-operand arithmetic
+
+    /**
+     * @brief Print operand as in text asm. Label is printed by its name from names
+     *        array, or as "L<id>" if names is nullptr.
+     *
+     * @return Number of printed chars
+     */
+    int print_operand (FILE *stream, const operand_t *operand, const char *const *label_names);
+
+    /**
+     * @brief Print both operands of register form in asm order, e.g. "rbx, [rdx+1]"
+     *        or "[rdx+1], rbx" for store
+     *
+     * @return Number of printed chars
+     */
+    int print_reg_form (FILE *stream, opcode_t opcode, reg_t reg, const operand_t *operand);
+}
+
+#endif
@@ -1,13 +1,75 @@
 #define __LOG_CPP
 
 #include <assert.h>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "log.h"
 
+// -------------------------------------------------------------------------------------------------
+
+const size_t TIME_BUF_SIZE = 10;
+const size_t LOG_RING_SIZE = 256;       ///< Power of two
+
+struct log_entry_t
+{
+    log lvl;
+    time_t sec;
+    const char *file;
+    unsigned int line;
+    FILE *stream;           ///< Stream at the moment of the call
+    char msg[LOG_MSG_SIZE];
+};
+
+/// Cell of bounded queue, seq tells whose turn it is: producer of pos == seq or consumer of pos == seq-1
+struct log_cell_t
+{
+    std::atomic<size_t> seq {0};
+    log_entry_t entry {};
+};
+
+// -------------------------------------------------------------------------------------------------
+
 log __LOG_LEVEL = log::INF;
 FILE *__LOG_OUT_STREAM = stdout;
 
+static log_cell_t *ring = nullptr;
+static std::atomic<size_t> enqueue_pos {0};
+static std::atomic<size_t> written_cnt {0};     ///< Only writer moves it, so it is dequeue position too
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_t      writer    = {};
+static sem_t          pending   = {};
+static bool           is_async  = false;        ///< Writer thread is running, else callers write
+static std::atomic<bool> stopping {false};
+
+static pthread_mutex_t sync_write_lock = PTHREAD_MUTEX_INITIALIZER;  ///< Callers and writer write one by one
+
+static thread_local FILE  *thread_stream = nullptr;  ///< Overrides __LOG_OUT_STREAM for this thread
+static thread_local size_t own_enqueued  = 0;        ///< Messages queued before this thread's last one
+
+// -------------------------------------------------------------------------------------------------
+
+static void  init_logger ();
+static void  stop_logger ();
+static void *writer_loop (void *);
+static void  write_entry (const log_entry_t *entry);
+static void  wait_writer (size_t target);
+
+static inline FILE *current_stream ()
+{
+    return thread_stream != nullptr ? thread_stream : __LOG_OUT_STREAM;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
 void set_log_level (log level)
 {
     __LOG_LEVEL = level;
@@ -17,6 +79,7 @@ void set_log_stream (FILE *stream)
 {
     assert (stream != NULL);
 
+    log_flush ();
     __LOG_OUT_STREAM = stream;
 
     #if HTML_LOGS
@@ -24,31 +87,209 @@ void set_log_stream (FILE *stream)
     #endif
 }
 
+void set_thread_log_stream (FILE *stream)
+{
+    // Messages queued for the old stream must be written before it can be closed
+    wait_writer (own_enqueued);
+    thread_stream = stream;
+}
+
 FILE *get_log_stream ()
 {
-    return __LOG_OUT_STREAM;
+    // Writer has put our queued messages into the same FILE buffer, so no fflush is needed
+    wait_writer (own_enqueued);
+    return current_stream ();
 }
 
+void log_flush ()
+{
+    wait_writer (enqueue_pos.load (std::memory_order_acquire));
+    fflush (current_stream ());
+}
+
+// -------------------------------------------------------------------------------------------------
+
 void _log (log lvl, const char *fmt, const char *file, unsigned int line...)
 {
+    if (lvl < __LOG_LEVEL) { return; }
+
+    pthread_once (&init_once, init_logger);
+
+    // Error may be the last message before a crash, so it is written and flushed right away,
+    // after everything queued before it
+    if (!is_async || lvl >= log::ERR)
+    {
+        log_entry_t entry = {lvl, time (nullptr), file, line, current_stream (), ""};
+
+        va_list args;
+        va_start (args, line);
+        vsnprintf (entry.msg, LOG_MSG_SIZE, fmt, args);
+        va_end (args);
+
+        if (is_async) {
+            wait_writer (enqueue_pos.load (std::memory_order_acquire));
+        }
+
+        pthread_mutex_lock   (&sync_write_lock);
+        write_entry (&entry);
+        if (lvl >= log::ERR) { fflush (entry.stream); }
+        pthread_mutex_unlock (&sync_write_lock);
+        return;
+    }
+
+    // Vyukov bounded queue: claim position by CAS, then publish cell by its seq
+    size_t      pos  = enqueue_pos.load (std::memory_order_relaxed);
+    log_cell_t *cell = nullptr;
+
+    while (true)
+    {
+        cell = &ring[pos & (LOG_RING_SIZE - 1)];
+
+        size_t   seq  = cell->seq.load (std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0)
+        {
+            if (enqueue_pos.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed)) { break; }
+        }
+        else
+        {
+            // Full ring waits for the writer rather than losing messages
+            if (diff < 0) { sched_yield (); }
+            pos = enqueue_pos.load (std::memory_order_relaxed);
+        }
+    }
+
+    log_entry_t *entry = &cell->entry;
+    entry->lvl    = lvl;
+    entry->sec    = time (nullptr);
+    entry->file   = file;
+    entry->line   = line;
+    entry->stream = current_stream ();
+
     va_list args;
     va_start (args, line);
+    vsnprintf (entry->msg, LOG_MSG_SIZE, fmt, args);
+    va_end (args);
+
+    cell->seq.store (pos + 1, std::memory_order_release);
+    own_enqueued = pos + 1;
+    sem_post (&pending);
+}
 
-    if (lvl >= __LOG_LEVEL)                                             
-    {                                                                   
-        char time_buf[__TIME_BUF_SIZE] = "";                            
-        current_time (time_buf, __TIME_BUF_SIZE);                       
-        fprintf (__LOG_OUT_STREAM, "%s ", time_buf);                    
-                                                                        
-        if      (lvl == log::DBG) { fprintf (__LOG_OUT_STREAM, "DEBUG"); }                 
-        else if (lvl == log::INF) { fprintf (__LOG_OUT_STREAM, Cyan "INFO " D); }          
-        else if (lvl == log::WRN) { fprintf (__LOG_OUT_STREAM, Y "WARN " D); fflush (__LOG_OUT_STREAM); }             
-        else if (lvl == log::ERR) { fprintf (__LOG_OUT_STREAM, R "ERROR" D); fflush (__LOG_OUT_STREAM); }             
-                                                                        
-        fprintf (__LOG_OUT_STREAM, " [%s:%u] ", file, line);    
-        vfprintf (__LOG_OUT_STREAM, fmt, args);                        
-        fputc   ('\n', __LOG_OUT_STREAM);                               
-    }       
-
-    va_end (args);                                                            
-}
\ No newline at end of file
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static void init_logger ()
+{
+    ring = (log_cell_t *) calloc (LOG_RING_SIZE, sizeof (log_cell_t));
+    if (ring == nullptr) { return; }
+
+    for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+        ring[i].seq.store (i, std::memory_order_relaxed);
+    }
+
+    if (sem_init (&pending, 0, 0) != 0) { return; }
+
+    if (pthread_create (&writer, nullptr, writer_loop, nullptr) != 0)
+    {
+        sem_destroy (&pending);
+        return;
+    }
+
+    is_async = true;
+    atexit (stop_logger);
+}
+
+static void stop_logger ()
+{
+    stopping.store (true, std::memory_order_release);
+    sem_post (&pending);
+
+    pthread_join (writer, nullptr);
+    sem_destroy (&pending);
+
+    is_async = false;
+    free (ring);
+    ring = nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void *writer_loop (void *)
+{
+    size_t pos = 0;
+
+    while (true)
+    {
+        log_cell_t *cell = &ring[pos & (LOG_RING_SIZE - 1)];
+
+        if (cell->seq.load (std::memory_order_acquire) == pos + 1)
+        {
+            pthread_mutex_lock (&sync_write_lock);
+            write_entry (&cell->entry);
+
+            // Stream is flushed at the end of each run of messages to it, and before the progress
+            // is published: once it is, thread that owns the stream may close it
+            FILE       *stream = cell->entry.stream;
+            log_cell_t *next   = &ring[(pos + 1) & (LOG_RING_SIZE - 1)];
+
+            if (next->seq.load (std::memory_order_acquire) != pos + 2 || next->entry.stream != stream) {
+                fflush (stream);
+            }
+            pthread_mutex_unlock (&sync_write_lock);
+
+            cell->seq.store (pos + LOG_RING_SIZE, std::memory_order_release);
+            written_cnt.store (++pos, std::memory_order_release);
+            continue;
+        }
+
+        // Ring is drained, sleep till the next message
+        if (stopping.load (std::memory_order_acquire) && pos == enqueue_pos.load (std::memory_order_acquire)) {
+            break;
+        }
+
+        sem_wait (&pending);
+    }
+
+    return nullptr;
+}
+
+static void wait_writer (size_t target)
+{
+    while (written_cnt.load (std::memory_order_acquire) < target) {
+        sched_yield ();
+    }
+}
+
+static void write_entry (const log_entry_t *entry)
+{
+    assert (entry != nullptr && "invalid pointer");
+
+    // Writes are serialized by sync_write_lock, localtime is called once per second at most
+    static time_t cached_sec = -1;
+    static char   time_buf[TIME_BUF_SIZE] = "";
+
+    if (entry->sec != cached_sec)
+    {
+        struct tm timeinfo = {};
+        localtime_r (&entry->sec, &timeinfo);
+        strftime (time_buf, TIME_BUF_SIZE, "%H:%M:%S", &timeinfo);
+
+        cached_sec = entry->sec;
+    }
+
+    const char *lvl_name = "";
+
+    switch (entry->lvl)
+    {
+        case log::DBG: lvl_name = "DEBUG";         break;
+        case log::INF: lvl_name = Cyan "INFO " D;  break;
+        case log::WRN: lvl_name = Y "WARN " D;     break;
+        case log::ERR: lvl_name = R "ERROR" D;     break;
+        default: assert (0 && "Unexpected log level");
+    }
+
+    fprintf (entry->stream, "%s %s [%s:%u] %s\n", time_buf, lvl_name, entry->file, entry->line, entry->msg);
+}
@@ -21,7 +21,16 @@ enum class log
     ERR = 4,
 };
 
-const size_t __TIME_BUF_SIZE = 10;
+const size_t LOG_MSG_SIZE = 256;
+
+/// Levels below this one are removed at compile time, their arguments are not even evaluated
+#ifndef LOG_MIN_LEVEL
+    #ifdef _DEBUG
+        #define LOG_MIN_LEVEL 1
+    #else
+        #define LOG_MIN_LEVEL 2
+    #endif
+#endif
 
 #ifndef __LOG_CPP
 extern enum log __LOG_LEVEL;
@@ -46,10 +55,11 @@ extern FILE *__LOG_OUT_STREAM;
     #define Plain   "\033[0m"
 #endif
 
-static inline void current_time (char *buf, size_t buf_size);
-
 /**
- * @brief      Write to log stream time, file&line and your formatted message
+ * @brief      Queue message with time, file&line for background writer. Message is formatted
+ *             on the caller thread and truncated to LOG_MSG_SIZE. ERR and higher messages are
+ *             written and flushed on the caller thread after the queued ones, so they survive
+ *             a crash that follows.
  *
  * @param      lvl   Log level
  * @param[in]  fmt   Format string
@@ -61,14 +71,18 @@ static inline void current_time (char *buf, size_t buf_size);
 
 void _log (enum log lvl, const char *fmt, const char *file, unsigned int line, ...);
 
-#define LOG(lvl, fmt, ...)                               \
-{                                                        \
-    _log (lvl, fmt, __FILE__, __LINE__, ##__VA_ARGS__);  \
-}                                                       
+#define LOG(lvl, fmt, ...)                                          \
+{                                                                   \
+    if constexpr ((int) (lvl) >= LOG_MIN_LEVEL) {                   \
+        if ((lvl) >= __LOG_LEVEL) {                                 \
+            _log (lvl, fmt, __FILE__, __LINE__, ##__VA_ARGS__);     \
+        }                                                           \
+    }                                                               \
+}
 
 #else
 
-#define log(lvl, ...) {;}
+#define LOG(lvl, ...) {;}
 
 #endif
 /**
@@ -80,31 +94,21 @@ void _log (enum log lvl, const char *fmt, const char *file, unsigned int line, .
 void set_log_level (enum log level);
 
 /**
- * @brief      Sets the output log stream.
+ * @brief      Sets the output log stream. Queued messages go to the old one.
  *
  * @param      stream  Stream
  */
 void set_log_stream (FILE *stream);
 
-FILE *get_log_stream ();
-
 /**
- * @brief      Write current time in HH:MM:SS format to given buffer
- *
- * @param[out] buf       Output buffer
- * @param[in]  buf_size  Buffer size
+ * @brief      Send logs of calling thread to stream, nullptr returns them to the common one.
+ *             Queued messages of thread are written to the old stream before the switch.
  */
-static inline void current_time (char *buf, size_t buf_size)
-{
-    assert (buf != nullptr && "pointer can't be null");
-    assert (buf_size >= 9 && "Small buffer");
-
-    time_t rawtime;
-    struct tm * timeinfo;
+void set_thread_log_stream (FILE *stream);
 
-    time ( &rawtime );
-    timeinfo = localtime ( &rawtime );
+/// Stream is returned after messages queued by this thread are written to it, so direct writes keep order
+FILE *get_log_stream ();
 
-    strftime (buf, buf_size, "%H:%M:%S", timeinfo);
-}
-#endif //LOG_H
\ No newline at end of file
+/// Wait until background writer has written every queued message
+void log_flush ();
+#endif //LOG_H
@@ -0,0 +1,169 @@
+#include <assert.h>
+#include <atomic>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "log.h"
+#include "pool.h"
+
+// -------------------------------------------------------------------------------------------------
+
+/// Tasks [top, bottom) are left, owner takes from top and thieves from bottom
+struct pool_deque_t
+{
+    pthread_mutex_t lock;
+
+    int top;
+    int bottom;
+};
+
+struct pool_t
+{
+    pool_deque_t *deques;
+    int threads_cnt;
+
+    pool_task_f task;
+    void *ctx;
+
+    std::atomic<int> failed {0};
+};
+
+struct worker_arg_t
+{
+    pool_t *pool;
+    int index;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static void *worker_loop (void *arg_ptr);
+static int   take_task   (pool_t *pool, int self);
+static int   pop_task    (pool_deque_t *deque, bool own);
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int pool::run (int tasks_cnt, int threads_cnt, pool_task_f task, void *ctx)
+{
+    assert (task != nullptr && "invalid pointer");
+    assert (tasks_cnt >= 0 && "Invalid tasks count");
+
+    if (threads_cnt <= 0)        { threads_cnt = default_threads_cnt (); }
+    if (threads_cnt > tasks_cnt) { threads_cnt = tasks_cnt > 0 ? tasks_cnt : 1; }
+
+    pool_t pool = {};
+    pool.threads_cnt = threads_cnt;
+    pool.task        = task;
+    pool.ctx         = ctx;
+
+    pool.deques = (pool_deque_t *) calloc ((size_t) threads_cnt, sizeof (pool_deque_t));
+    pthread_t    *threads = (pthread_t *)    calloc ((size_t) threads_cnt, sizeof (pthread_t));
+    worker_arg_t *args    = (worker_arg_t *) calloc ((size_t) threads_cnt, sizeof (worker_arg_t));
+
+    if (pool.deques == nullptr || threads == nullptr || args == nullptr)
+    {
+        free (pool.deques);
+        free (threads);
+        free (args);
+        return ERROR;
+    }
+
+    for (int i = 0; i < threads_cnt; ++i)
+    {
+        pthread_mutex_init (&pool.deques[i].lock, nullptr);
+        pool.deques[i].top    = (int) ((long) tasks_cnt *  i      / threads_cnt);
+        pool.deques[i].bottom = (int) ((long) tasks_cnt * (i + 1) / threads_cnt);
+
+        args[i] = {&pool, i};
+    }
+
+    // Tasks of thread that failed to start are stolen by others
+    bool *started = (bool *) calloc ((size_t) threads_cnt, sizeof (bool));
+
+    for (int i = 1; i < threads_cnt && started != nullptr; ++i)
+    {
+        started[i] = (pthread_create (&threads[i], nullptr, worker_loop, &args[i]) == 0);
+        if (!started[i]) {
+            LOG (log::WRN, "Failed to start worker %d, others take its tasks", i);
+        }
+    }
+
+    worker_loop (&args[0]);
+
+    for (int i = 1; i < threads_cnt && started != nullptr; ++i)
+    {
+        if (started[i]) { pthread_join (threads[i], nullptr); }
+    }
+
+    for (int i = 0; i < threads_cnt; ++i) {
+        pthread_mutex_destroy (&pool.deques[i].lock);
+    }
+
+    free (started);
+    free (pool.deques);
+    free (threads);
+    free (args);
+
+    return pool.failed.load ();
+}
+
+int pool::default_threads_cnt ()
+{
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int) cpus : 1;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static void *worker_loop (void *arg_ptr)
+{
+    assert (arg_ptr != nullptr && "invalid pointer");
+
+    const worker_arg_t *arg = (const worker_arg_t *) arg_ptr;
+    pool_t *pool = arg->pool;
+
+    // Tasks never create new ones, so once every deque is empty the work is done
+    for (int task = take_task (pool, arg->index); task != -1; task = take_task (pool, arg->index))
+    {
+        if (!pool->task (pool->ctx, task)) {
+            pool->failed.fetch_add (1);
+        }
+    }
+
+    return nullptr;
+}
+
+static int take_task (pool_t *pool, int self)
+{
+    assert (pool != nullptr && "invalid pointer");
+
+    int task = pop_task (&pool->deques[self], true);
+
+    for (int i = 1; task == -1 && i < pool->threads_cnt; ++i) {
+        task = pop_task (&pool->deques[(self + i) % pool->threads_cnt], false);
+    }
+
+    return task;
+}
+
+static int pop_task (pool_deque_t *deque, bool own)
+{
+    assert (deque != nullptr && "invalid pointer");
+
+    int task = -1;
+
+    pthread_mutex_lock (&deque->lock);
+
+    if (deque->top < deque->bottom) {
+        task = own ? deque->top++ : --deque->bottom;
+    }
+
+    pthread_mutex_unlock (&deque->lock);
+
+    return task;
+}
@@ -0,0 +1,31 @@
+#ifndef POOL_H
+#define POOL_H
+
+/// Stages split work by function definitions, fewer of them are not worth starting threads
+const unsigned int PARALLEL_MIN_FUNCS = 16;
+
+/// Task returns false if it has failed, it may run on any thread of pool
+typedef bool (*pool_task_f)(void *ctx, int task);
+
+/**
+ * Work-stealing thread pool for a fixed set of independent tasks.
+ *
+ * Tasks are dealt to threads in contiguous blocks. Thread takes its own tasks in order from the
+ * top of its deque, and when it runs out, steals from the bottom of others, so a few heavy tasks
+ * do not leave the rest of threads idle.
+ */
+namespace pool
+{
+    /**
+     * @brief      Run task for each index in [0, tasks_cnt), calling thread is one of workers
+     *
+     * @param      threads_cnt  0 for number of online cpus
+     *
+     * @return     Number of failed tasks or ERROR if there is no memory for pool
+     */
+    int run (int tasks_cnt, int threads_cnt, pool_task_f task, void *ctx);
+
+    int default_threads_cnt ();
+}
+
+#endif
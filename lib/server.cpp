@@ -0,0 +1,351 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "server.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const int    REQUEST_FIELDS_CNT = 3;                        ///< Client cwd, input, output
+const size_t REQUEST_MAX_SIZE   = REQUEST_FIELDS_CNT * PATH_MAX;
+const size_t COPY_BUF_SIZE      = 4096;
+
+const int CONNECT_RETRIES = 50;
+const int RETRY_DELAY_US  = 100000;
+
+struct server_t
+{
+    batch_job_f job;
+    const void *ctx;
+};
+
+struct client_t
+{
+    const server_t *server;
+    int fd;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static int   listen_on    (const char *socket_path);
+static int   connect_to   (const char *socket_path);
+static bool  fill_addr    (sockaddr_un *addr, const char *socket_path);
+static void *serve_client (void *client_ptr);
+static void  handle       (const server_t *server, int fd, char *buf);
+static bool  read_request (int fd, char *buf, const char **fields);
+static bool  make_path    (char *path, const char *cwd, const char *file);
+static bool  read_all     (int fd, void *data, size_t size);
+static bool  write_all    (int fd, const void *data, size_t size);
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int server::serve (const char *socket_path, batch_job_f job, const void *ctx)
+{
+    assert (socket_path != nullptr && "invalid pointer");
+    assert (job         != nullptr && "invalid pointer");
+
+    int listen_fd = listen_on (socket_path);
+    if (listen_fd == -1) { return ERROR; }
+
+    // Client that has gone away must not kill the server
+    signal (SIGPIPE, SIG_IGN);
+
+    server_t server = {job, ctx};
+    fprintf (stderr, "Serving on %s\n", socket_path);
+
+    while (true)
+    {
+        int fd = accept4 (listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+
+            fprintf (stderr, "Failed to accept client on %s: %s\n", socket_path, strerror (errno));
+            break;
+        }
+
+        client_t *client = (client_t *) calloc (1, sizeof (client_t));
+        if (client == nullptr)
+        {
+            close (fd);
+            continue;
+        }
+
+        *client = {&server, fd};
+
+        // Without a thread client is still served, just not concurrently
+        pthread_t thread = {};
+        if (pthread_create (&thread, nullptr, serve_client, client) == 0) {
+            pthread_detach (thread);
+        } else {
+            serve_client (client);
+        }
+    }
+
+    close (listen_fd);
+    return ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int server::request (const char *socket_path, const char *input, const char *output, FILE *log_stream,
+                                                                                    bool wait)
+{
+    assert (socket_path != nullptr && "invalid pointer");
+    assert (input       != nullptr && "invalid pointer");
+    assert (output      != nullptr && "invalid pointer");
+    assert (log_stream  != nullptr && "invalid pointer");
+
+    int fd = connect_to (socket_path);
+
+    // Server that has just been started may not listen yet
+    for (int i = 0; wait && fd == -1 && i < CONNECT_RETRIES; ++i)
+    {
+        usleep (RETRY_DELAY_US);
+        fd = connect_to (socket_path);
+    }
+
+    if (fd == -1) { return NO_SERVER; }
+
+    char *buf = (char *) calloc (PATH_MAX + COPY_BUF_SIZE, sizeof (char));
+    bool success = (buf != nullptr && getcwd (buf, PATH_MAX) != nullptr);
+
+    // Paths are sent relative to client, server has its own working directory
+    success = success && write_all (fd, buf,    strlen (buf)    + 1) &&
+                         write_all (fd, input,  strlen (input)  + 1) &&
+                         write_all (fd, output, strlen (output) + 1) &&
+                         shutdown  (fd, SHUT_WR) == 0;
+
+    int32_t status = ERROR;
+    success = success && read_all (fd, &status, sizeof (status));
+
+    for (ssize_t len = 0; success && (len = read (fd, buf, COPY_BUF_SIZE)) > 0; ) {
+        fwrite (buf, sizeof (char), (size_t) len, log_stream);
+    }
+
+    free (buf);
+    close (fd);
+
+    return success ? status : ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static int listen_on (const char *socket_path)
+{
+    assert (socket_path != nullptr && "invalid pointer");
+
+    sockaddr_un addr = {};
+    if (!fill_addr (&addr, socket_path))
+    {
+        fprintf (stderr, "Socket path %s is too long\n", socket_path);
+        return -1;
+    }
+
+    int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) { return -1; }
+
+    bool bound = (bind (fd, (const sockaddr *) &addr, sizeof (addr)) == 0);
+
+    // Socket file of dead server refuses connections, live one keeps its socket
+    if (!bound && errno == EADDRINUSE)
+    {
+        int probe = connect_to (socket_path);
+
+        if (probe != -1)
+        {
+            close (probe);
+            close (fd);
+            fprintf (stderr, "%s is already served\n", socket_path);
+            return -1;
+        }
+
+        unlink (socket_path);
+        bound = (bind (fd, (const sockaddr *) &addr, sizeof (addr)) == 0);
+    }
+
+    if (!bound || listen (fd, SOMAXCONN) != 0)
+    {
+        fprintf (stderr, "Failed to listen on %s: %s\n", socket_path, strerror (errno));
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int connect_to (const char *socket_path)
+{
+    assert (socket_path != nullptr && "invalid pointer");
+
+    sockaddr_un addr = {};
+    if (!fill_addr (&addr, socket_path)) { return -1; }
+
+    int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) { return -1; }
+
+    if (connect (fd, (const sockaddr *) &addr, sizeof (addr)) != 0)
+    {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool fill_addr (sockaddr_un *addr, const char *socket_path)
+{
+    assert (addr        != nullptr && "invalid pointer");
+    assert (socket_path != nullptr && "invalid pointer");
+
+    if (strlen (socket_path) >= sizeof (addr->sun_path)) { return false; }
+
+    addr->sun_family = AF_UNIX;
+    strcpy (addr->sun_path, socket_path);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void *serve_client (void *client_ptr)
+{
+    assert (client_ptr != nullptr && "invalid pointer");
+
+    client_t client = *(client_t *) client_ptr;
+    free (client_ptr);
+
+    // Request and both full paths
+    char *buf = (char *) calloc (REQUEST_MAX_SIZE + 2 * PATH_MAX, sizeof (char));
+
+    if (buf != nullptr) {
+        handle (client.server, client.fd, buf);
+    }
+
+    free  (buf);
+    close (client.fd);
+
+    return nullptr;
+}
+
+static void handle (const server_t *server, int fd, char *buf)
+{
+    assert (server != nullptr && "invalid pointer");
+    assert (buf    != nullptr && "invalid pointer");
+
+    const char *fields[REQUEST_FIELDS_CNT] = {};
+    if (!read_request (fd, buf, fields)) { return; }
+
+    char *input  = buf + REQUEST_MAX_SIZE;
+    char *output = input + PATH_MAX;
+
+    int32_t status = ERROR;
+    char   *log      = nullptr;
+    size_t  log_size = 0;
+
+    if (make_path (input, fields[0], fields[1]) && make_path (output, fields[0], fields[2])) {
+        status = batch::run_captured (server->job, input, output, server->ctx, &log, &log_size);
+    }
+
+    // Client that has gone away loses its response, server goes on
+    if (write_all (fd, &status, sizeof (status)) && log != nullptr) {
+        write_all (fd, log, log_size);
+    }
+
+    free (log);
+}
+
+static bool read_request (int fd, char *buf, const char **fields)
+{
+    assert (buf    != nullptr && "invalid pointer");
+    assert (fields != nullptr && "invalid pointer");
+
+    size_t size = 0;
+
+    while (size < REQUEST_MAX_SIZE)
+    {
+        ssize_t len = read (fd, buf + size, REQUEST_MAX_SIZE - size);
+
+        if (len == -1 && errno == EINTR) { continue; }
+        if (len <= 0) { break; }
+
+        size += (size_t) len;
+    }
+
+    // Every field is terminated, even if request fills the whole buffer
+    const char *cur = buf;
+    const char *end = buf + size;
+
+    for (int i = 0; i < REQUEST_FIELDS_CNT; ++i)
+    {
+        const char *field_end = (const char *) memchr (cur, '\0', (size_t) (end - cur));
+        if (field_end == nullptr) { return false; }
+
+        fields[i] = cur;
+        cur = field_end + 1;
+    }
+
+    return cur == end;
+}
+
+static bool make_path (char *path, const char *cwd, const char *file)
+{
+    assert (path != nullptr && "invalid pointer");
+    assert (cwd  != nullptr && "invalid pointer");
+    assert (file != nullptr && "invalid pointer");
+
+    int len = (file[0] == '/') ? snprintf (path, PATH_MAX, "%s", file) :
+                                 snprintf (path, PATH_MAX, "%s/%s", cwd, file);
+
+    return len > 0 && len < PATH_MAX;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool read_all (int fd, void *data, size_t size)
+{
+    assert (data != nullptr && "invalid pointer");
+
+    for (size_t done = 0; done < size; )
+    {
+        ssize_t len = read (fd, (char *) data + done, size - done);
+
+        if (len == -1 && errno == EINTR) { continue; }
+        if (len <= 0) { return false; }
+
+        done += (size_t) len;
+    }
+
+    return true;
+}
+
+static bool write_all (int fd, const void *data, size_t size)
+{
+    assert (data != nullptr && "invalid pointer");
+
+    for (size_t done = 0; done < size; )
+    {
+        ssize_t len = write (fd, (const char *) data + done, size - done);
+
+        if (len == -1 && errno == EINTR) { continue; }
+        if (len <= 0) { return false; }
+
+        done += (size_t) len;
+    }
+
+    return true;
+}
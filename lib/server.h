@@ -0,0 +1,32 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include "batch.h"
+
+const int NO_SERVER = 3;    ///< Exit code of client when nobody listens on socket
+
+/**
+ * Compile server keeps front, middle or back resident and compiles files on request from
+ * clients over Unix domain socket, each client is served in its own thread.
+ *
+ * Request is client working directory, input path and output path, each terminated by '\0'.
+ * Response is int status of compilation followed by its log till the end of connection.
+ */
+namespace server
+{
+    /// Serve requests till killed, stale socket file of dead server is replaced. @return ERROR
+    int serve (const char *socket_path, batch_job_f job, const void *ctx);
+
+    /**
+     * @brief      Compile file on server, log is copied to log_stream
+     *
+     * @param      wait  Retry for a while if server is not listening yet
+     *
+     * @return     Status of compilation, NO_SERVER if there is no server, ERROR on broken connection
+     */
+    int request (const char *socket_path, const char *input, const char *output, FILE *log_stream,
+                                                                                    bool wait);
+}
+
+#endif
@@ -1,5 +1,9 @@
 #include <assert.h>
+#include <atomic>
+#include <spawn.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <cstdio>
 #include <cstdlib>
 #include <string.h>
@@ -15,11 +19,13 @@
 
 // -------------------------------------------------------------------------------------------------
 
-struct dfs_params
+struct dump_params
 {
     FILE *stream;
     char ** var_names;
     char **func_names;
+
+    int next_id;        ///< Nodes are numbered in pre-order, so dumps of equal trees are equal
 };
 
 // -------------------------------------------------------------------------------------------------
@@ -32,6 +38,14 @@ const int MAX_NODE_LEN = 32;
 const char PREFIX[] = "digraph G {\nnode [shape=record,style=\"filled\"]\nsplines=spline;\n";
 static const size_t DUMP_FILE_PATH_LEN = 20;
 static const char DUMP_FILE_PATH_FORMAT[] = "dump/%d.grv";
+static const size_t DUMP_BUF_SIZE = 1 << 16;
+
+static bool graph_dumps_enabled = false;
+static int  first_unrendered    = 1;
+
+static std::atomic<int> dump_counter {0};       ///< Dumps are numbered across threads of batch mode
+
+extern char **environ;
 
 // -------------------------------------------------------------------------------------------------
 // STATIC PROTOTYPES SECTION
@@ -43,10 +57,11 @@ static bool dfs_recursion (tree::node_t *node, tree::walk_f pre_exec,  void *pre
 
 static tree::node_t *load_subtree (const char **str);
 
-static bool node_codegen   (tree::node_t *node, void *void_params, bool);
-static bool middle_codegen (tree::node_t *node, void *void_params, bool);
-static bool close_subgraph (tree::node_t *node, void *void_params, bool);
+static int  dump_subtree   (const tree::node_t *node, dump_params *params);
+static bool spawn_dot      (int dump_num);
+static bool wait_dot       ();
 static const char *get_op_name (tree::op_t op);
+static bool verify_node (const tree::node_t *node);
 static void format_node (const tree::node_t *node, char *buf, char **var_names, char **func_names, const char **color);
 
 
@@ -148,6 +163,34 @@ tree::node_t *tree::copy_subtree (tree::node_t *node)
 
 // -------------------------------------------------------------------------------------------------
 
+long tree::count_nodes (const node_t *node)
+{
+    if (node == nullptr) {
+        return 0;
+    }
+
+    return 1 + count_nodes (node->left) + count_nodes (node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool tree::verify (const node_t *node)
+{
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (!verify_node (node))
+    {
+        LOG (log::ERR, "Broken node %p: type %d, data %d", node, (int) node->type, node->data);
+        return false;
+    }
+
+    return verify (node->left) && verify (node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
 int tree::graph_dump (tree_t *tree, const char *reason_fmt, char **var_names, char **func_names, ...)
 {
     assert (tree       != nullptr && "pointer can't be nullptr");
@@ -216,10 +259,11 @@ int tree::graph_dump (node_t *node, const char *reason_fmt, char **var_names, ch
     assert (reason_fmt != nullptr && "pointer can't be nullptr");
 
 
-    static int counter = 0;
-    counter++;
+    if (!graph_dumps_enabled) { return 0; }
 
-    char filepath[DUMP_FILE_PATH_LEN+1] = "";    
+    int counter = dump_counter.fetch_add (1) + 1;
+
+    char filepath[DUMP_FILE_PATH_LEN+1] = "";
     sprintf (filepath, DUMP_FILE_PATH_FORMAT, counter);
 
     FILE *dump_file = fopen (filepath, "w");
@@ -229,25 +273,18 @@ int tree::graph_dump (node_t *node, const char *reason_fmt, char **var_names, ch
         return counter;
     }
 
+    // One write per buffer instead of per line, huge trees are dumped in a moment
+    setvbuf (dump_file, nullptr, _IOFBF, DUMP_BUF_SIZE);
+
     fprintf (dump_file, PREFIX);
-    
-    dfs_params params = {dump_file, var_names, func_names};
 
-    dfs_exec (node, node_codegen,    &params,
-                    middle_codegen,    &params,
-                    close_subgraph,  &params);
+    dump_params params = {dump_file, var_names, func_names, 0};
+    dump_subtree (node, &params);
 
     fprintf (dump_file, "}\n");
 
     fclose (dump_file);
 
-    char cmd[2*DUMP_FILE_PATH_LEN+20+1] = "";
-    sprintf (cmd, "dot -T png -o %s.png %s", filepath, filepath);
-    if (system (cmd) != 0)
-    {
-        LOG (log::ERR, "Failed to execute '%s'", cmd);
-    }
-
     #if HTML_LOGS
         FILE *stream = get_log_stream ();
 
@@ -268,6 +305,51 @@ int tree::graph_dump (node_t *node, const char *reason_fmt, char **var_names, ch
 
 // -------------------------------------------------------------------------------------------------
 
+void tree::enable_graph_dumps (bool enable)
+{
+    graph_dumps_enabled = enable;
+}
+
+int tree::render_graph_dumps ()
+{
+    long max_jobs = sysconf (_SC_NPROCESSORS_ONLN);
+    if (max_jobs < 1) { max_jobs = 1; }
+
+    int  failed  = 0;
+    long running = 0;
+
+    int last_dump = dump_counter.load ();
+
+    for (int i = first_unrendered; i <= last_dump; ++i)
+    {
+        if (running == max_jobs)
+        {
+            failed += !wait_dot ();
+            running--;
+        }
+
+        if (spawn_dot (i)) {
+            running++;
+        } else {
+            failed++;
+        }
+    }
+
+    for (; running > 0; --running) {
+        failed += !wait_dot ();
+    }
+
+    first_unrendered = last_dump + 1;
+
+    if (failed > 0) {
+        LOG (log::ERR, "Failed to render %d dumps", failed);
+    }
+
+    return failed;
+}
+
+// -------------------------------------------------------------------------------------------------
+
 void tree::save_tree (tree_t *tree, FILE *stream)
 {
     assert (tree   != nullptr && "invalid pointer");
@@ -497,85 +579,87 @@ static tree::node_t *load_subtree (const char **str)
 #define WRAP_SUBGRAPH(node_type, color)                                                            \
 if (node->type == tree::node_type_t::node_type)                                                    \
 {                                                                                                  \
-    fprintf (stream, "subgraph cluster_%d {\ncolor=%s;\n", subgraph_cnt, FUNC_DEF_SUBGRAPH_COLOR); \
+    fprintf (stream, "subgraph cluster_%d {\ncolor=%s;\n", id, color);                            \
 }
 
-
-static bool node_codegen (tree::node_t *node, void *void_params, bool)
+/// @return Id of node in dump
+static int dump_subtree (const tree::node_t *node, dump_params *params)
 {
     assert (node   != nullptr && "invalid pointer");
-    assert (void_params != nullptr && "invalid pointer");
-
-    dfs_params *params = (dfs_params *) void_params;
-
-    static int subgraph_cnt = 0;
-    subgraph_cnt++;
+    assert (params != nullptr && "invalid pointer");
 
     FILE *stream = params->stream;
+    int   id     = params->next_id++;
+
     char name_buf [MAX_NODE_LEN] = "";
     const char *color_buf = "";
     format_node (node, name_buf, params->var_names, params->func_names, &color_buf);
 
-    fprintf (stream, "node_%p [label = \"%s\", fillcolor = \"%s\"]\n", node, name_buf, color_buf);
-
-    if (node->left != nullptr)
-    {
-        fprintf (stream, "node_%p -> node_%p\n", node, node->left);
-    }
-
-    if (node->right != nullptr)
-    {
-        fprintf (stream, "node_%p -> node_%p\n", node, node->right);
-    }
+    fprintf (stream, "node_%d [label = \"%s\", fillcolor = \"%s\"]\n", id, name_buf, color_buf);
 
+    // Edges go after children, their ids are unknown before. Node belongs to the cluster
+    // it is declared in, so edge placement does not move it.
     WRAP_SUBGRAPH (FUNC_DEF, FUNC_DEF_SUBGRAPH_COLOR);
     WRAP_SUBGRAPH (WHILE,       WHILE_SUBGRAPH_COLOR);
     WRAP_SUBGRAPH (ELSE,         ELSE_SUBGRAPH_COLOR);
 
-    return true;
-}
-
-// -------------------------------------------------------------------------------------------------
-
-static bool middle_codegen (tree::node_t *node, void *void_params, bool)
-{
-    assert (node   != nullptr && "invalid pointer");
-    assert (void_params != nullptr && "invalid pointer");
+    if (node->left != nullptr) {
+        fprintf (stream, "node_%d -> node_%d\n", id, dump_subtree (node->left, params));
+    }
 
-    dfs_params *params = (dfs_params *) void_params;
-    FILE *stream = params->stream;
+    if (node->type == tree::node_type_t::ELSE && node->left != nullptr) {
+        fprintf (stream, "} \nsubgraph cluster_else_%d {\ncolor=cyan;\n", id);
+    }
 
-    static int subgraph_cnt = 0;
-    subgraph_cnt++;
+    if (node->right != nullptr) {
+        fprintf (stream, "node_%d -> node_%d\n", id, dump_subtree (node->right, params));
+    }
 
-    if (node->type == tree::node_type_t::ELSE && node->left != nullptr)
+    if (node->type == tree::node_type_t::FUNC_DEF ||
+        node->type == tree::node_type_t::WHILE    ||
+        node->type == tree::node_type_t::ELSE)
     {
-        fprintf (stream, "} \nsubgraph cluster_else_%d {\ncolor=cyan;\n", subgraph_cnt);
+        fprintf (stream, "}\n");
     }
 
-    return true;
+    return id;
 }
 
+#undef WRAP_SUBGRAPH
+
 // -------------------------------------------------------------------------------------------------
 
-static bool close_subgraph (tree::node_t *node, void *void_params, bool)
+static bool spawn_dot (int dump_num)
 {
-    assert (node   != nullptr && "invalid pointer");
-    assert (void_params != nullptr && "invalid pointer");
+    char grv_path[DUMP_FILE_PATH_LEN+1]   = "";
+    char png_path[DUMP_FILE_PATH_LEN+4+1] = "";
+    sprintf (grv_path, DUMP_FILE_PATH_FORMAT, dump_num);
+    sprintf (png_path, "%s.png", grv_path);
 
-    dfs_params *params = (dfs_params *) void_params;
-    FILE *stream = params->stream;
+    char dot[] = "dot";
+    char fmt[] = "-Tpng";
+    char out[] = "-o";
+    char *argv[] = {dot, fmt, out, png_path, grv_path, nullptr};
 
-    if (node->type == tree::node_type_t::FUNC_DEF || 
-        node->type == tree::node_type_t::WHILE    || 
-        node->type == tree::node_type_t::ELSE)
+    pid_t pid = 0;
+    if (posix_spawnp (&pid, dot, nullptr, nullptr, argv, environ) != 0)
     {
-        fprintf (stream, "}\n");
+        LOG (log::ERR, "Failed to spawn dot for '%s'", grv_path);
+        return false;
     }
 
     return true;
 }
 
+/// Reap any finished dot
+static bool wait_dot ()
+{
+    int status = 0;
+    if (wait (&status) == -1) { return false; }
+
+    return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
 // -------------------------------------------------------------------------------------------------
 
 #define _PRINT(color_const, fmt, ...)   \
@@ -672,4 +756,107 @@ static const char *get_op_name (tree::op_t op)
         default:
             assert (0 && "Invalid op, possible union error");
     }
-}
\ No newline at end of file
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define EXPECT(cond)        \
+{                           \
+    if (!(cond)) {          \
+        return false;       \
+    }                       \
+}
+
+static bool verify_node (const tree::node_t *node)
+{
+    assert (node != nullptr && "invalid pointer");
+
+    const tree::node_t *left  = node->left;
+    const tree::node_t *right = node->right;
+
+    switch (node->type)
+    {
+        case tree::node_type_t::FICTIOUS:
+            return true;
+
+        case tree::node_type_t::VAL:
+            EXPECT (left == nullptr && right == nullptr);
+            return true;
+
+        case tree::node_type_t::VAR:
+        case tree::node_type_t::VAR_DEF:
+            EXPECT (node->data >= 0 && left == nullptr && right == nullptr);
+            return true;
+
+        case tree::node_type_t::IF:
+            EXPECT (left != nullptr && right != nullptr);
+            EXPECT (right->type == tree::node_type_t::ELSE && right->right != nullptr);
+            return true;
+
+        case tree::node_type_t::ELSE:
+            EXPECT (right != nullptr);
+            return true;
+
+        case tree::node_type_t::WHILE:
+            EXPECT (left != nullptr && right != nullptr);
+            return true;
+
+        case tree::node_type_t::FUNC_DEF:
+        case tree::node_type_t::FUNC_CALL:
+            EXPECT (node->data >= 0);
+            return true;
+
+        case tree::node_type_t::RETURN:
+            EXPECT (right != nullptr);
+            return true;
+
+        case tree::node_type_t::OP:
+            break;
+
+        case tree::node_type_t::NOT_SET:
+            return false;
+
+        default:
+            return false;
+    }
+
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD:
+        case tree::op_t::SUB:
+        case tree::op_t::MUL:
+        case tree::op_t::DIV:
+        case tree::op_t::EQ:
+        case tree::op_t::GT:
+        case tree::op_t::LT:
+        case tree::op_t::GE:
+        case tree::op_t::LE:
+        case tree::op_t::NEQ:
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+            EXPECT (left != nullptr && right != nullptr);
+            return true;
+
+        case tree::op_t::ASSIG:
+            EXPECT (left != nullptr && right != nullptr);
+            EXPECT (left->type == tree::node_type_t::VAR);
+            return true;
+
+        case tree::op_t::SQRT:
+        case tree::op_t::SIN:
+        case tree::op_t::COS:
+        case tree::op_t::OUTPUT:
+        case tree::op_t::NOT:
+            EXPECT (right != nullptr);
+            return true;
+
+        case tree::op_t::INPUT:
+            EXPECT (left == nullptr && right == nullptr);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+#undef EXPECT
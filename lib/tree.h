@@ -86,6 +86,9 @@ namespace tree
 
     tree::node_t *copy_subtree (tree::node_t *node);
 
+    long count_nodes (const node_t *node);
+    bool verify      (const node_t *node);
+
     int graph_dump (tree_t *tree, const char *reason_fmt, char **var_names, char **func_names, ...);
     int graph_dump (node_t *node, const char *reason_fmt, char **var_names, char **func_names, ...);
     int graph_dump (node_t *node, const char *reason_fmt, char **var_names, char **func_names, va_list args);
@@ -93,6 +96,17 @@ namespace tree
     int graph_dump (node_t *node, const char *reason_fmt, ...);
     int graph_dump (node_t *node, const char *reason_fmt, va_list args);
 
+    /// Dumps are off by default, graph_dump is a no-op returning 0 until they are enabled
+    void enable_graph_dumps (bool enable);
+
+    /**
+     * @brief Render to png every dump written since the previous call. graph_dump only writes
+     *        .grv, so dot never runs on the compile path: call this once the output is ready.
+     *
+     * @return Number of dumps that failed to render
+     */
+    int  render_graph_dumps ();
+
     void    save_tree (tree_t *tree, FILE *stream);
     void    save_tree (node_t *tree, FILE *stream);
     node_t *load_tree (              const char *content);
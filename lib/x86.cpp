@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "x86.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const size_t DEFAULT_CODE_CAPACITY = 4096;
+
+// -------------------------------------------------------------------------------------------------
+
+static void emit_rex    (x86_code_t *code, bool wide, int reg, int index, int base);
+static void emit_opcode (x86_code_t *code, unsigned opcode);
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int x86::ctor (x86_code_t *code)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    *code = {};
+
+    code->data     = (uint8_t *) calloc (DEFAULT_CODE_CAPACITY, sizeof (uint8_t));
+    code->capacity = DEFAULT_CODE_CAPACITY;
+    code->oom      = (code->data == nullptr);
+
+    return code->oom ? ERROR : 0;
+}
+
+void x86::dtor (x86_code_t *code)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    free (code->data);
+    *code = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void x86::emit_byte (x86_code_t *code, uint8_t byte)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    if (code->oom) { return; }
+
+    if (code->size == code->capacity)
+    {
+        uint8_t *new_data = (uint8_t *) realloc (code->data, 2 * code->capacity);
+        if (new_data == nullptr)
+        {
+            code->oom = true;
+            return;
+        }
+
+        code->data      = new_data;
+        code->capacity *= 2;
+    }
+
+    code->data[code->size++] = byte;
+}
+
+void x86::emit_u32 (x86_code_t *code, uint32_t val)
+{
+    for (int i = 0; i < 4; ++i) {
+        emit_byte (code, (uint8_t) (val >> (8 * i)));
+    }
+}
+
+void x86::emit_u64 (x86_code_t *code, uint64_t val)
+{
+    for (int i = 0; i < 8; ++i) {
+        emit_byte (code, (uint8_t) (val >> (8 * i)));
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void x86::emit_rr (x86_code_t *code, unsigned opcode, int reg, int rm, bool wide)
+{
+    emit_rex    (code, wide, reg, -1, rm);
+    emit_opcode (code, opcode);
+    emit_byte   (code, (uint8_t) (0xC0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+void x86::emit_rm (x86_code_t *code, unsigned opcode, int reg, int base, int index,
+                                                                    int32_t disp, bool wide)
+{
+    emit_rex    (code, wide, reg, index, base);
+    emit_opcode (code, opcode);
+
+    // rsp/r12 as base need SIB byte, disp32 form is used always for simplicity
+    if (index < 0 && (base & 7) != RSP)
+    {
+        emit_byte (code, (uint8_t) (0x80 | (reg & 7) << 3 | (base & 7)));
+    }
+    else
+    {
+        emit_byte (code, (uint8_t) (0x80 | (reg & 7) << 3 | RSP));
+        emit_byte (code, (uint8_t) ((index >= 0 ? 2 << 6 : 0) |
+                                    (index >= 0 ? index & 7 : RSP) << 3 | (base & 7)));
+    }
+
+    emit_u32 (code, (uint32_t) disp);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void x86::emit_mov_imm (x86_code_t *code, reg_t dst, uint32_t imm)
+{
+    emit_rex  (code, false, 0, -1, dst);
+    emit_byte (code, (uint8_t) (0xB8 + (dst & 7)));
+    emit_u32  (code, imm);
+}
+
+void x86::emit_mov_imm64 (x86_code_t *code, reg_t dst, uint64_t imm)
+{
+    emit_rex  (code, true, 0, -1, dst);
+    emit_byte (code, (uint8_t) (0xB8 + (dst & 7)));
+    emit_u64  (code, imm);
+}
+
+void x86::emit_push (x86_code_t *code, reg_t reg)
+{
+    emit_rex  (code, false, 0, -1, reg);
+    emit_byte (code, (uint8_t) (0x50 + (reg & 7)));
+}
+
+void x86::emit_pop (x86_code_t *code, reg_t reg)
+{
+    emit_rex  (code, false, 0, -1, reg);
+    emit_byte (code, (uint8_t) (0x58 + (reg & 7)));
+}
+
+void x86::emit_setcc (x86_code_t *code, cond_t cond, reg_t dst)
+{
+    // REX is forced, so spl/bpl/sil/dil are used instead of ah/ch/dh/bh
+    emit_byte   (code, (uint8_t) (0x40 | ((dst >> 3) & 1)));
+    emit_opcode (code, 0x0F90u | (unsigned) cond);
+    emit_byte   (code, (uint8_t) (0xC0 | (dst & 7)));
+
+    emit_rr (code, 0x0FB6, dst, dst, false);                                // movzx r32, r8
+}
+
+// -------------------------------------------------------------------------------------------------
+
+size_t x86::emit_jcc (x86_code_t *code, cond_t cond)
+{
+    emit_byte (code, 0x0F);
+    emit_byte (code, (uint8_t) (0x80 | cond));
+
+    size_t pos = code->size;
+    emit_u32 (code, 0);
+    return pos;
+}
+
+size_t x86::emit_jmp (x86_code_t *code)
+{
+    emit_byte (code, 0xE9);
+
+    size_t pos = code->size;
+    emit_u32 (code, 0);
+    return pos;
+}
+
+size_t x86::emit_call (x86_code_t *code)
+{
+    emit_byte (code, 0xE8);
+
+    size_t pos = code->size;
+    emit_u32 (code, 0);
+    return pos;
+}
+
+void x86::patch_rel32 (x86_code_t *code, size_t pos, size_t target)
+{
+    assert (code != nullptr && "invalid pointer");
+
+    if (code->oom) { return; }
+
+    assert (pos + 4 <= code->size && "invalid position");
+
+    uint32_t rel = (uint32_t) ((int64_t) target - (int64_t) (pos + 4));
+    memcpy (code->data + pos, &rel, sizeof (rel));
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static void emit_rex (x86_code_t *code, bool wide, int reg, int index, int base)
+{
+    uint8_t rex = (uint8_t) (0x40 | (wide ? 0x08 : 0) | ((reg >> 3) & 1) << 2 |
+                                   ((index >= 0 ? index >> 3 : 0) & 1) << 1 | ((base >> 3) & 1));
+
+    if (rex != 0x40) {
+        x86::emit_byte (code, rex);
+    }
+}
+
+static void emit_opcode (x86_code_t *code, unsigned opcode)
+{
+    if (opcode > 0xFF) {
+        x86::emit_byte (code, (uint8_t) (opcode >> 8));
+    }
+
+    x86::emit_byte (code, (uint8_t) opcode);
+}
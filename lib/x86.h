@@ -0,0 +1,77 @@
+#ifndef X86_H
+#define X86_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Minimal x86-64 machine code encoder, shared by jit and native backend
+namespace x86
+{
+    enum reg_t
+    {
+        RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8,      R9,  R10, R11, R12, R13, R14, R15,
+    };
+
+    /// Condition codes, low nibble of jcc/setcc opcode
+    enum cond_t
+    {
+        CC_B  = 0x2,
+        CC_AE = 0x3,
+        CC_E  = 0x4,
+        CC_NE = 0x5,
+        CC_BE = 0x6,
+        CC_A  = 0x7,
+        CC_S  = 0x8,
+        CC_NS = 0x9,
+        CC_L  = 0xC,
+        CC_GE = 0xD,
+        CC_LE = 0xE,
+        CC_G  = 0xF,
+    };
+}
+
+struct x86_code_t
+{
+    uint8_t *data;
+    size_t   size;
+    size_t   capacity;
+
+    bool oom;               ///< Some bytes were lost, code is broken
+};
+
+namespace x86
+{
+    /// @return 0 or ERROR on OOM
+    int  ctor (x86_code_t *code);
+    void dtor (x86_code_t *code);
+
+    void emit_byte (x86_code_t *code, uint8_t  byte);
+    void emit_u32  (x86_code_t *code, uint32_t val);
+    void emit_u64  (x86_code_t *code, uint64_t val);
+
+    /**
+     * @brief      Opcode with ModRM in register form. Two-byte opcodes are passed as 0x0Fxx,
+     *             reg is register or opcode extension (/digit).
+     */
+    void emit_rr (x86_code_t *code, unsigned opcode, int reg, int rm, bool wide);
+
+    /// Opcode with ModRM in memory form [base + index*4 + disp32], index < 0 for none
+    void emit_rm (x86_code_t *code, unsigned opcode, int reg, int base, int index,
+                                                                    int32_t disp, bool wide);
+
+    void emit_mov_imm   (x86_code_t *code, reg_t dst, uint32_t imm);   ///< mov r32, imm32
+    void emit_mov_imm64 (x86_code_t *code, reg_t dst, uint64_t imm);   ///< mov r64, imm64
+    void emit_push      (x86_code_t *code, reg_t reg);
+    void emit_pop       (x86_code_t *code, reg_t reg);
+    void emit_setcc     (x86_code_t *code, cond_t cond, reg_t dst);    ///< dst = cond ? 1 : 0
+
+    /// @return Position of rel32 to patch
+    size_t emit_jcc  (x86_code_t *code, cond_t cond);
+    size_t emit_jmp  (x86_code_t *code);
+    size_t emit_call (x86_code_t *code);
+
+    void patch_rel32 (x86_code_t *code, size_t pos, size_t target);
+}
+
+#endif
@@ -0,0 +1,397 @@
+#include <cassert>
+#include <cstdlib>
+#include "../lib/log.h"
+#include "evaluator.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const int MAX_EVAL_DEPTH = 256;
+const int MAX_EVAL_ARGS  = 64;
+
+// -------------------------------------------------------------------------------------------------
+
+struct eval_ctx_t
+{
+    const func_table_t *funcs;
+
+    int fuel;
+    int depth;
+};
+
+struct frame_t
+{
+    int  *vals;
+    bool *inited;
+    int   size;
+};
+
+enum class exec_t
+{
+    NORMAL,
+    RETURNED,
+    FAIL,
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static bool   call_func  (eval_ctx_t *ctx, int func, const int *args, int n_args, int *result);
+static exec_t exec_stmt  (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node, int *result);
+static bool   eval_expr  (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node, int *result);
+static bool   eval_op    (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node, int *result);
+static bool   eval_args  (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node,
+                                                                        int *args, int *n_args);
+static bool   bind_params (frame_t *frame, const tree::node_t *node, const int *args, int n_args,
+                                                                                     int *bound);
+static int    max_var    (const tree::node_t *node);
+
+// -------------------------------------------------------------------------------------------------
+
+#define SPEND_FUEL()                \
+{                                   \
+    if (--ctx->fuel < 0) {          \
+        return false;               \
+    }                               \
+}
+
+#define TRY(cond)       \
+{                       \
+    if (!(cond))        \
+    {                   \
+        return false;   \
+    }                   \
+}
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+bool evaluator::eval_call (const func_table_t *funcs, const tree::node_t *call, int *result, int fuel)
+{
+    assert (funcs  != nullptr && "invalid pointer");
+    assert (call   != nullptr && "invalid pointer");
+    assert (result != nullptr && "invalid pointer");
+    assert (call->type == tree::node_type_t::FUNC_CALL && "Invalid call");
+
+    eval_ctx_t ctx = {funcs, fuel, 0};
+
+    int args[MAX_EVAL_ARGS] = {};
+    int n_args = 0;
+
+    // Args are constants, so they don't need a frame
+    frame_t no_frame = {nullptr, nullptr, 0};
+    TRY (eval_args (&ctx, &no_frame, call->right, args, &n_args));
+
+    return call_func (&ctx, call->data, args, n_args, result);
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static bool call_func (eval_ctx_t *ctx, int func, const int *args, int n_args, int *result)
+{
+    assert (ctx    != nullptr && "invalid pointer");
+    assert (args   != nullptr && "invalid pointer");
+    assert (result != nullptr && "invalid pointer");
+
+    TRY (func_table::is_pure (ctx->funcs, func));
+    TRY (ctx->depth < MAX_EVAL_DEPTH);
+
+    const tree::node_t *def = func_table::get_def (ctx->funcs, func);
+    assert (def != nullptr && "Pure function must be defined");
+
+    frame_t frame = {};
+    frame.size   = max_var (def) + 1;
+    frame.vals   = (int *)  calloc ((size_t) frame.size + 1, sizeof (int));
+    frame.inited = (bool *) calloc ((size_t) frame.size + 1, sizeof (bool));
+
+    exec_t res = exec_t::FAIL;
+    int bound  = 0;
+
+    if (frame.vals != nullptr && frame.inited != nullptr &&
+        bind_params (&frame, def->left, args, n_args, &bound) && bound == n_args)
+    {
+        ctx->depth++;
+        res = exec_stmt (ctx, &frame, def->right, result);
+        ctx->depth--;
+    }
+
+    free (frame.vals);
+    free (frame.inited);
+
+    // Falling off the end of function body continues execution after FUNC_DEF at runtime
+    return res == exec_t::RETURNED;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define TRY_STMT(cond)          \
+{                               \
+    if (!(cond))                \
+    {                           \
+        return exec_t::FAIL;    \
+    }                           \
+}
+
+static exec_t exec_stmt (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node, int *result)
+{
+    assert (ctx    != nullptr && "invalid pointer");
+    assert (frame  != nullptr && "invalid pointer");
+    assert (result != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return exec_t::NORMAL;
+    }
+
+    TRY_STMT (--ctx->fuel >= 0);
+
+    exec_t res = exec_t::NORMAL;
+    int val    = 0;
+
+    switch (node->type)
+    {
+        case tree::node_type_t::FICTIOUS:
+            res = exec_stmt (ctx, frame, node->left, result);
+            if (res != exec_t::NORMAL) { return res; }
+            return exec_stmt (ctx, frame, node->right, result);
+
+        case tree::node_type_t::VAR_DEF:
+            return exec_t::NORMAL;
+
+        case tree::node_type_t::RETURN:
+            TRY_STMT (eval_expr (ctx, frame, node->right, result));
+            return exec_t::RETURNED;
+
+        case tree::node_type_t::IF:
+            TRY_STMT (eval_expr (ctx, frame, node->left, &val));
+
+            if (node->right->left != nullptr) {
+                return exec_stmt (ctx, frame, val ? node->right->left : node->right->right, result);
+            } else {
+                return val ? exec_stmt (ctx, frame, node->right->right, result) : exec_t::NORMAL;
+            }
+
+        case tree::node_type_t::WHILE:
+            while (true)
+            {
+                TRY_STMT (eval_expr (ctx, frame, node->left, &val));
+                if (!val) { return exec_t::NORMAL; }
+
+                res = exec_stmt (ctx, frame, node->right, result);
+                if (res != exec_t::NORMAL) { return res; }
+            }
+
+        case tree::node_type_t::VAL:
+        case tree::node_type_t::VAR:
+        case tree::node_type_t::OP:
+        case tree::node_type_t::FUNC_CALL:
+            TRY_STMT (eval_expr (ctx, frame, node, &val));
+            return exec_t::NORMAL;
+
+        case tree::node_type_t::FUNC_DEF:
+        case tree::node_type_t::ELSE:
+        case tree::node_type_t::NOT_SET:
+            return exec_t::FAIL;
+
+        default:
+            assert (0 && "Unexpected node");
+            return exec_t::FAIL;
+    }
+}
+
+#undef TRY_STMT
+
+// -------------------------------------------------------------------------------------------------
+
+static bool eval_expr (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node, int *result)
+{
+    assert (ctx    != nullptr && "invalid pointer");
+    assert (frame  != nullptr && "invalid pointer");
+    assert (result != nullptr && "invalid pointer");
+
+    TRY (node != nullptr);
+    SPEND_FUEL ();
+
+    int args[MAX_EVAL_ARGS] = {};
+    int n_args = 0;
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (node->type)
+    {
+        case tree::node_type_t::VAL:
+            *result = node->data;
+            return true;
+
+        case tree::node_type_t::VAR:
+            // Reading uninitialized local gives garbage from old frames at runtime
+            TRY (node->data < frame->size && frame->inited[node->data]);
+            *result = frame->vals[node->data];
+            return true;
+
+        case tree::node_type_t::OP:
+            return eval_op (ctx, frame, node, result);
+
+        case tree::node_type_t::FUNC_CALL:
+            TRY (eval_args (ctx, frame, node->right, args, &n_args));
+            return call_func (ctx, node->data, args, n_args, result);
+
+        default:
+            return false;
+    }
+    #pragma GCC diagnostic pop
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define BINARY(expr)                                            \
+{                                                               \
+    TRY (eval_expr (ctx, frame, node->left,  &lhs));            \
+    TRY (eval_expr (ctx, frame, node->right, &rhs));            \
+    expr;                                                       \
+    return true;                                                \
+}
+
+static bool eval_op (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node, int *result)
+{
+    assert (ctx    != nullptr && "invalid pointer");
+    assert (frame  != nullptr && "invalid pointer");
+    assert (node   != nullptr && "invalid pointer");
+    assert (result != nullptr && "invalid pointer");
+
+    int lhs = 0;
+    int rhs = 0;
+
+    switch ((tree::op_t) node->data)
+    {
+        case tree::op_t::ADD: BINARY (TRY (!__builtin_add_overflow (lhs, rhs, result)));
+        case tree::op_t::SUB: BINARY (TRY (!__builtin_sub_overflow (lhs, rhs, result)));
+        case tree::op_t::MUL: BINARY (TRY (!__builtin_mul_overflow (lhs, rhs, result)));
+
+        case tree::op_t::EQ:  BINARY (*result = (lhs == rhs));
+        case tree::op_t::GT:  BINARY (*result = (lhs >  rhs));
+        case tree::op_t::LT:  BINARY (*result = (lhs <  rhs));
+        case tree::op_t::GE:  BINARY (*result = (lhs >= rhs));
+        case tree::op_t::LE:  BINARY (*result = (lhs <= rhs));
+        case tree::op_t::NEQ: BINARY (*result = (lhs != rhs));
+
+        case tree::op_t::AND:
+            TRY (eval_expr (ctx, frame, node->left, &lhs));
+            if (!lhs) { *result = 0; return true; }
+            TRY (eval_expr (ctx, frame, node->right, &rhs));
+            *result = (rhs != 0);
+            return true;
+
+        case tree::op_t::OR:
+            TRY (eval_expr (ctx, frame, node->left, &lhs));
+            if (lhs) { *result = 1; return true; }
+            TRY (eval_expr (ctx, frame, node->right, &rhs));
+            *result = (rhs != 0);
+            return true;
+
+        case tree::op_t::NOT:
+            TRY (eval_expr (ctx, frame, node->right, &rhs));
+            *result = !rhs;
+            return true;
+
+        case tree::op_t::ASSIG:
+            TRY (node->left->data < frame->size);
+            TRY (eval_expr (ctx, frame, node->right, result));
+            frame->vals  [node->left->data] = *result;
+            frame->inited[node->left->data] = true;
+            return true;
+
+        // Runtime semantics of these is up to target, so they are left to it
+        case tree::op_t::DIV:
+        case tree::op_t::SQRT:
+        case tree::op_t::SIN:
+        case tree::op_t::COS:
+        case tree::op_t::INPUT:
+        case tree::op_t::OUTPUT:
+            return false;
+
+        default:
+            assert (0 && "Unexpected op");
+            return false;
+    }
+}
+
+#undef BINARY
+
+// -------------------------------------------------------------------------------------------------
+
+/// Args are flattened in the same order as backend pushes them
+static bool eval_args (eval_ctx_t *ctx, frame_t *frame, const tree::node_t *node,
+                                                                        int *args, int *n_args)
+{
+    assert (ctx    != nullptr && "invalid pointer");
+    assert (args   != nullptr && "invalid pointer");
+    assert (n_args != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::FICTIOUS) {
+        TRY (eval_args (ctx, frame, node->left,  args, n_args));
+        TRY (eval_args (ctx, frame, node->right, args, n_args));
+        return true;
+    }
+
+    TRY (*n_args < MAX_EVAL_ARGS);
+    TRY (eval_expr (ctx, frame, node, &args[*n_args]));
+    (*n_args)++;
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool bind_params (frame_t *frame, const tree::node_t *node, const int *args, int n_args,
+                                                                                     int *bound)
+{
+    assert (frame != nullptr && "invalid pointer");
+    assert (args  != nullptr && "invalid pointer");
+    assert (bound != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::FICTIOUS) {
+        TRY (bind_params (frame, node->left,  args, n_args, bound));
+        TRY (bind_params (frame, node->right, args, n_args, bound));
+        return true;
+    }
+
+    TRY (node->type == tree::node_type_t::VAR);
+    TRY (*bound < n_args && node->data < frame->size);
+
+    frame->vals  [node->data] = args[*bound];
+    frame->inited[node->data] = true;
+    (*bound)++;
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int max_var (const tree::node_t *node)
+{
+    if (node == nullptr) {
+        return -1;
+    }
+
+    int res = -1;
+    if (node->type == tree::node_type_t::VAR || node->type == tree::node_type_t::VAR_DEF) {
+        res = node->data;
+    }
+
+    int left  = max_var (node->left);
+    int right = max_var (node->right);
+
+    if (left  > res) { res = left;  }
+    if (right > res) { res = right; }
+
+    return res;
+}
@@ -0,0 +1,25 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include "../lib/tree.h"
+#include "../lib/func_table.h"
+
+const int EVAL_DEFAULT_FUEL = 100000;
+
+namespace evaluator
+{
+    /**
+     * @brief      Execute call of pure function with constant (VAL) args at compile time
+     *
+     * @param      funcs   Function table of the program
+     * @param      call    FUNC_CALL node, all args must be VAL nodes
+     * @param[out] result  Returned value
+     * @param      fuel    Max number of evaluated nodes
+     *
+     * @return     false if call can't be evaluated: callee is impure, result depends on
+     *             runtime-defined behaviour (overflow, division, builtins) or fuel ran out
+     */
+    bool eval_call (const func_table_t *funcs, const tree::node_t *call, int *result, int fuel);
+}
+
+#endif
@@ -2,7 +2,11 @@
 #include <cstdio>
 #include <string.h>
 #include "optimizer.h"
+#include "pass_manager.h"
+#include "../lib/batch.h"
+#include "../lib/cache.h"
 #include "../lib/file.h"
+#include "../lib/server.h"
 #include "../lib/common.h"
 
 // -------------------------------------------------------------------------------------------------
@@ -18,25 +22,137 @@
 
 // -------------------------------------------------------------------------------------------------
 
+struct middle_opts_t
+{
+    pass_manager_t pm;          ///< Configured pipeline, each file runs its own copy
+    bool time_passes;
+
+    const char *const *flags;   ///< Flags as given, they are part of cache key
+    int flags_cnt;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static int  compile_file (const char *input_path, const char *output_path, const middle_opts_t *opts);
+static int  batch_job    (const char *input_path, const char *output_path, const void *opts);
+static void print_usage  ();
+
+// -------------------------------------------------------------------------------------------------
+
 int main (int argc, const char *argv[])
 {
     tree::node_t *ast = nullptr;
 
-    ERR_CASE (argc != 3 || (strcmp (argv[1], "-h") == 0), "Usage: ./back <input ast file> <output asm file>");
-    
-    const file_t src = open_ro_file (argv[1]);
-    ERR_CASE (src.content == nullptr, "Failed to open file %s", argv[1]);
+    batch_opts_t batch = {};
+    int batch_flags = batch::parse_flags (argc, argv, &batch);
+
+    if (batch_flags == ERROR)
+    {
+        print_usage ();
+        return ERROR;
+    }
+
+    argc -= batch_flags;
+    argv += batch_flags;
+
+    middle_opts_t opts = {};
+    pass_manager::ctor (&opts.pm);
+
+    int flag_cnt = 1;
+    for (; flag_cnt < argc && argv[flag_cnt][0] == '-'; ++flag_cnt)
+    {
+        const char *flag = argv[flag_cnt];
+
+        if (strcmp (flag, "-h") == 0) {
+            print_usage ();
+            return ERROR;
+        } else if (strcmp (flag, "--time-passes") == 0) {
+            opts.time_passes = true;
+        } else if (strncmp (flag, "--passes=", strlen ("--passes=")) == 0) {
+            ERR_CASE (pass_manager::set_passes (&opts.pm, flag + strlen ("--passes=")) == ERROR,
+                                                                    "Invalid pass list: %s", flag);
+        } else if (flag[1] == 'O' && flag[2] >= '0' && flag[2] <= '9' && flag[3] == '\0') {
+            pass_manager::set_opt_level (&opts.pm, flag[2] - '0');
+        } else {
+            ERR_CASE (true, "Unknown flag %s", flag);
+        }
+    }
+
+    opts.flags     = argv + 1;
+    opts.flags_cnt = flag_cnt - 1;
+
+    if (batch_flags != 0)
+    {
+        // Reports of parallel files would interleave
+        ERR_CASE (opts.time_passes, "--time-passes is not supported in batch and server modes");
+        ERR_CASE (argc != flag_cnt, "No input files are expected with --batch and --serve");
+
+        // Files already run in parallel, functions of each file stay on its thread
+        opts.pm.threads = 1;
+
+        if (batch.socket != nullptr) {
+            return server::serve (batch.socket, batch_job, &opts);
+        }
+
+        return batch::run (&batch, batch_job, &opts);
+    }
+
+    if (argc - flag_cnt != 2)
+    {
+        print_usage ();
+        return ERROR;
+    }
+
+    return compile_file (argv[flag_cnt], argv[flag_cnt + 1], &opts);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int compile_file (const char *input_path, const char *output_path, const middle_opts_t *opts)
+{
+    assert (input_path  != nullptr && "invalid pointer");
+    assert (output_path != nullptr && "invalid pointer");
+    assert (opts        != nullptr && "invalid pointer");
+
+    tree::node_t *ast = nullptr;
+    pass_manager_t pm = opts->pm;
+
+    const file_t src = open_ro_file (input_path);
+    ERR_CASE (src.content == nullptr, "Failed to open file %s", input_path);
+
+    // Pass timings are wanted from the real run
+    cache_t cache = {};
+    if (!opts->time_passes) {
+        cache::ctor (&cache, "middle", opts->flags, opts->flags_cnt, src.content, src.size);
+    }
+
+    if (cache::fetch (&cache, output_path))
+    {
+        unmap_ro_file (src);
+        return 0;
+    }
 
     const char *tree_section = src.content;
     while (*tree_section != '{') tree_section++;
 
     ast = tree::load_tree (tree_section);
+    if (ast == nullptr) { unmap_ro_file (src); }
     ERR_CASE (ast == nullptr, "Failed to load AST tree");
 
-    FILE *output_file = fopen (argv[2], "w");
-    ERR_CASE (output_file == nullptr, "Failed to open file %s", argv[2]);
+    FILE *output_file = fopen (output_path, "w");
+    if (output_file == nullptr) { unmap_ro_file (src); }
+    ERR_CASE (output_file == nullptr, "Failed to open file %s", output_path);
 
-    optimize (ast);
+    if (!pass_manager::run (&pm, ast))
+    {
+        unmap_ro_file (src);
+        fclose (output_file);
+        ERR_CASE (true, "Optimization failed, see logs");
+    }
+
+    if (opts->time_passes) {
+        pass_manager::print_report (&pm, stderr);
+    }
 
     fwrite (src.content, sizeof (char), (size_t) (tree_section - src.content), output_file);
     tree::save_tree (ast, output_file);
@@ -44,4 +160,29 @@ int main (int argc, const char *argv[])
     unmap_ro_file (src);
     fclose (output_file);
     tree::del_node (ast);
-}
\ No newline at end of file
+
+    cache::store (&cache, output_path);
+    return 0;
+}
+
+static int batch_job (const char *input_path, const char *output_path, const void *opts)
+{
+    return compile_file (input_path, output_path, (const middle_opts_t *) opts);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void print_usage ()
+{
+    fprintf (stderr, "Usage: ./middle (flags) <input ast file> <output ast file>\n"
+                     "       ./middle --batch=<manifest> [--jobs=<n>] (flags)\n"
+                     "       ./middle --serve=<socket> (flags)\n"
+                     "      -O<N>             optimization level, default -O%d\n"
+                     "      --passes=a,b,...  run given passes instead of -O pipeline\n"
+                     "      --time-passes     print per-pass time & statistics to stderr\n"
+                     "      --batch           compile each \"<input> <output>\" line of manifest in parallel\n"
+                     "      --serve           stay resident and compile files sent by bin/client\n"
+                     "Passes:\n", DEFAULT_OPT_LEVEL);
+
+    pass_manager::list_passes (stderr);
+}
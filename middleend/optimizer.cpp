@@ -1,10 +1,14 @@
 #include <cassert>
+#include "../lib/func_table.h"
+#include "evaluator.h"
 #include "optimizer.h"
 
 
 static bool subtree_optimize_const (tree::node_t *node);
 static bool optimize_const_calc (tree::node_t *node);
 static bool optimize_const_comp (tree::node_t *node);
+static bool optimize_const_call (tree::node_t *node, const func_table_t *funcs);
+static bool is_const_args       (const tree::node_t *node);
 
 // -------------------------------------------------------------------------------------------------
 
@@ -21,12 +25,31 @@ static bool optimize_const_comp (tree::node_t *node);
 
 // -------------------------------------------------------------------------------------------------
 
-void optimize (tree::node_t *node)
+bool optimize_const_fold (tree::node_t *node)
 {
+    bool changed = false;
+
     while (subtree_optimize_const (node))
     {
-        ;
+        changed = true;
+    }
+
+    return changed;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool optimize_const_calls (tree::node_t *node)
+{
+    func_table_t funcs = {};
+    if (func_table::ctor (&funcs, node) != 0) {
+        return false;
     }
+
+    bool changed = optimize_const_call (node, &funcs);
+
+    func_table::dtor (&funcs);
+    return changed;
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -83,6 +106,7 @@ static bool subtree_optimize_const (tree::node_t *node)
 #define SET_VALUE(val)                                      \
     tree::change_node (node, tree::node_type_t::VAL, val);  \
     del_childs (node);                                      \
+    changed = true;                                         \
 
 // -------------------------------------------------------------------------------------------------
 
@@ -159,4 +183,46 @@ static bool optimize_const_comp (tree::node_t *node)
     #pragma GCC diagnostic pop
 
     return changed;
-}
\ No newline at end of file
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool optimize_const_call (tree::node_t *node, const func_table_t *funcs)
+{
+    assert (funcs != nullptr && "invalid pointer");
+
+    if (node == nullptr) {
+        return false;
+    }
+
+    bool changed = false;
+    if (optimize_const_call (node->left,  funcs)) { changed = true; }
+    if (optimize_const_call (node->right, funcs)) { changed = true; }
+
+    if (node->type != tree::node_type_t::FUNC_CALL || !is_const_args (node->right)) {
+        return changed;
+    }
+
+    int result = 0;
+    if (evaluator::eval_call (funcs, node, &result, EVAL_DEFAULT_FUEL))
+    {
+        SET_VALUE (result);
+    }
+
+    return changed;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool is_const_args (const tree::node_t *node)
+{
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::FICTIOUS) {
+        return is_const_args (node->left) && is_const_args (node->right);
+    }
+
+    return isVAL (node);
+}
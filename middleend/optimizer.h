@@ -3,6 +3,9 @@
 
 #include "../lib/tree.h"
 
-void optimize (tree::node_t *node);
+// Single passes run by pass manager, return true if tree was changed
+
+bool optimize_const_fold  (tree::node_t *node);
+bool optimize_const_calls (tree::node_t *node);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,375 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include "../lib/common.h"
+#include "../lib/log.h"
+#include "../lib/pool.h"
+#include "optimizer.h"
+#include "pass_manager.h"
+
+// -------------------------------------------------------------------------------------------------
+
+const int MAX_PASS_NAME_LEN = 32;
+
+static const pass_t PASSES[] =
+{
+    {"const-fold",  "Collapse constant arithmetic and comparisons", 1, true,  optimize_const_fold },
+    {"const-calls", "Evaluate pure calls with constant args",       2, false, optimize_const_calls},
+};
+
+static const size_t PASSES_CNT = sizeof (PASSES) / sizeof (PASSES[0]);
+
+/**
+ * Program split into units: unit 0 is the whole tree with function definitions cut out of it,
+ * others are definitions. Definitions hang off statement lists, which passes do not change, so
+ * the slots stay valid while they are cut.
+ */
+struct units_t
+{
+    tree::node_t  **roots;
+    tree::node_t ***slots;      ///< Where unit i + 1 is attached
+    unsigned int    cnt;
+    unsigned int    capacity;
+
+    const pass_t *pass;
+    bool *changed;
+    long *nodes_delta;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static const pass_t *find_pass      (const char *name, size_t name_len);
+static bool          run_pass       (pass_stat_t *stat, tree::node_t *ast);
+static bool          run_pass_split (pass_stat_t *stat, units_t *units, int threads);
+static bool          run_unit       (void *units_ptr, int unit);
+static bool          split_units    (units_t *units, tree::node_t *ast);
+static bool          collect_defs   (units_t *units, tree::node_t **slot);
+static void          free_units     (units_t *units);
+static double        now_ms         ();
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+void pass_manager::ctor (pass_manager_t *pm)
+{
+    assert (pm != nullptr && "invalid pointer");
+
+    *pm = {};
+    set_opt_level (pm, DEFAULT_OPT_LEVEL);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void pass_manager::set_opt_level (pass_manager_t *pm, int level)
+{
+    assert (pm != nullptr && "invalid pointer");
+
+    pm->size = 0;
+
+    for (size_t i = 0; i < PASSES_CNT; ++i)
+    {
+        if (PASSES[i].min_opt_level <= level)
+        {
+            assert (pm->size < MAX_PIPELINE_LEN && "Too many passes");
+            pm->pipeline[pm->size++] = {&PASSES[i], 0, 0, 0, 0};
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int pass_manager::set_passes (pass_manager_t *pm, const char *list)
+{
+    assert (pm   != nullptr && "invalid pointer");
+    assert (list != nullptr && "invalid pointer");
+
+    pm->size = 0;
+
+    while (*list != '\0')
+    {
+        size_t name_len = strcspn (list, ",");
+        const pass_t *pass = find_pass (list, name_len);
+
+        if (pass == nullptr)
+        {
+            LOG (log::ERR, "Unknown pass '%.*s'", (int) name_len, list);
+            return ERROR;
+        }
+
+        if (pm->size == MAX_PIPELINE_LEN)
+        {
+            LOG (log::ERR, "Pipeline is too long, max %d passes", MAX_PIPELINE_LEN);
+            return ERROR;
+        }
+
+        pm->pipeline[pm->size++] = {pass, 0, 0, 0, 0};
+
+        list += name_len;
+        if (*list == ',') list++;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool pass_manager::run (pass_manager_t *pm, tree::node_t *ast)
+{
+    assert (pm  != nullptr && "invalid pointer");
+    assert (ast != nullptr && "invalid pointer");
+
+    double start = now_ms ();
+    bool changed = true;
+
+    // Without memory for units everything just runs on the whole tree. Root unit is not a function
+    units_t units  = {};
+    bool parallel  = pm->threads != 1 && split_units (&units, ast) && units.cnt - 1 >= PARALLEL_MIN_FUNCS;
+
+    for (pm->iterations = 0; changed && pm->iterations < MAX_PIPELINE_ITER; pm->iterations++)
+    {
+        changed = false;
+
+        for (unsigned int i = 0; i < pm->size; ++i)
+        {
+            pass_stat_t *stat = &pm->pipeline[i];
+
+            if ((parallel && stat->pass->local) ? run_pass_split (stat, &units, pm->threads) :
+                                                  run_pass       (stat, ast))
+            {
+                changed = true;
+            }
+
+            #ifdef _DEBUG
+                if (!tree::verify (ast))
+                {
+                    LOG (log::ERR, "AST is broken after pass '%s'", stat->pass->name);
+                    free_units (&units);
+                    return false;
+                }
+            #endif
+        }
+    }
+
+    free_units (&units);
+
+    pm->total_time_ms = now_ms () - start;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void pass_manager::print_report (const pass_manager_t *pm, FILE *stream)
+{
+    assert (pm     != nullptr && "invalid pointer");
+    assert (stream != nullptr && "invalid pointer");
+
+    fprintf (stream, "===---------------------------------------------------------===\n");
+    fprintf (stream, "  Pass execution timing report, %u pipeline iteration(s)\n", pm->iterations);
+    fprintf (stream, "===---------------------------------------------------------===\n");
+    fprintf (stream, "  %-*s %6s %8s %12s %12s\n", MAX_PASS_NAME_LEN, "Name", "Runs", "Changes",
+                                                                        "Time (ms)", "Nodes delta");
+
+    for (unsigned int i = 0; i < pm->size; ++i)
+    {
+        const pass_stat_t *stat = &pm->pipeline[i];
+
+        fprintf (stream, "  %-*s %6u %8u %12.3lf %12ld\n", MAX_PASS_NAME_LEN, stat->pass->name,
+                            stat->runs, stat->changes, stat->time_ms, stat->nodes_delta);
+    }
+
+    fprintf (stream, "  %-*s %6s %8s %12.3lf\n", MAX_PASS_NAME_LEN, "Total", "", "", pm->total_time_ms);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void pass_manager::list_passes (FILE *stream)
+{
+    assert (stream != nullptr && "invalid pointer");
+
+    for (size_t i = 0; i < PASSES_CNT; ++i)
+    {
+        fprintf (stream, "  %-*s -O%d  %s\n", MAX_PASS_NAME_LEN, PASSES[i].name,
+                                                    PASSES[i].min_opt_level, PASSES[i].descr);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static const pass_t *find_pass (const char *name, size_t name_len)
+{
+    assert (name != nullptr && "invalid pointer");
+
+    for (size_t i = 0; i < PASSES_CNT; ++i)
+    {
+        if (strlen (PASSES[i].name) == name_len && strncmp (PASSES[i].name, name, name_len) == 0)
+        {
+            return &PASSES[i];
+        }
+    }
+
+    return nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool run_pass (pass_stat_t *stat, tree::node_t *ast)
+{
+    assert (stat != nullptr && "invalid pointer");
+    assert (ast  != nullptr && "invalid pointer");
+
+    long   nodes_before = tree::count_nodes (ast);
+    double start        = now_ms ();
+
+    bool changed = stat->pass->run (ast);
+
+    stat->time_ms     += now_ms () - start;
+    stat->nodes_delta += tree::count_nodes (ast) - nodes_before;
+    stat->runs++;
+
+    if (changed) {
+        stat->changes++;
+    }
+
+    return changed;
+}
+
+/// Units are cut out only for the time of the pass, so the tree is whole between passes
+static bool run_pass_split (pass_stat_t *stat, units_t *units, int threads)
+{
+    assert (stat  != nullptr && "invalid pointer");
+    assert (units != nullptr && "invalid pointer");
+
+    double start = now_ms ();
+
+    for (unsigned int i = 1; i < units->cnt; ++i) {
+        *units->slots[i] = nullptr;
+    }
+
+    units->pass = stat->pass;
+    int failed  = pool::run ((int) units->cnt, threads, run_unit, units);
+
+    for (unsigned int i = 1; i < units->cnt; ++i) {
+        *units->slots[i] = units->roots[i];
+    }
+
+    // Pool without memory has run nothing, the tree is left as it was
+    if (failed == ERROR) {
+        return run_pass (stat, units->roots[0]);
+    }
+
+    bool changed = false;
+
+    for (unsigned int i = 0; i < units->cnt; ++i)
+    {
+        changed            = changed || units->changed[i];
+        stat->nodes_delta += units->nodes_delta[i];
+    }
+
+    stat->time_ms += now_ms () - start;
+    stat->runs++;
+
+    if (changed) {
+        stat->changes++;
+    }
+
+    return changed;
+}
+
+static bool run_unit (void *units_ptr, int unit)
+{
+    assert (units_ptr != nullptr && "invalid pointer");
+
+    units_t      *units = (units_t *) units_ptr;
+    tree::node_t *root  = units->roots[unit];
+
+    long nodes_before = tree::count_nodes (root);
+
+    units->changed[unit]     = units->pass->run (root);
+    units->nodes_delta[unit] = tree::count_nodes (root) - nodes_before;
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool split_units (units_t *units, tree::node_t *ast)
+{
+    assert (units != nullptr && "invalid pointer");
+    assert (ast   != nullptr && "invalid pointer");
+
+    units->capacity = PARALLEL_MIN_FUNCS;
+    units->roots    = (tree::node_t **)  calloc (units->capacity, sizeof (tree::node_t *));
+    units->slots    = (tree::node_t ***) calloc (units->capacity, sizeof (tree::node_t **));
+
+    if (units->roots == nullptr || units->slots == nullptr) { return false; }
+
+    units->roots[0] = ast;
+    units->cnt      = 1;
+
+    if (!collect_defs (units, &ast->left) || !collect_defs (units, &ast->right)) { return false; }
+
+    units->changed     = (bool *) calloc (units->cnt, sizeof (bool));
+    units->nodes_delta = (long *) calloc (units->cnt, sizeof (long));
+
+    return units->changed != nullptr && units->nodes_delta != nullptr;
+}
+
+static bool collect_defs (units_t *units, tree::node_t **slot)
+{
+    assert (units != nullptr && "invalid pointer");
+    assert (slot  != nullptr && "invalid pointer");
+
+    tree::node_t *node = *slot;
+    if (node == nullptr) { return true; }
+
+    if (node->type != tree::node_type_t::FUNC_DEF) {
+        return collect_defs (units, &node->left) && collect_defs (units, &node->right);
+    }
+
+    if (units->cnt == units->capacity)
+    {
+        unsigned int new_capacity = 2 * units->capacity;
+
+        tree::node_t  **new_roots = (tree::node_t **)  realloc (units->roots, new_capacity * sizeof (tree::node_t *));
+        if (new_roots == nullptr) { return false; }
+        units->roots = new_roots;
+
+        tree::node_t ***new_slots = (tree::node_t ***) realloc (units->slots, new_capacity * sizeof (tree::node_t **));
+        if (new_slots == nullptr) { return false; }
+        units->slots = new_slots;
+
+        units->capacity = new_capacity;
+    }
+
+    units->roots[units->cnt] = node;
+    units->slots[units->cnt] = slot;
+    units->cnt++;
+
+    return true;
+}
+
+static void free_units (units_t *units)
+{
+    assert (units != nullptr && "invalid pointer");
+
+    free (units->roots);
+    free (units->slots);
+    free (units->changed);
+    free (units->nodes_delta);
+
+    *units = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static double now_ms ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
@@ -0,0 +1,66 @@
+#ifndef PASS_MANAGER_H
+#define PASS_MANAGER_H
+
+#include <stdio.h>
+#include "../lib/tree.h"
+
+const int MAX_PIPELINE_LEN  = 16;
+const int MAX_PIPELINE_ITER = 32;
+const int DEFAULT_OPT_LEVEL = 2;
+
+/// Pass returns true if it has changed the tree
+typedef bool (*pass_f)(tree::node_t *node);
+
+struct pass_t
+{
+    const char *name;
+    const char *descr;
+    int         min_opt_level;
+    bool        local;          ///< Looks only inside one function, functions run in parallel
+
+    pass_f run;
+};
+
+struct pass_stat_t
+{
+    const pass_t *pass;
+
+    unsigned int runs;
+    unsigned int changes;
+
+    double time_ms;
+    long   nodes_delta;
+};
+
+struct pass_manager_t
+{
+    pass_stat_t pipeline[MAX_PIPELINE_LEN];
+    unsigned int size;
+
+    unsigned int iterations;
+    double total_time_ms;
+
+    int threads;                ///< Local passes run on functions in parallel, 0 for number of cpus
+};
+
+namespace pass_manager
+{
+    void ctor (pass_manager_t *pm);
+
+    void set_opt_level (pass_manager_t *pm, int level);
+    int  set_passes    (pass_manager_t *pm, const char *list);
+
+    /**
+     * @brief      Run pipeline until no pass changes the tree. In debug builds tree is verified
+     *             after each pass. Local passes run on each function definition and on the rest
+     *             of the program separately, which gives the same tree as a run on the whole one.
+     *
+     * @return     false if some pass has broken the tree
+     */
+    bool run (pass_manager_t *pm, tree::node_t *ast);
+
+    void print_report (const pass_manager_t *pm, FILE *stream);
+    void list_passes  (FILE *stream);
+}
+
+#endif
@@ -50,8 +50,8 @@ static void realloc_tokens (program_t *program);
 {                                                                               \
     if (cond)                                                                   \
     {                                                                           \
-        FILE *__log_stream_48de = get_log_stream();                             \
         LOG (log::ERR, "Bad token at line %d after token", program->line+1);    \
+        FILE *__log_stream_48de = get_log_stream();                             \
         fprintf (__log_stream_48de, "\t--> ");                                  \
         print_token_func (&program->tokens[program->size-1], __log_stream_48de);  \
         fprintf (__log_stream_48de, " <--\n");                                  \
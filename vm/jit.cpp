@@ -0,0 +1,1042 @@
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "../lib/common.h"
+#include "../lib/x86.h"
+#include "jit.h"
+
+// -------------------------------------------------------------------------------------------------
+
+/// State shared by generated code and C helpers, r15 points to it
+struct jit_ctx_t
+{
+    int *memory;
+    int *stack_beg;
+    int *stack_end;
+
+    uint32_t call_depth;
+    uint32_t call_limit;
+
+    int regs[isa::REGS_CNT];
+    int input;                  ///< Value read by helper_inp
+
+    uint64_t entry_rsp;         ///< Restored on exit, so runtime error can leave from any depth
+    uint64_t helper_rsp;        ///< Saved around C calls, they need aligned stack
+
+    FILE *in;
+    FILE *out;
+
+    uint32_t fault_addr;
+};
+
+typedef int (*jit_entry_t) (jit_ctx_t *ctx);
+
+// -------------------------------------------------------------------------------------------------
+
+using enum x86::reg_t;
+using enum x86::cond_t;
+
+// Register roles in generated code, all are callee-saved
+const x86::reg_t TOS       = RBX;   // Cached top of operand stack
+const x86::reg_t VM_RDX    = RBP;   // VM rdx, frame base of every local access
+const x86::reg_t MEMORY    = R12;
+const x86::reg_t SP        = R13;   // Next free operand stack cell
+const x86::reg_t STACK_BEG = R14;
+const x86::reg_t CTX       = R15;
+
+const size_t DEFAULT_LIST_CAPACITY = 64;
+
+// -------------------------------------------------------------------------------------------------
+
+struct fixup_t
+{
+    size_t   pos;       ///< rel32 to patch
+    uint32_t target;    ///< Bytecode address
+};
+
+struct stub_t
+{
+    size_t      pos;
+    vm_status_t status;
+    uint32_t    addr;
+};
+
+struct gen_t
+{
+    const bytecode_t *bc;
+    uint32_t memory_size;
+
+    x86_code_t code;
+
+    size_t *offsets;        ///< Machine code offset of each bytecode instruction
+    bool   *is_target;
+
+    fixup_t *fixups;
+    size_t   fixups_cnt;
+    size_t   fixups_capacity;
+
+    stub_t *stubs;
+    size_t  stubs_cnt;
+    size_t  stubs_capacity;
+
+    size_t   exit_pos;
+    uint32_t addr;          ///< Bytecode address being compiled
+    bool     cached;        ///< TOS register holds top of stack
+    bool     oom;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static int  gen_ctor (gen_t *gen, const bytecode_t *bc, size_t memory_size);
+static void gen_dtor (gen_t *gen);
+
+static void compile_prologue (gen_t *gen);
+static void compile_insn     (gen_t *gen, const bc_insn_t *insn);
+static void compile_push     (gen_t *gen, const bc_insn_t *insn);
+static void compile_pop      (gen_t *gen, const bc_insn_t *insn);
+static void compile_arith    (gen_t *gen, isa::opcode_t opcode);
+static void compile_div      (gen_t *gen);
+static void compile_cmp_jump (gen_t *gen, const bc_insn_t *insn);
+static void compile_reg_form (gen_t *gen, const bc_insn_t *insn);
+static bool load_src         (gen_t *gen, const bc_insn_t *insn);
+static void compile_exit     (gen_t *gen);
+static void compile_stubs    (gen_t *gen);
+static void resolve_fixups   (gen_t *gen);
+static void add_fixup        (gen_t *gen, size_t pos, uint32_t target);
+
+static void need       (gen_t *gen, int cnt);
+static void check_push (gen_t *gen);
+static void spill      (gen_t *gen);
+static void load_tos   (gen_t *gen);
+static void pop_eax    (gen_t *gen);
+static void push_eax   (gen_t *gen);
+static void load_reg   (gen_t *gen, x86::reg_t dst, isa::reg_t reg);
+static void store_reg  (gen_t *gen, isa::reg_t reg, x86::reg_t src);
+static void check_addr (gen_t *gen, x86::reg_t addr_reg);
+static void c_call     (gen_t *gen, uintptr_t func);
+
+static void emit_jcc_stub (gen_t *gen, x86::cond_t cond, vm_status_t status);
+
+static bool grow (gen_t *gen, void **array, size_t *capacity, size_t cnt, size_t elem_size);
+
+static int  helper_inp  (jit_ctx_t *ctx);
+static void helper_out  (jit_ctx_t *ctx, int val);
+static int  helper_sqrt (int val);
+static int  helper_sin  (int val);
+
+// -------------------------------------------------------------------------------------------------
+
+#define CTX_OFFSET(field) ((int32_t) offsetof (jit_ctx_t, field))
+#define REG_OFFSET(reg)   (CTX_OFFSET (regs) + (int32_t) (sizeof (int) * (size_t) (reg)))
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int jit::ctor (jit_t *jit, const bytecode_t *bc, size_t memory_size)
+{
+    assert (jit != nullptr && "invalid pointer");
+    assert (bc  != nullptr && "invalid pointer");
+
+    *jit = {};
+
+    // Static addresses are encoded as disp32 of [r12 + addr*4]
+    if (memory_size > INT32_MAX / sizeof (int)) { return ERROR; }
+
+    gen_t gen = {};
+    if (gen_ctor (&gen, bc, memory_size) == ERROR) { return ERROR; }
+
+    // Exit goes first, so halt and error stubs jump to known position
+    compile_exit (&gen);
+    jit->entry = gen.code.size;
+    compile_prologue (&gen);
+
+    for (uint32_t i = 0; i < bc->size; ++i)
+    {
+        gen.addr = i;
+
+        // Jump targets are entered with empty cache
+        if (gen.is_target[i]) { spill (&gen); }
+        gen.offsets[i] = gen.code.size;
+
+        compile_insn (&gen, &bc->code[i]);
+    }
+
+    // Sentinel past the last instruction, as in vm
+    gen.addr = bc->size;
+    spill (&gen);
+    gen.offsets[bc->size] = gen.code.size;
+    x86::emit_mov_imm (&gen.code, RDX, bc->size);
+    x86::emit_mov_imm (&gen.code, RAX, (uint32_t) vm_status_t::FELL_OFF_CODE);
+    x86::patch_rel32 (&gen.code, x86::emit_jmp (&gen.code), gen.exit_pos);
+
+    compile_stubs  (&gen);
+    resolve_fixups (&gen);
+
+    if (gen.oom || gen.code.oom)
+    {
+        gen_dtor (&gen);
+        return ERROR;
+    }
+
+    size_t page = 4096;
+    jit->map_size    = (gen.code.size + page - 1) / page * page;
+    jit->code_size   = gen.code.size;
+    jit->memory_size = memory_size;
+
+    void *map = mmap (nullptr, jit->map_size, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        gen_dtor (&gen);
+        *jit = {};
+        return ERROR;
+    }
+
+    memcpy (map, gen.code.data, gen.code.size);
+    gen_dtor (&gen);
+
+    if (mprotect (map, jit->map_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap (map, jit->map_size);
+        *jit = {};
+        return ERROR;
+    }
+
+    jit->code = (uint8_t *) map;
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void jit::dtor (jit_t *jit)
+{
+    assert (jit != nullptr && "invalid pointer");
+
+    if (jit->code != nullptr) {
+        munmap (jit->code, jit->map_size);
+    }
+
+    *jit = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+vm_status_t jit::run (const jit_t *jit, vm_t *vm)
+{
+    assert (jit       != nullptr && "invalid pointer");
+    assert (vm        != nullptr && "invalid pointer");
+    assert (jit->code != nullptr && "jit is not compiled");
+    assert (jit->memory_size == vm->memory_size && "jit is compiled for other memory size");
+
+    jit_ctx_t ctx = {};
+
+    ctx.memory     = vm->memory;
+    ctx.stack_beg  = vm->stack;
+    ctx.stack_end  = vm->stack + vm->stack_size;
+    ctx.call_limit = (uint32_t) vm->call_stack_size;
+    ctx.in         = vm->in;
+    ctx.out        = vm->out;
+    memcpy (ctx.regs, vm->regs, sizeof (ctx.regs));
+
+    const uint8_t *entry_addr = jit->code + jit->entry;
+
+    jit_entry_t entry = nullptr;
+    static_assert (sizeof (entry) == sizeof (entry_addr), "code and function pointers differ");
+    memcpy (&entry, &entry_addr, sizeof (entry));
+
+    vm_status_t status = (vm_status_t) entry (&ctx);
+
+    memcpy (vm->regs, ctx.regs, sizeof (ctx.regs));
+    vm->executed   = 0;
+    vm->fault_addr = ctx.fault_addr;
+
+    return status;
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+static int gen_ctor (gen_t *gen, const bytecode_t *bc, size_t memory_size)
+{
+    assert (gen != nullptr && "invalid pointer");
+    assert (bc  != nullptr && "invalid pointer");
+
+    *gen = {};
+
+    gen->bc              = bc;
+    gen->memory_size     = (uint32_t) memory_size;
+    gen->fixups_capacity = DEFAULT_LIST_CAPACITY;
+    gen->stubs_capacity  = DEFAULT_LIST_CAPACITY;
+
+    x86::ctor (&gen->code);
+    gen->offsets   = (size_t *)  calloc (bc->size + 1,         sizeof (size_t));
+    gen->is_target = (bool *)    calloc (bc->size + 1,         sizeof (bool));
+    gen->fixups    = (fixup_t *) calloc (gen->fixups_capacity, sizeof (fixup_t));
+    gen->stubs     = (stub_t *)  calloc (gen->stubs_capacity,  sizeof (stub_t));
+
+    if (gen->code.oom || gen->offsets == nullptr || gen->is_target == nullptr ||
+        gen->fixups == nullptr || gen->stubs   == nullptr)
+    {
+        gen_dtor (gen);
+        return ERROR;
+    }
+
+    for (uint32_t i = 0; i < bc->size; ++i)
+    {
+        if (bc->code[i].arg_type == (uint8_t) isa::operand_type_t::LABEL) {
+            gen->is_target[bc->code[i].value] = true;
+        }
+    }
+
+    return 0;
+}
+
+static void gen_dtor (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    x86::dtor (&gen->code);
+    free (gen->offsets);
+    free (gen->is_target);
+    free (gen->fixups);
+    free (gen->stubs);
+
+    *gen = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_prologue (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    x86::emit_push (&gen->code, RBX);
+    x86::emit_push (&gen->code, RBP);
+    x86::emit_push (&gen->code, R12);
+    x86::emit_push (&gen->code, R13);
+    x86::emit_push (&gen->code, R14);
+    x86::emit_push (&gen->code, R15);
+
+    x86::emit_rr (&gen->code, 0x89, RDI, CTX, true);                                // mov r15, rdi
+    x86::emit_rm (&gen->code, 0x89, RSP, CTX, -1, CTX_OFFSET (entry_rsp), true);    // mov [entry_rsp], rsp
+
+    x86::emit_rm (&gen->code, 0x8B, MEMORY,    CTX, -1, CTX_OFFSET (memory),    true);
+    x86::emit_rm (&gen->code, 0x8B, SP,        CTX, -1, CTX_OFFSET (stack_beg), true);
+    x86::emit_rr (&gen->code, 0x89, SP, STACK_BEG, true);
+    x86::emit_rm (&gen->code, 0x8B, VM_RDX,    CTX, -1, REG_OFFSET (isa::reg_t::RDX), false);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_insn (gen_t *gen, const bc_insn_t *insn)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    switch ((isa::opcode_t) insn->opcode)
+    {
+        case isa::opcode_t::NOP:
+            break;
+
+        case isa::opcode_t::PUSH:
+            compile_push (gen, insn);
+            break;
+
+        case isa::opcode_t::POP:
+            compile_pop (gen, insn);
+            break;
+
+        case isa::opcode_t::ADD:
+        case isa::opcode_t::SUB:
+        case isa::opcode_t::MUL:
+            compile_arith (gen, (isa::opcode_t) insn->opcode);
+            break;
+
+        case isa::opcode_t::DIV:
+            compile_div (gen);
+            break;
+
+        case isa::opcode_t::SQRT:
+            need (gen, 1);
+            load_tos (gen);
+            x86::emit_rr (&gen->code, 0x85, TOS, TOS, false);                      // test ebx, ebx
+            emit_jcc_stub (gen, CC_S, vm_status_t::NEGATIVE_SQRT);
+            x86::emit_rr (&gen->code, 0x89, TOS, RDI, false);                      // mov edi, ebx
+            c_call (gen, (uintptr_t) &helper_sqrt);
+            x86::emit_rr (&gen->code, 0x89, RAX, TOS, false);                      // mov ebx, eax
+            break;
+
+        case isa::opcode_t::SIN:
+            need (gen, 1);
+            load_tos (gen);
+            x86::emit_rr (&gen->code, 0x89, TOS, RDI, false);
+            c_call (gen, (uintptr_t) &helper_sin);
+            x86::emit_rr (&gen->code, 0x89, RAX, TOS, false);
+            break;
+
+        case isa::opcode_t::INP:
+            x86::emit_rr (&gen->code, 0x89, CTX, RDI, true);                       // mov rdi, r15
+            c_call (gen, (uintptr_t) &helper_inp);
+            x86::emit_rr (&gen->code, 0x85, RAX, RAX, false);
+            emit_jcc_stub (gen, CC_E, vm_status_t::INPUT_ERROR);
+            x86::emit_rm (&gen->code, 0x8B, RAX, CTX, -1, CTX_OFFSET (input), false);
+            check_push (gen);
+            push_eax (gen);
+            break;
+
+        case isa::opcode_t::OUT:
+            need (gen, 1);
+            pop_eax (gen);
+            x86::emit_rr (&gen->code, 0x89, RAX, RSI, false);                      // mov esi, eax
+            x86::emit_rr (&gen->code, 0x89, CTX, RDI, true);
+            c_call (gen, (uintptr_t) &helper_out);
+            break;
+
+        case isa::opcode_t::JMP:
+            spill (gen);
+            add_fixup (gen, x86::emit_jmp (&gen->code), (uint32_t) insn->value);
+            break;
+
+        case isa::opcode_t::JE:
+        case isa::opcode_t::JNE:
+        case isa::opcode_t::JA:
+        case isa::opcode_t::JAE:
+        case isa::opcode_t::JB:
+        case isa::opcode_t::JBE:
+            compile_cmp_jump (gen, insn);
+            break;
+
+        case isa::opcode_t::CALL:
+            spill (gen);
+            x86::emit_rm (&gen->code, 0x8B, RAX, CTX, -1, CTX_OFFSET (call_depth), false);
+            x86::emit_rm (&gen->code, 0x3B, RAX, CTX, -1, CTX_OFFSET (call_limit), false);  // cmp eax, limit
+            emit_jcc_stub (gen, CC_AE, vm_status_t::CALL_STACK_OVERFLOW);
+            x86::emit_rm (&gen->code, 0xFF, 0, CTX, -1, CTX_OFFSET (call_depth), false);   // inc depth
+
+            x86::emit_byte (&gen->code, 0xE8);                                     // call rel32
+            add_fixup (gen, gen->code.size, (uint32_t) insn->value);
+            x86::emit_u32 (&gen->code, 0);
+            break;
+
+        case isa::opcode_t::RET:
+            spill (gen);
+            x86::emit_rm (&gen->code, 0x81, 7, CTX, -1, CTX_OFFSET (call_depth), false);   // cmp depth, 0
+            x86::emit_u32 (&gen->code, 0);
+            emit_jcc_stub (gen, CC_E, vm_status_t::CALL_STACK_UNDERFLOW);
+            x86::emit_rm (&gen->code, 0xFF, 1, CTX, -1, CTX_OFFSET (call_depth), false);   // dec depth
+            x86::emit_byte (&gen->code, 0xC3);
+            break;
+
+        case isa::opcode_t::HALT:
+            x86::emit_mov_imm (&gen->code, RDX, gen->addr);
+            x86::emit_mov_imm (&gen->code, RAX, (uint32_t) vm_status_t::OK);
+            x86::patch_rel32 (&gen->code, x86::emit_jmp (&gen->code), gen->exit_pos);
+            gen->cached = false;
+            break;
+
+        case isa::opcode_t::MOV:
+        case isa::opcode_t::STORE:
+        case isa::opcode_t::ADD_R:
+        case isa::opcode_t::SUB_R:
+        case isa::opcode_t::MUL_R:
+        case isa::opcode_t::DIV_R:
+            compile_reg_form (gen, insn);
+            break;
+
+        default:
+            assert (0 && "Opcode is checked by bytecode::load");
+            break;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_push (gen_t *gen, const bc_insn_t *insn)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    switch ((isa::operand_type_t) insn->arg_type)
+    {
+        case isa::operand_type_t::IMM:
+            check_push (gen);
+            spill (gen);
+            x86::emit_mov_imm (&gen->code, TOS, (uint32_t) insn->value);
+            gen->cached = true;
+            return;
+
+        case isa::operand_type_t::REG:
+            load_reg (gen, RAX, (isa::reg_t) insn->reg);
+            break;
+
+        case isa::operand_type_t::MEM:
+            if ((uint32_t) insn->value < gen->memory_size)
+            {
+                x86::emit_rm (&gen->code, 0x8B, RAX, MEMORY, -1, insn->value * (int32_t) sizeof (int), false);
+                break;
+            }
+
+            x86::emit_mov_imm (&gen->code, RAX, (uint32_t) insn->value);
+            check_addr (gen, RAX);
+            break;
+
+        case isa::operand_type_t::MEM_REG:
+            load_reg (gen, RAX, (isa::reg_t) insn->reg);
+            x86::emit_rr (&gen->code, 0x81, 0, RAX, false);                        // add eax, imm32
+            x86::emit_u32 (&gen->code, (uint32_t) insn->value);
+            check_addr (gen, RAX);
+            x86::emit_rm (&gen->code, 0x8B, RAX, MEMORY, RAX, 0, false);           // mov eax, [r12+rax*4]
+            break;
+
+        case isa::operand_type_t::NONE:
+        case isa::operand_type_t::LABEL:
+        default:
+            assert (0 && "Operand is checked by bytecode::load");
+            return;
+    }
+
+    check_push (gen);
+    push_eax (gen);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_pop (gen_t *gen, const bc_insn_t *insn)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    need (gen, 1);
+
+    switch ((isa::operand_type_t) insn->arg_type)
+    {
+        case isa::operand_type_t::REG:
+            pop_eax (gen);
+            store_reg (gen, (isa::reg_t) insn->reg, RAX);
+            return;
+
+        case isa::operand_type_t::MEM:
+            if ((uint32_t) insn->value < gen->memory_size)
+            {
+                pop_eax (gen);
+                x86::emit_rm (&gen->code, 0x89, RAX, MEMORY, -1, insn->value * (int32_t) sizeof (int), false);
+                return;
+            }
+
+            x86::emit_mov_imm (&gen->code, RCX, (uint32_t) insn->value);
+            check_addr (gen, RCX);
+            return;
+
+        case isa::operand_type_t::MEM_REG:
+            load_reg (gen, RCX, (isa::reg_t) insn->reg);
+            x86::emit_rr (&gen->code, 0x81, 0, RCX, false);                        // add ecx, imm32
+            x86::emit_u32 (&gen->code, (uint32_t) insn->value);
+            check_addr (gen, RCX);
+            pop_eax (gen);
+            x86::emit_rm (&gen->code, 0x89, RAX, MEMORY, RCX, 0, false);           // mov [r12+rcx*4], eax
+            return;
+
+        case isa::operand_type_t::NONE:
+        case isa::operand_type_t::IMM:
+        case isa::operand_type_t::LABEL:
+        default:
+            assert (0 && "Operand is checked by bytecode::load");
+            return;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_arith (gen_t *gen, isa::opcode_t opcode)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    // rhs is TOS, lhs is the cell below it
+    need (gen, 2);
+    load_tos (gen);
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (opcode)
+    {
+        case isa::opcode_t::ADD:
+            x86::emit_rm (&gen->code, 0x03, TOS, SP, -1, -4, false);               // add ebx, [r13-4]
+            break;
+
+        case isa::opcode_t::MUL:
+            x86::emit_rm (&gen->code, 0x0FAF, TOS, SP, -1, -4, false);             // imul ebx, [r13-4]
+            break;
+
+        case isa::opcode_t::SUB:
+            x86::emit_rm (&gen->code, 0x8B, RAX, SP, -1, -4, false);               // mov eax, [r13-4]
+            x86::emit_rr (&gen->code, 0x29, TOS, RAX, false);                      // sub eax, ebx
+            x86::emit_rr (&gen->code, 0x89, RAX, TOS, false);
+            break;
+
+        default:
+            assert (0 && "Not an arithmetic opcode");
+            break;
+    }
+    #pragma GCC diagnostic pop
+
+    x86::emit_rr (&gen->code, 0x83, 5, SP, true);                                  // sub r13, 4
+    x86::emit_byte (&gen->code, 4);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_div (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    need (gen, 2);
+    load_tos (gen);
+
+    x86::emit_rr (&gen->code, 0x85, TOS, TOS, false);
+    emit_jcc_stub (gen, CC_E, vm_status_t::DIV_BY_ZERO);
+
+    x86::emit_rm (&gen->code, 0x8B, RAX, SP, -1, -4, false);                       // mov eax, [r13-4]
+    x86::emit_rr (&gen->code, 0x83, 5, SP, true);                                  // sub r13, 4
+    x86::emit_byte (&gen->code, 4);
+
+    // idiv traps on INT_MIN / -1, vm wraps it to negation
+    x86::emit_rr (&gen->code, 0x83, 7, TOS, false);                                // cmp ebx, -1
+    x86::emit_byte (&gen->code, 0xFF);
+    size_t to_div = x86::emit_jcc (&gen->code, CC_NE);
+    x86::emit_rr (&gen->code, 0xF7, 3, RAX, false);                                // neg eax
+    size_t to_end = x86::emit_jmp (&gen->code);
+
+    x86::patch_rel32 (&gen->code, to_div, gen->code.size);
+    x86::emit_byte (&gen->code, 0x99);                                             // cdq
+    x86::emit_rr (&gen->code, 0xF7, 7, TOS, false);                                // idiv ebx
+
+    x86::patch_rel32 (&gen->code, to_end, gen->code.size);
+    x86::emit_rr (&gen->code, 0x89, RAX, TOS, false);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_cmp_jump (gen_t *gen, const bc_insn_t *insn)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    x86::cond_t cond = CC_E;
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch ((isa::opcode_t) insn->opcode)
+    {
+        case isa::opcode_t::JE:  cond = CC_E;  break;
+        case isa::opcode_t::JNE: cond = CC_NE; break;
+        case isa::opcode_t::JA:  cond = CC_G;  break;
+        case isa::opcode_t::JAE: cond = CC_GE; break;
+        case isa::opcode_t::JB:  cond = CC_L;  break;
+        case isa::opcode_t::JBE: cond = CC_LE; break;
+
+        default:
+            assert (0 && "Not a conditional jump");
+            break;
+    }
+    #pragma GCC diagnostic pop
+
+    need (gen, 2);
+    load_tos (gen);
+
+    x86::emit_rm (&gen->code, 0x8B, RAX, SP, -1, -4, false);                       // lhs
+    x86::emit_rr (&gen->code, 0x83, 5, SP, true);
+    x86::emit_byte (&gen->code, 4);
+    gen->cached = false;
+
+    x86::emit_rr (&gen->code, 0x39, TOS, RAX, false);                              // cmp eax, ebx
+    add_fixup (gen, x86::emit_jcc (&gen->code, cond), (uint32_t) insn->value);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Register forms do not touch operand stack, so cached TOS stays as is.
+ *        Source goes to ecx, register operand is loaded to eax.
+ */
+static void compile_reg_form (gen_t *gen, const bc_insn_t *insn)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    isa::opcode_t opcode = (isa::opcode_t) insn->opcode;
+    isa::reg_t    reg    = (isa::reg_t) insn->reg2;
+
+    if (opcode == isa::opcode_t::STORE)
+    {
+        load_reg (gen, RAX, reg);
+
+        if (insn->arg_type == (uint8_t) isa::operand_type_t::MEM)
+        {
+            if ((uint32_t) insn->value < gen->memory_size) {
+                x86::emit_rm (&gen->code, 0x89, RAX, MEMORY, -1, insn->value * (int32_t) sizeof (int), false);
+            } else {
+                x86::emit_mov_imm (&gen->code, RCX, (uint32_t) insn->value);
+                check_addr (gen, RCX);
+            }
+            return;
+        }
+
+        load_reg (gen, RCX, (isa::reg_t) insn->reg);
+        x86::emit_rr (&gen->code, 0x81, 0, RCX, false);                            // add ecx, imm32
+        x86::emit_u32 (&gen->code, (uint32_t) insn->value);
+        check_addr (gen, RCX);
+        x86::emit_rm (&gen->code, 0x89, RAX, MEMORY, RCX, 0, false);               // mov [r12+rcx*4], eax
+        return;
+    }
+
+    if (!load_src (gen, insn)) { return; }
+
+    if (opcode == isa::opcode_t::MOV)
+    {
+        store_reg (gen, reg, RCX);
+        return;
+    }
+
+    load_reg (gen, RAX, reg);
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (opcode)
+    {
+        case isa::opcode_t::ADD_R:
+            x86::emit_rr (&gen->code, 0x01, RCX, RAX, false);                      // add eax, ecx
+            break;
+
+        case isa::opcode_t::SUB_R:
+            x86::emit_rr (&gen->code, 0x29, RCX, RAX, false);                      // sub eax, ecx
+            break;
+
+        case isa::opcode_t::MUL_R:
+            x86::emit_rr (&gen->code, 0x0FAF, RAX, RCX, false);                    // imul eax, ecx
+            break;
+
+        case isa::opcode_t::DIV_R:
+        {
+            x86::emit_rr (&gen->code, 0x85, RCX, RCX, false);
+            emit_jcc_stub (gen, CC_E, vm_status_t::DIV_BY_ZERO);
+
+            x86::emit_rr (&gen->code, 0x83, 7, RCX, false);                        // cmp ecx, -1
+            x86::emit_byte (&gen->code, 0xFF);
+            size_t to_div = x86::emit_jcc (&gen->code, CC_NE);
+            x86::emit_rr (&gen->code, 0xF7, 3, RAX, false);                        // neg eax
+            size_t to_end = x86::emit_jmp (&gen->code);
+
+            x86::patch_rel32 (&gen->code, to_div, gen->code.size);
+            x86::emit_byte (&gen->code, 0x99);                                     // cdq
+            x86::emit_rr (&gen->code, 0xF7, 7, RCX, false);                        // idiv ecx
+
+            x86::patch_rel32 (&gen->code, to_end, gen->code.size);
+            break;
+        }
+
+        default:
+            assert (0 && "Not a register form");
+            break;
+    }
+    #pragma GCC diagnostic pop
+
+    store_reg (gen, reg, RAX);
+}
+
+/// Load source operand of register form to ecx
+/// @return false if access is statically out of bounds and only error exit is emitted
+static bool load_src (gen_t *gen, const bc_insn_t *insn)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (insn != nullptr && "invalid pointer");
+
+    switch ((isa::operand_type_t) insn->arg_type)
+    {
+        case isa::operand_type_t::IMM:
+            x86::emit_mov_imm (&gen->code, RCX, (uint32_t) insn->value);
+            return true;
+
+        case isa::operand_type_t::REG:
+            load_reg (gen, RCX, (isa::reg_t) insn->reg);
+            return true;
+
+        case isa::operand_type_t::MEM:
+            if ((uint32_t) insn->value < gen->memory_size)
+            {
+                x86::emit_rm (&gen->code, 0x8B, RCX, MEMORY, -1, insn->value * (int32_t) sizeof (int), false);
+                return true;
+            }
+
+            x86::emit_mov_imm (&gen->code, RCX, (uint32_t) insn->value);
+            check_addr (gen, RCX);
+            return false;
+
+        case isa::operand_type_t::MEM_REG:
+            load_reg (gen, RCX, (isa::reg_t) insn->reg);
+            x86::emit_rr (&gen->code, 0x81, 0, RCX, false);                        // add ecx, imm32
+            x86::emit_u32 (&gen->code, (uint32_t) insn->value);
+            check_addr (gen, RCX);
+            x86::emit_rm (&gen->code, 0x8B, RCX, MEMORY, RCX, 0, false);           // mov ecx, [r12+rcx*4]
+            return true;
+
+        case isa::operand_type_t::NONE:
+        case isa::operand_type_t::LABEL:
+        default:
+            assert (0 && "Operand is checked by bytecode::load");
+            return false;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Expects status in eax and fault address in edx
+static void compile_exit (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    gen->exit_pos = gen->code.size;
+
+    x86::emit_rm (&gen->code, 0x8B, RSP,    CTX, -1, CTX_OFFSET (entry_rsp),  true);
+    x86::emit_rm (&gen->code, 0x89, RDX,    CTX, -1, CTX_OFFSET (fault_addr), false);
+    x86::emit_rm (&gen->code, 0x89, VM_RDX, CTX, -1, REG_OFFSET (isa::reg_t::RDX), false);
+
+    x86::emit_pop (&gen->code, R15);
+    x86::emit_pop (&gen->code, R14);
+    x86::emit_pop (&gen->code, R13);
+    x86::emit_pop (&gen->code, R12);
+    x86::emit_pop (&gen->code, RBP);
+    x86::emit_pop (&gen->code, RBX);
+    x86::emit_byte (&gen->code, 0xC3);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_stubs (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    for (size_t i = 0; i < gen->stubs_cnt; ++i)
+    {
+        const stub_t *stub = &gen->stubs[i];
+
+        x86::patch_rel32 (&gen->code, stub->pos, gen->code.size);
+        x86::emit_mov_imm (&gen->code, RDX, stub->addr);
+        x86::emit_mov_imm (&gen->code, RAX, (uint32_t) stub->status);
+        x86::patch_rel32 (&gen->code, x86::emit_jmp (&gen->code), gen->exit_pos);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void resolve_fixups (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    for (size_t i = 0; i < gen->fixups_cnt; ++i) {
+        x86::patch_rel32 (&gen->code, gen->fixups[i].pos, gen->offsets[gen->fixups[i].target]);
+    }
+}
+
+static void add_fixup (gen_t *gen, size_t pos, uint32_t target)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (grow (gen, (void **) &gen->fixups, &gen->fixups_capacity, gen->fixups_cnt, sizeof (fixup_t))) {
+        gen->fixups[gen->fixups_cnt++] = {pos, target};
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Stack underflow check for cnt operands, part of them may be cached
+static void need (gen_t *gen, int cnt)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    int in_memory = cnt - (int) gen->cached;
+    if (in_memory <= 0) { return; }
+
+    x86::emit_rm (&gen->code, 0x8D, RAX, STACK_BEG, -1, in_memory * (int32_t) sizeof (int), true);
+    x86::emit_rr (&gen->code, 0x39, RAX, SP, true);                                // cmp r13, rax
+    emit_jcc_stub (gen, CC_B, vm_status_t::STACK_UNDERFLOW);
+}
+
+/// Stack overflow check before push, uses rcx
+static void check_push (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    x86::emit_rm (&gen->code, 0x8D, RCX, SP,  -1, (int32_t) gen->cached * (int32_t) sizeof (int), true);
+    x86::emit_rm (&gen->code, 0x3B, RCX, CTX, -1, CTX_OFFSET (stack_end), true);   // cmp rcx, [end]
+    emit_jcc_stub (gen, CC_AE, vm_status_t::STACK_OVERFLOW);
+}
+
+/// Move cached TOS to memory stack
+static void spill (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (!gen->cached) { return; }
+
+    x86::emit_rm (&gen->code, 0x89, TOS, SP, -1, 0, false);                        // mov [r13], ebx
+    x86::emit_rr (&gen->code, 0x83, 0, SP, true);                                  // add r13, 4
+    x86::emit_byte (&gen->code, 4);
+
+    gen->cached = false;
+}
+
+/// Make sure TOS is cached, stack must be checked by need
+static void load_tos (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (gen->cached) { return; }
+
+    x86::emit_rr (&gen->code, 0x83, 5, SP, true);                                  // sub r13, 4
+    x86::emit_byte (&gen->code, 4);
+    x86::emit_rm (&gen->code, 0x8B, TOS, SP, -1, 0, false);                        // mov ebx, [r13]
+
+    gen->cached = true;
+}
+
+static void pop_eax (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (gen->cached)
+    {
+        x86::emit_rr (&gen->code, 0x89, TOS, RAX, false);
+        gen->cached = false;
+        return;
+    }
+
+    x86::emit_rr (&gen->code, 0x83, 5, SP, true);
+    x86::emit_byte (&gen->code, 4);
+    x86::emit_rm (&gen->code, 0x8B, RAX, SP, -1, 0, false);
+}
+
+static void push_eax (gen_t *gen)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    spill (gen);
+    x86::emit_rr (&gen->code, 0x89, RAX, TOS, false);
+    gen->cached = true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void load_reg (gen_t *gen, x86::reg_t dst, isa::reg_t reg)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (reg == isa::reg_t::RDX) {
+        x86::emit_rr (&gen->code, 0x89, VM_RDX, dst, false);
+    } else {
+        x86::emit_rm (&gen->code, 0x8B, dst, CTX, -1, REG_OFFSET (reg), false);
+    }
+}
+
+static void store_reg (gen_t *gen, isa::reg_t reg, x86::reg_t src)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    if (reg == isa::reg_t::RDX) {
+        x86::emit_rr (&gen->code, 0x89, src, VM_RDX, false);
+    } else {
+        x86::emit_rm (&gen->code, 0x89, src, CTX, -1, REG_OFFSET (reg), false);
+    }
+}
+
+static void check_addr (gen_t *gen, x86::reg_t addr_reg)
+{
+    assert (gen != nullptr && "invalid pointer");
+
+    x86::emit_rr (&gen->code, 0x81, 7, addr_reg, false);                           // cmp reg, memory_size
+    x86::emit_u32 (&gen->code, gen->memory_size);
+    emit_jcc_stub (gen, CC_AE, vm_status_t::BAD_ADDRESS);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Call C function, arguments are already in rdi/esi
+static void c_call (gen_t *gen, uintptr_t func)
+{
+    assert (gen  != nullptr && "invalid pointer");
+    assert (func != 0 && "invalid pointer");
+
+    // Native stack depth depends on call depth, so align it explicitly
+    x86::emit_rm (&gen->code, 0x89, RSP, CTX, -1, CTX_OFFSET (helper_rsp), true);
+    x86::emit_rr (&gen->code, 0x83, 4, RSP, true);                                 // and rsp, -16
+    x86::emit_byte (&gen->code, 0xF0);
+
+    x86::emit_mov_imm64 (&gen->code, RAX, func);
+    x86::emit_rr (&gen->code, 0xFF, 2, RAX, false);                              // call rax
+
+    x86::emit_rm (&gen->code, 0x8B, RSP, CTX, -1, CTX_OFFSET (helper_rsp), true);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Conditional jump to error exit with current bytecode address
+static void emit_jcc_stub (gen_t *gen, x86::cond_t cond, vm_status_t status)
+{
+    size_t pos = x86::emit_jcc (&gen->code, cond);
+
+    if (grow (gen, (void **) &gen->stubs, &gen->stubs_capacity, gen->stubs_cnt, sizeof (stub_t))) {
+        gen->stubs[gen->stubs_cnt++] = {pos, status, gen->addr};
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Make room for one more element
+/// @return false on OOM, gen->oom is set then
+static bool grow (gen_t *gen, void **array, size_t *capacity, size_t cnt, size_t elem_size)
+{
+    assert (gen      != nullptr && "invalid pointer");
+    assert (array    != nullptr && "invalid pointer");
+    assert (capacity != nullptr && "invalid pointer");
+
+    if (gen->oom)        { return false; }
+    if (cnt < *capacity) { return true;  }
+
+    void *new_array = realloc (*array, 2 * *capacity * elem_size);
+    if (new_array == nullptr)
+    {
+        gen->oom = true;
+        return false;
+    }
+
+    *array     = new_array;
+    *capacity *= 2;
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int helper_inp (jit_ctx_t *ctx)
+{
+    return fscanf (ctx->in, "%d", &ctx->input) == 1;
+}
+
+static void helper_out (jit_ctx_t *ctx, int val)
+{
+    fprintf (ctx->out, "%d\n", val);
+}
+
+static int helper_sqrt (int val)
+{
+    return (int) sqrt ((double) val);
+}
+
+static int helper_sin (int val)
+{
+    return (int) sin ((double) val);
+}
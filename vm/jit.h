@@ -0,0 +1,37 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include "../lib/bytecode.h"
+#include "vm.h"
+
+/// Bytecode compiled to x86-64 machine code
+struct jit_t
+{
+    uint8_t *code;          ///< mmap'd, read+exec after compilation
+    size_t   code_size;
+    size_t   map_size;
+    size_t   entry;         ///< Offset of entry point in code
+
+    size_t memory_size;     ///< Bounds checks are compiled in, so it is fixed per compilation
+};
+
+namespace jit
+{
+    /**
+     * @brief      Compile bytecode. Top of operand stack is cached in a register, calls are
+     *             native call/ret, builtins and I/O call C functions.
+     *
+     * @return     0 or ERROR on OOM, mmap failure or too big memory size
+     */
+    int  ctor (jit_t *jit, const bytecode_t *bc, size_t memory_size);
+    void dtor (jit_t *jit);
+
+    /**
+     * @brief      Run compiled code on VM memory, stack and registers. Status, fault address
+     *             and output are the same as vm::run gives, executed instructions are not counted.
+     */
+    vm_status_t run (const jit_t *jit, vm_t *vm);
+}
+
+#endif
@@ -0,0 +1,322 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../lib/common.h"
+#include "../lib/file.h"
+#include "vm.h"
+#include "jit.h"
+
+// -------------------------------------------------------------------------------------------------
+
+struct run_opts_t
+{
+    bool     stats;
+    unsigned repeat;
+    size_t   memory_size;
+    bool     jit;
+    bool     diff;
+};
+
+struct run_result_t
+{
+    vm_status_t status;
+    uint32_t    fault_addr;
+    char       *output;
+    size_t      output_size;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static int    parse_flags (int argc, const char *argv[], run_opts_t *opts);
+static double now_sec     ();
+
+static int   diff_engines  (vm_t *vm, const jit_t *jit);
+static int   run_captured  (vm_t *vm, const jit_t *jit, char *input, size_t input_size,
+                                                                    run_result_t *result);
+static char *read_stream   (FILE *stream, size_t *size);
+
+// -------------------------------------------------------------------------------------------------
+
+#define ERR_CASE(cond, fmt, ...)                    \
+{                                                   \
+    if (cond) {                                     \
+        fprintf (stderr, fmt "\n", ##__VA_ARGS__);  \
+        jit::dtor (&jit);                           \
+        vm::dtor (&vm);                             \
+        bytecode::dtor (&bc);                       \
+        return ERROR;                               \
+    }                                               \
+}
+
+// -------------------------------------------------------------------------------------------------
+
+int main (int argc, const char *argv[])
+{
+    bytecode_t bc = {};
+    vm_t       vm = {};
+    jit_t      jit = {};
+    run_opts_t opts = {false, 1, DEFAULT_VM_MEMORY_SIZE, false, false};
+
+    int flag_cnt = parse_flags (argc, argv, &opts);
+
+    ERR_CASE (flag_cnt == ERROR || argc != 2 + flag_cnt,
+                "Usage: ./vm [flags] <bytecode file>\n"
+                "      --stats       print executed instructions and instructions/sec to stderr\n"
+                "      --repeat=<N>  run program N times, for benchmarks\n"
+                "      --mem=<N>     memory size in cells\n"
+                "      --jit         compile bytecode to native code and run it\n"
+                "      --diff        run both vm and jit on the same input and compare results");
+
+    const file_t src = open_ro_file (argv[1 + flag_cnt]);
+    ERR_CASE (src.content == nullptr, "Failed to open file %s", argv[1 + flag_cnt]);
+
+    int load_res = bytecode::load (&bc, src.content, src.size);
+    unmap_ro_file (src);
+    ERR_CASE (load_res == ERROR, "Invalid bytecode file %s", argv[1 + flag_cnt]);
+
+    ERR_CASE (vm::ctor (&vm, &bc, opts.memory_size) == ERROR, "Failed to allocate VM");
+
+    if (opts.jit || opts.diff) {
+        ERR_CASE (jit::ctor (&jit, &bc, opts.memory_size) == ERROR, "Failed to compile bytecode");
+    }
+
+    if (opts.diff)
+    {
+        int res = diff_engines (&vm, &jit);
+
+        jit::dtor (&jit);
+        vm::dtor (&vm);
+        bytecode::dtor (&bc);
+        return res;
+    }
+
+    uint64_t executed = 0;
+    double   elapsed  = 0;
+
+    for (unsigned i = 0; i < opts.repeat; ++i)
+    {
+        vm::reset (&vm);
+
+        double start = now_sec ();
+        vm_status_t status = opts.jit ? jit::run (&jit, &vm) : vm::run (&vm);
+        elapsed  += now_sec () - start;
+        executed += vm.executed;
+
+        ERR_CASE (status != vm_status_t::OK, "Runtime error at %u: %s",
+                                                        vm.fault_addr, vm::status_str (status));
+    }
+
+    if (opts.stats)
+    {
+        fflush (stdout);
+        fprintf (stderr, "runs:         %u\n",       opts.repeat);
+        fprintf (stderr, "time:         %.3lf ms\n", elapsed * 1e3);
+
+        // Compiled code does not count instructions
+        if (!opts.jit)
+        {
+            fprintf (stderr, "instructions: %lu\n", executed);
+            fprintf (stderr, "speed:        %.2lf Minstr/sec\n",
+                                        (elapsed > 0) ? (double) executed / elapsed / 1e6 : 0.0);
+        }
+    }
+
+    jit::dtor (&jit);
+    vm::dtor (&vm);
+    bytecode::dtor (&bc);
+}
+
+#undef ERR_CASE
+
+// -------------------------------------------------------------------------------------------------
+
+static int parse_flags (int argc, const char *argv[], run_opts_t *opts)
+{
+    assert (argv != nullptr && "invalid pointer");
+    assert (opts != nullptr && "invalid pointer");
+
+    int flag_cnt = 0;
+
+    for (; 1 + flag_cnt < argc && strncmp (argv[1 + flag_cnt], "--", 2) == 0; ++flag_cnt)
+    {
+        const char *flag = argv[1 + flag_cnt];
+
+        if (strcmp (flag, "--stats") == 0)
+        {
+            opts->stats = true;
+        }
+        else if (strncmp (flag, "--repeat=", strlen ("--repeat=")) == 0)
+        {
+            opts->repeat = (unsigned) strtoul (flag + strlen ("--repeat="), nullptr, 10);
+            if (opts->repeat == 0) { return ERROR; }
+        }
+        else if (strncmp (flag, "--mem=", strlen ("--mem=")) == 0)
+        {
+            opts->memory_size = strtoul (flag + strlen ("--mem="), nullptr, 10);
+            if (opts->memory_size == 0) { return ERROR; }
+        }
+        else if (strcmp (flag, "--jit") == 0)
+        {
+            opts->jit = true;
+        }
+        else if (strcmp (flag, "--diff") == 0)
+        {
+            opts->diff = true;
+        }
+        else
+        {
+            return ERROR;
+        }
+    }
+
+    return flag_cnt;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static double now_sec ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief      Differential test: run vm and jit on the same stdin, print vm output and report
+ *             any difference in output, status or fault address to stderr
+ *
+ * @return     0 if results match and program succeeded, ERROR otherwise
+ */
+static int diff_engines (vm_t *vm, const jit_t *jit)
+{
+    assert (vm  != nullptr && "invalid pointer");
+    assert (jit != nullptr && "invalid pointer");
+
+    size_t input_size = 0;
+    char  *input      = read_stream (stdin, &input_size);
+    if (input == nullptr) { return ERROR; }
+
+    run_result_t expected = {};
+    run_result_t actual   = {};
+
+    if (run_captured (vm, nullptr, input, input_size, &expected) == ERROR ||
+        run_captured (vm, jit,     input, input_size, &actual)   == ERROR)
+    {
+        fprintf (stderr, "Failed to capture program output\n");
+        free (expected.output);
+        free (input);
+        return ERROR;
+    }
+
+    fwrite (expected.output, 1, expected.output_size, stdout);
+    fflush (stdout);
+
+    int res = 0;
+
+    if (expected.status != actual.status ||
+        (expected.status != vm_status_t::OK && expected.fault_addr != actual.fault_addr))
+    {
+        fprintf (stderr, "Status mismatch: vm '%s' at %u, jit '%s' at %u\n",
+                            vm::status_str (expected.status), expected.fault_addr,
+                            vm::status_str (actual.status),   actual.fault_addr);
+        res = ERROR;
+    }
+
+    if (expected.output_size != actual.output_size ||
+        memcmp (expected.output, actual.output, expected.output_size) != 0)
+    {
+        size_t pos = 0;
+        while (pos < expected.output_size && pos < actual.output_size &&
+                                                    expected.output[pos] == actual.output[pos]) {
+            pos++;
+        }
+
+        fprintf (stderr, "Output mismatch at byte %zu\n", pos);
+        res = ERROR;
+    }
+
+    if (res == 0 && expected.status != vm_status_t::OK)
+    {
+        fprintf (stderr, "Runtime error at %u: %s\n", expected.fault_addr,
+                                                            vm::status_str (expected.status));
+        res = ERROR;
+    }
+
+    free (expected.output);
+    free (actual.output);
+    free (input);
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Run vm, or jit if it is not nullptr, with input from buffer and output to memory
+static int run_captured (vm_t *vm, const jit_t *jit, char *input, size_t input_size,
+                                                                    run_result_t *result)
+{
+    assert (vm     != nullptr && "invalid pointer");
+    assert (input  != nullptr && "invalid pointer");
+    assert (result != nullptr && "invalid pointer");
+
+    // fmemopen rejects empty buffers
+    FILE *in  = (input_size > 0) ? fmemopen (input, input_size, "r") : fopen ("/dev/null", "r");
+    FILE *out = open_memstream (&result->output, &result->output_size);
+
+    if (in == nullptr || out == nullptr)
+    {
+        if (in  != nullptr) { fclose (in);  }
+        if (out != nullptr) { fclose (out); }
+        return ERROR;
+    }
+
+    vm::reset (vm);
+    vm->in  = in;
+    vm->out = out;
+
+    result->status     = (jit != nullptr) ? jit::run (jit, vm) : vm::run (vm);
+    result->fault_addr = vm->fault_addr;
+
+    fclose (in);
+    fclose (out);
+
+    vm->in  = stdin;
+    vm->out = stdout;
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static char *read_stream (FILE *stream, size_t *size)
+{
+    assert (stream != nullptr && "invalid pointer");
+    assert (size   != nullptr && "invalid pointer");
+
+    size_t capacity = 4096;
+    char  *buf      = (char *) calloc (capacity, sizeof (char));
+
+    *size = 0;
+
+    while (buf != nullptr)
+    {
+        *size += fread (buf + *size, 1, capacity - *size, stream);
+        if (*size < capacity) { break; }
+
+        char *new_buf = (char *) realloc (buf, 2 * capacity);
+        if (new_buf == nullptr)
+        {
+            free (buf);
+            return nullptr;
+        }
+
+        buf       = new_buf;
+        capacity *= 2;
+    }
+
+    return buf;
+}
@@ -0,0 +1,543 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/common.h"
+#include "vm.h"
+
+// -------------------------------------------------------------------------------------------------
+
+/// Instruction specialized by operand kind, so handlers never look at operand type
+enum handler_t
+{
+    H_NOP = 0,
+    H_PUSH_IMM,
+    H_PUSH_REG,
+    H_PUSH_MEM,
+    H_PUSH_MEM_REG,
+    H_POP_REG,
+    H_POP_MEM,
+    H_POP_MEM_REG,
+    H_ADD,
+    H_SUB,
+    H_MUL,
+    H_DIV,
+    H_SQRT,
+    H_SIN,
+    H_INP,
+    H_OUT,
+    H_JMP,
+    H_JE,
+    H_JNE,
+    H_JA,
+    H_JAE,
+    H_JB,
+    H_JBE,
+    H_CALL,
+    H_RET,
+    H_HALT,
+    H_FELL_OFF,
+
+    // Register forms, source kind order is imm, reg, mem, mem_reg as in SELECT_BY_ARG
+    H_MOV_IMM,   H_MOV_REG,   H_MOV_MEM,   H_MOV_MEM_REG,
+    H_STORE_MEM, H_STORE_MEM_REG,
+    H_ADD_R_IMM, H_ADD_R_REG, H_ADD_R_MEM, H_ADD_R_MEM_REG,
+    H_SUB_R_IMM, H_SUB_R_REG, H_SUB_R_MEM, H_SUB_R_MEM_REG,
+    H_MUL_R_IMM, H_MUL_R_REG, H_MUL_R_MEM, H_MUL_R_MEM_REG,
+    H_DIV_R_IMM, H_DIV_R_REG, H_DIV_R_MEM, H_DIV_R_MEM_REG,
+
+    HANDLERS_CNT
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static handler_t select_handler (const bc_insn_t *insn);
+static int       decode         (vm_t *vm, const void *const *handlers);
+
+// -------------------------------------------------------------------------------------------------
+// PUBLIC SECTION
+// -------------------------------------------------------------------------------------------------
+
+int vm::ctor (vm_t *vm, const bytecode_t *bc, size_t memory_size)
+{
+    assert (vm != nullptr && "invalid pointer");
+    assert (bc != nullptr && "invalid pointer");
+
+    *vm = {};
+
+    vm->bc              = bc;
+    vm->memory_size     = memory_size;
+    vm->stack_size      = DEFAULT_VM_STACK_SIZE;
+    vm->call_stack_size = DEFAULT_VM_CALL_STACK_SIZE;
+    vm->in              = stdin;
+    vm->out             = stdout;
+
+    vm->memory     = (int *)              calloc (vm->memory_size,     sizeof (int));
+    vm->stack      = (int *)              calloc (vm->stack_size,      sizeof (int));
+    vm->call_stack = (const vm_insn_t **) calloc (vm->call_stack_size, sizeof (vm_insn_t *));
+
+    if (vm->memory == nullptr || vm->stack == nullptr || vm->call_stack == nullptr)
+    {
+        dtor (vm);
+        return ERROR;
+    }
+
+    return 0;
+}
+
+void vm::dtor (vm_t *vm)
+{
+    assert (vm != nullptr && "invalid pointer");
+
+    free (vm->code);
+    free (vm->memory);
+    free (vm->stack);
+    free (vm->call_stack);
+
+    *vm = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void vm::reset (vm_t *vm)
+{
+    assert (vm != nullptr && "invalid pointer");
+
+    memset (vm->memory, 0, vm->memory_size * sizeof (int));
+    memset (vm->regs,   0, sizeof (vm->regs));
+
+    vm->executed   = 0;
+    vm->fault_addr = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+#define DISPATCH()          \
+{                           \
+    executed++;             \
+    goto *ip->handler;      \
+}
+
+#define NEXT()              \
+{                           \
+    ip++;                   \
+    DISPATCH ();            \
+}
+
+#define FAIL(err)           \
+{                           \
+    status = vm_status_t::err; \
+    goto finish;            \
+}
+
+#define NEED(cnt)                                               \
+    if (__builtin_expect (sp - stack_beg < (cnt), 0)) {         \
+        FAIL (STACK_UNDERFLOW);                                 \
+    }
+
+#define PUSH(val)                                               \
+{                                                               \
+    if (__builtin_expect (sp == stack_end, 0)) {                \
+        FAIL (STACK_OVERFLOW);                                  \
+    }                                                           \
+    *sp++ = (val);                                              \
+}
+
+#define CHECK_ADDR(addr)                                        \
+    if (__builtin_expect ((uint32_t) (addr) >= memory_size, 0)) { \
+        FAIL (BAD_ADDRESS);                                     \
+    }
+
+// Arithmetic wraps around as in two's complement hardware
+#define WRAP(lhs, op, rhs) ((int) ((uint32_t) (lhs) op (uint32_t) (rhs)))
+
+#define BINARY_OP(expr)                                         \
+{                                                               \
+    NEED (2);                                                   \
+    int rhs = *--sp;                                            \
+    int lhs = sp[-1];                                           \
+    sp[-1] = (expr);                                            \
+    NEXT ();                                                    \
+}
+
+// Source operand of register form by its kind
+#define SRC_IMM(src)                                            \
+    int src = ip->value;
+
+#define SRC_REG(src)                                            \
+    int src = regs[ip->reg];
+
+#define SRC_MEM(src)                                            \
+    CHECK_ADDR (ip->value);                                     \
+    int src = memory[ip->value];
+
+#define SRC_MEM_REG(src)                                        \
+    int src##_addr = WRAP (regs[ip->reg], +, ip->value);        \
+    CHECK_ADDR (src##_addr);                                    \
+    int src = memory[src##_addr];
+
+#define REG_MOV(kind)                                           \
+{                                                               \
+    SRC_##kind (src);                                           \
+    regs[ip->reg2] = src;                                       \
+    NEXT ();                                                    \
+}
+
+#define REG_OP(kind, expr)                                      \
+{                                                               \
+    SRC_##kind (rhs);                                           \
+    int lhs = regs[ip->reg2];                                   \
+    regs[ip->reg2] = (expr);                                    \
+    NEXT ();                                                    \
+}
+
+#define REG_DIV(kind)                                           \
+{                                                               \
+    SRC_##kind (rhs);                                           \
+    int lhs = regs[ip->reg2];                                   \
+    if (rhs == 0) { FAIL (DIV_BY_ZERO); }                       \
+    regs[ip->reg2] = (rhs == -1) ? WRAP (0, -, lhs) : lhs / rhs; \
+    NEXT ();                                                    \
+}
+
+#define COND_JUMP(cmp)                                          \
+{                                                               \
+    NEED (2);                                                   \
+    int rhs = *--sp;                                            \
+    int lhs = *--sp;                                            \
+    ip = (lhs cmp rhs) ? ip->target : ip + 1;                   \
+    DISPATCH ();                                                \
+}
+
+vm_status_t vm::run (vm_t *vm)
+{
+    assert (vm != nullptr && "invalid pointer");
+
+    static const void *const HANDLERS[HANDLERS_CNT] =
+    {
+        &&nop,
+        &&push_imm, &&push_reg, &&push_mem, &&push_mem_reg,
+        &&pop_reg,  &&pop_mem,  &&pop_mem_reg,
+        &&add, &&sub, &&mul, &&div, &&sqrt, &&sin,
+        &&inp, &&out,
+        &&jmp, &&je, &&jne, &&ja, &&jae, &&jb, &&jbe,
+        &&call, &&ret, &&halt, &&fell_off,
+
+        &&mov_imm,   &&mov_reg,   &&mov_mem,   &&mov_mem_reg,
+        &&store_mem, &&store_mem_reg,
+        &&add_r_imm, &&add_r_reg, &&add_r_mem, &&add_r_mem_reg,
+        &&sub_r_imm, &&sub_r_reg, &&sub_r_mem, &&sub_r_mem_reg,
+        &&mul_r_imm, &&mul_r_reg, &&mul_r_mem, &&mul_r_mem_reg,
+        &&div_r_imm, &&div_r_reg, &&div_r_mem, &&div_r_mem_reg,
+    };
+
+    if (vm->code == nullptr && decode (vm, HANDLERS) == ERROR) {
+        return vm_status_t::OOM;
+    }
+
+    const vm_insn_t  *ip          = vm->code;
+    int              *stack_beg   = vm->stack;
+    int              *stack_end   = vm->stack + vm->stack_size;
+    int              *sp          = stack_beg;
+    const vm_insn_t **csp         = vm->call_stack;
+    const vm_insn_t **call_end    = vm->call_stack + vm->call_stack_size;
+    int              *memory      = vm->memory;
+    size_t            memory_size = vm->memory_size;
+    int              *regs        = vm->regs;
+
+    uint64_t    executed = 0;
+    vm_status_t status   = vm_status_t::OK;
+
+    DISPATCH ();
+
+nop:
+    NEXT ();
+
+push_imm:
+    PUSH (ip->value);
+    NEXT ();
+
+push_reg:
+    PUSH (regs[ip->reg]);
+    NEXT ();
+
+push_mem:
+    CHECK_ADDR (ip->value);
+    PUSH (memory[ip->value]);
+    NEXT ();
+
+push_mem_reg:
+{
+    int addr = WRAP (regs[ip->reg], +, ip->value);
+    CHECK_ADDR (addr);
+    PUSH (memory[addr]);
+    NEXT ();
+}
+
+pop_reg:
+    NEED (1);
+    regs[ip->reg] = *--sp;
+    NEXT ();
+
+pop_mem:
+    NEED (1);
+    CHECK_ADDR (ip->value);
+    memory[ip->value] = *--sp;
+    NEXT ();
+
+pop_mem_reg:
+{
+    NEED (1);
+    int addr = WRAP (regs[ip->reg], +, ip->value);
+    CHECK_ADDR (addr);
+    memory[addr] = *--sp;
+    NEXT ();
+}
+
+add: BINARY_OP (WRAP (lhs, +, rhs));
+sub: BINARY_OP (WRAP (lhs, -, rhs));
+mul: BINARY_OP (WRAP (lhs, *, rhs));
+
+div:
+{
+    NEED (2);
+    int rhs = *--sp;
+    int lhs = sp[-1];
+
+    if (rhs == 0) { FAIL (DIV_BY_ZERO); }
+
+    // INT_MIN / -1 overflows, wrap it like the other ops
+    sp[-1] = (rhs == -1) ? WRAP (0, -, lhs) : lhs / rhs;
+    NEXT ();
+}
+
+sqrt:
+    NEED (1);
+    if (sp[-1] < 0) { FAIL (NEGATIVE_SQRT); }
+    sp[-1] = (int) ::sqrt ((double) sp[-1]);
+    NEXT ();
+
+sin:
+    NEED (1);
+    sp[-1] = (int) ::sin ((double) sp[-1]);
+    NEXT ();
+
+inp:
+{
+    int val = 0;
+    if (fscanf (vm->in, "%d", &val) != 1) { FAIL (INPUT_ERROR); }
+    PUSH (val);
+    NEXT ();
+}
+
+out:
+    NEED (1);
+    fprintf (vm->out, "%d\n", *--sp);
+    NEXT ();
+
+jmp:
+    ip = ip->target;
+    DISPATCH ();
+
+je:  COND_JUMP (==);
+jne: COND_JUMP (!=);
+ja:  COND_JUMP (>);
+jae: COND_JUMP (>=);
+jb:  COND_JUMP (<);
+jbe: COND_JUMP (<=);
+
+call:
+    if (__builtin_expect (csp == call_end, 0)) { FAIL (CALL_STACK_OVERFLOW); }
+    *csp++ = ip + 1;
+    ip = ip->target;
+    DISPATCH ();
+
+ret:
+    if (__builtin_expect (csp == vm->call_stack, 0)) { FAIL (CALL_STACK_UNDERFLOW); }
+    ip = *--csp;
+    DISPATCH ();
+
+mov_imm:     REG_MOV (IMM);
+mov_reg:     REG_MOV (REG);
+mov_mem:     REG_MOV (MEM);
+mov_mem_reg: REG_MOV (MEM_REG);
+
+store_mem:
+    CHECK_ADDR (ip->value);
+    memory[ip->value] = regs[ip->reg2];
+    NEXT ();
+
+store_mem_reg:
+{
+    int addr = WRAP (regs[ip->reg], +, ip->value);
+    CHECK_ADDR (addr);
+    memory[addr] = regs[ip->reg2];
+    NEXT ();
+}
+
+add_r_imm:     REG_OP (IMM,     WRAP (lhs, +, rhs));
+add_r_reg:     REG_OP (REG,     WRAP (lhs, +, rhs));
+add_r_mem:     REG_OP (MEM,     WRAP (lhs, +, rhs));
+add_r_mem_reg: REG_OP (MEM_REG, WRAP (lhs, +, rhs));
+
+sub_r_imm:     REG_OP (IMM,     WRAP (lhs, -, rhs));
+sub_r_reg:     REG_OP (REG,     WRAP (lhs, -, rhs));
+sub_r_mem:     REG_OP (MEM,     WRAP (lhs, -, rhs));
+sub_r_mem_reg: REG_OP (MEM_REG, WRAP (lhs, -, rhs));
+
+mul_r_imm:     REG_OP (IMM,     WRAP (lhs, *, rhs));
+mul_r_reg:     REG_OP (REG,     WRAP (lhs, *, rhs));
+mul_r_mem:     REG_OP (MEM,     WRAP (lhs, *, rhs));
+mul_r_mem_reg: REG_OP (MEM_REG, WRAP (lhs, *, rhs));
+
+div_r_imm:     REG_DIV (IMM);
+div_r_reg:     REG_DIV (REG);
+div_r_mem:     REG_DIV (MEM);
+div_r_mem_reg: REG_DIV (MEM_REG);
+
+fell_off:
+    FAIL (FELL_OFF_CODE);
+
+halt:
+finish:
+    vm->executed   = executed;
+    vm->fault_addr = (uint32_t) (ip - vm->code);
+
+    return status;
+}
+
+#undef DISPATCH
+#undef NEXT
+#undef FAIL
+#undef NEED
+#undef PUSH
+#undef CHECK_ADDR
+#undef WRAP
+#undef BINARY_OP
+#undef SRC_IMM
+#undef SRC_REG
+#undef SRC_MEM
+#undef SRC_MEM_REG
+#undef REG_MOV
+#undef REG_OP
+#undef REG_DIV
+#undef COND_JUMP
+
+// -------------------------------------------------------------------------------------------------
+
+const char *vm::status_str (vm_status_t status)
+{
+    switch (status)
+    {
+        case vm_status_t::OK:                   return "ok";
+        case vm_status_t::OOM:                  return "out of memory";
+        case vm_status_t::STACK_OVERFLOW:       return "stack overflow";
+        case vm_status_t::STACK_UNDERFLOW:      return "stack underflow";
+        case vm_status_t::CALL_STACK_OVERFLOW:  return "call stack overflow";
+        case vm_status_t::CALL_STACK_UNDERFLOW: return "ret without call";
+        case vm_status_t::BAD_ADDRESS:          return "memory access out of bounds";
+        case vm_status_t::DIV_BY_ZERO:          return "division by zero";
+        case vm_status_t::NEGATIVE_SQRT:        return "sqrt of negative number";
+        case vm_status_t::INPUT_ERROR:          return "failed to read input";
+        case vm_status_t::FELL_OFF_CODE:        return "reached end of code without halt";
+
+        default:
+            assert (0 && "Unexpected status");
+            return "unknown";
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// PRIVATE SECTION
+// -------------------------------------------------------------------------------------------------
+
+#define SELECT_BY_ARG(imm, reg, mem, mem_reg)                       \
+    switch ((isa::operand_type_t) insn->arg_type)                   \
+    {                                                               \
+        case isa::operand_type_t::IMM:     return imm;              \
+        case isa::operand_type_t::REG:     return reg;              \
+        case isa::operand_type_t::MEM:     return mem;              \
+        case isa::operand_type_t::MEM_REG: return mem_reg;          \
+                                                                    \
+        case isa::operand_type_t::NONE:                             \
+        case isa::operand_type_t::LABEL:                            \
+        default:                                                    \
+            assert (0 && "Operand is checked by bytecode::load");   \
+            return H_NOP;                                           \
+    }
+
+static handler_t select_handler (const bc_insn_t *insn)
+{
+    assert (insn != nullptr && "invalid pointer");
+
+    switch ((isa::opcode_t) insn->opcode)
+    {
+        case isa::opcode_t::NOP:  return H_NOP;
+        case isa::opcode_t::PUSH: SELECT_BY_ARG (H_PUSH_IMM, H_PUSH_REG, H_PUSH_MEM, H_PUSH_MEM_REG);
+        case isa::opcode_t::POP:  SELECT_BY_ARG (H_NOP,      H_POP_REG,  H_POP_MEM,  H_POP_MEM_REG);
+        case isa::opcode_t::ADD:  return H_ADD;
+        case isa::opcode_t::SUB:  return H_SUB;
+        case isa::opcode_t::MUL:  return H_MUL;
+        case isa::opcode_t::DIV:  return H_DIV;
+        case isa::opcode_t::SQRT: return H_SQRT;
+        case isa::opcode_t::SIN:  return H_SIN;
+        case isa::opcode_t::INP:  return H_INP;
+        case isa::opcode_t::OUT:  return H_OUT;
+        case isa::opcode_t::JMP:  return H_JMP;
+        case isa::opcode_t::JE:   return H_JE;
+        case isa::opcode_t::JNE:  return H_JNE;
+        case isa::opcode_t::JA:   return H_JA;
+        case isa::opcode_t::JAE:  return H_JAE;
+        case isa::opcode_t::JB:   return H_JB;
+        case isa::opcode_t::JBE:  return H_JBE;
+        case isa::opcode_t::CALL: return H_CALL;
+        case isa::opcode_t::RET:  return H_RET;
+        case isa::opcode_t::HALT: return H_HALT;
+
+        case isa::opcode_t::MOV:   SELECT_BY_ARG (H_MOV_IMM,   H_MOV_REG,   H_MOV_MEM,   H_MOV_MEM_REG);
+        case isa::opcode_t::STORE: SELECT_BY_ARG (H_NOP,       H_NOP,       H_STORE_MEM, H_STORE_MEM_REG);
+        case isa::opcode_t::ADD_R: SELECT_BY_ARG (H_ADD_R_IMM, H_ADD_R_REG, H_ADD_R_MEM, H_ADD_R_MEM_REG);
+        case isa::opcode_t::SUB_R: SELECT_BY_ARG (H_SUB_R_IMM, H_SUB_R_REG, H_SUB_R_MEM, H_SUB_R_MEM_REG);
+        case isa::opcode_t::MUL_R: SELECT_BY_ARG (H_MUL_R_IMM, H_MUL_R_REG, H_MUL_R_MEM, H_MUL_R_MEM_REG);
+        case isa::opcode_t::DIV_R: SELECT_BY_ARG (H_DIV_R_IMM, H_DIV_R_REG, H_DIV_R_MEM, H_DIV_R_MEM_REG);
+
+        default:
+            assert (0 && "Opcode is checked by bytecode::load");
+            return H_NOP;
+    }
+}
+
+#undef SELECT_BY_ARG
+
+// -------------------------------------------------------------------------------------------------
+
+static int decode (vm_t *vm, const void *const *handlers)
+{
+    assert (vm       != nullptr && "invalid pointer");
+    assert (handlers != nullptr && "invalid pointer");
+
+    const bytecode_t *bc = vm->bc;
+
+    vm->code = (vm_insn_t *) calloc (bc->size + 1, sizeof (vm_insn_t));
+    if (vm->code == nullptr) { return ERROR; }
+
+    for (uint32_t i = 0; i < bc->size; ++i)
+    {
+        const bc_insn_t *insn = &bc->code[i];
+        vm_insn_t *decoded    = &vm->code[i];
+
+        decoded->handler = handlers[select_handler (insn)];
+        decoded->reg     = insn->reg;
+        decoded->reg2    = insn->reg2;
+
+        if (insn->arg_type == (uint8_t) isa::operand_type_t::LABEL) {
+            decoded->target = &vm->code[insn->value];
+        } else {
+            decoded->value  = insn->value;
+        }
+    }
+
+    vm->code[bc->size].handler = handlers[H_FELL_OFF];
+
+    return 0;
+}
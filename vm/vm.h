@@ -0,0 +1,79 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../lib/bytecode.h"
+
+const size_t DEFAULT_VM_MEMORY_SIZE     = 1 << 20;
+const size_t DEFAULT_VM_STACK_SIZE      = 1 << 16;
+const size_t DEFAULT_VM_CALL_STACK_SIZE = 1 << 16;
+
+enum class vm_status_t
+{
+    OK = 0,
+    OOM,
+    STACK_OVERFLOW,
+    STACK_UNDERFLOW,
+    CALL_STACK_OVERFLOW,
+    CALL_STACK_UNDERFLOW,
+    BAD_ADDRESS,
+    DIV_BY_ZERO,
+    NEGATIVE_SQRT,
+    INPUT_ERROR,
+    FELL_OFF_CODE,          ///< Execution reached end of code without halt
+};
+
+/// Pre-decoded instruction, handler is address of its implementation inside vm::run
+struct vm_insn_t
+{
+    const void *handler;
+
+    union
+    {
+        int32_t value;
+        const vm_insn_t *target;
+    };
+
+    uint8_t reg;
+    uint8_t reg2;           ///< Register operand of register forms
+};
+
+struct vm_t
+{
+    const bytecode_t *bc;
+    vm_insn_t *code;            ///< Decoded on first run, has fell off sentinel at the end
+
+    int   *memory;
+    size_t memory_size;
+
+    int   *stack;
+    size_t stack_size;
+
+    const vm_insn_t **call_stack;
+    size_t call_stack_size;
+
+    int regs[isa::REGS_CNT];
+
+    FILE *in;
+    FILE *out;
+
+    uint64_t executed;          ///< Instructions executed by last run
+    uint32_t fault_addr;        ///< Address of instruction that stopped last run with error
+};
+
+namespace vm
+{
+    /// @return 0 or ERROR on OOM
+    int  ctor (vm_t *vm, const bytecode_t *bc, size_t memory_size = DEFAULT_VM_MEMORY_SIZE);
+    void dtor (vm_t *vm);
+
+    /// Clear memory and registers before the next run
+    void reset (vm_t *vm);
+
+    vm_status_t run (vm_t *vm);
+
+    const char *status_str (vm_status_t status);
+}
+
+#endif